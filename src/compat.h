@@ -43,9 +43,18 @@
 #include <ifaddrs.h>
 #include <limits.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #endif
 
+// poll() and epoll are not limited to FD_SETSIZE sockets, select() is only used on Windows
+#ifndef WIN32
+#define USE_POLL
+#endif
+#if defined(HAVE_SYS_EPOLL_H)
+#define USE_EPOLL
+#endif
+
 #ifdef WIN32
 #define MSG_DONTWAIT        0
 #else
@@ -94,7 +103,7 @@ size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_POLL)
     return true;
 #else
     return (s < FD_SETSIZE);
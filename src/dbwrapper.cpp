@@ -54,6 +54,9 @@ CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, b
     syncoptions.sync = true;
     options = GetOptions(nCacheSize);
     options.create_if_missing = true;
+    MetricLabels labels{{"db", path.filename().string()}};
+    pmetricRead = &GetMetricHistogram("ebakus_db_read_seconds", "Time spent reading a key from a database", labels);
+    pmetricWrite = &GetMetricHistogram("ebakus_db_write_seconds", "Time spent writing a batch to a database", labels);
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
         options.env = penv;
@@ -104,6 +107,7 @@ CDBWrapper::~CDBWrapper()
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync) throw(dbwrapper_error)
 {
+    CMetricTimer timer(*pmetricWrite);
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
     HandleError(status);
     return true;
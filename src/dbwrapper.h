@@ -6,6 +6,7 @@
 #define BITCOIN_DBWRAPPER_H
 
 #include "clientversion.h"
+#include "metrics.h"
 #include "serialize.h"
 #include "streams.h"
 #include "util.h"
@@ -156,6 +157,10 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! latency of reads and batch writes, labelled with the database directory
+    CMetricHistogram* pmetricRead;
+    CMetricHistogram* pmetricWrite;
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -188,7 +193,11 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status;
+        {
+            CMetricTimer timer(*pmetricRead);
+            status = pdb->Get(readoptions, slKey, &strValue);
+        }
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
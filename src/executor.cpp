@@ -1,11 +1,12 @@
 #include "executor.h"
+#include "sendercache.h"
 
 bool CExecutor::Execute()
 {
     CAccount receiver = mState.GetAccount(mTx.mReceiver);
 
-    CPubKey senderPubKey = mTx.GetSenderPubKey();
-    if (!senderPubKey.IsValid()) {
+    CPubKey senderPubKey;
+    if (!RecoverTransactionSender(mTx, senderPubKey)) {
         return false;
     }
 
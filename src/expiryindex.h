@@ -0,0 +1,78 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef EXPIRYINDEX_H
+#define EXPIRYINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+/**
+ * Index of map entries by the time (or block height) at which they expire.
+ *
+ * Owners register an entry when it is added or its expiry changes and pop the
+ * expired keys on their maintenance tick, so cleaning up costs O(expired)
+ * instead of a walk over the whole map. Entries erased from the owner's map
+ * by other code paths may stay in the index until they expire, owners must
+ * check that a popped key still exists before erasing it.
+ *
+ * Not thread safe, guard it with the lock of the map it indexes.
+ */
+template<typename K>
+class CExpiryIndex
+{
+private:
+    typedef std::multimap<int64_t, K> expiry_map_t;
+    typedef typename expiry_map_t::iterator expiry_map_it;
+    typedef std::map<K, expiry_map_it> key_map_t;
+
+    expiry_map_t mapByExpiry;
+    key_map_t mapByKey;
+
+public:
+    /// Register key to expire at nExpiry, replacing a previous registration
+    void Set(const K& key, int64_t nExpiry)
+    {
+        typename key_map_t::iterator it = mapByKey.find(key);
+        if(it != mapByKey.end()) {
+            if(it->second->first == nExpiry) return;
+            mapByExpiry.erase(it->second);
+            it->second = mapByExpiry.insert(std::make_pair(nExpiry, key));
+            return;
+        }
+        mapByKey.insert(std::make_pair(key, mapByExpiry.insert(std::make_pair(nExpiry, key))));
+    }
+
+    void Erase(const K& key)
+    {
+        typename key_map_t::iterator it = mapByKey.find(key);
+        if(it == mapByKey.end()) return;
+        mapByExpiry.erase(it->second);
+        mapByKey.erase(it);
+    }
+
+    /// Remove all keys expiring at or before nNow and append them to vecKeysRet
+    void PopExpired(int64_t nNow, std::vector<K>& vecKeysRet)
+    {
+        expiry_map_it it = mapByExpiry.begin();
+        while(it != mapByExpiry.end() && it->first <= nNow) {
+            vecKeysRet.push_back(it->second);
+            mapByKey.erase(it->second);
+            mapByExpiry.erase(it++);
+        }
+    }
+
+    size_t size() const { return mapByKey.size(); }
+
+    void Clear()
+    {
+        mapByExpiry.clear();
+        mapByKey.clear();
+    }
+};
+
+#endif
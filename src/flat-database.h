@@ -13,11 +13,78 @@
 
 #include <boost/filesystem.hpp>
 
-/** 
+/**
 *   Generic Dumping and Loading
 *   ---------------------------
+*
+*   A flat file holds a snapshot of the whole object followed by its checksum.
+*
+*   Types that can list their changes may also keep an append-only journal
+*   next to the snapshot (<file>.log), see LoadWithJournal(), Append() and
+*   DumpWithJournal(). The journal names the checksum of the snapshot it
+*   extends and every record carries its own checksum, so a journal left over
+*   from an older snapshot is ignored and a torn record at the end is cut off.
+*   Pending changes are only discarded once they are on disk, in the journal
+*   or in a new snapshot. Such a type provides:
+*
+*       typedef ... journal_entry_t;
+*       size_t GetJournalEntries(std::vector<journal_entry_t>& vecEntriesRet); // pending changes, returns how many were looked at
+*       size_t GetJournalSize();                                               // number of pending changes
+*       void DiscardJournalEntries(size_t nCount);                             // drop the oldest nCount pending changes
+*       void ApplyJournalEntry(const journal_entry_t& entry);                  // must be idempotent
 */
 
+/** Reads at most nSize bytes from a stream while hashing them, used to load snapshots without buffering them */
+template<typename Source>
+class CFlatDBHashReader
+{
+private:
+    Source& source;
+    CHash256 hasher;
+    uint64_t nRemaining;
+
+public:
+    CFlatDBHashReader(Source& sourceIn, uint64_t nSizeIn) : source(sourceIn), nRemaining(nSizeIn) {}
+
+    int GetType() { return source.GetType(); }
+    int GetVersion() { return source.GetVersion(); }
+    /// Bytes left to read, like CDataStream::size() for objects with optional trailing fields
+    uint64_t size() const { return nRemaining; }
+
+    CFlatDBHashReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > nRemaining)
+            throw std::ios_base::failure("CFlatDBHashReader::read: end of data");
+        source.read(pch, nSize);
+        hasher.Write((const unsigned char*)pch, nSize);
+        nRemaining -= nSize;
+        return (*this);
+    }
+
+    /// Hash whatever the object did not consume, the checksum covers all data
+    void ReadToEnd()
+    {
+        char buf[4096];
+        while (nRemaining > 0) {
+            read(buf, std::min(nRemaining, (uint64_t)sizeof(buf)));
+        }
+    }
+
+    H256 GetHash()
+    {
+        H256 result;
+        hasher.Finalize((unsigned char*)&result);
+        return result;
+    }
+
+    template<typename T>
+    CFlatDBHashReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, GetType(), GetVersion());
+        return (*this);
+    }
+};
+
 template<typename T>
 class CFlatDB
 {
@@ -34,6 +101,7 @@ private:
     };
 
     boost::filesystem::path pathDB;
+    boost::filesystem::path pathJournal;
     std::string strFilename;
     std::string strMagicMessage;
 
@@ -51,11 +119,14 @@ private:
         H256 hash = Hash(ssObj.begin(), ssObj.end());
         ssObj << hash;
 
+        // write to a temporary file first, the old snapshot stays valid until the rename
+        boost::filesystem::path pathTmp = pathDB.string() + ".new";
+
         // open output file, and associate with CAutoFile
-        FILE *file = fopen(pathDB.string().c_str(), "wb");
+        FILE *file = fopen(pathTmp.string().c_str(), "wb");
         CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
         if (fileout.IsNull())
-            return error("%s: Failed to open file %s", __func__, pathDB.string());
+            return error("%s: Failed to open file %s", __func__, pathTmp.string());
 
         // Write and commit header, data
         try {
@@ -64,15 +135,51 @@ private:
         catch (std::exception &e) {
             return error("%s: Serialize or I/O error - %s", __func__, e.what());
         }
+        FileCommit(fileout.Get());
         fileout.fclose();
 
+        if (!RenameOver(pathTmp, pathDB))
+            return error("%s: Rename-into-place failed for %s", __func__, pathDB.string());
+
+        // the journal extended the previous snapshot, which now includes its changes
+        boost::system::error_code ec;
+        boost::filesystem::remove(pathJournal, ec);
+
         LogPrintf("Written info to %s  %dms\n", strFilename, GetTimeMillis() - nStart);
         LogPrintf("     %s\n", objToSave.ToString());
 
         return true;
     }
 
-    ReadResult Read(T& objToLoad, bool fDryRun = false)
+    ReadResult ReadHeader(CFlatDBHashReader<CAutoFile>& ssObj)
+    {
+        unsigned char pchMsgTmp[4];
+        std::string strMagicMessageTmp;
+
+        // de-serialize file header (file specific magic message) and ..
+        ssObj >> strMagicMessageTmp;
+
+        // ... verify the message matches predefined one
+        if (strMagicMessage != strMagicMessageTmp)
+        {
+            error("%s: Invalid magic message", __func__);
+            return IncorrectMagicMessage;
+        }
+
+        // de-serialize file header (network specific magic number) and ..
+        ssObj >> FLATDATA(pchMsgTmp);
+
+        // ... verify the network matches ours
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+        {
+            error("%s: Invalid network magic number", __func__);
+            return IncorrectMagicNumber;
+        }
+
+        return Ok;
+    }
+
+    ReadResult Read(T& objToLoad, bool fHeaderOnly, H256& hashRet)
     {
         //LOCK(objToLoad.cs);
 
@@ -86,87 +193,193 @@ private:
             return FileError;
         }
 
-        // use file size to size memory buffer
-        int fileSize = boost::filesystem::file_size(pathDB);
-        int dataSize = fileSize - sizeof(H256);
-        // Don't try to resize to a negative number if file is small
-        if (dataSize < 0)
-            dataSize = 0;
-        std::vector<unsigned char> vchData;
-        vchData.resize(dataSize);
-        H256 hashIn;
+        // use file size to find where the data ends and the checksum starts
+        uint64_t fileSize = boost::filesystem::file_size(pathDB);
+        if (fileSize < sizeof(H256))
+        {
+            error("%s: File %s is too small", __func__, pathDB.string());
+            return HashReadError;
+        }
 
-        // read data and checksum from file
+        // the data is hashed while it is deserialized, it is never held in memory as a whole
+        CFlatDBHashReader<CAutoFile> ssObj(filein, fileSize - sizeof(H256));
+        try {
+            ReadResult headerResult = ReadHeader(ssObj);
+            if (headerResult != Ok || fHeaderOnly)
+                return headerResult;
+
+            // de-serialize data into T object
+            ssObj >> objToLoad;
+            ssObj.ReadToEnd();
+        }
+        catch (std::exception &e) {
+            objToLoad.Clear();
+            error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            return IncorrectFormat;
+        }
+
+        // verify stored checksum matches input data
+        H256 hashIn;
         try {
-            filein.read((char *)&vchData[0], dataSize);
             filein >> hashIn;
         }
         catch (std::exception &e) {
+            objToLoad.Clear();
             error("%s: Deserialize or I/O error - %s", __func__, e.what());
             return HashReadError;
         }
         filein.fclose();
 
-        CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
-        // verify stored checksum matches input data
-        H256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-        if (hashIn != hashTmp)
+        if (hashIn != ssObj.GetHash())
         {
+            objToLoad.Clear();
             error("%s: Checksum mismatch, data corrupted", __func__);
             return IncorrectHash;
         }
+        hashRet = hashIn;
 
+        LogPrintf("Loaded info from %s  %dms\n", strFilename, GetTimeMillis() - nStart);
+        LogPrintf("     %s\n", objToLoad.ToString());
 
-        unsigned char pchMsgTmp[4];
-        std::string strMagicMessageTmp;
-        try {
-            // de-serialize file header (file specific magic message) and ..
-            ssObj >> strMagicMessageTmp;
+        return Ok;
+    }
 
-            // ... verify the message matches predefined one
-            if (strMagicMessage != strMagicMessageTmp)
+    bool CheckReadResult(ReadResult readResult)
+    {
+        if (readResult == FileError)
+            LogPrintf("Missing file %s, will try to recreate\n", strFilename);
+        else if (readResult != Ok)
+        {
+            LogPrintf("Error reading %s: ", strFilename);
+            if(readResult == IncorrectFormat)
             {
-                error("%s: Invalid magic message", __func__);
-                return IncorrectMagicMessage;
+                LogPrintf("%s: Magic is ok but data has invalid format, will try to recreate\n", __func__);
             }
+            else {
+                LogPrintf("%s: File format is unknown or invalid, please fix it manually\n", __func__);
+                // program should exit with an error
+                return false;
+            }
+        }
+        return true;
+    }
 
+    void Clean(T& objToLoad)
+    {
+        LogPrintf("%s: Cleaning....\n", __func__);
+        objToLoad.CheckAndRemove();
+        LogPrintf("     %s\n", objToLoad.ToString());
+    }
 
-            // de-serialize file header (network specific magic number) and ..
-            ssObj >> FLATDATA(pchMsgTmp);
+    void ReplayJournal(T& objToLoad, const H256& hashSnapshot)
+    {
+        int64_t nStart = GetTimeMillis();
+        FILE *file = fopen(pathJournal.string().c_str(), "rb");
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return;
 
-            // ... verify the network matches ours
-            if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+        int nEntries = 0;
+        long nGoodSize = 0;
+        try {
+            std::string strMagicMessageTmp;
+            unsigned char pchMsgTmp[4];
+            H256 hashSnapshotTmp;
+            filein >> strMagicMessageTmp >> FLATDATA(pchMsgTmp) >> hashSnapshotTmp;
+            if (strMagicMessage != strMagicMessageTmp || memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)) ||
+                hashSnapshot != hashSnapshotTmp)
             {
-                error("%s: Invalid network magic number", __func__);
-                return IncorrectMagicNumber;
+                LogPrintf("%s: Journal %s does not extend the loaded snapshot, ignoring it\n", __func__, pathJournal.string());
+                filein.fclose();
+                boost::system::error_code ec;
+                boost::filesystem::remove(pathJournal, ec);
+                return;
+            }
+            nGoodSize = ftell(filein.Get());
+
+            while (true) {
+                std::vector<unsigned char> vchRecord;
+                H256 hashRecord;
+                filein >> vchRecord >> hashRecord;
+                if (Hash(vchRecord.begin(), vchRecord.end()) != hashRecord)
+                    break;
+
+                CDataStream ssRecord(vchRecord, SER_DISK, CLIENT_VERSION);
+                typename T::journal_entry_t entry;
+                ssRecord >> entry;
+                objToLoad.ApplyJournalEntry(entry);
+                ++nEntries;
+                nGoodSize = ftell(filein.Get());
             }
-
-            // de-serialize data into T object
-            ssObj >> objToLoad;
         }
         catch (std::exception &e) {
-            objToLoad.Clear();
-            error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            return IncorrectFormat;
+            // end of the journal, possibly in the middle of a record that was not fully written
         }
+        filein.fclose();
 
-        LogPrintf("Loaded info from %s  %dms\n", strFilename, GetTimeMillis() - nStart);
-        LogPrintf("     %s\n", objToLoad.ToString());
-        if(!fDryRun) {
-            LogPrintf("%s: Cleaning....\n", __func__);
-            objToLoad.CheckAndRemove();
-            LogPrintf("     %s\n", objToLoad.ToString());
+        // cut off a torn or corrupt tail, new records are appended after the last good one
+        boost::system::error_code ec;
+        if (boost::filesystem::file_size(pathJournal, ec) != (uintmax_t)nGoodSize && !ec) {
+            LogPrintf("%s: Truncating journal %s to %d bytes\n", __func__, pathJournal.string(), nGoodSize);
+            boost::filesystem::resize_file(pathJournal, nGoodSize, ec);
         }
 
-        return Ok;
+        LogPrintf("Replayed %d journal entries from %s  %dms\n", nEntries, pathJournal.string(), GetTimeMillis() - nStart);
     }
 
+    template<typename Entry>
+    bool WriteJournal(const std::vector<Entry>& vecEntries)
+    {
+        int64_t nStart = GetTimeMillis();
+
+        CDataStream ssJournal(SER_DISK, CLIENT_VERSION);
+        if (!boost::filesystem::exists(pathJournal)) {
+            // a new journal names the snapshot it extends by its checksum
+            FILE *file = fopen(pathDB.string().c_str(), "rb");
+            CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s: Failed to open file %s", __func__, pathDB.string());
+            H256 hashSnapshot;
+            try {
+                fseek(filein.Get(), -(long)sizeof(H256), SEEK_END);
+                filein >> hashSnapshot;
+            }
+            catch (std::exception &e) {
+                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            }
+            ssJournal << strMagicMessage << FLATDATA(Params().MessageStart()) << hashSnapshot;
+        }
+
+        for (size_t i = 0; i < vecEntries.size(); ++i) {
+            CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+            ssRecord << vecEntries[i];
+            std::vector<unsigned char> vchRecord(ssRecord.begin(), ssRecord.end());
+            ssJournal << vchRecord << Hash(vchRecord.begin(), vchRecord.end());
+        }
+
+        FILE *file = fopen(pathJournal.string().c_str(), "ab");
+        CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: Failed to open file %s", __func__, pathJournal.string());
+
+        try {
+            fileout << ssJournal;
+        }
+        catch (std::exception &e) {
+            return error("%s: Serialize or I/O error - %s", __func__, e.what());
+        }
+        FileCommit(fileout.Get());
+        fileout.fclose();
+
+        LogPrint("flatdb", "Appended %u entries to %s  %dms\n", vecEntries.size(), pathJournal.string(), GetTimeMillis() - nStart);
+        return true;
+    }
 
 public:
     CFlatDB(std::string strFilenameIn, std::string strMagicMessageIn)
     {
         pathDB = GetDataDir() / strFilenameIn;
+        pathJournal = GetDataDir() / (strFilenameIn + ".log");
         strFilename = strFilenameIn;
         strMagicMessage = strMagicMessageIn;
     }
@@ -174,21 +387,30 @@ public:
     bool Load(T& objToLoad)
     {
         LogPrintf("Reading info from %s...\n", strFilename);
-        ReadResult readResult = Read(objToLoad);
-        if (readResult == FileError)
-            LogPrintf("Missing file %s, will try to recreate\n", strFilename);
-        else if (readResult != Ok)
-        {
-            LogPrintf("Error reading %s: ", strFilename);
-            if(readResult == IncorrectFormat)
-            {
-                LogPrintf("%s: Magic is ok but data has invalid format, will try to recreate\n", __func__);
-            }
-            else {
-                LogPrintf("%s: File format is unknown or invalid, please fix it manually\n", __func__);
-                // program should exit with an error
-                return false;
-            }
+        H256 hashSnapshot;
+        ReadResult readResult = Read(objToLoad, false, hashSnapshot);
+        if (!CheckReadResult(readResult))
+            return false;
+        if (readResult == Ok)
+            Clean(objToLoad);
+        return true;
+    }
+
+    /// Load the snapshot and replay the journal on top of it
+    bool LoadWithJournal(T& objToLoad)
+    {
+        LogPrintf("Reading info from %s...\n", strFilename);
+        H256 hashSnapshot;
+        ReadResult readResult = Read(objToLoad, false, hashSnapshot);
+        if (!CheckReadResult(readResult))
+            return false;
+        if (readResult == Ok) {
+            ReplayJournal(objToLoad, hashSnapshot);
+            Clean(objToLoad);
+        } else {
+            // the snapshot will be recreated, a journal on top of the old one is useless
+            boost::system::error_code ec;
+            boost::filesystem::remove(pathJournal, ec);
         }
         return true;
     }
@@ -197,9 +419,12 @@ public:
     {
         int64_t nStart = GetTimeMillis();
 
+        // Only the header of the existing file is verified: a file of another
+        // type or network is not overwritten, anything else is replaced.
         LogPrintf("Verifying %s format...\n", strFilename);
         T tmpObjToLoad;
-        ReadResult readResult = Read(tmpObjToLoad, true);
+        H256 hashUnused;
+        ReadResult readResult = Read(tmpObjToLoad, true, hashUnused);
 
         // there was an error and it was not an error on file opening => do not proceed
         if (readResult == FileError)
@@ -207,7 +432,7 @@ public:
         else if (readResult != Ok)
         {
             LogPrintf("Error reading %s: ", strFilename);
-            if(readResult == IncorrectFormat)
+            if(readResult == IncorrectFormat || readResult == HashReadError)
                 LogPrintf("%s: Magic is ok but data has invalid format, will try to recreate\n", __func__);
             else
             {
@@ -217,9 +442,44 @@ public:
         }
 
         LogPrintf("Writting info to %s...\n", strFilename);
-        Write(objToSave);
+        bool fWritten = Write(objToSave);
         LogPrintf("%s dump finished  %dms\n", strFilename, GetTimeMillis() - nStart);
 
+        return fWritten;
+    }
+
+    /// Write a new snapshot and drop the pending journal changes it includes
+    bool DumpWithJournal(T& objToSave)
+    {
+        // Changes that arrive while the snapshot is written stay pending and go
+        // to the new journal, at worst one of them is in both, which replays fine.
+        size_t nPending = objToSave.GetJournalSize();
+        if (!Dump(objToSave))
+            return false;
+        objToSave.DiscardJournalEntries(nPending);
+        return true;
+    }
+
+    /// Append the changes since the last call to the journal, writing a new
+    /// snapshot instead once the journal has grown larger than the snapshot
+    bool Append(T& objToSave)
+    {
+        boost::system::error_code ec;
+        uintmax_t nSnapshotSize = boost::filesystem::file_size(pathDB, ec);
+        if (ec)
+            return DumpWithJournal(objToSave);
+
+        uintmax_t nJournalSize = boost::filesystem::file_size(pathJournal, ec);
+        if (!ec && nJournalSize > nSnapshotSize) {
+            LogPrintf("Compacting %s, journal size %u\n", strFilename, nJournalSize);
+            return DumpWithJournal(objToSave);
+        }
+
+        std::vector<typename T::journal_entry_t> vecEntries;
+        size_t nPending = objToSave.GetJournalEntries(vecEntries);
+        if (!vecEntries.empty() && !WriteJournal(vecEntries))
+            return false;
+        objToSave.DiscardJournalEntries(nPending);
         return true;
     }
 
@@ -0,0 +1,188 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "governance-db.h"
+#include "governance-object.h"
+#include "util.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+static const char DB_OBJECT = 'o';
+static const char DB_OBJECT_TIME = 't';
+static const char DB_VOTE = 'v';
+static const char DB_VOTE_PARENT = 'h';
+static const char DB_VOTE_MASTERNODE = 'm';
+
+CGovernanceDB* pgovernancedb = NULL;
+
+namespace {
+
+typedef std::pair<H256, H256> vote_key_t;
+typedef std::pair<COutPoint, vote_key_t> masternode_vote_key_t;
+
+void BatchEraseVote(CDBBatch& batch, const CGovernanceVote& vote)
+{
+    const H256& nParentHash = vote.GetParentHash();
+    H256 nHash = vote.GetHash();
+    batch.Erase(std::make_pair(DB_VOTE, vote_key_t(nParentHash, nHash)));
+    batch.Erase(std::make_pair(DB_VOTE_PARENT, nHash));
+    batch.Erase(std::make_pair(DB_VOTE_MASTERNODE, masternode_vote_key_t(vote.GetVinMasternode().prevout, vote_key_t(nParentHash, nHash))));
+}
+
+}
+
+CGovernanceDB::CGovernanceDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "governance", nCacheSize, fMemory, fWipe) {
+}
+
+bool CGovernanceDB::WriteObject(const CGovernanceObject& govobj, const std::vector<CGovernanceVote>& vecVotes) {
+    CDBBatch batch(&GetObfuscateKey());
+    H256 nHash = govobj.GetHash();
+    batch.Write(std::make_pair(DB_OBJECT, nHash), govobj);
+    batch.Write(std::make_pair(DB_OBJECT_TIME, CGovernanceTimeIndexKey(govobj.GetCreationTime(), nHash)), '1');
+    for (std::vector<CGovernanceVote>::const_iterator it = vecVotes.begin(); it != vecVotes.end(); ++it) {
+        const H256& nParentHash = it->GetParentHash();
+        H256 nVoteHash = it->GetHash();
+        batch.Write(std::make_pair(DB_VOTE, vote_key_t(nParentHash, nVoteHash)), *it);
+        batch.Write(std::make_pair(DB_VOTE_PARENT, nVoteHash), nParentHash);
+        batch.Write(std::make_pair(DB_VOTE_MASTERNODE, masternode_vote_key_t(it->GetVinMasternode().prevout, vote_key_t(nParentHash, nVoteHash))), '1');
+    }
+    return WriteBatch(batch);
+}
+
+bool CGovernanceDB::EraseObject(const CGovernanceObject& govobj) {
+    H256 nHash = govobj.GetHash();
+    std::vector<CGovernanceVote> vecVotes;
+    if (!ReadVotes(nHash, vecVotes))
+        return false;
+
+    CDBBatch batch(&GetObfuscateKey());
+    batch.Erase(std::make_pair(DB_OBJECT, nHash));
+    batch.Erase(std::make_pair(DB_OBJECT_TIME, CGovernanceTimeIndexKey(govobj.GetCreationTime(), nHash)));
+    for (std::vector<CGovernanceVote>::const_iterator it = vecVotes.begin(); it != vecVotes.end(); ++it) {
+        BatchEraseVote(batch, *it);
+    }
+    return WriteBatch(batch);
+}
+
+bool CGovernanceDB::LoadObjects(std::map<H256, CGovernanceObject>& mapObjects) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_OBJECT, H256()));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, H256> key;
+        if (pcursor->GetKey(key) && key.first == DB_OBJECT) {
+            CGovernanceObject& govobj = mapObjects[key.second];
+            if (!pcursor->GetValue(govobj)) {
+                return error("%s: failed to read governance object %s", __func__, key.second.ToString());
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool CGovernanceDB::ReadObjectsNewerThan(int64_t nTime, std::vector<H256>& vecHashes) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_OBJECT_TIME, CGovernanceTimeIndexKey(nTime, H256())));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CGovernanceTimeIndexKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_OBJECT_TIME) {
+            vecHashes.push_back(key.second.nHash);
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool CGovernanceDB::ReadVote(const H256& nHash, CGovernanceVote& vote) {
+    H256 nParentHash;
+    if (!ReadVoteParent(nHash, nParentHash))
+        return false;
+    return Read(std::make_pair(DB_VOTE, vote_key_t(nParentHash, nHash)), vote);
+}
+
+bool CGovernanceDB::ReadVoteParent(const H256& nHash, H256& nParentHashRet) {
+    return Read(std::make_pair(DB_VOTE_PARENT, nHash), nParentHashRet);
+}
+
+bool CGovernanceDB::ReadVotes(const H256& nParentHash, std::vector<CGovernanceVote>& vecVotes) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_VOTE, vote_key_t(nParentHash, H256())));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, vote_key_t> key;
+        if (pcursor->GetKey(key) && key.first == DB_VOTE && key.second.first == nParentHash) {
+            CGovernanceVote vote;
+            if (!pcursor->GetValue(vote)) {
+                return error("%s: failed to read governance vote %s", __func__, key.second.second.ToString());
+            }
+            vecVotes.push_back(vote);
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool CGovernanceDB::ReadVoteHashes(const H256& nParentHash, std::set<H256>& setHashes) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_VOTE, vote_key_t(nParentHash, H256())));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, vote_key_t> key;
+        if (pcursor->GetKey(key) && key.first == DB_VOTE && key.second.first == nParentHash) {
+            setHashes.insert(key.second.second);
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool CGovernanceDB::EraseVotesFromMasternode(const COutPoint& outpointMasternode, const H256& nParentHash, std::vector<H256>& vecErased) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_VOTE_MASTERNODE, masternode_vote_key_t(outpointMasternode, vote_key_t(nParentHash, H256()))));
+
+    CDBBatch batch(&GetObfuscateKey());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, masternode_vote_key_t> key;
+        if (pcursor->GetKey(key) && key.first == DB_VOTE_MASTERNODE &&
+            key.second.first == outpointMasternode && key.second.second.first == nParentHash) {
+            const H256& nHash = key.second.second.second;
+            batch.Erase(std::make_pair(DB_VOTE, vote_key_t(nParentHash, nHash)));
+            batch.Erase(std::make_pair(DB_VOTE_PARENT, nHash));
+            batch.Erase(key);
+            vecErased.push_back(nHash);
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    if (vecErased.empty())
+        return true;
+    return WriteBatch(batch);
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GOVERNANCE_DB_H
+#define GOVERNANCE_DB_H
+
+#include "dbwrapper.h"
+#include "governance-vote.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+class CGovernanceDB;
+class CGovernanceObject;
+
+extern CGovernanceDB* pgovernancedb;
+
+/** Cache size of the governance database */
+static const size_t GOVERNANCE_DB_CACHE_SIZE = 8 << 20;
+
+/**
+ * Key of the object creation time index, big endian with the sign bit flipped
+ * so that keys sort by time, negative times included
+ */
+struct CGovernanceTimeIndexKey {
+    int64_t nTime;
+    H256 nHash;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 40;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        ser_writedata64be(s, (uint64_t)nTime ^ TIME_SIGN_BIT);
+        nHash.Serialize(s, nType, nVersion);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        nTime = (int64_t)(ser_readdata64be(s) ^ TIME_SIGN_BIT);
+        nHash.Unserialize(s, nType, nVersion);
+    }
+
+    CGovernanceTimeIndexKey(int64_t nTimeIn, const H256& nHashIn) : nTime(nTimeIn), nHash(nHashIn) {}
+
+    CGovernanceTimeIndexKey() : nTime(0), nHash() {}
+
+private:
+    static const uint64_t TIME_SIGN_BIT = 1ULL << 63;
+};
+
+/**
+ * Access to the governance database (governance/)
+ *
+ * Objects are stored one per key, without their votes. Votes are stored one
+ * per key under the hash of their parent object, so the votes of one object
+ * can be read without touching any other. Secondary indexes map a vote hash
+ * to its parent, a masternode outpoint to the votes it cast and a creation
+ * time to the objects created at that time.
+ */
+class CGovernanceDB : public CDBWrapper
+{
+public:
+    CGovernanceDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CGovernanceDB(const CGovernanceDB&);
+    void operator=(const CGovernanceDB&);
+public:
+    /// Write the object record together with votes not yet on disk
+    bool WriteObject(const CGovernanceObject& govobj, const std::vector<CGovernanceVote>& vecVotes);
+    /// Erase the object record, its votes and all index entries
+    bool EraseObject(const CGovernanceObject& govobj);
+    bool LoadObjects(std::map<H256, CGovernanceObject>& mapObjects);
+    bool ReadObjectsNewerThan(int64_t nTime, std::vector<H256>& vecHashes);
+
+    bool ReadVote(const H256& nHash, CGovernanceVote& vote);
+    bool ReadVoteParent(const H256& nHash, H256& nParentHashRet);
+    bool ReadVotes(const H256& nParentHash, std::vector<CGovernanceVote>& vecVotes);
+    bool ReadVoteHashes(const H256& nParentHash, std::set<H256>& setHashes);
+    /// Erase the votes cast by a masternode on one object, returns the hashes of the erased votes
+    bool EraseVotesFromMasternode(const COutPoint& outpointMasternode, const H256& nParentHash, std::vector<H256>& vecErased);
+};
+
+#endif
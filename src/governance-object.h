@@ -26,6 +26,8 @@ class CGovernanceVote;
 static const int MAX_GOVERNANCE_OBJECT_DATA_SIZE = 16 * 1024;
 static const int MIN_GOVERNANCE_PEER_PROTO_VERSION = 70206;
 static const int GOVERNANCE_FILTER_PROTO_VERSION = 70206;
+//! peers from this version on reconcile object and vote hashes with "govrecon"
+static const int GOVERNANCE_RECON_PROTO_VERSION = 70209;
 
 static const double GOVERNANCE_FILTER_FP_RATE = 0.001;
 
@@ -3,45 +3,63 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "governance-votedb.h"
+#include "governance-db.h"
 
 CGovernanceObjectVoteFile::CGovernanceObjectVoteFile()
-    : nMemoryVotes(0),
+    : nParentHash(),
+      nMemoryVotes(0),
       listVotes(),
-      mapVoteIndex()
+      mapVoteIndex(),
+      nStoredVotes(0),
+      setStoredHashes(),
+      fStoredLoaded(true),
+      ibltReconVotes()
 {}
 
 CGovernanceObjectVoteFile::CGovernanceObjectVoteFile(const CGovernanceObjectVoteFile& other)
-    : nMemoryVotes(other.nMemoryVotes),
+    : nParentHash(other.nParentHash),
+      nMemoryVotes(other.nMemoryVotes),
       listVotes(other.listVotes),
-      mapVoteIndex()
+      mapVoteIndex(),
+      nStoredVotes(other.nStoredVotes),
+      setStoredHashes(other.setStoredHashes),
+      fStoredLoaded(other.fStoredLoaded),
+      ibltReconVotes(other.ibltReconVotes)
 {
     RebuildIndex();
 }
 
 void CGovernanceObjectVoteFile::AddVote(const CGovernanceVote& vote)
 {
+    nParentHash = vote.GetParentHash();
     listVotes.push_front(vote);
     mapVoteIndex[vote.GetHash()] = listVotes.begin();
     ++nMemoryVotes;
+    ibltReconVotes.Insert(vote.GetHash());
 }
 
 bool CGovernanceObjectVoteFile::HasVote(const H256& nHash) const
 {
     vote_m_cit it = mapVoteIndex.find(nHash);
-    if(it == mapVoteIndex.end()) {
-        return false;
+    if(it != mapVoteIndex.end()) {
+        return true;
     }
-    return true;
+    LoadStoredHashes();
+    return setStoredHashes.count(nHash);
 }
 
 bool CGovernanceObjectVoteFile::GetVote(const H256& nHash, CGovernanceVote& vote) const
 {
     vote_m_cit it = mapVoteIndex.find(nHash);
-    if(it == mapVoteIndex.end()) {
+    if(it != mapVoteIndex.end()) {
+        vote = *(it->second);
+        return true;
+    }
+    LoadStoredHashes();
+    if(!setStoredHashes.count(nHash) || !pgovernancedb) {
         return false;
     }
-    vote = *(it->second);
-    return true;
+    return pgovernancedb->ReadVote(nHash, vote);
 }
 
 std::vector<CGovernanceVote> CGovernanceObjectVoteFile::GetVotes() const
@@ -50,9 +68,56 @@ std::vector<CGovernanceVote> CGovernanceObjectVoteFile::GetVotes() const
     for(vote_l_cit it = listVotes.begin(); it != listVotes.end(); ++it) {
         vecResult.push_back(*it);
     }
+    if(nStoredVotes > 0 && pgovernancedb) {
+        pgovernancedb->ReadVotes(nParentHash, vecResult);
+    }
     return vecResult;
 }
 
+std::vector<H256> CGovernanceObjectVoteFile::GetVoteHashes() const
+{
+    std::vector<H256> vecResult;
+    for(vote_m_cit it = mapVoteIndex.begin(); it != mapVoteIndex.end(); ++it) {
+        vecResult.push_back(it->first);
+    }
+    LoadStoredHashes();
+    vecResult.insert(vecResult.end(), setStoredHashes.begin(), setStoredHashes.end());
+    return vecResult;
+}
+
+const CIblt& CGovernanceObjectVoteFile::GetReconTable(unsigned int nCells, uint64_t nSalt) const
+{
+    const CIblt* pTable = ibltReconVotes.Get(nCells, nSalt);
+    if(pTable) {
+        return *pTable;
+    }
+    CIblt& table = ibltReconVotes.Create(nCells, nSalt);
+    std::vector<H256> vecHashes = GetVoteHashes();
+    for(size_t i = 0; i < vecHashes.size(); ++i) {
+        table.Insert(vecHashes[i]);
+    }
+    return table;
+}
+
+void CGovernanceObjectVoteFile::GetMemoryVotes(std::vector<CGovernanceVote>& vecVotesRet) const
+{
+    vecVotesRet.insert(vecVotesRet.end(), listVotes.begin(), listVotes.end());
+}
+
+void CGovernanceObjectVoteFile::SetMemoryVotesStored()
+{
+    // hashes are only tracked once they were read back from disk
+    if(fStoredLoaded) {
+        for(vote_l_cit it = listVotes.begin(); it != listVotes.end(); ++it) {
+            setStoredHashes.insert(it->GetHash());
+        }
+    }
+    nStoredVotes += nMemoryVotes;
+    nMemoryVotes = 0;
+    listVotes.clear();
+    mapVoteIndex.clear();
+}
+
 void CGovernanceObjectVoteFile::RemoveVotesFromMasternode(const CTxIn& vinMasternode)
 {
     vote_l_it it = listVotes.begin();
@@ -60,18 +125,38 @@ void CGovernanceObjectVoteFile::RemoveVotesFromMasternode(const CTxIn& vinMaster
         if(it->GetVinMasternode() == vinMasternode) {
             --nMemoryVotes;
             mapVoteIndex.erase(it->GetHash());
+            ibltReconVotes.Erase(it->GetHash());
             listVotes.erase(it++);
         }
         else {
             ++it;
         }
     }
+
+    if(nStoredVotes == 0 || !pgovernancedb) {
+        return;
+    }
+
+    std::vector<H256> vecErased;
+    if(!pgovernancedb->EraseVotesFromMasternode(vinMasternode.prevout, nParentHash, vecErased)) {
+        return;
+    }
+    for(size_t i = 0; i < vecErased.size(); ++i) {
+        setStoredHashes.erase(vecErased[i]);
+        ibltReconVotes.Erase(vecErased[i]);
+    }
+    nStoredVotes -= vecErased.size();
 }
 
 CGovernanceObjectVoteFile& CGovernanceObjectVoteFile::operator=(const CGovernanceObjectVoteFile& other)
 {
+    nParentHash = other.nParentHash;
     nMemoryVotes = other.nMemoryVotes;
     listVotes = other.listVotes;
+    nStoredVotes = other.nStoredVotes;
+    setStoredHashes = other.setStoredHashes;
+    fStoredLoaded = other.fStoredLoaded;
+    ibltReconVotes = other.ibltReconVotes;
     RebuildIndex();
     return *this;
 }
@@ -94,3 +179,14 @@ void CGovernanceObjectVoteFile::RebuildIndex()
         }
     }
 }
+
+void CGovernanceObjectVoteFile::LoadStoredHashes() const
+{
+    if(fStoredLoaded) {
+        return;
+    }
+    if(pgovernancedb) {
+        pgovernancedb->ReadVoteHashes(nParentHash, setStoredHashes);
+    }
+    fStoredLoaded = true;
+}
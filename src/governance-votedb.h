@@ -7,18 +7,21 @@
 
 #include <list>
 #include <map>
+#include <set>
+#include <vector>
 
 #include "governance-vote.h"
+#include "iblt.h"
 #include "serialize.h"
 #include "uint256.h"
 
 /**
  * Represents the collection of votes associated with a given CGovernanceObject
- * Recently received votes are held in memory until a maximum size is reached after
- * which older votes a flushed to a disk file.
- *
- * Note: This is a stub implementation that doesn't limit the number of votes held
- * in memory and doesn't flush to disk.
+ * Recently received votes are held in memory until they are flushed to the
+ * governance database together with their object, after which only the vote
+ * hashes are kept. Those are read back lazily, the first time the file is used
+ * after its object was loaded from disk, and the votes themselves are only
+ * read when they are asked for.
  */
 class CGovernanceObjectVoteFile
 {
@@ -35,8 +38,11 @@ public: // Types
 
     typedef vote_m_t::const_iterator vote_m_cit;
 
+    typedef std::set<H256> hash_s_t;
+
 private:
-    static const int MAX_MEMORY_VOTES = -1;
+    /// Hash of the object the stored votes belong to
+    H256 nParentHash;
 
     int nMemoryVotes;
 
@@ -44,6 +50,16 @@ private:
 
     vote_m_t mapVoteIndex;
 
+    int nStoredVotes;
+
+    /// Hashes of the votes in the governance database, valid when fStoredLoaded is set
+    mutable hash_s_t setStoredHashes;
+
+    mutable bool fStoredLoaded;
+
+    /// Reconciliation tables of all vote hashes, created on first use
+    mutable CIbltSet ibltReconVotes;
+
 public:
     CGovernanceObjectVoteFile();
 
@@ -55,21 +71,47 @@ public:
     void AddVote(const CGovernanceVote& vote);
 
     /**
-     * Return true if the vote with this hash is currently cached in memory
+     * Return true if the vote with this hash is in the file
      */
     bool HasVote(const H256& nHash) const;
 
     /**
-     * Retrieve a vote cached in memory
+     * Retrieve a vote from memory or from the governance database
      */
     bool GetVote(const H256& nHash, CGovernanceVote& vote) const;
 
-    int GetVoteCount() {
+    int GetVoteCount() const {
+        return nMemoryVotes + nStoredVotes;
+    }
+
+    int GetMemoryVoteCount() const {
         return nMemoryVotes;
     }
 
     std::vector<CGovernanceVote> GetVotes() const;
 
+    /**
+     * Return the vote hashes without reading stored votes
+     */
+    std::vector<H256> GetVoteHashes() const;
+
+    /**
+     * Reconciliation table of the vote hashes, kept up to date from then on
+     */
+    const CIblt& GetReconTable(unsigned int nCells, uint64_t nSalt) const;
+
+    /**
+     * Append the votes held in memory to vecVotesRet, the caller writes them
+     * to the governance database together with the object
+     */
+    void GetMemoryVotes(std::vector<CGovernanceVote>& vecVotesRet) const;
+
+    /**
+     * Drop the votes held in memory once they were written to the governance
+     * database, from then on they are counted as stored votes
+     */
+    void SetMemoryVotesStored();
+
     CGovernanceObjectVoteFile& operator=(const CGovernanceObjectVoteFile& other);
 
     void RemoveVotesFromMasternode(const CTxIn& vinMasternode);
@@ -79,15 +121,29 @@ public:
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
-        READWRITE(nMemoryVotes);
-        READWRITE(listVotes);
-        if(ser_action.ForRead()) {
-            RebuildIndex();
+        // only stored votes are described, votes in memory are written separately
+        // by the governance database in the same batch, so they count as stored
+        READWRITE(nParentHash);
+        if(!ser_action.ForRead()) {
+            int nVotes = nStoredVotes + nMemoryVotes;
+            READWRITE(nVotes);
+        }
+        else {
+            READWRITE(nStoredVotes);
+            nMemoryVotes = 0;
+            listVotes.clear();
+            mapVoteIndex.clear();
+            setStoredHashes.clear();
+            fStoredLoaded = (nStoredVotes == 0);
+            ibltReconVotes.Clear();
         }
     }
 private:
     void RebuildIndex();
 
+    /// Read the stored vote hashes if they were not read yet
+    void LoadStoredHashes() const;
+
 };
 
 #endif
@@ -6,10 +6,12 @@
 #include "governance-object.h"
 #include "governance-vote.h"
 #include "governance-classes.h"
+#include "governance-db.h"
 #include "net_processing.h"
 #include "masternode.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
+#include "metrics.h"
 #include "messagesigner.h"
 #include "netfulfilledman.h"
 #include "util.h"
@@ -18,7 +20,7 @@ CGovernanceManager governance;
 
 int nSubmittedFinalBudget;
 
-const std::string CGovernanceManager::SERIALIZATION_VERSION_STRING = "CGovernanceManager-Version-12";
+const std::string CGovernanceManager::SERIALIZATION_VERSION_STRING = "CGovernanceManager-Version-13";
 const int CGovernanceManager::MAX_TIME_FUTURE_DEVIATION = 60*60;
 const int CGovernanceManager::RELIABLE_PROPAGATION_TIME = 60;
 
@@ -36,6 +38,11 @@ CGovernanceManager::CGovernanceManager()
       mapOrphanVotes(MAX_CACHE_SIZE),
       mapLastMasternodeObject(),
       setRequestedObjects(),
+      setDirtyObjects(),
+      mapReconRequests(),
+      setReconObjects(),
+      ibltReconObjects(),
+      fReconObjectsValid(false),
       fRateChecksEnabled(true),
       cs()
 {}
@@ -64,7 +71,7 @@ bool CGovernanceManager::HaveVoteForHash(H256 nHash)
     LOCK(cs);
 
     CGovernanceObject* pGovobj = NULL;
-    if(!mapVoteToObject.Get(nHash,pGovobj)) {
+    if(!GetVoteObject(nHash, pGovobj)) {
         return false;
     }
 
@@ -77,7 +84,12 @@ bool CGovernanceManager::HaveVoteForHash(H256 nHash)
 int CGovernanceManager::GetVoteCount() const
 {
     LOCK(cs);
-    return (int)mapVoteToObject.GetSize();
+
+    int nCount = 0;
+    for(object_m_cit it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+        nCount += it->second.fileVotes.GetVoteCount();
+    }
+    return nCount;
 }
 
 bool CGovernanceManager::SerializeVoteForHash(H256 nHash, CDataStream& ss)
@@ -85,7 +97,7 @@ bool CGovernanceManager::SerializeVoteForHash(H256 nHash, CDataStream& ss)
     LOCK(cs);
 
     CGovernanceObject* pGovobj = NULL;
-    if(!mapVoteToObject.Get(nHash,pGovobj)) {
+    if(!GetVoteObject(nHash, pGovobj)) {
         return false;
     }
 
@@ -109,6 +121,8 @@ void CGovernanceManager::ProcessMessage(CNode* pfrom, std::string& strCommand, C
     // ANOTHER USER IS ASKING US TO HELP THEM SYNC GOVERNANCE OBJECT DATA
     if (strCommand == NetMsgType::MNGOVERNANCESYNC)
     {
+        static CMetricHistogram& metric = GetMessageHandlerMetric("governance", NetMsgType::MNGOVERNANCESYNC);
+        CMetricTimer timer(metric);
 
         // Ignore such requests until we are fully synced.
         // We could start processing this after masternode list is synced
@@ -143,9 +157,74 @@ void CGovernanceManager::ProcessMessage(CNode* pfrom, std::string& strCommand, C
 
     }
 
+    // ANOTHER USER WANTS THE OBJECTS OR VOTES MISSING FROM THEIR TABLE
+    else if (strCommand == NetMsgType::MNGOVERNANCERECON)
+    {
+        static CMetricHistogram& metric = GetMessageHandlerMetric("governance", NetMsgType::MNGOVERNANCERECON);
+        CMetricTimer timer(metric);
+        // same as MNGOVERNANCESYNC, answer only once fully synced
+        if (!masternodeSync.IsSynced()) return;
+
+        H256 nProp;
+        CIblt iblt;
+
+        vRecv >> nProp >> iblt;
+
+        if(!iblt.IsValid() || iblt.GetSalt() != GOVERNANCE_RECON_SALT || !IsReconCellCount(iblt.GetCellCount())) {
+            LogPrint("gobject", "MNGOVERNANCERECON -- invalid table, %d cells, peer=%d\n", iblt.GetCellCount(), pfrom->id);
+            Misbehaving(pfrom->GetId(), 20);
+            return;
+        }
+
+        if(nProp.IsNull()) {
+            // every table size can be asked for once, so that failed requests can be retried with a bigger one
+            std::string strRequest = strprintf("%s-%d", NetMsgType::MNGOVERNANCERECON, iblt.GetCellCount());
+            if(netfulfilledman.HasFulfilledRequest(pfrom->addr, strRequest)) {
+                LogPrint("gobject", "MNGOVERNANCERECON -- peer already asked me for the list\n");
+                Misbehaving(pfrom->GetId(), 20);
+                return;
+            }
+            netfulfilledman.AddFulfilledRequest(pfrom->addr, strRequest);
+        }
+
+        if(!SyncReconciliation(pfrom, nProp, iblt)) {
+            g_connman->PushMessage(pfrom, NetMsgType::MNGOVERNANCERECONFAIL, nProp);
+        }
+    }
+
+    // OUR TABLE WAS TOO SMALL FOR THE DIFFERENCE, RETRY WITH A BIGGER ONE
+    else if (strCommand == NetMsgType::MNGOVERNANCERECONFAIL)
+    {
+        static CMetricHistogram& metric = GetMessageHandlerMetric("governance", NetMsgType::MNGOVERNANCERECONFAIL);
+        CMetricTimer timer(metric);
+        H256 nProp;
+        vRecv >> nProp;
+
+        unsigned int nCells;
+        {
+            LOCK(cs);
+            recon_m_it it = mapReconRequests.find(std::make_pair(pfrom->GetId(), nProp));
+            if(it == mapReconRequests.end()) {
+                LogPrint("gobject", "MNGOVERNANCERECONFAIL -- no pending request for hash %s, peer=%d\n", nProp.ToString(), pfrom->id);
+                return;
+            }
+            nCells = it->second.first * 2;
+            mapReconRequests.erase(it);
+        }
+
+        LogPrint("gobject", "MNGOVERNANCERECONFAIL -- hash %s, retrying with %d cells, peer=%d\n", nProp.ToString(), nCells, pfrom->id);
+
+        if(nCells > MAX_IBLT_CELLS || !RequestGovernanceReconciliation(pfrom, nProp, nCells)) {
+            // the difference is too big to reconcile, ask for everything
+            PushGovernanceSyncRequest(pfrom, nProp, true);
+        }
+    }
+
     // A NEW GOVERNANCE OBJECT HAS ARRIVED
     else if (strCommand == NetMsgType::MNGOVERNANCEOBJECT)
     {
+        static CMetricHistogram& metric = GetMessageHandlerMetric("governance", NetMsgType::MNGOVERNANCEOBJECT);
+        CMetricTimer timer(metric);
         // MAKE SURE WE HAVE A VALID REFERENCE TO THE TIP BEFORE CONTINUING
 
 
@@ -232,6 +311,8 @@ void CGovernanceManager::ProcessMessage(CNode* pfrom, std::string& strCommand, C
     // A NEW GOVERNANCE OBJECT VOTE HAS ARRIVED
     else if (strCommand == NetMsgType::MNGOVERNANCEOBJECTVOTE)
     {
+        static CMetricHistogram& metric = GetMessageHandlerMetric("governance", NetMsgType::MNGOVERNANCEOBJECTVOTE);
+        CMetricTimer timer(metric);
         // Ignore such messages until masternode list is synced
         if(!masternodeSync.IsMasternodeListSynced()) {
             LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- masternode list not synced\n");
@@ -349,7 +430,11 @@ void CGovernanceManager::AddGovernanceObject(CGovernanceObject& govobj, CNode* p
     }
 
     // INSERT INTO OUR GOVERNANCE OBJECT MEMORY
-    mapObjects.insert(std::make_pair(nHash, govobj));
+    object_m_it itObject = mapObjects.insert(std::make_pair(nHash, govobj)).first;
+    if(!WriteObject(itObject->second)) {
+        setDirtyObjects.insert(nHash);
+    }
+    UpdateReconObject(nHash);
 
     // SHOULD WE ADD THIS OBJECT TO ANY OTHER MANANGERS?
 
@@ -366,6 +451,7 @@ void CGovernanceManager::AddGovernanceObject(CGovernanceObject& govobj, CNode* p
         break;
     case GOVERNANCE_OBJECT_WATCHDOG:
         mapWatchdogObjects[nHash] = govobj.GetCreationTime() + GOVERNANCE_WATCHDOG_EXPIRATION_TIME;
+        expiryWatchdogObjects.Set(nHash, mapWatchdogObjects[nHash] + 1);
         LogPrint("gobject", "CGovernanceManager::AddGovernanceObject -- Added watchdog to map: hash = %s\n", nHash.ToString());
         break;
     default:
@@ -411,6 +497,7 @@ bool CGovernanceManager::UpdateCurrentWatchdog(CGovernanceObject& watchdogNew)
             if(it->second.nDeletionTime == 0) {
                 it->second.nDeletionTime = nNow;
             }
+            UpdateReconObject(it->first);
         }
         nHashWatchdogCurrent = watchdogNew.GetHash();
         nTimeWatchdogCurrent = watchdogNew.GetCreationTime();
@@ -433,27 +520,29 @@ void CGovernanceManager::UpdateCachesAndClean()
     int64_t nNow = GetAdjustedTime();
     LogPrint("gobject", "CGovernanceManager::UpdateCachesAndClean -- Number watchdogs in map: %d, current time = %d\n", mapWatchdogObjects.size(), nNow);
     if(mapWatchdogObjects.size() > 1) {
-        hash_time_m_it it = mapWatchdogObjects.begin();
-        while(it != mapWatchdogObjects.end()) {
-            LogPrint("gobject", "CGovernanceManager::UpdateCachesAndClean -- Checking watchdog: %s, expiration time = %d\n", it->first.ToString(), it->second);
-            if(it->second < nNow) {
-                LogPrint("gobject", "CGovernanceManager::UpdateCachesAndClean -- Attempting to expire watchdog: %s, expiration time = %d\n", it->first.ToString(), it->second);
-                object_m_it it2 = mapObjects.find(it->first);
-                if(it2 != mapObjects.end()) {
-                    LogPrint("gobject", "CGovernanceManager::UpdateCachesAndClean -- Expiring watchdog: %s, expiration time = %d\n", it->first.ToString(), it->second);
-                    it2->second.fExpired = true;
-                    if(it2->second.nDeletionTime == 0) {
-                        it2->second.nDeletionTime = nNow;
-                    }
-                }
-                if(it->first == nHashWatchdogCurrent) {
-                    nHashWatchdogCurrent.SetNull();
+        // only visit expired watchdogs, see CExpiryIndex
+        std::vector<H256> vecExpired;
+        expiryWatchdogObjects.PopExpired(nNow, vecExpired);
+        for(size_t i = 0; i < vecExpired.size(); ++i) {
+            hash_time_m_it it = mapWatchdogObjects.find(vecExpired[i]);
+            if(it == mapWatchdogObjects.end()) {
+                continue;
+            }
+            LogPrint("gobject", "CGovernanceManager::UpdateCachesAndClean -- Attempting to expire watchdog: %s, expiration time = %d\n", it->first.ToString(), it->second);
+            object_m_it it2 = mapObjects.find(it->first);
+            if(it2 != mapObjects.end()) {
+                LogPrint("gobject", "CGovernanceManager::UpdateCachesAndClean -- Expiring watchdog: %s, expiration time = %d\n", it->first.ToString(), it->second);
+                it2->second.fExpired = true;
+                if(it2->second.nDeletionTime == 0) {
+                    it2->second.nDeletionTime = nNow;
                 }
-                mapWatchdogObjects.erase(it++);
+                setDirtyObjects.insert(it->first);
+                UpdateReconObject(it->first);
             }
-            else {
-                ++it;
+            if(it->first == nHashWatchdogCurrent) {
+                nHashWatchdogCurrent.SetNull();
             }
+            mapWatchdogObjects.erase(it);
         }
     }
 
@@ -464,6 +553,7 @@ void CGovernanceManager::UpdateCachesAndClean()
         }
         it->second.ClearMasternodeVotes();
         it->second.fDirtyCache = true;
+        setDirtyObjects.insert(it->first);
     }
 
     CRateChecksGuard guard(false, *this);
@@ -489,6 +579,8 @@ void CGovernanceManager::UpdateCachesAndClean()
 
         // IF CACHE IS NOT DIRTY, WHY DO THIS?
         if(pObj->IsSetDirtyCache()) {
+            setDirtyObjects.insert(nHash);
+
             // UPDATE LOCAL VALIDITY AGAINST CRYPTO DATA
             pObj->UpdateLocalValidity();
 
@@ -496,6 +588,9 @@ void CGovernanceManager::UpdateCachesAndClean()
             pObj->UpdateSentinelVariables();
         }
 
+        // flags may have been changed here, by the trigger manager or while checking superblocks
+        UpdateReconObject(nHash);
+
         if(pObj->IsSetCachedDelete() && (nHash == nHashWatchdogCurrent)) {
             nHashWatchdogCurrent.SetNull();
         }
@@ -537,22 +632,29 @@ void CGovernanceManager::UpdateCachesAndClean()
             }
 
             mapErasedGovernanceObjects.insert(std::make_pair(nHash, nTimeExpired));
+            if(nTimeExpired != std::numeric_limits<int64_t>::max()) {
+                expiryErasedGovernanceObjects.Set(nHash, nTimeExpired + 1);
+            }
+            if(pgovernancedb && !pgovernancedb->EraseObject(*pObj)) {
+                LogPrintf("CGovernanceManager::UpdateCachesAndClean -- failed to erase obj %s from governance db\n", strHash);
+            }
+            setDirtyObjects.erase(nHash);
             mapObjects.erase(it++);
+            UpdateReconObject(nHash);
         } else {
             ++it;
         }
     }
 
-    // forget about expired deleted objects
-    hash_time_m_it s_it = mapErasedGovernanceObjects.begin();
-    nNow = GetTime();
-    while(s_it != mapErasedGovernanceObjects.end()) {
-        if(s_it->second < nNow)
-            mapErasedGovernanceObjects.erase(s_it++);
-        else
-            ++s_it;
+    // forget about expired deleted objects, hashes of deleted proposals are never registered
+    std::vector<H256> vecErasedExpired;
+    expiryErasedGovernanceObjects.PopExpired(GetTime(), vecErasedExpired);
+    for(size_t i = 0; i < vecErasedExpired.size(); ++i) {
+        mapErasedGovernanceObjects.erase(vecErasedExpired[i]);
     }
 
+    FlushObjects();
+
     LogPrintf("CGovernanceManager::UpdateCachesAndClean -- %s\n", ToString());
 }
 
@@ -633,6 +735,18 @@ std::vector<CGovernanceObject*> CGovernanceManager::GetAllNewerThan(int64_t nMor
 
     std::vector<CGovernanceObject*> vGovObjs;
 
+    // every object is written to the governance database when it is added, use its time index
+    std::vector<H256> vecHashes;
+    if(pgovernancedb && pgovernancedb->ReadObjectsNewerThan(nMoreThanTime, vecHashes)) {
+        for(size_t i = 0; i < vecHashes.size(); ++i) {
+            object_m_it it = mapObjects.find(vecHashes[i]);
+            if(it != mapObjects.end()) {
+                vGovObjs.push_back(&it->second);
+            }
+        }
+        return vGovObjs;
+    }
+
     object_m_it it = mapObjects.begin();
     while(it != mapObjects.end())
     {
@@ -703,7 +817,8 @@ bool CGovernanceManager::ConfirmInventoryRequest(const CInv& inv)
     break;
     case MSG_GOVERNANCE_OBJECT_VOTE:
     {
-        if(mapVoteToObject.HasKey(inv.hash)) {
+        CGovernanceObject* pGovobj = NULL;
+        if(GetVoteObject(inv.hash, pGovobj)) {
             LogPrint("gobject", "CGovernanceManager::ConfirmInventoryRequest already have governance vote, returning false\n");
             return false;
         }
@@ -820,6 +935,76 @@ void CGovernanceManager::Sync(CNode* pfrom, const H256& nProp, const CBloomFilte
 }
 
 
+bool CGovernanceManager::SyncReconciliation(CNode* pfrom, const H256& nProp, CIblt& iblt)
+{
+    // do not provide any data until our node is synced
+    if(fMasterNode && !masternodeSync.IsSynced()) return true;
+
+    int nObjCount = 0;
+    int nVoteCount = 0;
+
+    LogPrint("gobject", "CGovernanceManager::SyncReconciliation -- syncing to peer=%d, nProp = %s, cells = %d\n", pfrom->id, nProp.ToString(), iblt.GetCellCount());
+
+    {
+        LOCK2(cs_main, cs);
+
+        // our tables are kept up to date, so the work done here is mostly
+        // proportional to the difference, see UpdateReconObject
+        CIblt ibltVotesTmp;
+        const CIblt* pibltLocal = NULL;
+        CGovernanceObject* pObj = NULL;
+
+        if(nProp.IsNull()) {
+            pibltLocal = &GetReconObjectTable(iblt.GetCellCount());
+        } else {
+            object_m_it it = mapObjects.find(nProp);
+            if(it == mapObjects.end()) {
+                LogPrint("gobject", "CGovernanceManager::SyncReconciliation -- no matching object for hash %s, peer=%d\n", nProp.ToString(), pfrom->id);
+                return true;
+            }
+            pObj = &it->second;
+            if(pObj->IsSetCachedDelete() || pObj->IsSetExpired()) {
+                LogPrint("gobject", "CGovernanceManager::SyncReconciliation -- not syncing deleted/expired govobj: %s, peer=%d\n", nProp.ToString(), pfrom->id);
+                return true;
+            }
+            pibltLocal = &GetReconVoteTable(*pObj, iblt.GetCellCount(), ibltVotesTmp);
+        }
+
+        // what is left of the peer's table are the hashes only it has and, negated, the ones only we have
+        std::set<H256> setMissing;
+        std::set<H256> setUnknown;
+        if(!iblt.Subtract(*pibltLocal) || !iblt.ListEntries(setUnknown, setMissing)) {
+            LogPrint("gobject", "CGovernanceManager::SyncReconciliation -- could not decode %d cells, nProp = %s, peer=%d\n", iblt.GetCellCount(), nProp.ToString(), pfrom->id);
+            return false;
+        }
+
+        if(pObj) {
+            // the peer needs the object to accept its votes
+            pfrom->PushInventory(CInv(MSG_GOVERNANCE_OBJECT, nProp));
+            ++nObjCount;
+        }
+
+        BOOST_FOREACH(const H256& nHash, setMissing) {
+            if(!pObj) {
+                pfrom->PushInventory(CInv(MSG_GOVERNANCE_OBJECT, nHash));
+                ++nObjCount;
+                continue;
+            }
+            CGovernanceVote vote;
+            if(!pObj->GetVoteFile().GetVote(nHash, vote) || !vote.IsValid(true)) {
+                continue;
+            }
+            pfrom->PushInventory(CInv(MSG_GOVERNANCE_OBJECT_VOTE, nHash));
+            ++nVoteCount;
+        }
+    }
+
+    g_connman->PushMessage(pfrom, NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_GOVOBJ, nObjCount);
+    g_connman->PushMessage(pfrom, NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_GOVOBJ_VOTE, nVoteCount);
+    LogPrintf("CGovernanceManager::SyncReconciliation -- sent %d objects and %d votes to peer=%d\n", nObjCount, nVoteCount, pfrom->id);
+    return true;
+}
+
 void CGovernanceManager::MasternodeRateUpdate(const CGovernanceObject& govobj)
 {
     int nObjectType = govobj.GetObjectType();
@@ -979,6 +1164,7 @@ bool CGovernanceManager::ProcessVote(CNode* pfrom, const CGovernanceVote& vote,
     bool fOk = govobj.ProcessVote(pfrom, vote, exception);
     if(fOk) {
         mapVoteToObject.Insert(nHashVote, &govobj);
+        setDirtyObjects.insert(nHashGovobj);
 
         if(govobj.GetObjectType() == GOVERNANCE_OBJECT_WATCHDOG) {
             mnodeman.UpdateWatchdogVoteTime(vote.GetVinMasternode());
@@ -1112,6 +1298,15 @@ void CGovernanceManager::RequestGovernanceObject(CNode* pfrom, const H256& nHash
 
     LogPrint("gobject", "CGovernanceObject::RequestGovernanceObject -- hash = %s (peer=%d)\n", nHash.ToString(), pfrom->GetId());
 
+    if(fUseFilter && RequestGovernanceReconciliation(pfrom, nHash)) {
+        return;
+    }
+
+    PushGovernanceSyncRequest(pfrom, nHash, fUseFilter);
+}
+
+void CGovernanceManager::PushGovernanceSyncRequest(CNode* pfrom, const H256& nHash, bool fUseFilter)
+{
     if(pfrom->nVersion < GOVERNANCE_FILTER_PROTO_VERSION) {
         g_connman->PushMessage(pfrom, NetMsgType::MNGOVERNANCESYNC, nHash);
         return;
@@ -1127,10 +1322,10 @@ void CGovernanceManager::RequestGovernanceObject(CNode* pfrom, const H256& nHash
 
         if(pObj) {
             filter = CBloomFilter(Params().GetConsensus().nGovernanceFilterElements, GOVERNANCE_FILTER_FP_RATE, GetRandInt(999999), BLOOM_UPDATE_ALL);
-            std::vector<CGovernanceVote> vecVotes = pObj->GetVoteFile().GetVotes();
-            nVoteCount = vecVotes.size();
-            for(size_t i = 0; i < vecVotes.size(); ++i) {
-                filter.insert(vecVotes[i].GetHash());
+            std::vector<H256> vecVoteHashes = pObj->GetVoteFile().GetVoteHashes();
+            nVoteCount = vecVoteHashes.size();
+            for(size_t i = 0; i < vecVoteHashes.size(); ++i) {
+                filter.insert(vecVoteHashes[i]);
             }
         }
     }
@@ -1139,6 +1334,133 @@ void CGovernanceManager::RequestGovernanceObject(CNode* pfrom, const H256& nHash
     g_connman->PushMessage(pfrom, NetMsgType::MNGOVERNANCESYNC, nHash, filter);
 }
 
+bool CGovernanceManager::RequestGovernanceReconciliation(CNode* pfrom, const H256& nHash, unsigned int nCells)
+{
+    if(!pfrom || pfrom->nVersion < GOVERNANCE_RECON_PROTO_VERSION) {
+        return false;
+    }
+
+    // the same tables as for answering requests, so both sides leave out deleted and expired objects
+    CIblt iblt;
+    size_t nCount = 0;
+    {
+        LOCK(cs);
+
+        if(nHash.IsNull()) {
+            iblt = GetReconObjectTable(nCells);
+            nCount = setReconObjects.size();
+        } else {
+            object_m_it it = mapObjects.find(nHash);
+            if(it != mapObjects.end()) {
+                nCount = it->second.GetVoteFile().GetVoteCount();
+                if(nCount > 0) {
+                    CIblt ibltTmp;
+                    iblt = GetReconVoteTable(it->second, nCells, ibltTmp);
+                }
+            }
+        }
+
+        if(nCount == 0) {
+            return false;
+        }
+
+        int64_t nNow = GetTime();
+        recon_m_it it = mapReconRequests.begin();
+        while(it != mapReconRequests.end()) {
+            if(it->second.second < nNow - GOVERNANCE_RECON_TIMEOUT) {
+                mapReconRequests.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        mapReconRequests[std::make_pair(pfrom->GetId(), nHash)] = std::make_pair(iblt.GetCellCount(), nNow);
+    }
+
+    LogPrint("gobject", "CGovernanceManager::RequestGovernanceReconciliation -- nHash %s nCount %d cells %d peer=%d\n", nHash.ToString(), nCount, iblt.GetCellCount(), pfrom->id);
+    g_connman->PushMessage(pfrom, NetMsgType::MNGOVERNANCERECON, nHash, iblt);
+    return true;
+}
+
+bool CGovernanceManager::IsReconCellCount(unsigned int nCells)
+{
+    for(unsigned int nCellsValid = GOVERNANCE_RECON_START_CELLS; nCellsValid <= MAX_IBLT_CELLS; nCellsValid *= 2) {
+        if(nCells == nCellsValid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CGovernanceManager::UpdateReconObject(const H256& nHash)
+{
+    AssertLockHeld(cs);
+
+    if(!fReconObjectsValid) {
+        // everything is added on the next use
+        return;
+    }
+
+    object_m_it it = mapObjects.find(nHash);
+    bool fOffered = it != mapObjects.end() && !it->second.IsSetCachedDelete() && !it->second.IsSetExpired();
+    if(fOffered == (setReconObjects.count(nHash) > 0)) {
+        return;
+    }
+
+    if(fOffered) {
+        setReconObjects.insert(nHash);
+        ibltReconObjects.Insert(nHash);
+    } else {
+        setReconObjects.erase(nHash);
+        ibltReconObjects.Erase(nHash);
+    }
+}
+
+const CIblt& CGovernanceManager::GetReconObjectTable(unsigned int nCells)
+{
+    AssertLockHeld(cs);
+
+    if(!fReconObjectsValid) {
+        setReconObjects.clear();
+        ibltReconObjects.Clear();
+        for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
+            if(it->second.IsSetCachedDelete() || it->second.IsSetExpired()) {
+                continue;
+            }
+            setReconObjects.insert(it->first);
+        }
+        fReconObjectsValid = true;
+    }
+
+    const CIblt* pTable = ibltReconObjects.Get(nCells, GOVERNANCE_RECON_SALT);
+    if(pTable) {
+        return *pTable;
+    }
+
+    CIblt& table = ibltReconObjects.Create(nCells, GOVERNANCE_RECON_SALT);
+    BOOST_FOREACH(const H256& nHash, setReconObjects) {
+        table.Insert(nHash);
+    }
+    return table;
+}
+
+const CIblt& CGovernanceManager::GetReconVoteTable(CGovernanceObject& govobj, unsigned int nCells, CIblt& tableTmp)
+{
+    AssertLockHeld(cs);
+
+    CGovernanceObjectVoteFile& fileVotes = govobj.GetVoteFile();
+    if(nCells <= GOVERNANCE_RECON_MAX_KEPT_VOTE_CELLS) {
+        return fileVotes.GetReconTable(nCells, GOVERNANCE_RECON_SALT);
+    }
+
+    // only asked for after the smaller tables failed, not worth keeping for every object
+    tableTmp = CIblt(nCells, GOVERNANCE_RECON_SALT);
+    std::vector<H256> vecVoteHashes = fileVotes.GetVoteHashes();
+    for(size_t i = 0; i < vecVoteHashes.size(); ++i) {
+        tableTmp.Insert(vecVoteHashes[i]);
+    }
+    return tableTmp;
+}
+
 int CGovernanceManager::RequestGovernanceObjectVotes(CNode* pnode)
 {
     if(pnode->nVersion < MIN_GOVERNANCE_PEER_PROTO_VERSION) return -3;
@@ -1275,14 +1597,78 @@ bool CGovernanceManager::AcceptMessage(const H256& nHash, hash_s_t& setHash)
 
 void CGovernanceManager::RebuildIndexes()
 {
+    // votes of loaded objects stay on disk, GetVoteObject fills the cache on demand
     mapVoteToObject.Clear();
+
+    expiryErasedGovernanceObjects.Clear();
+    for(hash_time_m_it it = mapErasedGovernanceObjects.begin(); it != mapErasedGovernanceObjects.end(); ++it) {
+        if(it->second != std::numeric_limits<int64_t>::max()) {
+            expiryErasedGovernanceObjects.Set(it->first, it->second + 1);
+        }
+    }
+
+    expiryWatchdogObjects.Clear();
+    for(hash_time_m_it it = mapWatchdogObjects.begin(); it != mapWatchdogObjects.end(); ++it) {
+        expiryWatchdogObjects.Set(it->first, it->second + 1);
+    }
+}
+
+bool CGovernanceManager::GetVoteObject(const H256& nHash, CGovernanceObject*& pGovobjRet)
+{
+    if(mapVoteToObject.Get(nHash, pGovobjRet)) {
+        return true;
+    }
+
+    H256 nParentHash;
+    if(!pgovernancedb || !pgovernancedb->ReadVoteParent(nHash, nParentHash)) {
+        return false;
+    }
+
+    object_m_it it = mapObjects.find(nParentHash);
+    if(it == mapObjects.end()) {
+        return false;
+    }
+
+    pGovobjRet = &it->second;
+    mapVoteToObject.Insert(nHash, pGovobjRet);
+    return true;
+}
+
+bool CGovernanceManager::WriteObject(CGovernanceObject& govobj)
+{
+    if(!pgovernancedb) return true;
+
+    // the votes stay in memory until the write succeeded, a later flush retries them
+    std::vector<CGovernanceVote> vecVotes;
+    govobj.GetVoteFile().GetMemoryVotes(vecVotes);
+    if(!pgovernancedb->WriteObject(govobj, vecVotes)) {
+        LogPrintf("CGovernanceManager::WriteObject -- failed to write obj %s to governance db\n", govobj.GetHash().ToString());
+        return false;
+    }
+    govobj.GetVoteFile().SetMemoryVotesStored();
+    return true;
+}
+
+void CGovernanceManager::FlushObjects()
+{
+    LOCK(cs);
+
+    int64_t nStart = GetTimeMillis();
+    int nObjects = 0;
+    hash_s_t setFailed;
     for(object_m_it it = mapObjects.begin(); it != mapObjects.end(); ++it) {
-        CGovernanceObject& govobj = it->second;
-        std::vector<CGovernanceVote> vecVotes = govobj.GetVoteFile().GetVotes();
-        for(size_t i = 0; i < vecVotes.size(); ++i) {
-            mapVoteToObject.Insert(vecVotes[i].GetHash(), &govobj);
+        if(!setDirtyObjects.count(it->first) && it->second.GetVoteFile().GetMemoryVoteCount() == 0) {
+            continue;
         }
+        if(!WriteObject(it->second)) {
+            setFailed.insert(it->first);
+            continue;
+        }
+        ++nObjects;
     }
+    // failed objects are written again on the next flush
+    setDirtyObjects.swap(setFailed);
+    LogPrint("gobject", "CGovernanceManager::FlushObjects -- wrote %d objects  %dms\n", nObjects, GetTimeMillis() - nStart);
 }
 
 void CGovernanceManager::AddCachedTriggers()
@@ -1305,8 +1691,12 @@ void CGovernanceManager::InitOnLoad()
     LOCK(cs);
     int64_t nStart = GetTimeMillis();
     LogPrintf("Preparing masternode indexes and governance triggers...\n");
+    if(pgovernancedb && !pgovernancedb->LoadObjects(mapObjects)) {
+        LogPrintf("CGovernanceManager::InitOnLoad -- failed to load objects from governance db\n");
+    }
     RebuildIndexes();
     AddCachedTriggers();
+    fReconObjectsValid = false;
     LogPrintf("Masternode indexes and governance triggers prepared  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("     %s\n", ToString());
 }
@@ -1343,7 +1733,7 @@ std::string CGovernanceManager::ToString() const
     return strprintf("Governance Objects: %d (Proposals: %d, Triggers: %d, Watchdogs: %d/%d, Other: %d; Erased: %d), Votes: %d",
                     (int)mapObjects.size(),
                     nProposalCount, nTriggerCount, nWatchdogCount, mapWatchdogObjects.size(), nOtherCount, (int)mapErasedGovernanceObjects.size(),
-                    (int)mapVoteToObject.GetSize());
+                    GetVoteCount());
 }
 
 void CGovernanceManager::UpdatedBlockTip(const CBlockIndex *pindex)
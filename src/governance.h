@@ -11,9 +11,11 @@
 #include "cachemap.h"
 #include "cachemultimap.h"
 #include "chain.h"
+#include "expiryindex.h"
 #include "governance-exceptions.h"
 #include "governance-object.h"
 #include "governance-vote.h"
+#include "iblt.h"
 #include "net.h"
 #include "sync.h"
 #include "timedata.h"
@@ -37,6 +39,17 @@ typedef std::pair<CGovernanceObject, ExpirationInfo> object_info_pair_t;
 
 static const int RATE_BUFFER_SIZE = 5;
 
+//! first "govrecon" table size, doubled on every "govreconfail" up to MAX_IBLT_CELLS
+static const unsigned int GOVERNANCE_RECON_START_CELLS = 60;
+//! seconds to wait for a "govreconfail" before forgetting the request
+static const int64_t GOVERNANCE_RECON_TIMEOUT = 60;
+//! salt of every "govrecon" table. A per-request salt would force a new table
+//! for every request, a fixed one lets both sides keep theirs up to date.
+//! Crafted hashes can at worst make decoding fail, which falls back to govsync.
+static const uint64_t GOVERNANCE_RECON_SALT = 0x676f767265636f6eULL;
+//! vote tables up to this size are kept per object, bigger ones are built when asked for
+static const unsigned int GOVERNANCE_RECON_MAX_KEPT_VOTE_CELLS = GOVERNANCE_RECON_START_CELLS * 4;
+
 class CRateCheckBuffer {
 private:
     std::vector<int64_t> vecTimestamps;
@@ -218,6 +231,11 @@ public: // Types
 
     typedef hash_time_m_t::const_iterator hash_time_m_cit;
 
+    // cell count and time of pending reconciliation requests, by peer and object hash
+    typedef std::map<std::pair<NodeId, H256>, std::pair<unsigned int, int64_t> > recon_m_t;
+
+    typedef recon_m_t::iterator recon_m_it;
+
 private:
     static const int MAX_CACHE_SIZE = 1000000;
 
@@ -247,6 +265,10 @@ private:
 
     hash_time_m_t mapWatchdogObjects;
 
+    // expiry of mapErasedGovernanceObjects and mapWatchdogObjects, by time
+    CExpiryIndex<H256> expiryErasedGovernanceObjects;
+    CExpiryIndex<H256> expiryWatchdogObjects;
+
     H256 nHashWatchdogCurrent;
 
     int64_t nTimeWatchdogCurrent;
@@ -263,6 +285,19 @@ private:
 
     hash_s_t setRequestedVotes;
 
+    recon_m_t mapReconRequests;
+
+    // objects offered for reconciliation (neither deleted nor expired) and
+    // their tables, rebuilt on first use when fReconObjectsValid is not set
+    hash_s_t setReconObjects;
+
+    CIbltSet ibltReconObjects;
+
+    bool fReconObjectsValid;
+
+    // objects changed since they were last written to the governance database
+    hash_s_t setDirtyObjects;
+
     bool fRateChecksEnabled;
 
     class CRateChecksGuard
@@ -329,12 +364,17 @@ public:
         mapObjects.clear();
         mapErasedGovernanceObjects.clear();
         mapWatchdogObjects.clear();
+        expiryErasedGovernanceObjects.Clear();
+        expiryWatchdogObjects.Clear();
         nHashWatchdogCurrent = H256();
         nTimeWatchdogCurrent = 0;
         mapVoteToObject.Clear();
         mapInvalidVotes.Clear();
         mapOrphanVotes.Clear();
         mapLastMasternodeObject.clear();
+        setDirtyObjects.clear();
+        mapReconRequests.clear();
+        fReconObjectsValid = false;
     }
 
     std::string ToString() const;
@@ -356,7 +396,7 @@ public:
         READWRITE(mapErasedGovernanceObjects);
         READWRITE(mapInvalidVotes);
         READWRITE(mapOrphanVotes);
-        READWRITE(mapObjects);
+        // objects and their votes are kept in the governance database
         READWRITE(mapWatchdogObjects);
         READWRITE(nHashWatchdogCurrent);
         READWRITE(nTimeWatchdogCurrent);
@@ -421,12 +461,44 @@ public:
 
     void InitOnLoad();
 
+    /// Write changed objects and the votes they hold in memory to the governance database
+    void FlushObjects();
+
     int RequestGovernanceObjectVotes(CNode* pnode);
     int RequestGovernanceObjectVotes(const std::vector<CNode*>& vNodesCopy);
 
+    /**
+     * Ask pfrom for the objects (null nHash) or the votes of object nHash we
+     * don't have by sending an IBLT of the hashes we know. Returns false when
+     * the peer is too old or we know nothing yet, a plain request is cheaper then.
+     */
+    bool RequestGovernanceReconciliation(CNode* pfrom, const H256& nHash, unsigned int nCells = GOVERNANCE_RECON_START_CELLS);
+
 private:
     void RequestGovernanceObject(CNode* pfrom, const H256& nHash, bool fUseFilter = false);
 
+    /// Send a "govsync" request, with a bloom filter of known votes if fUseFilter is set
+    void PushGovernanceSyncRequest(CNode* pfrom, const H256& nHash, bool fUseFilter);
+
+    /// Answer a "govrecon" request, returns false if the difference could not be decoded
+    bool SyncReconciliation(CNode* pfrom, const H256& nProp, CIblt& iblt);
+
+    /// Reconciliation table sizes are GOVERNANCE_RECON_START_CELLS doubled up to MAX_IBLT_CELLS
+    static bool IsReconCellCount(unsigned int nCells);
+
+    /**
+     * Add or remove object nHash from the reconciliation tables after it was
+     * added, erased, or flagged deleted or expired. Flags set outside of this
+     * manager are picked up by the next UpdateCachesAndClean pass.
+     */
+    void UpdateReconObject(const H256& nHash);
+
+    /// Reconciliation table of the objects we offer, requires cs
+    const CIblt& GetReconObjectTable(unsigned int nCells);
+
+    /// Reconciliation table of the votes of govobj, requires cs
+    const CIblt& GetReconVoteTable(CGovernanceObject& govobj, unsigned int nCells, CIblt& tableTmp);
+
     void AddInvalidVote(const CGovernanceVote& vote)
     {
         mapInvalidVotes.Insert(vote.GetHash(), vote);
@@ -451,6 +523,11 @@ private:
 
     void RebuildIndexes();
 
+    /// Find the object a vote belongs to, consulting the governance database for votes not seen since startup
+    bool GetVoteObject(const H256& nHash, CGovernanceObject*& pGovobjRet);
+
+    bool WriteObject(CGovernanceObject& govobj);
+
     void AddCachedTriggers();
 
     bool UpdateCurrentWatchdog(CGovernanceObject& watchdogNew);
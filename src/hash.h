@@ -276,6 +276,37 @@ H256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL_VE
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+/** SipHash-2-4, can be used as a keyed hash for short inputs such as the
+ * short transaction ids used in compact block relay.
+ */
+class CSipHasher
+{
+private:
+    uint64_t v[4];
+    uint64_t tmp;
+    int count;
+
+public:
+    /** Construct a SipHash calculator initialized with 128-bit key (k0, k1) */
+    CSipHasher(uint64_t k0, uint64_t k1);
+    /** Hash a 64-bit integer worth of data
+     *  It is treated as if this was the little-endian interpretation of 8 bytes.
+     *  This function can only be used when a multiple of 8 bytes have been written so far.
+     */
+    CSipHasher& Write(uint64_t data);
+    /** Hash arbitrary bytes. */
+    CSipHasher& Write(const unsigned char* data, size_t size);
+    /** Compute the 64-bit SipHash-2-4 of the data written so far. The object remains untouched. */
+    uint64_t Finalize() const;
+};
+
+/** Optimized SipHash-2-4 implementation for hashing a single H256.
+ *
+ *  It is identical to CSipHasher(k0, k1).Write(val.begin(), 32).Finalize(),
+ *  processing the hash as four little-endian 64-bit words.
+ */
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const H256& val);
+
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
 /* ----------- Ebakus Hash ------------------------------------------------ */
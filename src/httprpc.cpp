@@ -3,6 +3,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "metrics.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -17,9 +18,19 @@
 #include <boost/algorithm/string.hpp> // boost::trim
 #include <boost/foreach.hpp> //BOOST_FOREACH
 
+#include <set>
+
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
 
+/** Calls that only read a few values, they go to the fast work queue in addition to -rpcfastmethod */
+static const char* const DEFAULT_RPC_FAST_METHODS[] = {
+    "getbestblockhash", "getblockcount", "getblockhash", "getconnectioncount", "getdifficulty",
+    "getnetworkinfo", "ping", "getmetrics",
+};
+/** Part of the body looked at to find the method, requests are classified on the event thread */
+static const size_t RPC_CLASSIFY_PEEK_SIZE = 512;
+
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wellet.
  */
@@ -61,6 +72,8 @@ private:
 static std::string strRPCUserColonPass;
 /* Stored RPC timer interface (for unregistration) */
 static HTTPRPCTimerInterface* httpRPCTimerInterface = 0;
+/* Methods served by the fast work queue */
+static std::set<std::string> setRPCFastMethods;
 
 static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
 {
@@ -140,14 +153,9 @@ static bool RPCAuthorized(const std::string& strAuth)
     return multiUserAuthorized(strUserPass);
 }
 
-static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+/** Check the RPC credentials of a request, replies with 401 Unauthorized if they are missing or wrong */
+static bool HTTPReq_Authorized(HTTPRequest* req)
 {
-    // JSONRPC handles only POST
-    if (req->GetRequestMethod() != HTTPRequest::POST) {
-        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
-        return false;
-    }
-    // Check authorization
     std::pair<bool, std::string> authHeader = req->GetHeader("authorization");
     if (!authHeader.first) {
         req->WriteHeader("WWW-Authenticate", WWW_AUTH_HEADER_DATA);
@@ -167,6 +175,81 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         req->WriteReply(HTTP_UNAUTHORIZED);
         return false;
     }
+    return true;
+}
+
+/** Find the method of a JSON-RPC request from the start of its body, used to
+ * send single calls to cheap methods to the fast queue. Only the top-level
+ * "method" key counts, strings and nested values are skipped and nothing is
+ * parsed. A body cut off before the method, or anything unexpected (batches,
+ * "method" not among the first keys), returns false and the request goes to
+ * the heavy queue.
+ */
+bool PeekJSONRPCMethod(const std::string& strBody, std::string& strMethodRet)
+{
+    size_t pos = strBody.find_first_not_of(" \t\r\n");
+    if (pos == std::string::npos || strBody[pos] != '{')
+        return false;
+
+    int nDepth = 0;
+    bool fKey = true;
+    std::string strKey;
+    for (; pos < strBody.size(); pos++) {
+        char c = strBody[pos];
+        if (c == '"') {
+            size_t end = pos + 1;
+            while (end < strBody.size() && strBody[end] != '"') {
+                if (strBody[end] == '\\')
+                    end++;
+                end++;
+            }
+            if (end >= strBody.size())
+                return false;
+            if (nDepth == 1) {
+                std::string str = strBody.substr(pos + 1, end - pos - 1);
+                if (fKey) {
+                    strKey = str;
+                } else if (strKey == "method") {
+                    // leave escaped names to the parser
+                    if (str.find('\\') != std::string::npos)
+                        return false;
+                    strMethodRet = str;
+                    return true;
+                }
+            }
+            pos = end;
+        } else if (c == '{' || c == '[') {
+            nDepth++;
+        } else if (c == '}' || c == ']') {
+            if (--nDepth == 0)
+                return false;
+        } else if (nDepth == 1 && c == ':') {
+            fKey = false;
+        } else if (nDepth == 1 && c == ',') {
+            fKey = true;
+        }
+    }
+    return false;
+}
+
+static HTTPWorkQueueClass HTTPReq_JSONRPC_Classify(HTTPRequest* req, const std::string &)
+{
+    std::string strMethod;
+    if (!PeekJSONRPCMethod(req->PeekBody(RPC_CLASSIFY_PEEK_SIZE), strMethod))
+        return HTTP_QUEUE_HEAVY;
+    return setRPCFastMethods.count(strMethod) ? HTTP_QUEUE_FAST : HTTP_QUEUE_HEAVY;
+}
+
+static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
+{
+    // JSONRPC handles only POST
+    if (req->GetRequestMethod() != HTTPRequest::POST) {
+        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
+        return false;
+    }
+    // Check authorization
+    if (!HTTPReq_Authorized(req))
+        return false;
 
     JSONRequest jreq;
     try {
@@ -175,24 +258,29 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (!valRequest.read(req->ReadBody()))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-        std::string strReply;
         // singleton request
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            // Send reply, serialized straight into the (chunked) reply
+            req->WriteHeader("Content-Type", "application/json");
+            HTTPReplyWriter writer(req, HTTP_OK);
+            JSONRPCWriteReply(writer, result, jreq.id);
+            writer.finish();
 
         // array of requests
-        } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+        } else if (valRequest.isArray()) {
+            UniValue ret = JSONRPCExecBatch(valRequest.get_array());
+
+            req->WriteHeader("Content-Type", "application/json");
+            HTTPReplyWriter writer(req, HTTP_OK);
+            if (JSONWrite(writer, ret))
+                writer.write("\n");
+            writer.finish();
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strReply);
     } catch (const UniValue& objError) {
         JSONErrorReply(req, objError, jreq.id);
         return false;
@@ -227,11 +315,19 @@ bool StartHTTPRPC()
     if (!InitRPCAuthentication())
         return false;
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    setRPCFastMethods.clear();
+    setRPCFastMethods.insert(DEFAULT_RPC_FAST_METHODS, DEFAULT_RPC_FAST_METHODS + ARRAYLEN(DEFAULT_RPC_FAST_METHODS));
+    if (mapMultiArgs.count("-rpcfastmethod")) {
+        const std::vector<std::string>& vMethods = mapMultiArgs["-rpcfastmethod"];
+        setRPCFastMethods.insert(vMethods.begin(), vMethods.end());
+    }
+
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, HTTPReq_JSONRPC_Classify);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
     RPCRegisterTimerInterface(httpRPCTimerInterface);
+    RPCSetBatchDispatcher(&QueueHTTPWork);
     return true;
 }
 
@@ -244,9 +340,45 @@ void StopHTTPRPC()
 {
     LogPrint("rpc", "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    RPCSetBatchDispatcher(RPCBatchDispatcher());
     if (httpRPCTimerInterface) {
         RPCUnregisterTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
         httpRPCTimerInterface = 0;
     }
 }
+
+static HTTPWorkQueueClass HTTPReq_Metrics_Classify(HTTPRequest* req, const std::string &)
+{
+    return HTTP_QUEUE_FAST;
+}
+
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string &)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests allowed");
+        return false;
+    }
+    // the metrics reveal what the node is doing, they are protected like RPC
+    if (!HTTPReq_Authorized(req))
+        return false;
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, MetricsToPrometheus());
+    return true;
+}
+
+bool StartHTTPMetrics()
+{
+    LogPrint("http", "Starting HTTP metrics endpoint\n");
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics, HTTPReq_Metrics_Classify);
+    return true;
+}
+
+void InterruptHTTPMetrics()
+{
+}
+
+void StopHTTPMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
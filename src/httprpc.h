@@ -34,4 +34,21 @@ void InterruptREST();
  */
 void StopREST();
 
+/** Start the Prometheus /metrics endpoint.
+ * Precondition; HTTP has been started.
+ */
+bool StartHTTPMetrics();
+/** Interrupt the /metrics endpoint.
+ */
+void InterruptHTTPMetrics();
+/** Stop the /metrics endpoint.
+ * Precondition; HTTP has been stopped.
+ */
+void StopHTTPMetrics();
+
+/** Find the method of a JSON-RPC request from the start of its body without
+ * parsing it. Returns false for batches and anything unexpected.
+ */
+bool PeekJSONRPCMethod(const std::string& strBody, std::string& strMethodRet);
+
 #endif
@@ -61,6 +61,23 @@ private:
     HTTPRequestHandler func;
 };
 
+/** Work item not tied to a request */
+class HTTPCallbackItem : public HTTPClosure
+{
+public:
+    HTTPCallbackItem(const boost::function<void(void)>& func):
+        func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    boost::function<void(void)> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
  */
@@ -72,10 +89,12 @@ private:
     CWaitableCriticalSection cs;
     CConditionVariable cond;
     /* XXX in C++11 we can use std::unique_ptr here and avoid manual cleanup */
-    std::deque<WorkItem*> queue;
+    /** Items with the time they were queued at */
+    std::deque<std::pair<WorkItem*, int64_t> > queue;
     bool running;
     size_t maxDepth;
     int numThreads;
+    HTTPWorkQueueStats stats;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -96,10 +115,12 @@ private:
     };
 
 public:
-    WorkQueue(size_t maxDepth) : running(true),
-                                 maxDepth(maxDepth),
-                                 numThreads(0)
+    WorkQueue(const std::string& name, size_t maxDepth) : running(true),
+                                                          maxDepth(maxDepth),
+                                                          numThreads(0)
     {
+        stats.strName = name;
+        stats.nMaxDepth = maxDepth;
     }
     /*( Precondition: worker threads have all stopped
      * (call WaitExit)
@@ -107,7 +128,7 @@ public:
     ~WorkQueue()
     {
         while (!queue.empty()) {
-            delete queue.front();
+            delete queue.front().first;
             queue.pop_front();
         }
     }
@@ -116,9 +137,10 @@ public:
     {
         boost::unique_lock<boost::mutex> lock(cs);
         if (queue.size() >= maxDepth) {
+            stats.nRejected++;
             return false;
         }
-        queue.push_back(item);
+        queue.push_back(std::make_pair(item, GetTimeMicros()));
         cond.notify_one();
         return true;
     }
@@ -128,17 +150,29 @@ public:
         ThreadCounter count(*this);
         while (true) {
             WorkItem* i = 0;
+            int64_t nTimeQueued = 0;
             {
                 boost::unique_lock<boost::mutex> lock(cs);
                 while (running && queue.empty())
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = queue.front();
+                i = queue.front().first;
+                nTimeQueued = queue.front().second;
                 queue.pop_front();
             }
+            int64_t nTimeStart = GetTimeMicros();
             (*i)();
             delete i;
+            int64_t nTimeEnd = GetTimeMicros();
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                stats.nProcessed++;
+                stats.nTotalWaitTime += nTimeStart - nTimeQueued;
+                stats.nMaxWaitTime = std::max(stats.nMaxWaitTime, nTimeStart - nTimeQueued);
+                stats.nTotalRunTime += nTimeEnd - nTimeStart;
+                stats.nMaxRunTime = std::max(stats.nMaxRunTime, nTimeEnd - nTimeStart);
+            }
         }
     }
     /** Interrupt and exit loops */
@@ -163,34 +197,56 @@ public:
         boost::unique_lock<boost::mutex> lock(cs);
         return queue.size();
     }
+
+    /** Return counters, with the current depth and number of threads */
+    HTTPWorkQueueStats GetStats()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        HTTPWorkQueueStats ret = stats;
+        ret.nDepth = queue.size();
+        ret.nThreads = numThreads;
+        return ret;
+    }
 };
 
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPRequestClassifier classifier):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), classifier(classifier)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPRequestClassifier classifier;
+};
+
+/** Event loop accepting and dispatching requests, there is one per dispatch thread */
+struct HTTPEventLoop
+{
+    struct event_base* base;
+    struct evhttp* http;
+    //! Bound listening sockets
+    std::vector<evhttp_bound_socket *> boundSockets;
+    boost::thread thread;
+
+    HTTPEventLoop() : base(0), http(0) {}
 };
 
 /** HTTP module state */
 
-//! libevent event loop
-static struct event_base* eventBase = 0;
-//! HTTP server
-struct evhttp* eventHTTP = 0;
+//! libevent event loops with their HTTP servers
+static std::vector<HTTPEventLoop*> eventLoops;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
-//! Work queue for handling longer requests off the event loop thread
-static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work queues for handling requests off the event loop threads
+static WorkQueue<HTTPClosure>* workQueues[HTTP_QUEUE_MAX] = {};
+static const char* const workQueueNames[HTTP_QUEUE_MAX] = {"fast", "heavy"};
+//! Send "Connection: close" with every reply, see -rpckeepalive
+static bool fHTTPKeepAlive = DEFAULT_HTTP_KEEPALIVE;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
-//! Bound listening sockets
-std::vector<evhttp_bound_socket *> boundSockets;
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -287,14 +343,21 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
         }
     }
 
+    if (!fHTTPKeepAlive)
+        hreq->WriteHeader("Connection", "close");
+
     // Dispatch to worker thread
     if (i != iend) {
+        HTTPWorkQueueClass queueClass = i->classifier.empty() ? HTTP_QUEUE_HEAVY : i->classifier(hreq.get(), path);
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(hreq.release(), path, i->handler));
-        assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        assert(workQueues[queueClass]);
+        if (workQueues[queueClass]->Enqueue(item.get()))
             item.release(); /* if true, queue took ownership */
-        else
-            item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
+        else {
+            // Tell well-behaved clients to back off instead of failing the call
+            item->req->WriteHeader("Retry-After", "1");
+            item->req->WriteReply(HTTP_SERVICE_UNAVAILABLE, "Work queue depth exceeded");
+        }
     } else {
         hreq->WriteReply(HTTP_NOTFOUND);
     }
@@ -317,8 +380,55 @@ static void ThreadHTTP(struct event_base* base, struct evhttp* http)
     LogPrint("http", "Exited http event loop\n");
 }
 
+/** Bind listening sockets with SO_REUSEPORT, so the event loops of all
+ * dispatch threads can listen on the same address and the kernel spreads
+ * new connections over them. Every address host resolves to is bound, the
+ * handles are appended to vBound.
+ */
+static bool HTTPBindReusePort(struct evhttp* http, const std::string& host, uint16_t port, std::vector<evhttp_bound_socket*>& vBound)
+{
+#if defined(SO_REUSEPORT) && !defined(WIN32)
+    struct evutil_addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = EVUTIL_AI_PASSIVE;
+    struct evutil_addrinfo* aiRes = NULL;
+    if (evutil_getaddrinfo(host.empty() ? NULL : host.c_str(), strprintf("%d", port).c_str(), &hints, &aiRes) != 0 || !aiRes)
+        return false;
+
+    bool fBound = false;
+    for (struct evutil_addrinfo* ai = aiRes; ai != NULL; ai = ai->ai_next) {
+        evutil_socket_t fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        evhttp_bound_socket* bind_handle = NULL;
+        int one = 1;
+        if (evutil_make_socket_nonblocking(fd) == 0 &&
+            evutil_make_listen_socket_reuseable(fd) == 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void*)&one, sizeof(one)) == 0 &&
+            (ai->ai_family != AF_INET6 || setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (void*)&one, sizeof(one)) == 0) &&
+            bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+            listen(fd, SOMAXCONN) == 0) {
+            // evhttp closes the socket when it is freed
+            bind_handle = evhttp_accept_socket_with_handle(http, fd);
+        }
+        if (!bind_handle) {
+            evutil_closesocket(fd);
+            continue;
+        }
+        vBound.push_back(bind_handle);
+        fBound = true;
+    }
+    evutil_freeaddrinfo(aiRes);
+    return fBound;
+#else
+    return false;
+#endif
+}
+
 /** Bind HTTP server to specified addresses */
-static bool HTTPBindAddresses(struct evhttp* http)
+static bool HTTPBindAddresses(HTTPEventLoop* loop, bool fReusePort)
 {
     int defaultPort = GetArg("-rpcport", BaseParams().RPCPort());
     std::vector<std::pair<std::string, uint16_t> > endpoints;
@@ -346,14 +456,20 @@ static bool HTTPBindAddresses(struct evhttp* http)
     // Bind addresses
     for (std::vector<std::pair<std::string, uint16_t> >::iterator i = endpoints.begin(); i != endpoints.end(); ++i) {
         LogPrint("http", "Binding RPC on address %s port %i\n", i->first, i->second);
-        evhttp_bound_socket *bind_handle = evhttp_bind_socket_with_handle(http, i->first.empty() ? NULL : i->first.c_str(), i->second);
-        if (bind_handle) {
-            boundSockets.push_back(bind_handle);
+        bool fBound;
+        if (fReusePort) {
+            fBound = HTTPBindReusePort(loop->http, i->first, i->second, loop->boundSockets);
         } else {
+            evhttp_bound_socket *bind_handle = evhttp_bind_socket_with_handle(loop->http, i->first.empty() ? NULL : i->first.c_str(), i->second);
+            if (bind_handle)
+                loop->boundSockets.push_back(bind_handle);
+            fBound = bind_handle != NULL;
+        }
+        if (!fBound) {
             LogPrintf("Binding RPC on address %s port %i failed.\n", i->first, i->second);
         }
     }
-    return !boundSockets.empty();
+    return !loop->boundSockets.empty();
 }
 
 /** Simple wrapper to set thread name and run work queue */
@@ -376,11 +492,18 @@ static void libevent_log_cb(int severity, const char *msg)
         LogPrint("libevent", "libevent: %s\n", msg);
 }
 
-bool InitHTTPServer()
+/** Free an event loop, its HTTP server closes the sockets bound to it */
+static void FreeHTTPEventLoop(HTTPEventLoop* loop)
 {
-    struct evhttp* http = 0;
-    struct event_base* base = 0;
+    if (loop->http)
+        evhttp_free(loop->http);
+    if (loop->base)
+        event_base_free(loop->base);
+    delete loop;
+}
 
+bool InitHTTPServer()
+{
     if (!InitHTTPAllowList())
         return false;
 
@@ -407,117 +530,155 @@ bool InitHTTPServer()
     evthread_use_pthreads();
 #endif
 
-    base = event_base_new(); // XXX RAII
-    if (!base) {
-        LogPrintf("Couldn't create an event_base: exiting\n");
-        return false;
+    int dispatchThreads = std::max((int)GetArg("-rpcdispatchthreads", DEFAULT_HTTP_DISPATCH_THREADS), 1);
+#if !defined(SO_REUSEPORT) || defined(WIN32)
+    if (dispatchThreads > 1) {
+        LogPrintf("HTTP: SO_REUSEPORT is not supported on this platform, using a single dispatch thread\n");
+        dispatchThreads = 1;
     }
+#endif
+    fHTTPKeepAlive = GetBoolArg("-rpckeepalive", DEFAULT_HTTP_KEEPALIVE);
 
-    /* Create a new evhttp object to handle requests. */
-    http = evhttp_new(base); // XXX RAII
-    if (!http) {
-        LogPrintf("couldn't create evhttp. Exiting.\n");
-        event_base_free(base);
-        return false;
-    }
+    for (int n = 0; n < dispatchThreads; n++) {
+        HTTPEventLoop* loop = new HTTPEventLoop();
+        eventLoops.push_back(loop);
 
-    evhttp_set_timeout(http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
-    evhttp_set_max_headers_size(http, MAX_HEADERS_SIZE);
-    evhttp_set_max_body_size(http, MAX_SIZE);
-    evhttp_set_gencb(http, http_request_cb, NULL);
+        loop->base = event_base_new(); // XXX RAII
+        if (!loop->base) {
+            LogPrintf("Couldn't create an event_base: exiting\n");
+            StopHTTPServer();
+            return false;
+        }
 
-    if (!HTTPBindAddresses(http)) {
-        LogPrintf("Unable to bind any endpoint for RPC server\n");
-        evhttp_free(http);
-        event_base_free(base);
-        return false;
+        /* Create a new evhttp object to handle requests. */
+        loop->http = evhttp_new(loop->base); // XXX RAII
+        if (!loop->http) {
+            LogPrintf("couldn't create evhttp. Exiting.\n");
+            StopHTTPServer();
+            return false;
+        }
+
+        evhttp_set_timeout(loop->http, GetArg("-rpcservertimeout", DEFAULT_HTTP_SERVER_TIMEOUT));
+        evhttp_set_max_headers_size(loop->http, MAX_HEADERS_SIZE);
+        evhttp_set_max_body_size(loop->http, MAX_SIZE);
+        evhttp_set_gencb(loop->http, http_request_cb, NULL);
+
+        if (!HTTPBindAddresses(loop, dispatchThreads > 1)) {
+            LogPrintf("Unable to bind any endpoint for RPC server\n");
+            StopHTTPServer();
+            return false;
+        }
     }
 
-    LogPrint("http", "Initialized HTTP server\n");
+    LogPrint("http", "Initialized HTTP server with %d dispatch threads\n", dispatchThreads);
     int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
+    LogPrintf("HTTP: creating work queues of depth %d\n", workQueueDepth);
 
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
-    eventBase = base;
-    eventHTTP = http;
+    for (int n = 0; n < HTTP_QUEUE_MAX; n++)
+        workQueues[n] = new WorkQueue<HTTPClosure>(workQueueNames[n], workQueueDepth);
     return true;
 }
 
-boost::thread threadHTTP;
-
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
-    threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
+    int rpcThreads[HTTP_QUEUE_MAX];
+    rpcThreads[HTTP_QUEUE_FAST] = std::max((long)GetArg("-rpcfastthreads", DEFAULT_HTTP_FAST_THREADS), 1L);
+    rpcThreads[HTTP_QUEUE_HEAVY] = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    LogPrintf("HTTP: starting %d fast and %d heavy worker threads\n", rpcThreads[HTTP_QUEUE_FAST], rpcThreads[HTTP_QUEUE_HEAVY]);
+    BOOST_FOREACH(HTTPEventLoop* loop, eventLoops)
+        loop->thread = boost::thread(boost::bind(&ThreadHTTP, loop->base, loop->http));
 
-    for (int i = 0; i < rpcThreads; i++)
-        boost::thread(boost::bind(&HTTPWorkQueueRun, workQueue));
+    for (int n = 0; n < HTTP_QUEUE_MAX; n++)
+        for (int i = 0; i < rpcThreads[n]; i++)
+            boost::thread(boost::bind(&HTTPWorkQueueRun, workQueues[n]));
     return true;
 }
 
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
-    if (eventHTTP) {
+    BOOST_FOREACH(HTTPEventLoop* loop, eventLoops) {
+        if (!loop->http)
+            continue;
         // Unlisten sockets
-        BOOST_FOREACH (evhttp_bound_socket *socket, boundSockets) {
-            evhttp_del_accept_socket(eventHTTP, socket);
+        BOOST_FOREACH (evhttp_bound_socket *socket, loop->boundSockets) {
+            evhttp_del_accept_socket(loop->http, socket);
         }
+        loop->boundSockets.clear();
         // Reject requests on current connections
-        evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
+        evhttp_set_gencb(loop->http, http_reject_request_cb, NULL);
     }
-    if (workQueue)
-        workQueue->Interrupt();
+    for (int n = 0; n < HTTP_QUEUE_MAX; n++)
+        if (workQueues[n])
+            workQueues[n]->Interrupt();
 }
 
 void StopHTTPServer()
 {
     LogPrint("http", "Stopping HTTP server\n");
-    if (workQueue) {
-        LogPrint("http", "Waiting for HTTP worker threads to exit\n");
+    for (int n = 0; n < HTTP_QUEUE_MAX; n++) {
+        if (!workQueues[n])
+            continue;
+        LogPrint("http", "Waiting for HTTP %s worker threads to exit\n", workQueueNames[n]);
 #ifndef WIN32
         // ToDo: Disabling WaitExit() for Windows platforms is an ugly workaround for the wallet not
         // closing during a repair-restart. It doesn't hurt, though, because threadHTTP.timed_join
         // below takes care of this and sends a loopbreak.
-        workQueue->WaitExit();
+        workQueues[n]->WaitExit();
 #endif        
-        delete workQueue;
-    }
-    if (eventBase) {
-        LogPrint("http", "Waiting for HTTP event thread to exit\n");
-        // Give event loop a few seconds to exit (to send back last RPC responses), then break it
-        // Before this was solved with event_base_loopexit, but that didn't work as expected in
-        // at least libevent 2.0.21 and always introduced a delay. In libevent
-        // master that appears to be solved, so in the future that solution
-        // could be used again (if desirable).
-        // (see discussion in https://github.com/bitcoin/bitcoin/pull/6990)
+        delete workQueues[n];
+        workQueues[n] = 0;
+    }
+    BOOST_FOREACH(HTTPEventLoop* loop, eventLoops) {
+        if (loop->base && loop->thread.joinable()) {
+            LogPrint("http", "Waiting for HTTP event thread to exit\n");
+            // Give event loop a few seconds to exit (to send back last RPC responses), then break it
+            // Before this was solved with event_base_loopexit, but that didn't work as expected in
+            // at least libevent 2.0.21 and always introduced a delay. In libevent
+            // master that appears to be solved, so in the future that solution
+            // could be used again (if desirable).
+            // (see discussion in https://github.com/bitcoin/bitcoin/pull/6990)
 #if BOOST_VERSION >= 105000
-        if (!threadHTTP.try_join_for(boost::chrono::milliseconds(2000))) {
+            if (!loop->thread.try_join_for(boost::chrono::milliseconds(2000))) {
 #else
-        if (!threadHTTP.timed_join(boost::posix_time::milliseconds(2000))) {
+            if (!loop->thread.timed_join(boost::posix_time::milliseconds(2000))) {
 #endif
 
-            LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
-            event_base_loopbreak(eventBase);
-            threadHTTP.join();
+                LogPrintf("HTTP event loop did not exit within allotted time, sending loopbreak\n");
+                event_base_loopbreak(loop->base);
+                loop->thread.join();
+            }
         }
+        FreeHTTPEventLoop(loop);
     }
-    if (eventHTTP) {
-        evhttp_free(eventHTTP);
-        eventHTTP = 0;
-    }
-    if (eventBase) {
-        event_base_free(eventBase);
-        eventBase = 0;
-    }
+    eventLoops.clear();
     LogPrint("http", "Stopped HTTP server\n");
 }
 
+bool QueueHTTPWork(const boost::function<void(void)>& func)
+{
+    if (!workQueues[HTTP_QUEUE_HEAVY])
+        return false;
+    std::unique_ptr<HTTPCallbackItem> item(new HTTPCallbackItem(func));
+    if (!workQueues[HTTP_QUEUE_HEAVY]->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
+std::vector<HTTPWorkQueueStats> GetHTTPWorkQueueStats()
+{
+    std::vector<HTTPWorkQueueStats> vStats;
+    for (int n = 0; n < HTTP_QUEUE_MAX; n++)
+        if (workQueues[n])
+            vStats.push_back(workQueues[n]->GetStats());
+    return vStats;
+}
+
 struct event_base* EventBase()
 {
-    return eventBase;
+    return eventLoops.empty() ? 0 : eventLoops.front()->base;
 }
 
 static void httpevent_callback_fn(evutil_socket_t, short, void* data)
@@ -547,12 +708,18 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
-                                                       replySent(false)
+                                                       base(evhttp_connection_get_base(evhttp_request_get_connection(req))),
+                                                       replySent(false),
+                                                       replyStarted(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (replyStarted && !replySent) {
+        // Too late for an error status, end the reply with what was sent
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        WriteReplyEnd();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -591,6 +758,18 @@ std::string HTTPRequest::ReadBody()
     return rv;
 }
 
+std::string HTTPRequest::PeekBody(size_t nMaxSize)
+{
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return "";
+    size_t size = std::min(evbuffer_get_length(buf), nMaxSize);
+    std::string rv(size, '\0');
+    if (size > 0 && evbuffer_copyout(buf, &rv[0], size) != (ev_ssize_t)size)
+        return "";
+    return rv;
+}
+
 void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 {
     struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
@@ -605,18 +784,199 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  */
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
-    assert(!replySent && req);
+    assert(!replySent && !replyStarted && req);
     // Send event to main http thread to send reply message
     struct evbuffer* evb = evhttp_request_get_output_buffer(req);
     assert(evb);
     evbuffer_add(evb, strReply.data(), strReply.size());
-    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+    HTTPEvent* ev = new HTTPEvent(base, true,
         boost::bind(evhttp_send_reply, req, nStatus, (const char*)NULL, (struct evbuffer *)NULL));
     ev->trigger(0);
     replySent = true;
     req = 0; // transferred back to main thread
 }
 
+/** State of a chunked reply, shared between the worker thread writing it and
+ * the http thread sending it.
+ * Chunks are handed to the http thread in their own buffers, so the request's
+ * buffers are only ever touched by that thread once the reply started. Events
+ * are run in the order they were triggered, which keeps the chunks in order.
+ */
+struct HTTPChunkedReply
+{
+    //! only used on the http thread, NULL once libevent freed the request
+    struct evhttp_request* req;
+
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    bool fClosed;
+    int nChunksQueued;
+    int nChunksSent;
+    int nChunksWritten;
+
+    HTTPChunkedReply(struct evhttp_request* req) : req(req), fClosed(false),
+                                                   nChunksQueued(0), nChunksSent(0), nChunksWritten(0) {}
+};
+
+static void http_reply_set_closed(HTTPChunkedReply* reply)
+{
+    boost::lock_guard<boost::mutex> lock(reply->cs);
+    reply->fClosed = true;
+    reply->cond.notify_all();
+}
+
+/** The connection went away, a stalled client ends up here once -rpcservertimeout passed */
+static void http_reply_closed_cb(struct evhttp_connection* evcon, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    // A request still attached to the connection is freed with it. A detached
+    // one is ours, evhttp_send_reply_end frees it.
+    if (evhttp_request_get_connection(reply->req) == evcon)
+        reply->req = NULL;
+    http_reply_set_closed(reply);
+}
+
+/** Everything handed to libevent so far has left the output buffer */
+static void http_reply_written_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    boost::lock_guard<boost::mutex> lock(reply->cs);
+    reply->nChunksWritten = reply->nChunksSent;
+    reply->cond.notify_all();
+}
+
+static void http_send_reply_start(boost::shared_ptr<HTTPChunkedReply> reply, int nStatus)
+{
+    struct evhttp_connection* evcon = evhttp_request_get_connection(reply->req);
+    if (!evcon) {
+        http_reply_set_closed(reply.get());
+        return;
+    }
+    evhttp_connection_set_closecb(evcon, http_reply_closed_cb, reply.get());
+    evhttp_send_reply_start(reply->req, nStatus, NULL);
+}
+
+static void http_send_reply_chunk(boost::shared_ptr<HTTPChunkedReply> reply, struct evbuffer* chunk)
+{
+    if (reply->req && evhttp_request_get_connection(reply->req)) {
+        {
+            boost::lock_guard<boost::mutex> lock(reply->cs);
+            reply->nChunksSent++;
+        }
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        evhttp_send_reply_chunk_with_cb(reply->req, chunk, http_reply_written_cb, reply.get());
+#else
+        evhttp_send_reply_chunk(reply->req, chunk);
+        http_reply_written_cb(NULL, reply.get());
+#endif
+    }
+    evbuffer_free(chunk);
+}
+
+static void http_send_reply_end(boost::shared_ptr<HTTPChunkedReply> reply)
+{
+    if (!reply->req)
+        return;
+    struct evhttp_connection* evcon = evhttp_request_get_connection(reply->req);
+    if (evcon)
+        evhttp_connection_set_closecb(evcon, NULL, NULL);
+    evhttp_send_reply_end(reply->req);
+}
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && !replyStarted && req);
+    chunkedReply.reset(new HTTPChunkedReply(req));
+    HTTPEvent* ev = new HTTPEvent(base, true,
+        boost::bind(http_send_reply_start, chunkedReply, nStatus));
+    ev->trigger(0);
+    replyStarted = true;
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(!replySent && replyStarted && req);
+    {
+        boost::unique_lock<boost::mutex> lock(chunkedReply->cs);
+        while (!chunkedReply->fClosed &&
+               chunkedReply->nChunksQueued - chunkedReply->nChunksWritten >= HTTP_REPLY_MAX_CHUNKS_IN_FLIGHT)
+            chunkedReply->cond.wait(lock);
+        if (chunkedReply->fClosed)
+            return false;
+        if (strChunk.empty())
+            return true; // an empty chunk would end the reply
+        chunkedReply->nChunksQueued++;
+    }
+    struct evbuffer* chunk = evbuffer_new();
+    assert(chunk);
+    evbuffer_add(chunk, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(base, true,
+        boost::bind(http_send_reply_chunk, chunkedReply, chunk));
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(!replySent && replyStarted && req);
+    HTTPEvent* ev = new HTTPEvent(base, true,
+        boost::bind(http_send_reply_end, chunkedReply));
+    ev->trigger(0);
+    chunkedReply.reset();
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+HTTPReplyWriter::HTTPReplyWriter(HTTPRequest* reqIn, int nStatusIn) : req(reqIn),
+                                                                      nStatus(nStatusIn),
+                                                                      strPending(),
+                                                                      fStarted(false),
+                                                                      fClosed(false)
+{
+}
+
+bool HTTPReplyWriter::write(const std::string& s)
+{
+    if (fClosed)
+        return false;
+    strPending += s;
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+    if (strPending.size() < HTTP_REPLY_CHUNK_SIZE)
+        return true;
+    if (!fStarted) {
+        req->WriteReplyStart(nStatus);
+        fStarted = true;
+    }
+    fClosed = !req->WriteReplyChunk(strPending);
+    strPending.clear();
+    return !fClosed;
+#else
+    // Without a write callback a slow client cannot hold back the chunks, send the reply in one piece
+    return true;
+#endif
+}
+
+bool HTTPReplyWriter::IsChunked()
+{
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+    return true;
+#else
+    return false;
+#endif
+}
+
+void HTTPReplyWriter::finish()
+{
+    if (!fStarted) {
+        req->WriteReply(nStatus, strPending);
+        return;
+    }
+    if (!fClosed)
+        req->WriteReplyChunk(strPending);
+    req->WriteReplyEnd();
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -657,10 +1017,11 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         const HTTPRequestClassifier &classifier)
 {
     LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, classifier));
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
@@ -6,16 +6,28 @@
 #define BITCOIN_HTTPSERVER_H
 
 #include <string>
+#include <vector>
 #include <stdint.h>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
 
+#include "rpc/protocol.h"
+
 static const int DEFAULT_HTTP_THREADS=4;
+static const int DEFAULT_HTTP_FAST_THREADS=2;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
+static const int DEFAULT_HTTP_DISPATCH_THREADS=1;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+static const bool DEFAULT_HTTP_KEEPALIVE=true;
+/** Replies up to this size are sent in one piece, larger ones with chunked transfer encoding */
+static const size_t HTTP_REPLY_CHUNK_SIZE=65536;
+/** Chunks of a reply that may wait in memory for the client to read them */
+static const int HTTP_REPLY_MAX_CHUNKS_IN_FLIGHT=4;
 
 struct evhttp_request;
+struct HTTPChunkedReply;
 struct event_base;
 class CService;
 class HTTPRequest;
@@ -34,18 +46,55 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** Work queues with their own worker threads, so cheap requests never wait behind heavy ones */
+enum HTTPWorkQueueClass
+{
+    HTTP_QUEUE_FAST,
+    HTTP_QUEUE_HEAVY,
+    HTTP_QUEUE_MAX
+};
+
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<void(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
+/** Picks the work queue for a request. This runs on the event thread, so it must be cheap */
+typedef boost::function<HTTPWorkQueueClass(HTTPRequest* req, const std::string &)> HTTPRequestClassifier;
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
- * be invoked.
+ * be invoked. Requests go to the heavy queue unless a classifier says otherwise.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler,
+                         const HTTPRequestClassifier &classifier = HTTPRequestClassifier());
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
-/** Return evhttp event base. This can be used by submodules to
- * queue timers or custom events.
+/** Run func on one of the heavy queue's worker threads.
+ * Returns false if the work queue is full or the server is not running.
+ */
+bool QueueHTTPWork(const boost::function<void(void)>& func);
+
+/** Counters of one work queue, times are in microseconds */
+struct HTTPWorkQueueStats
+{
+    std::string strName;
+    int nThreads;
+    size_t nDepth;
+    size_t nMaxDepth;
+    uint64_t nProcessed;
+    uint64_t nRejected;
+    int64_t nTotalWaitTime;
+    int64_t nMaxWaitTime;
+    int64_t nTotalRunTime;
+    int64_t nMaxRunTime;
+
+    HTTPWorkQueueStats() : nThreads(0), nDepth(0), nMaxDepth(0), nProcessed(0), nRejected(0),
+                           nTotalWaitTime(0), nMaxWaitTime(0), nTotalRunTime(0), nMaxRunTime(0) {}
+};
+
+/** Return the counters of all work queues, empty if the server is not running */
+std::vector<HTTPWorkQueueStats> GetHTTPWorkQueueStats();
+
+/** Return evhttp event base of the first dispatch thread. This can be used
+ * by submodules to queue timers or custom events.
  */
 struct event_base* EventBase();
 
@@ -56,7 +105,12 @@ class HTTPRequest
 {
 private:
     struct evhttp_request* req;
+    //! event loop of the connection, replies must be sent from there
+    struct event_base* base;
     bool replySent;
+    bool replyStarted;
+    //! shared with the event loop while a chunked reply is sent
+    boost::shared_ptr<HTTPChunkedReply> chunkedReply;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -96,6 +150,9 @@ public:
      */
     std::string ReadBody();
 
+    /** Return up to nMaxSize bytes of the request body without consuming it */
+    std::string PeekBody(size_t nMaxSize);
+
     /**
      * Write output header.
      *
@@ -112,6 +169,48 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a chunked HTTP reply, send the body with WriteReplyChunk and
+     * finish it with WriteReplyEnd. Headers must be written before.
+     *
+     * WriteReplyChunk blocks while HTTP_REPLY_MAX_CHUNKS_IN_FLIGHT chunks wait
+     * for the client to read them. It returns false once the connection is
+     * closed, the rest of the reply is dropped then.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods
+     * after calling WriteReplyEnd.
+     */
+    void WriteReplyStart(int nStatus);
+    bool WriteReplyChunk(const std::string& strChunk);
+    void WriteReplyEnd();
+};
+
+/** Writes a reply as it is produced, e.g. by JSONWrite.
+ * Nothing is sent until HTTP_REPLY_CHUNK_SIZE bytes are pending, so small
+ * replies still go out as one plain reply from finish(). write() returns
+ * false once the client went away.
+ */
+class HTTPReplyWriter : public JSONWriteSink
+{
+private:
+    HTTPRequest* req;
+    int nStatus;
+    std::string strPending;
+    bool fStarted;
+    bool fClosed;
+
+public:
+    HTTPReplyWriter(HTTPRequest* req, int nStatus);
+
+    bool write(const std::string& s);
+
+    /** Send what is still pending and complete the reply */
+    void finish();
+
+    /** Whether replies go out in chunks, without chunked replies (libevent
+     * older than 2.1.1) the whole reply is held in memory until finish() */
+    static bool IsChunked();
 };
 
 /** Event handler closure.
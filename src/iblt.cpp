@@ -0,0 +1,119 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "iblt.h"
+#include "hash.h"
+
+CIblt::CIblt(unsigned int nCells, uint64_t nSaltIn) :
+    nSalt(nSaltIn),
+    vCells(((nCells + IBLT_HASH_FUNCS - 1) / IBLT_HASH_FUNCS) * IBLT_HASH_FUNCS)
+{}
+
+size_t CIblt::GetCellIndex(unsigned int nHashNum, const H256& hash) const
+{
+    // one cell per partition, so a hash never lands in the same cell twice
+    size_t nPartitionSize = vCells.size() / IBLT_HASH_FUNCS;
+    return nHashNum * nPartitionSize + SipHashUint256(nSalt, nHashNum, hash) % nPartitionSize;
+}
+
+uint32_t CIblt::GetCheckSum(const H256& hash) const
+{
+    return (uint32_t)SipHashUint256(nSalt, IBLT_HASH_FUNCS, hash);
+}
+
+void CIblt::Update(const H256& hash, int32_t nDelta)
+{
+    if(vCells.empty()) return;
+
+    uint32_t nCheckSum = GetCheckSum(hash);
+    for(unsigned int i = 0; i < IBLT_HASH_FUNCS; i++) {
+        cell_t& cell = vCells[GetCellIndex(i, hash)];
+        cell.nCount += nDelta;
+        for(unsigned int j = 0; j < hash.size(); j++) {
+            cell.hashSum.begin()[j] ^= hash.begin()[j];
+        }
+        cell.nCheckSum ^= nCheckSum;
+    }
+}
+
+bool CIblt::Subtract(const CIblt& other)
+{
+    if(nSalt != other.nSalt || vCells.size() != other.vCells.size()) return false;
+
+    for(size_t i = 0; i < vCells.size(); i++) {
+        cell_t& cell = vCells[i];
+        const cell_t& cellOther = other.vCells[i];
+        cell.nCount -= cellOther.nCount;
+        for(unsigned int j = 0; j < cell.hashSum.size(); j++) {
+            cell.hashSum.begin()[j] ^= cellOther.hashSum.begin()[j];
+        }
+        cell.nCheckSum ^= cellOther.nCheckSum;
+    }
+    return true;
+}
+
+bool CIblt::ListEntries(std::set<H256>& setPositiveRet, std::set<H256>& setNegativeRet) const
+{
+    CIblt peeled(*this);
+
+    // peel off "pure" cells (holding a single hash) until no more are found
+    bool fFound = true;
+    while(fFound) {
+        fFound = false;
+        for(size_t i = 0; i < peeled.vCells.size(); i++) {
+            const cell_t& cell = peeled.vCells[i];
+            if(cell.nCount != 1 && cell.nCount != -1) continue;
+            if(cell.nCheckSum != GetCheckSum(cell.hashSum)) continue;
+
+            H256 hash = cell.hashSum;
+            if(cell.nCount == 1) {
+                if(!setPositiveRet.insert(hash).second) return false;
+                peeled.Update(hash, -1);
+            } else {
+                if(!setNegativeRet.insert(hash).second) return false;
+                peeled.Update(hash, 1);
+            }
+            fFound = true;
+        }
+    }
+
+    for(size_t i = 0; i < peeled.vCells.size(); i++) {
+        if(!peeled.vCells[i].IsEmpty()) return false;
+    }
+    return true;
+}
+
+bool CIblt::IsValid() const
+{
+    return !vCells.empty() && vCells.size() <= MAX_IBLT_CELLS && vCells.size() % IBLT_HASH_FUNCS == 0;
+}
+
+void CIbltSet::Insert(const H256& hash)
+{
+    for(std::map<unsigned int, CIblt>::iterator it = mapTables.begin(); it != mapTables.end(); ++it) {
+        it->second.Insert(hash);
+    }
+}
+
+void CIbltSet::Erase(const H256& hash)
+{
+    for(std::map<unsigned int, CIblt>::iterator it = mapTables.begin(); it != mapTables.end(); ++it) {
+        it->second.Erase(hash);
+    }
+}
+
+const CIblt* CIbltSet::Get(unsigned int nCells, uint64_t nSalt) const
+{
+    std::map<unsigned int, CIblt>::const_iterator it = mapTables.find(nCells);
+    if(it == mapTables.end() || it->second.GetSalt() != nSalt) return NULL;
+    return &it->second;
+}
+
+CIblt& CIbltSet::Create(unsigned int nCells, uint64_t nSalt)
+{
+    CIblt table(nCells, nSalt);
+    CIblt& tableRet = mapTables[table.GetCellCount()];
+    tableRet = table;
+    return tableRet;
+}
@@ -0,0 +1,116 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef IBLT_H
+#define IBLT_H
+
+#include "serialize.h"
+#include "crypto/hash.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+//! 40 bytes per cell, ~160KB at most
+static const unsigned int MAX_IBLT_CELLS = 4095;
+
+/**
+ * Invertible bloom lookup table over 256-bit hashes.
+ *
+ * Each hash is added to one cell in each of IBLT_HASH_FUNCS partitions of the
+ * table. Subtracting the table of another set cancels out the hashes both sets
+ * have in common, what is left can be listed as long as the number of
+ * differences is small compared to the number of cells (roughly 2/3 of it).
+ * This lets two peers find the hashes only one of them has while exchanging
+ * an amount of data proportional to the difference, not to the set size.
+ */
+class CIblt
+{
+public:
+    static const unsigned int IBLT_HASH_FUNCS = 3;
+
+    struct cell_t {
+        int32_t nCount;
+        H256 hashSum;
+        uint32_t nCheckSum;
+
+        cell_t() : nCount(0), hashSum(), nCheckSum(0) {}
+
+        bool IsEmpty() const { return nCount == 0 && hashSum.IsNull() && nCheckSum == 0; }
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+            READWRITE(nCount);
+            READWRITE(hashSum);
+            READWRITE(nCheckSum);
+        }
+    };
+
+private:
+    uint64_t nSalt;
+    std::vector<cell_t> vCells;
+
+    size_t GetCellIndex(unsigned int nHashNum, const H256& hash) const;
+    uint32_t GetCheckSum(const H256& hash) const;
+    void Update(const H256& hash, int32_t nDelta);
+
+public:
+    CIblt() : nSalt(0), vCells() {}
+    /// nCells is rounded up to a multiple of IBLT_HASH_FUNCS
+    CIblt(unsigned int nCells, uint64_t nSaltIn);
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nSalt);
+        READWRITE(vCells);
+    }
+
+    void Insert(const H256& hash) { Update(hash, 1); }
+    void Erase(const H256& hash) { Update(hash, -1); }
+
+    /// Remove the hashes of other (built with the same size and salt) from this table
+    bool Subtract(const CIblt& other);
+
+    /**
+     * List the hashes left in the table: setPositiveRet gets the hashes only
+     * inserted into this table, setNegativeRet the ones only in the table that
+     * was subtracted. Returns false if the table could not be fully decoded.
+     */
+    bool ListEntries(std::set<H256>& setPositiveRet, std::set<H256>& setNegativeRet) const;
+
+    /// Empty tables and tables received from peers with an unusable size are not valid
+    bool IsValid() const;
+
+    unsigned int GetCellCount() const { return vCells.size(); }
+    uint64_t GetSalt() const { return nSalt; }
+};
+
+/**
+ * Tables of one set of hashes at several sizes, kept up to date as hashes are
+ * inserted and erased, so a table can be handed out without walking the set.
+ * The owner creates a size's table on first use and fills it with the set.
+ */
+class CIbltSet
+{
+private:
+    // by cell count
+    std::map<unsigned int, CIblt> mapTables;
+
+public:
+    void Insert(const H256& hash);
+    void Erase(const H256& hash);
+
+    /// Table with nCells cells and salt nSalt, NULL if it was not created yet
+    const CIblt* Get(unsigned int nCells, uint64_t nSalt) const;
+    /// Add an empty table (replacing one of the same size), the caller inserts the set into it
+    CIblt& Create(unsigned int nCells, uint64_t nSalt);
+
+    void Clear() { mapTables.clear(); }
+};
+
+#endif
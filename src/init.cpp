@@ -30,6 +30,7 @@
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "sendercache.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "torcontrol.h"
@@ -48,11 +49,13 @@
 #include "dsnotificationinterface.h"
 #include "flat-database.h"
 #include "governance.h"
+#include "governance-db.h"
 #include "instantx.h"
 #ifdef ENABLE_WALLET
 #include "keepass.h"
 #endif
 #include "masternode-payments.h"
+#include "masternode-sigqueue.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
 #include "masternodeconfig.h"
@@ -96,9 +99,13 @@ bool fFeeEstimatesInitialized = false;
 bool fRestartRequested = false;  // true: restart false: shutdown
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
+static const bool DEFAULT_METRICS_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
 
+// Set by AppInit2 so Interrupt() can stop the threads servicing it
+static CScheduler* pscheduler = NULL;
+
 std::unique_ptr<CConnman> g_connman;
 std::unique_ptr<PeerLogicValidation> peerLogic;
 
@@ -199,9 +206,13 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptHTTPRPC();
     InterruptRPC();
     InterruptREST();
+    InterruptHTTPMetrics();
     InterruptTorControl();
     if (g_connman)
         g_connman->Interrupt();
+    // the scheduler threads wait on std primitives, thread interruption does not reach them
+    if (pscheduler)
+        pscheduler->stop();
     threadGroup.interrupt_all();
 }
 
@@ -224,6 +235,7 @@ void PrepareShutdown()
     mempool.AddTransactionsUpdated(1);
     StopHTTPRPC();
     StopREST();
+    StopHTTPMetrics();
     StopRPC();
     StopHTTPServer();
 #ifdef ENABLE_WALLET
@@ -239,8 +251,10 @@ void PrepareShutdown()
     // STORE DATA CACHES INTO SERIALIZED DAT FILES
     CFlatDB<CMasternodeMan> flatdb1("mncache.dat", "magicMasternodeCache");
     flatdb1.Dump(mnodeman);
+    // payment votes are journaled, only votes since the last append are written
     CFlatDB<CMasternodePayments> flatdb2("mnpayments.dat", "magicMasternodePaymentsCache");
-    flatdb2.Dump(mnpayments);
+    flatdb2.Append(mnpayments);
+    governance.FlushObjects();
     CFlatDB<CGovernanceManager> flatdb3("governance.dat", "magicGovernanceCache");
     flatdb3.Dump(governance);
     CFlatDB<CNetFulfilledRequestManager> flatdb4("netfulfilled.dat", "magicFulfilledCache");
@@ -272,6 +286,8 @@ void PrepareShutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete pgovernancedb;
+        pgovernancedb = NULL;
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -326,6 +342,7 @@ void Shutdown()
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    StopAsyncLogging();
 }
 
 /**
@@ -418,6 +435,7 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
+    strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf(_("Set the number of threads running background maintenance tasks (default: %d)"), DEFAULT_SCHEDULER_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -543,7 +561,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, "
+    string debugCategories = "addrman, alert, bench, cmpctblock, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, "
                              "ebakus (or specifically: privatesend, instantsend, masternode, spork, keepass, mnpayments, gobject)"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
@@ -556,14 +574,18 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), DEFAULT_LOGIPS));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), DEFAULT_LOGTIMESTAMPS));
+    strUsage += HelpMessageOpt("-logasync", strprintf(_("Write debug.log from a background thread (default: %u)"), DEFAULT_LOGASYNC));
+    strUsage += HelpMessageOpt("-logasyncoverflow=<policy>", _("What to do when a thread logs faster than debug.log is written with -logasync, <policy> can be: drop (count and report the lost lines), block (wait for the writer) (default: drop)"));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS));
         strUsage += HelpMessageOpt("-logthreadnames", strprintf("Add thread names to debug messages (default: %u)", DEFAULT_LOGTHREADNAMES));
+        strUsage += HelpMessageOpt("-logasyncbuffer=<n>", strprintf("Number of lines each thread can have waiting to be written with -logasync (1 to %u, default: %u)", MAX_LOGASYNC_BUFFER, DEFAULT_LOGASYNC_BUFFER));
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsendercachesize=<n>", strprintf("Limit size of recovered transaction sender cache to <n> MiB (default: %u)", DEFAULT_MAX_SENDER_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)));
@@ -585,6 +607,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mnconf=<file>", strprintf(_("Specify masternode configuration file (default: %s)"), "masternode.conf"));
     strUsage += HelpMessageOpt("-mnconflock=<n>", strprintf(_("Lock masternodes from masternode configuration file (default: %u)"), 1));
     strUsage += HelpMessageOpt("-masternodeprivkey=<n>", _("Set the masternode private key"));
+    strUsage += HelpMessageOpt("-mnverifythreads=<n>", strprintf(_("Set the number of masternode message signature verification threads, 0 verifies on the message handler thread (default: %d)"), DEFAULT_MASTERNODE_VERIFY_THREADS));
 
     strUsage += HelpMessageGroup(_("PrivateSend options:"));
     strUsage += HelpMessageOpt("-enableprivatesend=<n>", strprintf(_("Enable use of automated PrivateSend for funds stored in this wallet (0-1, default: %u)"), 0));
@@ -617,6 +640,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
+    strUsage += HelpMessageOpt("-metrics", strprintf(_("Serve performance metrics in the Prometheus format at /metrics on the RPC port, using the RPC credentials (default: %u)"), DEFAULT_METRICS_ENABLE));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpccookiefile=<loc>", _("Location of the auth cookie (default: data dir)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
@@ -624,9 +648,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcauth=<userpw>", _("Username and hashed password for JSON-RPC connections. The field <userpw> comes in the format: <USERNAME>:<SALT>$<HASH>. A canonical python script is included in share/rpcuser. This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), BaseParams(CBaseChainParams::MAIN).RPCPort(), BaseParams(CBaseChainParams::TESTNET).RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Set the maximum number of threads executing the calls of one batch request of read-only lookups, other batches and 1 execute them in order (default: %d)"), DEFAULT_RPC_BATCH_THREADS));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcfastthreads=<n>", strprintf(_("Set the number of threads to service cheap RPC calls, which never wait behind other calls (default: %d)"), DEFAULT_HTTP_FAST_THREADS));
+    strUsage += HelpMessageOpt("-rpcfastmethod=<method>", _("Service calls to this RPC method with the cheap call threads. This option can be specified multiple times"));
     if (showDebug) {
-        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queues to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcdispatchthreads=<n>", strprintf("Set the number of threads accepting HTTP connections, more than one needs SO_REUSEPORT (default: %d)", DEFAULT_HTTP_DISPATCH_THREADS));
+        strUsage += HelpMessageOpt("-rpckeepalive", strprintf("Keep HTTP connections open between requests (default: %u)", DEFAULT_HTTP_KEEPALIVE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
@@ -648,6 +677,13 @@ std::string LicenseInfo()
            "\n";
 }
 
+/** Append new payment votes to the mnpayments.dat journal, compacting it when it has grown too large */
+static void FlushMasternodePayments()
+{
+    CFlatDB<CMasternodePayments> flatdb("mnpayments.dat", "magicMasternodePaymentsCache");
+    flatdb.Append(mnpayments);
+}
+
 static void BlockNotifyCallback(bool initialSync, const CBlockIndex *pBlockIndex)
 {
     if (initialSync || !pBlockIndex)
@@ -808,6 +844,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", DEFAULT_REST_ENABLE) && !StartREST())
         return false;
+    if (GetBoolArg("-metrics", DEFAULT_METRICS_ENABLE) && !StartHTTPMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -1021,7 +1059,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+#ifndef USE_POLL
+    // select() can only wait on descriptors below FD_SETSIZE; poll() and epoll
+    // are only bounded by the process descriptor limit below
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS), 0);
+#endif
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1249,6 +1291,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (fPrintToDebugLog)
         OpenDebugLog();
 
+    if (GetBoolArg("-logasync", DEFAULT_LOGASYNC)) {
+        std::string strOverflow = GetArg("-logasyncoverflow", "drop");
+        if (strOverflow != "drop" && strOverflow != "block")
+            return InitError(strprintf(_("Unknown -logasyncoverflow policy: '%s'"), strOverflow));
+        int64_t nBufferLines = GetArg("-logasyncbuffer", DEFAULT_LOGASYNC_BUFFER);
+        nBufferLines = std::min(std::max(nBufferLines, (int64_t)1), (int64_t)MAX_LOGASYNC_BUFFER);
+        StartAsyncLogging(nBufferLines, strOverflow == "block");
+    }
+
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -1266,9 +1317,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("Unable to sign spork message, wrong key?"));
     }
 
-    // Start the lightweight task scheduler thread
+    // Masternode rank scoring shares the -par thread count
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread(&ThreadMasternodeScore);
+
+    // Start the lightweight task scheduler threads
+    pscheduler = &scheduler;
+    int nSchedulerThreads = std::max((int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS), 1);
+    LogPrintf("Using %d scheduler threads\n", nSchedulerThreads);
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1938,6 +1997,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     boost::filesystem::path pathDB = GetDataDir();
     std::string strDBName;
 
+    // governance objects and votes live in their own database, governance.dat only holds caches
+    delete pgovernancedb;
+    pgovernancedb = new CGovernanceDB(GOVERNANCE_DB_CACHE_SIZE);
+
     strDBName = "mncache.dat";
     uiInterface.InitMessage(_("Loading masternode cache..."));
     CFlatDB<CMasternodeMan> flatdb1(strDBName, "magicMasternodeCache");
@@ -1949,7 +2012,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         strDBName = "mnpayments.dat";
         uiInterface.InitMessage(_("Loading masternode payment cache..."));
         CFlatDB<CMasternodePayments> flatdb2(strDBName, "magicMasternodePaymentsCache");
-        if(!flatdb2.Load(mnpayments)) {
+        if(!flatdb2.LoadWithJournal(mnpayments)) {
             return InitError(_("Failed to load masternode payments cache from") + "\n" + (pathDB / strDBName).string());
         }
 
@@ -1982,13 +2045,21 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     masternodeSync.UpdatedBlockTip(chainActive.Tip(), IsInitialBlockDownload());
     governance.UpdatedBlockTip(chainActive.Tip());
 
-    // ********************************************************* Step 11d: start ebakus-ps-<smth> threads
+    if (!fLiteMode)
+        scheduler.scheduleEvery(&FlushMasternodePayments, MASTERNODE_PAYMENTS_FLUSH_INTERVAL, CScheduler::PRIORITY_LOW, "mnpayments-flush");
+
+    // ********************************************************* Step 11d: start ebakus-ps-<smth> threads and maintenance tasks
+
+    int nMasternodeVerifyThreads = GetArg("-mnverifythreads", DEFAULT_MASTERNODE_VERIFY_THREADS);
+    LogPrintf("Using %d threads for masternode signature verification\n", std::max(nMasternodeVerifyThreads, 0));
+    for (int i = 0; i < nMasternodeVerifyThreads; i++)
+        threadGroup.create_thread(boost::bind(&CMasternodeSigQueue::ThreadVerify, &mnsigqueue));
 
-    threadGroup.create_thread(boost::bind(&ThreadCheckPrivateSend));
+    ScheduleCheckPrivateSend(scheduler);
     if (fMasterNode)
-        threadGroup.create_thread(boost::bind(&ThreadCheckPrivateSendServer));
+        ScheduleCheckPrivateSendServer(scheduler);
     else
-        threadGroup.create_thread(boost::bind(&ThreadCheckPrivateSendClient, boost::ref(*g_connman)));
+        ScheduleCheckPrivateSendClient(scheduler, *g_connman);
 
     // ********************************************************* Step 12: start node
 
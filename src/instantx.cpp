@@ -6,10 +6,13 @@
 #include "instantx.h"
 #include "key.h"
 #include "validation.h"
+#include "masternode-sigqueue.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
 #include "messagesigner.h"
+#include "metrics.h"
 #include "net.h"
+#include "net_processing.h"
 #include "protocol.h"
 #include "spork.h"
 #include "sync.h"
@@ -52,28 +55,43 @@ void CInstantSend::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
 
     if (strCommand == NetMsgType::TXLOCKVOTE) // InstantSend Transaction Lock Consensus Votes
     {
+        static CMetricHistogram& metric = GetMessageHandlerMetric("instantsend", NetMsgType::TXLOCKVOTE);
+        CMetricTimer timer(metric);
         if(pfrom->nVersion < MIN_INSTANTSEND_PROTO_VERSION) return;
 
         CTxLockVote vote;
         vRecv >> vote;
 
-        LOCK(cs_main);
-#ifdef ENABLE_WALLET
-        if (pwalletMain)
-            LOCK(pwalletMain->cs_wallet);
-#endif
-        LOCK(cs_instantsend);
+        {
+            // drop votes we already have before they take a slot in the verification queue
+            LOCK(cs_instantsend);
+            if(mapTxLockVotes.count(vote.GetHash())) return;
+        }
 
+        // recover the signing key on a verification thread, the vote is applied in order afterwards
+        if(!mnsigqueue.PushTxLockVote(pfrom->GetId(), vote)) {
+            ProcessTxLockVoteMessage(pfrom, vote);
+        }
 
-        H256 nVoteHash = vote.GetHash();
+        return;
+    }
+}
 
-        if(mapTxLockVotes.count(nVoteHash)) return;
-        mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
+void CInstantSend::ProcessTxLockVoteMessage(CNode* pfrom, CTxLockVote& vote)
+{
+    LOCK(cs_main);
+#ifdef ENABLE_WALLET
+    if (pwalletMain)
+        LOCK(pwalletMain->cs_wallet);
+#endif
+    LOCK(cs_instantsend);
 
-        ProcessTxLockVote(pfrom, vote);
+    H256 nVoteHash = vote.GetHash();
 
-        return;
-    }
+    if(mapTxLockVotes.count(nVoteHash)) return;
+    mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
+
+    ProcessTxLockVote(pfrom, vote);
 }
 
 bool CInstantSend::ProcessTxLockRequest(const CTxLockRequest& txLockRequest)
@@ -118,6 +136,7 @@ bool CInstantSend::CreateTxLockCandidate(const CTxLockRequest& txLockRequest)
         CTxLockCandidate txLockCandidate(txLockRequest);
         // all inputs should already be checked by txLockRequest.IsValid() above, just use them now
         mapTxLockCandidates.insert(std::make_pair(txHash, txLockCandidate));
+        lockIndex.UpdateCandidate(txLockCandidate);
     } else {
         LogPrint("instantsend", "CInstantSend::CreateTxLockCandidate -- seen, txid=%s\n", txHash.ToString());
     }
@@ -145,7 +164,7 @@ void CInstantSend::Vote(CTxLockCandidate& txLockCandidate)
 
         int nLockInputHeight = nPrevoutHeight + 4;
 
-        int n = mnodeman.GetMasternodeRank(activeMasternode.vin, nLockInputHeight, MIN_INSTANTSEND_PROTO_VERSION);
+        int n = GetMasternodeRank(activeMasternode.vin.prevout, nLockInputHeight);
 
         if(n == -1) {
             LogPrint("instantsend", "CInstantSend::Vote -- Can't calculate rank for masternode %s\n", activeMasternode.vin.prevout.ToStringShort());
@@ -201,6 +220,7 @@ void CInstantSend::Vote(CTxLockCandidate& txLockCandidate)
         H256 nVoteHash = vote.GetHash();
         mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
         if(itOutpointLock->second.AddVote(vote)) {
+            lockIndex.UpdateCandidate(txLockCandidate);
             LogPrintf("CInstantSend::Vote -- Vote created successfully, relaying: txHash=%s, outpoint=%s, vote=%s\n",
                     txHash.ToString(), itOutpointLock->first.ToStringShort(), nVoteHash.ToString());
 
@@ -250,6 +270,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote)
     if(it == mapTxLockCandidates.end()) {
         if(!mapTxLockVotesOrphan.count(vote.GetHash())) {
             mapTxLockVotesOrphan[vote.GetHash()] = vote;
+            expiryTxLockVotesOrphan.Set(vote.GetHash(), vote.GetTimeCreated() + ORPHAN_VOTE_SECONDS + 1);
             LogPrint("instantsend", "CInstantSend::ProcessTxLockVote -- Orphan vote: txid=%s  masternode=%s new\n",
                     txHash.ToString(), vote.GetMasternodeOutpoint().ToStringShort());
             bool fReprocess = true;
@@ -279,6 +300,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote)
         int nMasternodeOrphanExpireTime = GetTime() + 60*10; // keep time data for 10 minutes
         if(!mapMasternodeOrphanVotes.count(vote.GetMasternodeOutpoint())) {
             mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()] = nMasternodeOrphanExpireTime;
+            expiryMasternodeOrphanVotes.Set(vote.GetMasternodeOutpoint(), nMasternodeOrphanExpireTime + 1);
         } else {
             int64_t nPrevOrphanVote = mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()];
             if(nPrevOrphanVote > GetTime() && nPrevOrphanVote > GetAverageMasternodeOrphanVoteTime()) {
@@ -289,6 +311,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote)
             }
             // not spamming, refresh
             mapMasternodeOrphanVotes[vote.GetMasternodeOutpoint()] = nMasternodeOrphanExpireTime;
+            expiryMasternodeOrphanVotes.Set(vote.GetMasternodeOutpoint(), nMasternodeOrphanExpireTime + 1);
         }
 
         return true;
@@ -329,6 +352,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote)
         // this should never happen
         return false;
     }
+    lockIndex.UpdateCandidate(txLockCandidate);
 
     int nSignatures = txLockCandidate.CountVotes();
     int nSignaturesMax = txLockCandidate.txLockRequest.GetMaxSignatures();
@@ -448,6 +472,7 @@ void CInstantSend::LockTransactionInputs(const CTxLockCandidate& txLockCandidate
 
     while(it != txLockCandidate.mapOutPointLocks.end()) {
         mapLockedOutpoints.insert(std::make_pair(it->first, txHash));
+        lockIndex.LockOutPoint(it->first, txHash);
         ++it;
     }
     LogPrint("instantsend", "CInstantSend::LockTransactionInputs -- done, txid=%s\n", txHash.ToString());
@@ -455,11 +480,8 @@ void CInstantSend::LockTransactionInputs(const CTxLockCandidate& txLockCandidate
 
 bool CInstantSend::GetLockedOutPointTxHash(const COutPoint& outpoint, H256& hashRet)
 {
-    LOCK(cs_instantsend);
-    std::map<COutPoint, H256>::iterator it = mapLockedOutpoints.find(outpoint);
-    if(it == mapLockedOutpoints.end()) return false;
-    hashRet = it->second;
-    return true;
+    // served by the lock index, no need for cs_instantsend
+    return lockIndex.GetLockedOutPointTxHash(outpoint, hashRet);
 }
 
 bool CInstantSend::ResolveConflicts(const CTxLockCandidate& txLockCandidate, int nMaxBlocks)
@@ -527,63 +549,59 @@ void CInstantSend::CheckAndRemove()
 
     LOCK(cs_instantsend);
 
-    std::map<H256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.begin();
+    // only visit expired entries, see CExpiryIndex
+    std::vector<H256> vecExpired;
 
     // remove expired candidates
-    while(itLockCandidate != mapTxLockCandidates.end()) {
+    expiryTxLockCandidates.PopExpired(nCachedBlockHeight, vecExpired);
+    BOOST_FOREACH(const H256& txHash, vecExpired) {
+        std::map<H256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+        if(itLockCandidate == mapTxLockCandidates.end()) continue;
         CTxLockCandidate &txLockCandidate = itLockCandidate->second;
-        H256 txHash = txLockCandidate.GetHash();
-        if(txLockCandidate.IsExpired(nCachedBlockHeight)) {
-            LogPrintf("CInstantSend::CheckAndRemove -- Removing expired Transaction Lock Candidate: txid=%s\n", txHash.ToString());
-            std::map<COutPoint, COutPointLock>::iterator itOutpointLock = txLockCandidate.mapOutPointLocks.begin();
-            while(itOutpointLock != txLockCandidate.mapOutPointLocks.end()) {
-                mapLockedOutpoints.erase(itOutpointLock->first);
-                mapVotedOutpoints.erase(itOutpointLock->first);
-                ++itOutpointLock;
-            }
-            mapLockRequestAccepted.erase(txHash);
-            mapLockRequestRejected.erase(txHash);
-            mapTxLockCandidates.erase(itLockCandidate++);
-        } else {
-            ++itLockCandidate;
+        LogPrintf("CInstantSend::CheckAndRemove -- Removing expired Transaction Lock Candidate: txid=%s\n", txHash.ToString());
+        std::map<COutPoint, COutPointLock>::iterator itOutpointLock = txLockCandidate.mapOutPointLocks.begin();
+        while(itOutpointLock != txLockCandidate.mapOutPointLocks.end()) {
+            mapLockedOutpoints.erase(itOutpointLock->first);
+            lockIndex.UnlockOutPoint(itOutpointLock->first);
+            mapVotedOutpoints.erase(itOutpointLock->first);
+            ++itOutpointLock;
         }
+        lockIndex.RemoveCandidate(txHash);
+        mapLockRequestAccepted.erase(txHash);
+        mapLockRequestRejected.erase(txHash);
+        mapTxLockCandidates.erase(itLockCandidate);
     }
 
     // remove expired votes
-    std::map<H256, CTxLockVote>::iterator itVote = mapTxLockVotes.begin();
-    while(itVote != mapTxLockVotes.end()) {
-        if(itVote->second.IsExpired(nCachedBlockHeight)) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired vote: txid=%s  masternode=%s\n",
-                    itVote->second.GetTxHash().ToString(), itVote->second.GetMasternodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itVote++);
-        } else {
-            ++itVote;
-        }
+    vecExpired.clear();
+    expiryTxLockVotes.PopExpired(nCachedBlockHeight, vecExpired);
+    BOOST_FOREACH(const H256& nVoteHash, vecExpired) {
+        std::map<H256, CTxLockVote>::iterator itVote = mapTxLockVotes.find(nVoteHash);
+        if(itVote == mapTxLockVotes.end()) continue;
+        LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired vote: txid=%s  masternode=%s\n",
+                itVote->second.GetTxHash().ToString(), itVote->second.GetMasternodeOutpoint().ToStringShort());
+        mapTxLockVotes.erase(itVote);
     }
 
     // remove expired orphan votes
-    std::map<H256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.begin();
-    while(itOrphanVote != mapTxLockVotesOrphan.end()) {
-        if(GetTime() - itOrphanVote->second.GetTimeCreated() > ORPHAN_VOTE_SECONDS) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired orphan vote: txid=%s  masternode=%s\n",
-                    itOrphanVote->second.GetTxHash().ToString(), itOrphanVote->second.GetMasternodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itOrphanVote->first);
-            mapTxLockVotesOrphan.erase(itOrphanVote++);
-        } else {
-            ++itOrphanVote;
-        }
+    vecExpired.clear();
+    expiryTxLockVotesOrphan.PopExpired(GetTime(), vecExpired);
+    BOOST_FOREACH(const H256& nVoteHash, vecExpired) {
+        std::map<H256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.find(nVoteHash);
+        if(itOrphanVote == mapTxLockVotesOrphan.end()) continue;
+        LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired orphan vote: txid=%s  masternode=%s\n",
+                itOrphanVote->second.GetTxHash().ToString(), itOrphanVote->second.GetMasternodeOutpoint().ToStringShort());
+        mapTxLockVotes.erase(nVoteHash);
+        mapTxLockVotesOrphan.erase(itOrphanVote);
     }
 
     // remove expired masternode orphan votes (DOS protection)
-    std::map<COutPoint, int64_t>::iterator itMasternodeOrphan = mapMasternodeOrphanVotes.begin();
-    while(itMasternodeOrphan != mapMasternodeOrphanVotes.end()) {
-        if(itMasternodeOrphan->second < GetTime()) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired orphan masternode vote: masternode=%s\n",
-                    itMasternodeOrphan->first.ToStringShort());
-            mapMasternodeOrphanVotes.erase(itMasternodeOrphan++);
-        } else {
-            ++itMasternodeOrphan;
-        }
+    std::vector<COutPoint> vecExpiredMasternodes;
+    expiryMasternodeOrphanVotes.PopExpired(GetTime(), vecExpiredMasternodes);
+    BOOST_FOREACH(const COutPoint& outpointMasternode, vecExpiredMasternodes) {
+        if(!mapMasternodeOrphanVotes.erase(outpointMasternode)) continue;
+        LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired orphan masternode vote: masternode=%s\n",
+                outpointMasternode.ToStringShort());
     }
     LogPrintf("CInstantSend::CheckAndRemove -- %s\n", ToString());
 }
@@ -636,6 +654,26 @@ bool CInstantSend::GetTxLockVote(const H256& hash, CTxLockVote& txLockVoteRet)
     return true;
 }
 
+int CInstantSend::GetMasternodeRank(const COutPoint& outpointMasternode, int nLockInputHeight)
+{
+    LOCK(cs_instantsend);
+
+    std::map<int, std::map<COutPoint, int> >::iterator it = mapMasternodeRanks.find(nLockInputHeight);
+    if(it == mapMasternodeRanks.end()) {
+        // votes for the same inputs all use the same ranks, walk the score order only once per block
+        std::map<COutPoint, int>& mapRanks = mapMasternodeRanks[nLockInputHeight];
+        std::vector<std::pair<int, CMasternode> > vecMasternodeRanks = mnodeman.GetMasternodeRanks(nLockInputHeight, MIN_INSTANTSEND_PROTO_VERSION);
+        for(size_t i = 0; i < vecMasternodeRanks.size(); i++) {
+            mapRanks.insert(std::make_pair(vecMasternodeRanks[i].second.vin.prevout, vecMasternodeRanks[i].first));
+        }
+        it = mapMasternodeRanks.find(nLockInputHeight);
+    }
+
+    std::map<COutPoint, int>::iterator itRank = it->second.find(outpointMasternode);
+    if(itRank == it->second.end()) return -1;
+    return itRank->second;
+}
+
 bool CInstantSend::IsInstantSendReadyToLock(const H256& txHash)
 {
     if(!fEnableInstantSend || fLargeWorkForkFound || fLargeWorkInvalidChainFound ||
@@ -653,24 +691,8 @@ bool CInstantSend::IsLockedInstantSendTransaction(const H256& txHash)
     if(!fEnableInstantSend || fLargeWorkForkFound || fLargeWorkInvalidChainFound ||
         !sporkManager.IsSporkActive(SPORK_2_INSTANTSEND_ENABLED)) return false;
 
-    LOCK(cs_instantsend);
-
-    // there must be a lock candidate
-    std::map<H256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
-    if(itLockCandidate == mapTxLockCandidates.end()) return false;
-
-    // which should have outpoints
-    if(itLockCandidate->second.mapOutPointLocks.empty()) return false;
-
-    // and all of these outputs must be included in mapLockedOutpoints with correct hash
-    std::map<COutPoint, COutPointLock>::iterator itOutpointLock = itLockCandidate->second.mapOutPointLocks.begin();
-    while(itOutpointLock != itLockCandidate->second.mapOutPointLocks.end()) {
-        H256 hashLocked;
-        if(!GetLockedOutPointTxHash(itOutpointLock->first, hashLocked) || hashLocked != txHash) return false;
-        ++itOutpointLock;
-    }
-
-    return true;
+    // served by the lock index, no need for cs_instantsend
+    return lockIndex.IsLocked(txHash);
 }
 
 int CInstantSend::GetTransactionLockSignatures(const H256& txHash)
@@ -679,14 +701,7 @@ int CInstantSend::GetTransactionLockSignatures(const H256& txHash)
     if(fLargeWorkForkFound || fLargeWorkInvalidChainFound) return -2;
     if(!sporkManager.IsSporkActive(SPORK_2_INSTANTSEND_ENABLED)) return -3;
 
-    LOCK(cs_instantsend);
-
-    std::map<H256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
-    if(itLockCandidate != mapTxLockCandidates.end()) {
-        return itLockCandidate->second.CountVotes();
-    }
-
-    return -1;
+    return lockIndex.GetSignatures(txHash);
 }
 
 int CInstantSend::GetConfirmations(const H256 &nTXHash)
@@ -722,6 +737,20 @@ void CInstantSend::Relay(const H256& txHash)
 void CInstantSend::UpdatedBlockTip(const CBlockIndex *pindex)
 {
     nCachedBlockHeight = pindex->nHeight;
+
+    // masternode states may have changed, ranks are rebuilt on demand
+    LOCK(cs_instantsend);
+    mapMasternodeRanks.clear();
+}
+
+// Locks and votes expire nInstantSendKeepLock blocks after the block corresponding tx was included into.
+static void UpdateHeightExpiry(CExpiryIndex<H256>& expiry, const H256& hash, int nConfirmedHeight)
+{
+    if(nConfirmedHeight == -1) {
+        expiry.Erase(hash);
+    } else {
+        expiry.Set(hash, nConfirmedHeight + Params().GetConsensus().nInstantSendKeepLock + 1);
+    }
 }
 
 void CInstantSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
@@ -757,6 +786,7 @@ void CInstantSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
         LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d lock candidate updated\n",
                 txHash.ToString(), nHeightNew);
         itLockCandidate->second.SetConfirmedHeight(nHeightNew);
+        UpdateHeightExpiry(expiryTxLockCandidates, txHash, nHeightNew);
         // Loop through outpoint locks
         std::map<COutPoint, COutPointLock>::iterator itOutpointLock = itLockCandidate->second.mapOutPointLocks.begin();
         while(itOutpointLock != itLockCandidate->second.mapOutPointLocks.end()) {
@@ -771,6 +801,7 @@ void CInstantSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
                 it = mapTxLockVotes.find(nVoteHash);
                 if(it != mapTxLockVotes.end()) {
                     it->second.SetConfirmedHeight(nHeightNew);
+                    UpdateHeightExpiry(expiryTxLockVotes, nVoteHash, nHeightNew);
                 }
                 ++itVote;
             }
@@ -785,6 +816,7 @@ void CInstantSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
             LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d vote %s updated\n",
                     txHash.ToString(), nHeightNew, itOrphanVote->first.ToString());
             mapTxLockVotes[itOrphanVote->first].SetConfirmedHeight(nHeightNew);
+            UpdateHeightExpiry(expiryTxLockVotes, itOrphanVote->first, nHeightNew);
         }
         ++itOrphanVote;
     }
@@ -865,7 +897,7 @@ bool CTxLockVote::IsValid(CNode* pnode) const
 
     int nLockInputHeight = nPrevoutHeight + 4;
 
-    int n = mnodeman.GetMasternodeRank(CTxIn(outpointMasternode), nLockInputHeight, MIN_INSTANTSEND_PROTO_VERSION);
+    int n = instantsend.GetMasternodeRank(outpointMasternode, nLockInputHeight);
 
     if(n == -1) {
         //can be caused by past versions trying to vote with an invalid protocol
@@ -898,10 +930,15 @@ H256 CTxLockVote::GetHash() const
     return ss.GetHash();
 }
 
+std::string CTxLockVote::GetSignatureMessage() const
+{
+    return txHash.ToString() + outpoint.ToStringShort();
+}
+
 bool CTxLockVote::CheckSignature() const
 {
     std::string strError;
-    std::string strMessage = txHash.ToString() + outpoint.ToStringShort();
+    std::string strMessage = GetSignatureMessage();
 
     masternode_info_t infoMn = mnodeman.GetMasternodeInfo(CTxIn(outpointMasternode));
 
@@ -921,7 +958,7 @@ bool CTxLockVote::CheckSignature() const
 bool CTxLockVote::Sign()
 {
     std::string strError;
-    std::string strMessage = txHash.ToString() + outpoint.ToStringShort();
+    std::string strMessage = GetSignatureMessage();
 
     if(!CMessageSigner::SignMessage(strMessage, vchMasternodeSignature, activeMasternode.keyMasternode)) {
         LogPrintf("CTxLockVote::Sign -- SignMessage() failed\n");
@@ -1047,3 +1084,89 @@ void CTxLockCandidate::Relay() const
         ++itOutpointLock;
     }
 }
+
+//
+// CInstantSendLockIndex
+//
+
+void CInstantSendLockIndex::UpdateCandidate(const CTxLockCandidate& txLockCandidate)
+{
+    std::vector<COutPoint> vecOutPoints;
+    std::map<COutPoint, COutPointLock>::const_iterator it = txLockCandidate.mapOutPointLocks.begin();
+    while(it != txLockCandidate.mapOutPointLocks.end()) {
+        vecOutPoints.push_back(it->first);
+        ++it;
+    }
+    int nSignatures = txLockCandidate.CountVotes();
+
+    H256 txHash = txLockCandidate.GetHash();
+    candidate_shard_t& shard = GetShard(txHash);
+    boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+    CCandidateStatus& status = shard.map[txHash];
+    status.vecOutPoints.swap(vecOutPoints);
+    status.nSignatures = nSignatures;
+}
+
+void CInstantSendLockIndex::RemoveCandidate(const H256& txHash)
+{
+    candidate_shard_t& shard = GetShard(txHash);
+    boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+    shard.map.erase(txHash);
+}
+
+void CInstantSendLockIndex::LockOutPoint(const COutPoint& outpoint, const H256& txHash)
+{
+    outpoint_shard_t& shard = GetShard(outpoint);
+    boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+    shard.map.insert(std::make_pair(outpoint, txHash));
+}
+
+void CInstantSendLockIndex::UnlockOutPoint(const COutPoint& outpoint)
+{
+    outpoint_shard_t& shard = GetShard(outpoint);
+    boost::unique_lock<boost::shared_mutex> lock(shard.cs);
+    shard.map.erase(outpoint);
+}
+
+bool CInstantSendLockIndex::GetLockedOutPointTxHash(const COutPoint& outpoint, H256& hashRet) const
+{
+    const outpoint_shard_t& shard = GetShard(outpoint);
+    boost::shared_lock<boost::shared_mutex> lock(shard.cs);
+    boost::unordered_map<COutPoint, H256, COutPointHasher>::const_iterator it = shard.map.find(outpoint);
+    if(it == shard.map.end()) return false;
+    hashRet = it->second;
+    return true;
+}
+
+bool CInstantSendLockIndex::IsLocked(const H256& txHash) const
+{
+    std::vector<COutPoint> vecOutPoints;
+    {
+        const candidate_shard_t& shard = GetShard(txHash);
+        boost::shared_lock<boost::shared_mutex> lock(shard.cs);
+        // there must be a lock candidate
+        boost::unordered_map<H256, CCandidateStatus, CTxHasher>::const_iterator it = shard.map.find(txHash);
+        if(it == shard.map.end()) return false;
+        vecOutPoints = it->second.vecOutPoints;
+    }
+
+    // which should have outpoints
+    if(vecOutPoints.empty()) return false;
+
+    // and all of these outputs must be locked with correct hash
+    BOOST_FOREACH(const COutPoint& outpoint, vecOutPoints) {
+        H256 hashLocked;
+        if(!GetLockedOutPointTxHash(outpoint, hashLocked) || hashLocked != txHash) return false;
+    }
+
+    return true;
+}
+
+int CInstantSendLockIndex::GetSignatures(const H256& txHash) const
+{
+    const candidate_shard_t& shard = GetShard(txHash);
+    boost::shared_lock<boost::shared_mutex> lock(shard.cs);
+    boost::unordered_map<H256, CCandidateStatus, CTxHasher>::const_iterator it = shard.map.find(txHash);
+    if(it == shard.map.end()) return -1;
+    return it->second.nSignatures;
+}
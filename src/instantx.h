@@ -5,9 +5,13 @@
 #define INSTANTX_H
 
 #include "chain.h"
+#include "expiryindex.h"
 #include "net.h"
 #include "primitives/transaction.h"
 
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_map.hpp>
+
 class CTxLockVote;
 class COutPointLock;
 class CTxLockRequest;
@@ -34,6 +38,62 @@ extern bool fEnableInstantSend;
 extern int nInstantSendDepth;
 extern int nCompleteTXLocks;
 
+/**
+ * Read side of the InstantSend lock state: the outpoints and vote count of
+ * every lock candidate and the outpoint locks. Entries are kept in hash
+ * sharded maps, each guarded by its own reader/writer lock that writers only
+ * hold for a single insert or erase, so lock status queries from the wallet,
+ * mempool and RPC never wait on cs_instantsend, cs_main or vote processing.
+ * CInstantSend updates it whenever the corresponding maps change.
+ */
+class CInstantSendLockIndex
+{
+private:
+    static const size_t SHARDS = 16;
+
+    struct CTxHasher {
+        size_t operator()(const H256& hash) const { return hash.GetCheapHash(); }
+    };
+    struct COutPointHasher {
+        size_t operator()(const COutPoint& outpoint) const { return outpoint.hash.GetCheapHash() ^ outpoint.n; }
+    };
+
+    struct CCandidateStatus {
+        std::vector<COutPoint> vecOutPoints;
+        int nSignatures;
+    };
+
+    template<typename K, typename V, typename Hasher>
+    struct CShard {
+        mutable boost::shared_mutex cs;
+        boost::unordered_map<K, V, Hasher> map;
+    };
+
+    typedef CShard<H256, CCandidateStatus, CTxHasher> candidate_shard_t;
+    typedef CShard<COutPoint, H256, COutPointHasher> outpoint_shard_t;
+
+    candidate_shard_t vCandidateShards[SHARDS];
+    outpoint_shard_t vOutPointShards[SHARDS];
+
+    candidate_shard_t& GetShard(const H256& txHash) { return vCandidateShards[CTxHasher()(txHash) % SHARDS]; }
+    const candidate_shard_t& GetShard(const H256& txHash) const { return vCandidateShards[CTxHasher()(txHash) % SHARDS]; }
+    outpoint_shard_t& GetShard(const COutPoint& outpoint) { return vOutPointShards[COutPointHasher()(outpoint) % SHARDS]; }
+    const outpoint_shard_t& GetShard(const COutPoint& outpoint) const { return vOutPointShards[COutPointHasher()(outpoint) % SHARDS]; }
+
+public:
+    void UpdateCandidate(const CTxLockCandidate& txLockCandidate);
+    void RemoveCandidate(const H256& txHash);
+    // keeps an existing lock, like std::map::insert
+    void LockOutPoint(const COutPoint& outpoint, const H256& txHash);
+    void UnlockOutPoint(const COutPoint& outpoint);
+
+    bool GetLockedOutPointTxHash(const COutPoint& outpoint, H256& hashRet) const;
+    // all outpoints of the candidate are locked by it
+    bool IsLocked(const H256& txHash) const;
+    // number of votes for the candidate, -1 if there is no such candidate
+    int GetSignatures(const H256& txHash) const;
+};
+
 class CInstantSend
 {
 private:
@@ -53,9 +113,21 @@ private:
     std::map<COutPoint, std::set<H256> > mapVotedOutpoints; // utxo - tx hash set
     std::map<COutPoint, H256> mapLockedOutpoints; // utxo - tx hash
 
+    // lock status for readers, see CInstantSendLockIndex
+    CInstantSendLockIndex lockIndex;
+
     //track masternodes who voted with no txreq (for DOS protection)
     std::map<COutPoint, int64_t> mapMasternodeOrphanVotes; // mn outpoint - time
 
+    // expiry of the maps above, checked by CheckAndRemove
+    CExpiryIndex<H256> expiryTxLockCandidates; // tx hash, by block height
+    CExpiryIndex<H256> expiryTxLockVotes; // vote hash, by block height
+    CExpiryIndex<H256> expiryTxLockVotesOrphan; // vote hash, by time
+    CExpiryIndex<COutPoint> expiryMasternodeOrphanVotes; // mn outpoint, by time
+
+    // masternode ranks per lock input height, rebuilt on every new block
+    std::map<int, std::map<COutPoint, int> > mapMasternodeRanks; // height - (mn outpoint - rank)
+
     bool CreateTxLockCandidate(const CTxLockRequest& txLockRequest);
     void Vote(CTxLockCandidate& txLockCandidate);
 
@@ -78,6 +150,8 @@ public:
     CCriticalSection cs_instantsend;
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    // apply a vote received from the network, after its signature key was recovered
+    void ProcessTxLockVoteMessage(CNode* pfrom, CTxLockVote& vote);
 
     bool ProcessTxLockRequest(const CTxLockRequest& txLockRequest);
 
@@ -90,6 +164,9 @@ public:
 
     bool GetTxLockVote(const H256& hash, CTxLockVote& txLockVoteRet);
 
+    // rank of the masternode among voters for inputs confirmed at nLockInputHeight, -1 if unknown
+    int GetMasternodeRank(const COutPoint& outpointMasternode, int nLockInputHeight);
+
     bool GetLockedOutPointTxHash(const COutPoint& outpoint, H256& hashRet);
 
     // verify if transaction is currently locked
@@ -183,12 +260,14 @@ public:
     H256 GetTxHash() const { return txHash; }
     COutPoint GetOutpoint() const { return outpoint; }
     COutPoint GetMasternodeOutpoint() const { return outpointMasternode; }
+    const std::vector<unsigned char>& GetSignature() const { return vchMasternodeSignature; }
     int64_t GetTimeCreated() const { return nTimeCreated; }
 
     bool IsValid(CNode* pnode) const;
     void SetConfirmedHeight(int nConfirmedHeightIn) { nConfirmedHeight = nConfirmedHeightIn; }
     bool IsExpired(int nHeight) const;
 
+    std::string GetSignatureMessage() const;
     bool Sign();
     bool CheckSignature() const;
 
@@ -0,0 +1,98 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_LOGRING_H
+#define BITCOIN_LOGRING_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** A log line and its global sequence number */
+typedef std::pair<uint64_t, std::string> CLogLine;
+
+/**
+ * Lines of one logging thread waiting for the log writer thread (-logasync).
+ *
+ * Only the owning thread pushes and only the writer drains, so a line is
+ * queued with a few atomic operations and no lock.
+ */
+class CLogRing
+{
+private:
+    std::vector<CLogLine> vLines;
+    const size_t nMask;
+    std::atomic<size_t> nHead; // next slot written by the owning thread
+    std::atomic<size_t> nTail; // next slot read by the writer thread
+    std::atomic<uint64_t> nDropped;
+
+public:
+    /** nSize must be a power of two */
+    CLogRing(size_t nSize) : vLines(nSize), nMask(nSize - 1), nHead(0), nTail(0), nDropped(0) {}
+
+    /** Queue a line under the next number of nSequence. Returns false, without
+     * taking a number, when the ring is full. As the number is only taken once
+     * the line is sure to be queued, every number shows up in some ring.
+     */
+    bool Push(std::atomic<uint64_t>& nSequence, const std::string& str)
+    {
+        size_t head = nHead.load(std::memory_order_relaxed);
+        if (head - nTail.load(std::memory_order_acquire) > nMask)
+            return false;
+        vLines[head & nMask].first = nSequence++;
+        vLines[head & nMask].second = str;
+        nHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void Drain(std::vector<CLogLine>& vLinesRet)
+    {
+        size_t tail = nTail.load(std::memory_order_relaxed);
+        size_t head = nHead.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            vLinesRet.push_back(CLogLine(vLines[tail & nMask].first, std::string()));
+            vLinesRet.back().second.swap(vLines[tail & nMask].second);
+        }
+        nTail.store(tail, std::memory_order_release);
+    }
+
+    bool IsEmpty() const
+    {
+        return nHead.load(std::memory_order_acquire) == nTail.load(std::memory_order_acquire);
+    }
+
+    /** Count a line lost because the ring was full */
+    void AddDropped() { nDropped++; }
+    uint64_t TakeDropped() { return nDropped.exchange(0); }
+};
+
+typedef std::shared_ptr<CLogRing> CLogRingRef;
+
+/**
+ * Move the lines drained from the rings that can be written now from vLines
+ * to vLinesRet, in sequence order. A line whose number is missing is still
+ * being pushed by its thread, everything after it stays in vLines for the
+ * next round unless fAll is set. nNextSequence is the first number not
+ * written yet and is advanced past the lines taken.
+ */
+inline void TakeOrderedLogLines(std::vector<CLogLine>& vLines, uint64_t& nNextSequence, std::vector<CLogLine>& vLinesRet, bool fAll)
+{
+    std::sort(vLines.begin(), vLines.end());
+    size_t nTake = 0;
+    for (; nTake < vLines.size(); nTake++) {
+        if (vLines[nTake].first > nNextSequence && !fAll)
+            break;
+        nNextSequence = std::max(nNextSequence, vLines[nTake].first + 1);
+    }
+    for (size_t i = 0; i < nTake; i++) {
+        vLinesRet.push_back(CLogLine(vLines[i].first, std::string()));
+        vLinesRet.back().second.swap(vLines[i].second);
+    }
+    vLines.erase(vLines.begin(), vLines.begin() + nTake);
+}
+
+#endif // BITCOIN_LOGRING_H
@@ -230,6 +230,51 @@ void CMasternodePayments::Clear()
     LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
     mapMasternodeBlocks.clear();
     mapMasternodePaymentVotes.clear();
+    vecJournalVotes.clear();
+}
+
+size_t CMasternodePayments::GetJournalEntries(std::vector<CMasternodePaymentVote>& vecVotesRet)
+{
+    LOCK(cs_mapMasternodePaymentVotes);
+
+    for(size_t i = 0; i < vecJournalVotes.size(); ++i) {
+        std::map<H256, CMasternodePaymentVote>::iterator it = mapMasternodePaymentVotes.find(vecJournalVotes[i]);
+        // already removed again, nothing to persist
+        if(it == mapMasternodePaymentVotes.end()) continue;
+        vecVotesRet.push_back(it->second);
+    }
+    return vecJournalVotes.size();
+}
+
+size_t CMasternodePayments::GetJournalSize()
+{
+    LOCK(cs_mapMasternodePaymentVotes);
+    return vecJournalVotes.size();
+}
+
+void CMasternodePayments::DiscardJournalEntries(size_t nCount)
+{
+    LOCK(cs_mapMasternodePaymentVotes);
+    // Clear() may have emptied the journal in the meantime
+    vecJournalVotes.erase(vecJournalVotes.begin(), vecJournalVotes.begin() + std::min(nCount, vecJournalVotes.size()));
+}
+
+void CMasternodePayments::ApplyJournalEntry(const CMasternodePaymentVote& vote)
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
+
+    // the journal may overlap with the snapshot if a compaction was interrupted
+    H256 nHash = vote.GetHash();
+    if(mapMasternodePaymentVotes.count(nHash)) return;
+
+    mapMasternodePaymentVotes[nHash] = vote;
+
+    if(!mapMasternodeBlocks.count(vote.nBlockHeight)) {
+       CMasternodeBlockPayees blockPayees(vote.nBlockHeight);
+       mapMasternodeBlocks[vote.nBlockHeight] = blockPayees;
+    }
+
+    mapMasternodeBlocks[vote.nBlockHeight].AddPayee(vote);
 }
 
 bool CMasternodePayments::CanVote(COutPoint outMasternode, int nBlockHeight)
@@ -455,6 +500,37 @@ bool CMasternodePayments::IsScheduled(CMasternode& mn, int nNotBlockHeight)
     return false;
 }
 
+void CMasternodePayments::GetScheduledPayees(int nNotBlockHeight, std::set<CScript>& setPayeesRet)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    setPayeesRet.clear();
+    if(!masternodeSync.IsMasternodeListSynced()) return;
+
+    CScript payee;
+    for(int64_t h = nCachedBlockHeight; h <= nCachedBlockHeight + 8; h++){
+        if(h == nNotBlockHeight) continue;
+        if(mapMasternodeBlocks.count(h) && mapMasternodeBlocks[h].GetBestPayee(payee)) {
+            setPayeesRet.insert(payee);
+        }
+    }
+}
+
+void CMasternodePayments::GetPayeesWithVotes(int nBlockHeight, int nVotesReq, std::vector<CScript>& vecPayeesRet)
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_vecPayees);
+
+    vecPayeesRet.clear();
+    std::map<int, CMasternodeBlockPayees>::iterator it = mapMasternodeBlocks.find(nBlockHeight);
+    if(it == mapMasternodeBlocks.end()) return;
+
+    BOOST_FOREACH(CMasternodePayee& payee, it->second.vecPayees) {
+        if(payee.GetVoteCount() >= nVotesReq) {
+            vecPayeesRet.push_back(payee.GetPayee());
+        }
+    }
+}
+
 bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote& vote)
 {
     H256 blockHash = H256();
@@ -465,6 +541,7 @@ bool CMasternodePayments::AddPaymentVote(const CMasternodePaymentVote& vote)
     LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
 
     mapMasternodePaymentVotes[vote.GetHash()] = vote;
+    vecJournalVotes.push_back(vote.GetHash());
 
     if(!mapMasternodeBlocks.count(vote.nBlockHeight)) {
        CMasternodeBlockPayees blockPayees(vote.nBlockHeight);
@@ -18,6 +18,8 @@ class CMasternodeBlockPayees;
 
 static const int MNPAYMENTS_SIGNATURES_REQUIRED         = 6;
 static const int MNPAYMENTS_SIGNATURES_TOTAL            = 10;
+//! how often (in seconds) new payment votes are appended to the mnpayments.dat journal
+static const int MASTERNODE_PAYMENTS_FLUSH_INTERVAL      = 60;
 
 //! minimum peer version that can receive and send masternode payment messages,
 //  vote for masternode and be elected as a payment winner
@@ -28,7 +30,7 @@ static const int MIN_MASTERNODE_PAYMENT_PROTO_VERSION_2 = 70206;
 
 extern CCriticalSection cs_vecPayees;
 extern CCriticalSection cs_mapMasternodeBlocks;
-extern CCriticalSection cs_mapMasternodePayeeVotes;
+extern CCriticalSection cs_mapMasternodePaymentVotes;
 
 extern CMasternodePayments mnpayments;
 
@@ -175,7 +177,12 @@ private:
     // Keep track of current block height
     int nCachedBlockHeight;
 
+    // votes added since they were last written to the mnpayments.dat journal or snapshot
+    std::vector<H256> vecJournalVotes;
+
 public:
+    typedef CMasternodePaymentVote journal_entry_t;
+
     std::map<H256, CMasternodePaymentVote> mapMasternodePaymentVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
     std::map<COutPoint, int> mapMasternodesLastVote;
@@ -186,12 +193,22 @@ public:
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        // snapshots are written from the scheduler thread while votes keep arriving
+        LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePaymentVotes);
         READWRITE(mapMasternodePaymentVotes);
         READWRITE(mapMasternodeBlocks);
     }
 
     void Clear();
 
+    /// Copy the votes not yet persisted to vecVotesRet, returns how many were looked at, see CFlatDB::Append
+    size_t GetJournalEntries(std::vector<CMasternodePaymentVote>& vecVotesRet);
+    size_t GetJournalSize();
+    /// Forget the oldest nCount votes once they are persisted, see CFlatDB::DumpWithJournal
+    void DiscardJournalEntries(size_t nCount);
+    /// Add a vote read back from the journal, see CFlatDB::LoadWithJournal
+    void ApplyJournalEntry(const CMasternodePaymentVote& vote);
+
     bool AddPaymentVote(const CMasternodePaymentVote& vote);
     bool HasVerifiedPaymentVote(H256 hashIn);
     bool ProcessBlock(int nBlockHeight);
@@ -203,6 +220,10 @@ public:
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
     bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight);
     bool IsScheduled(CMasternode& mn, int nNotBlockHeight);
+    /// Collect the payees IsScheduled would match, to test many masternodes at once
+    void GetScheduledPayees(int nNotBlockHeight, std::set<CScript>& setPayeesRet);
+    /// Collect the payees of nBlockHeight with at least nVotesReq votes, the ones CMasternode::UpdateLastPaid looks for
+    void GetPayeesWithVotes(int nBlockHeight, int nVotesReq, std::vector<CScript>& vecPayeesRet);
 
     bool CanVote(COutPoint outMasternode, int nBlockHeight);
 
@@ -0,0 +1,218 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-sigqueue.h"
+#include "masternodeman.h"
+#include "messagesigner.h"
+#include "util.h"
+
+CMasternodeSigQueue mnsigqueue;
+
+bool CMasternodeSigQueue::Push(const entry_ptr& pentry)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        // no workers, let the caller process the message itself
+        if(nWorkers == 0) return false;
+        if(queueOrdered.size() < MAX_QUEUE_SIZE) {
+            queueOrdered.push_back(pentry);
+            queuePending.push_back(pentry);
+            mapQueuedByNode[pentry->nodeid]++;
+            lock.unlock();
+            condPending.notify_one();
+            return true;
+        }
+    }
+    // too far behind, the caller processes the message itself once the
+    // messages this peer queued before it are applied
+    ProcessQueued(pentry->nodeid);
+    return false;
+}
+
+bool CMasternodeSigQueue::PushBroadcast(NodeId nodeid, const CMasternodeBroadcast& mnb)
+{
+    entry_ptr pentry(new entry_t());
+    pentry->nodeid = nodeid;
+    pentry->type = ENTRY_BROADCAST;
+    pentry->mnb = mnb;
+    pentry->fVerified = false;
+    pentry->fApplied = false;
+    return Push(pentry);
+}
+
+bool CMasternodeSigQueue::PushPing(NodeId nodeid, const CMasternodePing& mnp)
+{
+    entry_ptr pentry(new entry_t());
+    pentry->nodeid = nodeid;
+    pentry->type = ENTRY_PING;
+    pentry->mnp = mnp;
+    pentry->fVerified = false;
+    pentry->fApplied = false;
+    return Push(pentry);
+}
+
+bool CMasternodeSigQueue::PushTxLockVote(NodeId nodeid, const CTxLockVote& vote)
+{
+    entry_ptr pentry(new entry_t());
+    pentry->nodeid = nodeid;
+    pentry->type = ENTRY_TXLOCKVOTE;
+    pentry->vote = vote;
+    pentry->fVerified = false;
+    pentry->fApplied = false;
+    return Push(pentry);
+}
+
+size_t CMasternodeSigQueue::size()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return queueOrdered.size();
+}
+
+void CMasternodeSigQueue::Verify(const entry_t& entry)
+{
+    // Only recover the signing keys here, the full checks (including comparing
+    // the recovered key with the expected one) run when the message is applied
+    // and hit the recovered key cache.
+    CKeyID keyID;
+    switch(entry.type) {
+        case ENTRY_BROADCAST:
+            CMessageSigner::RecoverMessage(entry.mnb.vchSig, entry.mnb.GetSignatureMessage(), keyID);
+            if(!entry.mnb.lastPing.vchSig.empty()) {
+                CMessageSigner::RecoverMessage(entry.mnb.lastPing.vchSig, entry.mnb.lastPing.GetSignatureMessage(), keyID);
+            }
+            break;
+        case ENTRY_PING:
+            CMessageSigner::RecoverMessage(entry.mnp.vchSig, entry.mnp.GetSignatureMessage(), keyID);
+            break;
+        case ENTRY_TXLOCKVOTE:
+            CMessageSigner::RecoverMessage(entry.vote.GetSignature(), entry.vote.GetSignatureMessage(), keyID);
+            break;
+    }
+}
+
+CMasternodeSigQueue::entry_ptr CMasternodeSigQueue::PopFront()
+{
+    // cs is held by the caller
+    entry_ptr pentry = queueOrdered.front();
+    queueOrdered.pop_front();
+    pentry->fApplied = true;
+    std::map<NodeId, int>::iterator it = mapQueuedByNode.find(pentry->nodeid);
+    if(--it->second == 0) mapQueuedByNode.erase(it);
+    return pentry;
+}
+
+void CMasternodeSigQueue::Apply(const entry_t& entry)
+{
+    // take a reference so the node outlives cs_vNodes, mnodeman locks cs_main
+    CNode* pfrom = NULL;
+    g_connman->ForNode(entry.nodeid, [&pfrom](CNode* pnode) {
+        pfrom = pnode->AddRef();
+        return true;
+    });
+
+    // a worker may still be reading an entry that is applied before it was
+    // verified, so the handlers get their own copy of the message
+    switch(entry.type) {
+        case ENTRY_BROADCAST: {
+            CMasternodeBroadcast mnb(entry.mnb);
+            mnodeman.ProcessMasternodeBroadcast(pfrom, mnb);
+            break;
+        }
+        case ENTRY_PING: {
+            CMasternodePing mnp(entry.mnp);
+            mnodeman.ProcessMasternodePing(pfrom, mnp);
+            break;
+        }
+        case ENTRY_TXLOCKVOTE: {
+            CTxLockVote vote(entry.vote);
+            instantsend.ProcessTxLockVoteMessage(pfrom, vote);
+            break;
+        }
+    }
+
+    if(pfrom) pfrom->Release();
+}
+
+void CMasternodeSigQueue::ProcessVerified()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    while(!queueOrdered.empty() && queueOrdered.front()->fVerified) {
+        entry_ptr pentry = PopFront();
+        lock.unlock();
+        Apply(*pentry);
+        lock.lock();
+    }
+}
+
+void CMasternodeSigQueue::ProcessQueued(NodeId nodeid)
+{
+    // the handlers check signatures themselves, entries the workers did not
+    // get to yet just miss the recovered key cache
+    boost::unique_lock<boost::mutex> lock(cs);
+    while(mapQueuedByNode.count(nodeid)) {
+        entry_ptr pentry = PopFront();
+        lock.unlock();
+        Apply(*pentry);
+        lock.lock();
+    }
+}
+
+void CMasternodeSigQueue::ThreadVerify()
+{
+    RenameThread("ebakus-mnverify");
+
+    // Keep nWorkers in sync even when the thread is interrupted
+    struct CWorkerCount {
+        CMasternodeSigQueue& queue;
+        CWorkerCount(CMasternodeSigQueue& queueIn) : queue(queueIn) {
+            boost::unique_lock<boost::mutex> lock(queue.cs);
+            queue.nWorkers++;
+        }
+        ~CWorkerCount() {
+            boost::unique_lock<boost::mutex> lock(queue.cs);
+            if(--queue.nWorkers == 0) {
+                queue.queueOrdered.clear();
+                queue.queuePending.clear();
+                queue.mapQueuedByNode.clear();
+            }
+        }
+    } workerCount(*this);
+
+    std::vector<entry_ptr> vBatch;
+    vBatch.reserve(MAX_BATCH_SIZE);
+
+    while(true) {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while(queuePending.empty())
+                condPending.wait(lock);
+            while(!queuePending.empty() && vBatch.size() < MAX_BATCH_SIZE) {
+                if(!queuePending.front()->fApplied)
+                    vBatch.push_back(queuePending.front());
+                queuePending.pop_front();
+            }
+        }
+        if(vBatch.empty()) continue;
+
+        int64_t nStart = GetTimeMicros();
+        BOOST_FOREACH(const entry_ptr& pentry, vBatch) {
+            boost::this_thread::interruption_point();
+            Verify(*pentry);
+        }
+        LogPrint("bench", "CMasternodeSigQueue::ThreadVerify -- verified %u messages in %.2fms\n",
+                 vBatch.size(), (GetTimeMicros() - nStart) * 0.001);
+
+        bool fWake;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            BOOST_FOREACH(const entry_ptr& pentry, vBatch) {
+                pentry->fVerified = true;
+            }
+            fWake = !queueOrdered.empty() && queueOrdered.front()->fVerified;
+        }
+        vBatch.clear();
+        // the message handler applies the verified messages
+        if(fWake && g_connman) g_connman->WakeMessageHandler();
+    }
+}
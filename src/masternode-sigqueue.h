@@ -0,0 +1,94 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MASTERNODE_SIGQUEUE_H
+#define MASTERNODE_SIGQUEUE_H
+
+#include "instantx.h"
+#include "masternode.h"
+#include "net.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+
+#include <boost/thread.hpp>
+
+class CMasternodeSigQueue;
+
+extern CMasternodeSigQueue mnsigqueue;
+
+/** Default for -mnverifythreads, the number of masternode signature verification threads */
+static const int DEFAULT_MASTERNODE_VERIFY_THREADS = 2;
+
+/**
+ * Verification queue for incoming masternode broadcasts, pings and
+ * InstantSend lock votes.
+ *
+ * Signing keys are recovered on a pool of worker threads (a worker takes a
+ * batch of messages at a time), which fills the recovered key cache in
+ * CHashSigner. The workers only verify: messages are applied to mnodeman or
+ * instantsend on the message handler thread, strictly in the order they
+ * were received, so CheckSignature only has to compare key ids.
+ */
+class CMasternodeSigQueue
+{
+private:
+    static const size_t MAX_QUEUE_SIZE  = 10000;
+    static const size_t MAX_BATCH_SIZE  = 16;
+
+    enum entry_type_t {
+        ENTRY_BROADCAST,
+        ENTRY_PING,
+        ENTRY_TXLOCKVOTE
+    };
+
+    struct entry_t {
+        NodeId nodeid;
+        entry_type_t type;
+        CMasternodeBroadcast mnb;
+        CMasternodePing mnp;
+        CTxLockVote vote;
+        bool fVerified;
+        // applied before a worker got to it, the worker skips it
+        bool fApplied;
+    };
+    typedef std::shared_ptr<entry_t> entry_ptr;
+
+    boost::mutex cs;
+    boost::condition_variable condPending;
+    // all queued messages in arrival order
+    std::deque<entry_ptr> queueOrdered;
+    // messages not yet picked up by a worker
+    std::deque<entry_ptr> queuePending;
+    // number of queued messages per peer
+    std::map<NodeId, int> mapQueuedByNode;
+    int nWorkers;
+
+    bool Push(const entry_ptr& pentry);
+    void Verify(const entry_t& entry);
+    /// Pop the front entry with cs held, the caller applies it after releasing cs
+    entry_ptr PopFront();
+    void Apply(const entry_t& entry);
+
+public:
+    CMasternodeSigQueue() : nWorkers(0) {}
+
+    /// Queue a message for verification, returns false if it must be processed by the caller
+    bool PushBroadcast(NodeId nodeid, const CMasternodeBroadcast& mnb);
+    bool PushPing(NodeId nodeid, const CMasternodePing& mnp);
+    bool PushTxLockVote(NodeId nodeid, const CTxLockVote& vote);
+
+    /// Apply verified messages from the front of the queue, message handler thread only
+    void ProcessVerified();
+    /// Apply messages in order until none from this peer are left, verified or not, message handler thread only
+    void ProcessQueued(NodeId nodeid);
+
+    size_t size();
+
+    /// Run a verification worker; returns when the thread is interrupted
+    void ThreadVerify();
+};
+
+#endif
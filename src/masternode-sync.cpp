@@ -375,6 +375,11 @@ void CMasternodeSync::ProcessTick()
 
 void CMasternodeSync::SendGovernanceSyncRequest(CNode* pnode)
 {
+    // objects loaded from the governance database only need the difference
+    if(governance.RequestGovernanceReconciliation(pnode, H256())) {
+        return;
+    }
+
     if(pnode->nVersion >= GOVERNANCE_FILTER_PROTO_VERSION) {
         CBloomFilter filter;
         filter.clear();
@@ -4,38 +4,84 @@
 
 #include "activemasternode.h"
 #include "addrman.h"
+#include "checkqueue.h"
 #include "governance.h"
 #include "masternode-payments.h"
+#include "masternode-sigqueue.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
+#include "metrics.h"
 #include "messagesigner.h"
+#include "net_processing.h"
 #include "netfulfilledman.h"
 #include "privatesend-client.h"
 #include "util.h"
 
+#include <boost/thread.hpp>
+
 /** Masternode manager */
 CMasternodeMan mnodeman;
 
 const std::string CMasternodeMan::SERIALIZATION_VERSION_STRING = "CMasternodeMan-Version-5";
 
-struct CompareLastPaidBlock
+// Best score first, ties go to the higher collateral outpoint
+struct CompareScoreOrder
 {
-    bool operator()(const std::pair<int, CMasternode*>& t1,
-                    const std::pair<int, CMasternode*>& t2) const
+    const std::vector<CMasternode>& vMasternodes;
+
+    CompareScoreOrder(const std::vector<CMasternode>& vMasternodesIn) : vMasternodes(vMasternodesIn) {}
+
+    bool operator()(const std::pair<int64_t, size_t>& t1,
+                    const std::pair<int64_t, size_t>& t2) const
     {
-        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
+        return (t1.first != t2.first) ? (t1.first > t2.first) : (vMasternodes[t2.second].vin < vMasternodes[t1.second].vin);
     }
 };
 
-struct CompareScoreMN
+/** Scores a range of masternodes for one block, run by the score workers */
+class CMasternodeScoreCheck
 {
-    bool operator()(const std::pair<int64_t, CMasternode*>& t1,
-                    const std::pair<int64_t, CMasternode*>& t2) const
+private:
+    std::vector<CMasternode>* pvMasternodes;
+    H256 blockHash;
+    size_t nBegin;
+    size_t nEnd;
+    std::vector<std::pair<int64_t, size_t> >* pvecScores;
+
+public:
+    CMasternodeScoreCheck() : pvMasternodes(NULL), nBegin(0), nEnd(0), pvecScores(NULL) {}
+    CMasternodeScoreCheck(std::vector<CMasternode>& vMasternodesIn, const H256& blockHashIn, size_t nBeginIn, size_t nEndIn,
+                          std::vector<std::pair<int64_t, size_t> >& vecScoresIn) :
+        pvMasternodes(&vMasternodesIn), blockHash(blockHashIn), nBegin(nBeginIn), nEnd(nEndIn), pvecScores(&vecScoresIn) {}
+
+    bool operator()()
+    {
+        for(size_t i = nBegin; i < nEnd; i++) {
+            int64_t nScore = H256((*pvMasternodes)[i].CalculateScore(blockHash)).GetCompact(false);
+            (*pvecScores)[i] = std::make_pair(nScore, i);
+        }
+        return true;
+    }
+
+    void swap(CMasternodeScoreCheck& check)
     {
-        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
+        std::swap(pvMasternodes, check.pvMasternodes);
+        std::swap(blockHash, check.blockHash);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(pvecScores, check.pvecScores);
     }
 };
 
+// Persistent pool for the score checks, the threads are started once by init
+static CCheckQueue<CMasternodeScoreCheck> scoreCheckQueue(16);
+
+void ThreadMasternodeScore()
+{
+    RenameThread("ebakus-mnscore");
+    scoreCheckQueue.Thread();
+}
+
 struct CompareByAddr
 
 {
@@ -46,9 +92,40 @@ struct CompareByAddr
     }
 };
 
+template <typename K>
+static void EraseIndexEntry(std::multimap<K, size_t>& mapIndex, const K& key, size_t nIndex)
+{
+    typename std::multimap<K, size_t>::iterator it = mapIndex.lower_bound(key);
+    while(it != mapIndex.end() && !(key < it->first)) {
+        if(it->second == nIndex) {
+            mapIndex.erase(it);
+            return;
+        }
+        ++it;
+    }
+}
+
 CMasternodeMan::CMasternodeMan()
 : cs(),
   vMasternodes(),
+  vIndexKeys(),
+  mapIndexByOutpoint(),
+  mapIndexByPubKey(),
+  mapIndexByPayee(),
+  mapIndexByAddr(),
+  setPaymentQueue(),
+  setPaymentEligible(),
+  setPaymentCandidatesBySigTime(),
+  setPaymentCandidatesByCollateral(),
+  setPaymentCandidatesNoCollateral(),
+  nPaymentEnabledCount(0),
+  pindexPayment(NULL),
+  nPaymentTime(0),
+  nPaymentMnCount(0),
+  nPaymentMinProtocol(0),
+  fPaymentSentinelRequired(false),
+  setLastPaidPending(),
+  pindexLastPaid(NULL),
   mAskedUsForMasternodeList(),
   mWeAskedForMasternodeList(),
   mWeAskedForMasternodeListEntry(),
@@ -60,6 +137,8 @@ CMasternodeMan::CMasternodeMan()
   fMasternodesRemoved(false),
   vecDirtyGovernanceObjectHashes(),
   nLastWatchdogVoteTime(0),
+  mapRankCache(),
+  nRankCacheCounter(0),
   mapSeenMasternodeBroadcast(),
   mapSeenMasternodePing(),
   nDsqCount(0)
@@ -73,10 +152,143 @@ bool CMasternodeMan::Add(CMasternode &mn)
 
     LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
     vMasternodes.push_back(mn);
+    vIndexKeys.push_back(index_keys_t());
+    AddToIndexes(vMasternodes.size() - 1);
+    AddToRankCache(vMasternodes.size() - 1);
+    setLastPaidPending.insert(mn.vin.prevout);
     fMasternodesAdded = true;
     return true;
 }
 
+void CMasternodeMan::AddToIndexes(size_t nIndex, int nCollateralHeight)
+{
+    AssertLockHeld(cs);
+    CMasternode& mn = vMasternodes[nIndex];
+    index_keys_t& keys = vIndexKeys[nIndex];
+    keys.pubKeyMasternode = mn.pubKeyMasternode;
+    keys.payee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
+    keys.addr = mn.addr;
+    keys.nLastPaidBlock = mn.GetLastPaidBlock();
+    keys.nCollateralHeight = nCollateralHeight;
+    keys.nSigTime = mn.sigTime;
+    keys.fPaymentEnabled = false;
+    keys.fPaymentCandidate = false;
+    keys.fPaymentEligible = false;
+
+    mapIndexByOutpoint[mn.vin.prevout] = nIndex;
+    mapIndexByPubKey.insert(std::make_pair(keys.pubKeyMasternode, nIndex));
+    mapIndexByPayee.insert(std::make_pair(keys.payee, nIndex));
+    mapIndexByAddr.insert(std::make_pair(keys.addr, nIndex));
+    setPaymentQueue.insert(std::make_pair(keys.nLastPaidBlock, mn.vin.prevout));
+    UpdatePaymentState(nIndex);
+}
+
+void CMasternodeMan::RemoveFromIndexes(size_t nIndex)
+{
+    AssertLockHeld(cs);
+    const index_keys_t& keys = vIndexKeys[nIndex];
+    mapIndexByOutpoint.erase(vMasternodes[nIndex].vin.prevout);
+    EraseIndexEntry(mapIndexByPubKey, keys.pubKeyMasternode, nIndex);
+    EraseIndexEntry(mapIndexByPayee, keys.payee, nIndex);
+    EraseIndexEntry(mapIndexByAddr, keys.addr, nIndex);
+    setPaymentQueue.erase(std::make_pair(keys.nLastPaidBlock, vMasternodes[nIndex].vin.prevout));
+    RemoveFromPayments(nIndex);
+}
+
+void CMasternodeMan::RebuildIndexes()
+{
+    AssertLockHeld(cs);
+    mapIndexByOutpoint.clear();
+    mapIndexByPubKey.clear();
+    mapIndexByPayee.clear();
+    mapIndexByAddr.clear();
+    setPaymentQueue.clear();
+    setPaymentEligible.clear();
+    setPaymentCandidatesBySigTime.clear();
+    setPaymentCandidatesByCollateral.clear();
+    setPaymentCandidatesNoCollateral.clear();
+    nPaymentEnabledCount = 0;
+    // start over from a full scan and evaluation
+    pindexPayment = NULL;
+    setLastPaidPending.clear();
+    pindexLastPaid = NULL;
+    vIndexKeys.assign(vMasternodes.size(), index_keys_t());
+    for(size_t i = 0; i < vMasternodes.size(); i++) {
+        AddToIndexes(i);
+    }
+    InvalidateRankCache();
+
+    expirySeenMasternodePing.Clear();
+    for(std::map<H256, CMasternodePing>::iterator it = mapSeenMasternodePing.begin(); it != mapSeenMasternodePing.end(); ++it) {
+        expirySeenMasternodePing.Set(it->first, it->second.sigTime + MASTERNODE_NEW_START_REQUIRED_SECONDS + 1);
+    }
+}
+
+void CMasternodeMan::RemoveMasternode(size_t nIndex)
+{
+    AssertLockHeld(cs);
+    size_t nLast = vMasternodes.size() - 1;
+    RemoveFromIndexes(nIndex);
+    if(nIndex != nLast) {
+        int nCollateralHeight = vIndexKeys[nLast].nCollateralHeight;
+        RemoveFromIndexes(nLast);
+        vMasternodes[nIndex] = vMasternodes[nLast];
+        AddToIndexes(nIndex, nCollateralHeight);
+    }
+    vMasternodes.pop_back();
+    vIndexKeys.pop_back();
+    RemoveFromRankCache(nIndex, nLast);
+}
+
+void CMasternodeMan::AddToRankCache(size_t nIndex)
+{
+    AssertLockHeld(cs);
+    // two hashes per cached block instead of rescoring the whole list
+    for(std::map<H256, rank_cache_entry_t>::iterator it = mapRankCache.begin(); it != mapRankCache.end(); ++it) {
+        score_order_t& vecSorted = it->second.vecSorted;
+        std::pair<int64_t, size_t> score(H256(vMasternodes[nIndex].CalculateScore(it->first)).GetCompact(false), nIndex);
+        vecSorted.insert(std::upper_bound(vecSorted.begin(), vecSorted.end(), score, CompareScoreOrder(vMasternodes)), score);
+    }
+}
+
+void CMasternodeMan::RemoveFromRankCache(size_t nIndex, size_t nLast)
+{
+    AssertLockHeld(cs);
+    // the masternode in slot nLast was moved to nIndex, nothing is rescored
+    for(std::map<H256, rank_cache_entry_t>::iterator it = mapRankCache.begin(); it != mapRankCache.end(); ++it) {
+        score_order_t& vecSorted = it->second.vecSorted;
+        score_order_t::iterator itRemoved = vecSorted.end();
+        for(score_order_t::iterator itScore = vecSorted.begin(); itScore != vecSorted.end(); ++itScore) {
+            if(itScore->second == nIndex)
+                itRemoved = itScore;
+            else if(itScore->second == nLast)
+                itScore->second = nIndex;
+        }
+        if(itRemoved != vecSorted.end())
+            vecSorted.erase(itRemoved);
+    }
+}
+
+void CMasternodeMan::UpdateIndexes(const CTxIn& vin)
+{
+    LOCK(cs);
+    std::map<COutPoint, size_t>::iterator it = mapIndexByOutpoint.find(vin.prevout);
+    if(it == mapIndexByOutpoint.end()) return;
+    // the collateral is the same, keep its height
+    int nCollateralHeight = vIndexKeys[it->second].nCollateralHeight;
+    RemoveFromIndexes(it->second);
+    AddToIndexes(it->second, nCollateralHeight);
+}
+
+void CMasternodeMan::AddSeenMasternodePing(const CMasternodePing& mnp)
+{
+    LOCK(cs);
+    // expires like CMasternodePing::IsExpired
+    H256 nHash = mnp.GetHash();
+    mapSeenMasternodePing.insert(std::make_pair(nHash, mnp));
+    expirySeenMasternodePing.Set(nHash, mnp.sigTime + MASTERNODE_NEW_START_REQUIRED_SECONDS + 1);
+}
+
 void CMasternodeMan::AskForMN(CNode* pnode, const CTxIn &vin)
 {
     if(!pnode) return;
@@ -112,8 +324,10 @@ void CMasternodeMan::Check()
 
     LogPrint("masternode", "CMasternodeMan::Check -- nLastWatchdogVoteTime=%d, IsWatchdogActive()=%d\n", nLastWatchdogVoteTime, IsWatchdogActive());
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-        mn.Check();
+    for(size_t i = 0; i < vMasternodes.size(); i++) {
+        vMasternodes[i].Check();
+        // also picks up state changes made by pings and broadcasts since the last pass
+        UpdatePaymentState(i);
     }
 }
 
@@ -148,7 +362,9 @@ void CMasternodeMan::CheckAndRemove()
 
                 // and finally remove it from the list
                 it->FlagGovernanceItemsAsDirty();
-                it = vMasternodes.erase(it);
+                size_t nIndex = it - vMasternodes.begin();
+                RemoveMasternode(nIndex);
+                it = vMasternodes.begin() + nIndex;
                 fMasternodesRemoved = true;
             } else {
                 bool fAsk = (nAskForMnbRecovery > 0) &&
@@ -270,25 +486,21 @@ void CMasternodeMan::CheckAndRemove()
 
         // NOTE: do not expire mapSeenMasternodeBroadcast entries here, clean them on mnb updates!
 
-        // remove expired mapSeenMasternodePing
-        std::map<H256, CMasternodePing>::iterator it4 = mapSeenMasternodePing.begin();
-        while(it4 != mapSeenMasternodePing.end()){
-            if((*it4).second.IsExpired()) {
-                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode ping: hash=%s\n", (*it4).second.GetHash().ToString());
-                mapSeenMasternodePing.erase(it4++);
-            } else {
-                ++it4;
+        // remove expired mapSeenMasternodePing, only visiting expired entries (see CExpiryIndex)
+        std::vector<H256> vecExpired;
+        expirySeenMasternodePing.PopExpired(GetTime(), vecExpired);
+        BOOST_FOREACH(const H256& hash, vecExpired) {
+            if(mapSeenMasternodePing.erase(hash)) {
+                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode ping: hash=%s\n", hash.ToString());
             }
         }
 
         // remove expired mapSeenMasternodeVerification
-        std::map<H256, CMasternodeVerification>::iterator itv2 = mapSeenMasternodeVerification.begin();
-        while(itv2 != mapSeenMasternodeVerification.end()){
-            if((*itv2).second.nBlockHeight < nCachedBlockHeight - MAX_POSE_BLOCKS){
-                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode verification: hash=%s\n", (*itv2).first.ToString());
-                mapSeenMasternodeVerification.erase(itv2++);
-            } else {
-                ++itv2;
+        vecExpired.clear();
+        expirySeenMasternodeVerification.PopExpired(nCachedBlockHeight, vecExpired);
+        BOOST_FOREACH(const H256& hash, vecExpired) {
+            if(mapSeenMasternodeVerification.erase(hash)) {
+                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode verification: hash=%s\n", hash.ToString());
             }
         }
 
@@ -304,11 +516,13 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    RebuildIndexes();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
     mapSeenMasternodeBroadcast.clear();
     mapSeenMasternodePing.clear();
+    expirySeenMasternodePing.Clear();
     nDsqCount = 0;
     nLastWatchdogVoteTime = 0;
 }
@@ -383,36 +597,24 @@ CMasternode* CMasternodeMan::Find(const CScript &payee)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()) == payee)
-            return &mn;
-    }
-    return NULL;
+    std::multimap<CScript, size_t>::iterator it = mapIndexByPayee.find(payee);
+    return it == mapIndexByPayee.end() ? NULL : &vMasternodes[it->second];
 }
 
 CMasternode* CMasternodeMan::Find(const CTxIn &vin)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    std::map<COutPoint, size_t>::iterator it = mapIndexByOutpoint.find(vin.prevout);
+    return it == mapIndexByOutpoint.end() ? NULL : &vMasternodes[it->second];
 }
 
 CMasternode* CMasternodeMan::Find(const CPubKey &pubKeyMasternode)
 {
     LOCK(cs);
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes)
-    {
-        if(mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
-    }
-    return NULL;
+    std::multimap<CPubKey, size_t>::iterator it = mapIndexByPubKey.find(pubKeyMasternode);
+    return it == mapIndexByPubKey.end() ? NULL : &vMasternodes[it->second];
 }
 
 bool CMasternodeMan::Get(const CPubKey& pubKeyMasternode, CMasternode& masternode)
@@ -492,48 +694,71 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     CMasternode *pBestMasternode = NULL;
     std::vector<std::pair<int, CMasternode*> > vecMasternodeLastPaid;
 
-    /*
-        Make a vector with all of the last paid times
-    */
-
-    int nMnCount = CountEnabled();
-    BOOST_FOREACH(CMasternode &mn, vMasternodes)
-    {
-        if(!mn.IsValidForPayment()) continue;
+    RefreshPaymentEligibility();
 
-        //check protocol version
-        if(mn.nProtocolVersion < mnpayments.GetMinMasternodePaymentsProto()) continue;
+    int nMnCount = nPaymentEnabledCount;
+    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
+    int nTenthNetwork = std::max(nMnCount/10, 1);
+    std::set<CScript> setScheduledPayees;
+    mnpayments.GetScheduledPayees(nBlockHeight, setScheduledPayees);
+
+    if(fFilterSigTime) {
+        // The eligible set holds everything the filters below check except the scheduled
+        // payees (up to 8 entries ahead of current block to allow propagation), so only
+        // those have to be taken out of the count and skipped while walking it.
+        nCount = (int)setPaymentEligible.size();
+        BOOST_FOREACH(const CScript& payee, setScheduledPayees) {
+            std::pair<std::multimap<CScript, size_t>::const_iterator, std::multimap<CScript, size_t>::const_iterator> range = mapIndexByPayee.equal_range(payee);
+            for(std::multimap<CScript, size_t>::const_iterator it = range.first; it != range.second; ++it) {
+                if(vIndexKeys[it->second].fPaymentEligible) nCount--;
+            }
+        }
 
-        //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if(mnpayments.IsScheduled(mn, nBlockHeight)) continue;
+        //when the network is in the process of upgrading, don't penalize nodes that recently restarted
+        if(nCount < nMnCount/3) return GetNextMasternodeInQueueForPayment(nBlockHeight, false, nCount);
 
-        //it's too new, wait for a cycle
-        if(fFilterSigTime && mn.sigTime + (nMnCount*2.6*60) > GetAdjustedTime()) continue;
+        BOOST_FOREACH(const PAIRTYPE(int, COutPoint)& queued, setPaymentEligible)
+        {
+            size_t nIndex = mapIndexByOutpoint[queued.second];
+            if(setScheduledPayees.count(vIndexKeys[nIndex].payee)) continue;
+            CMasternode &mn = vMasternodes[nIndex];
+            vecMasternodeLastPaid.push_back(std::make_pair(mn.GetLastPaidBlock(), &mn));
+            if((int)vecMasternodeLastPaid.size() >= nTenthNetwork) break;
+        }
+    } else {
+        /*
+            Without the sigTime filter walk the whole payment queue, it is already sorted low to high
+        */
+        int nMinProtocol = mnpayments.GetMinMasternodePaymentsProto();
+        BOOST_FOREACH(const PAIRTYPE(int, COutPoint)& queued, setPaymentQueue)
+        {
+            size_t nIndex = mapIndexByOutpoint[queued.second];
+            CMasternode &mn = vMasternodes[nIndex];
 
-        //make sure it has at least as many confirmations as there are masternodes
-        if(GetUTXOConfirmations(mn.vin.prevout) < nMnCount) continue;
+            if(!mn.IsValidForPayment()) continue;
 
-        vecMasternodeLastPaid.push_back(std::make_pair(mn.GetLastPaidBlock(), &mn));
-    }
+            //check protocol version
+            if(mn.nProtocolVersion < nMinProtocol) continue;
 
-    nCount = (int)vecMasternodeLastPaid.size();
+            //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
+            if(setScheduledPayees.count(vIndexKeys[nIndex].payee)) continue;
 
-    //when the network is in the process of upgrading, don't penalize nodes that recently restarted
-    if(fFilterSigTime && nCount < nMnCount/3) return GetNextMasternodeInQueueForPayment(nBlockHeight, false, nCount);
+            //make sure it has at least as many confirmations as there are masternodes
+            if(GetCollateralConfirmations(nIndex) < nMnCount) continue;
 
-    // Sort them low to high
-    sort(vecMasternodeLastPaid.begin(), vecMasternodeLastPaid.end(), CompareLastPaidBlock());
+            vecMasternodeLastPaid.push_back(std::make_pair(mn.GetLastPaidBlock(), &mn));
+        }
+        nCount = (int)vecMasternodeLastPaid.size();
+    }
 
     H256 blockHash;
     if(!GetBlockHash(blockHash, nBlockHeight - 101)) {
         LogPrintf("CMasternode::GetNextMasternodeInQueueForPayment -- ERROR: GetBlockHash() failed at nBlockHeight %d\n", nBlockHeight - 101);
         return NULL;
     }
-    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = nMnCount/10;
     int nCountTenth = 0;
     U256 nHighest = 0;
     BOOST_FOREACH (PAIRTYPE(int, CMasternode*)& s, vecMasternodeLastPaid){
@@ -548,6 +773,164 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     return pBestMasternode;
 }
 
+int CMasternodeMan::GetCollateralConfirmations(size_t nIndex)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    if(!chainActive.Tip()) return -1;
+    int nCollateralHeight = vIndexKeys[nIndex].nCollateralHeight;
+    if(nCollateralHeight == -1) {
+        // -1 means UTXO is yet unknown or already spent
+        nCollateralHeight = GetUTXOHeight(vMasternodes[nIndex].vin.prevout);
+        if(nCollateralHeight == -1) return -1;
+    }
+    return chainActive.Height() - nCollateralHeight + 1;
+}
+
+bool CMasternodeMan::IsPaymentEligible(size_t nIndex)
+{
+    AssertLockHeld(cs);
+    const index_keys_t& keys = vIndexKeys[nIndex];
+    if(!keys.fPaymentCandidate || keys.nCollateralHeight == -1 || !pindexPayment) return false;
+
+    //it's too new, wait for a cycle
+    if(keys.nSigTime + (nPaymentMnCount*2.6*60) > nPaymentTime) return false;
+
+    //make sure it has at least as many confirmations as there are masternodes
+    return pindexPayment->nHeight - keys.nCollateralHeight + 1 >= nPaymentMnCount;
+}
+
+void CMasternodeMan::UpdatePaymentEligible(size_t nIndex)
+{
+    AssertLockHeld(cs);
+    index_keys_t& keys = vIndexKeys[nIndex];
+    bool fEligible = IsPaymentEligible(nIndex);
+    if(fEligible == keys.fPaymentEligible) return;
+
+    std::pair<int, COutPoint> entry(keys.nLastPaidBlock, vMasternodes[nIndex].vin.prevout);
+    if(fEligible)
+        setPaymentEligible.insert(entry);
+    else
+        setPaymentEligible.erase(entry);
+    keys.fPaymentEligible = fEligible;
+}
+
+void CMasternodeMan::RemoveFromPayments(size_t nIndex)
+{
+    AssertLockHeld(cs);
+    index_keys_t& keys = vIndexKeys[nIndex];
+    const COutPoint& outpoint = vMasternodes[nIndex].vin.prevout;
+
+    if(keys.fPaymentEnabled) nPaymentEnabledCount--;
+    if(keys.fPaymentEligible) setPaymentEligible.erase(std::make_pair(keys.nLastPaidBlock, outpoint));
+    if(keys.fPaymentCandidate) {
+        setPaymentCandidatesBySigTime.erase(std::make_pair(keys.nSigTime, outpoint));
+        setPaymentCandidatesByCollateral.erase(std::make_pair(keys.nCollateralHeight, outpoint));
+        setPaymentCandidatesNoCollateral.erase(outpoint);
+    }
+    keys.fPaymentEnabled = keys.fPaymentCandidate = keys.fPaymentEligible = false;
+}
+
+void CMasternodeMan::UpdatePaymentState(size_t nIndex)
+{
+    AssertLockHeld(cs);
+    CMasternode& mn = vMasternodes[nIndex];
+    index_keys_t& keys = vIndexKeys[nIndex];
+
+    bool fEnabled = mn.IsEnabled() && mn.nProtocolVersion >= nPaymentMinProtocol;
+    bool fCandidate = mn.IsValidForPayment() && mn.nProtocolVersion >= nPaymentMinProtocol;
+    // a spent collateral must not keep counting confirmations if the masternode comes back
+    bool fForgetCollateral = mn.IsOutpointSpent() && keys.nCollateralHeight != -1;
+    if(fEnabled == keys.fPaymentEnabled && fCandidate == keys.fPaymentCandidate && !fForgetCollateral) {
+        UpdatePaymentEligible(nIndex);
+        return;
+    }
+
+    RemoveFromPayments(nIndex);
+    if(fForgetCollateral) keys.nCollateralHeight = -1;
+
+    const COutPoint& outpoint = mn.vin.prevout;
+    if(fEnabled) nPaymentEnabledCount++;
+    if(fCandidate) {
+        setPaymentCandidatesBySigTime.insert(std::make_pair(keys.nSigTime, outpoint));
+        if(keys.nCollateralHeight == -1)
+            setPaymentCandidatesNoCollateral.insert(outpoint);
+        else
+            setPaymentCandidatesByCollateral.insert(std::make_pair(keys.nCollateralHeight, outpoint));
+    }
+    keys.fPaymentEnabled = fEnabled;
+    keys.fPaymentCandidate = fCandidate;
+    UpdatePaymentEligible(nIndex);
+}
+
+void CMasternodeMan::RefreshPaymentEligibility()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs);
+
+    const CBlockIndex* pindex = chainActive.Tip();
+    if(!pindex) return;
+
+    int nMinProtocol = mnpayments.GetMinMasternodePaymentsProto();
+    bool fSentinelRequired = sporkManager.IsSporkActive(SPORK_14_REQUIRE_SENTINEL_FLAG);
+    if(!pindexPayment || nMinProtocol != nPaymentMinProtocol || fSentinelRequired != fPaymentSentinelRequired) {
+        // the candidate and enabled filters changed, evaluate everything once
+        nPaymentMinProtocol = nMinProtocol;
+        fPaymentSentinelRequired = fSentinelRequired;
+        pindexPayment = pindex;
+        for(size_t i = 0; i < vMasternodes.size(); i++) {
+            RemoveFromPayments(i);
+            UpdatePaymentState(i);
+        }
+    } else if(pindex->GetAncestor(pindexPayment->nHeight) != pindexPayment) {
+        // collateral heights above the fork may have moved
+        int nForkHeight = chainActive.FindFork(pindexPayment)->nHeight;
+        for(size_t i = 0; i < vMasternodes.size(); i++) {
+            if(vIndexKeys[i].nCollateralHeight > nForkHeight) {
+                RemoveFromPayments(i);
+                vIndexKeys[i].nCollateralHeight = -1;
+                UpdatePaymentState(i);
+            }
+        }
+    }
+
+    std::vector<COutPoint> vecNoCollateral(setPaymentCandidatesNoCollateral.begin(), setPaymentCandidatesNoCollateral.end());
+    BOOST_FOREACH(const COutPoint& outpoint, vecNoCollateral) {
+        size_t nIndex = mapIndexByOutpoint[outpoint];
+        int nHeight = GetUTXOHeight(outpoint);
+        if(nHeight == -1) continue;
+        setPaymentCandidatesNoCollateral.erase(outpoint);
+        vIndexKeys[nIndex].nCollateralHeight = nHeight;
+        setPaymentCandidatesByCollateral.insert(std::make_pair(nHeight, outpoint));
+    }
+
+    int64_t nSigTimeCutoffOld = nPaymentTime - nPaymentMnCount * 156;
+    int nCollateralCutoffOld = pindexPayment->nHeight - nPaymentMnCount + 1;
+
+    pindexPayment = pindex;
+    nPaymentTime = GetAdjustedTime();
+    nPaymentMnCount = nPaymentEnabledCount;
+
+    int64_t nSigTimeCutoff = nPaymentTime - nPaymentMnCount * 156;
+    int nCollateralCutoff = pindexPayment->nHeight - nPaymentMnCount + 1;
+
+    // Only candidates between the old and the new cutoffs can have changed, the
+    // sigTime band is widened by a second for the rounding of the age check
+    std::set<COutPoint> setChanged(vecNoCollateral.begin(), vecNoCollateral.end());
+    std::set<std::pair<int64_t, COutPoint> >::const_iterator itSigTime = setPaymentCandidatesBySigTime.lower_bound(std::make_pair(std::min(nSigTimeCutoffOld, nSigTimeCutoff) - 1, COutPoint()));
+    for(; itSigTime != setPaymentCandidatesBySigTime.end() && itSigTime->first <= std::max(nSigTimeCutoffOld, nSigTimeCutoff) + 1; ++itSigTime) {
+        setChanged.insert(itSigTime->second);
+    }
+    std::set<std::pair<int, COutPoint> >::const_iterator itCollateral = setPaymentCandidatesByCollateral.lower_bound(std::make_pair(std::min(nCollateralCutoffOld, nCollateralCutoff), COutPoint()));
+    for(; itCollateral != setPaymentCandidatesByCollateral.end() && itCollateral->first <= std::max(nCollateralCutoffOld, nCollateralCutoff); ++itCollateral) {
+        setChanged.insert(itCollateral->second);
+    }
+    BOOST_FOREACH(const COutPoint& outpoint, setChanged) {
+        UpdatePaymentEligible(mapIndexByOutpoint[outpoint]);
+    }
+}
+
 masternode_info_t CMasternodeMan::FindRandomNotInVec(const std::vector<CTxIn> &vecToExclude, int nProtocolVersion)
 {
     LOCK(cs);
@@ -591,18 +974,58 @@ masternode_info_t CMasternodeMan::FindRandomNotInVec(const std::vector<CTxIn> &v
     return masternode_info_t();
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
+const CMasternodeMan::score_order_t& CMasternodeMan::GetScoreOrder(const H256& blockHash)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
+    AssertLockHeld(cs);
+
+    std::map<H256, rank_cache_entry_t>::iterator it = mapRankCache.find(blockHash);
+    if(it != mapRankCache.end()) {
+        it->second.nLastUsed = ++nRankCacheCounter;
+        return it->second.vecSorted;
+    }
+
+    if(mapRankCache.size() >= MAX_RANK_CACHE_BLOCKS) {
+        std::map<H256, rank_cache_entry_t>::iterator itOldest = mapRankCache.begin();
+        for(std::map<H256, rank_cache_entry_t>::iterator it2 = mapRankCache.begin(); it2 != mapRankCache.end(); ++it2) {
+            if(it2->second.nLastUsed < itOldest->second.nLastUsed) itOldest = it2;
+        }
+        mapRankCache.erase(itOldest);
+    }
+
+    rank_cache_entry_t& entry = mapRankCache[blockHash];
+    entry.nLastUsed = ++nRankCacheCounter;
+    entry.vecSorted.resize(vMasternodes.size());
+
+    // Scoring is two hashes per masternode, large lists are split over the score workers.
+    // cs is held by the caller, so this is the only user of the queue.
+    std::vector<CMasternodeScoreCheck> vChecks;
+    for(size_t nBegin = 0; nBegin < vMasternodes.size(); nBegin += RANK_SCORES_PER_CHECK) {
+        vChecks.push_back(CMasternodeScoreCheck(vMasternodes, blockHash, nBegin,
+                                                std::min(vMasternodes.size(), nBegin + RANK_SCORES_PER_CHECK), entry.vecSorted));
+    }
+    size_t nChecks = vChecks.size();
+    CCheckQueueControl<CMasternodeScoreCheck> control(&scoreCheckQueue);
+    control.Add(vChecks);
+    control.Wait();
+
+    sort(entry.vecSorted.begin(), entry.vecSorted.end(), CompareScoreOrder(vMasternodes));
+
+    LogPrint("masternode", "CMasternodeMan::GetScoreOrder -- scored %d masternodes for block %s in %d batches\n",
+                vMasternodes.size(), blockHash.ToString(), nChecks);
+    return entry.vecSorted;
+}
 
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
+{
     //make sure we know about this block
     H256 blockHash = H256();
     if(!GetBlockHash(blockHash, nBlockHeight)) return -1;
 
     LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+    int nRank = 0;
+    BOOST_FOREACH(const PAIRTYPE(int64_t, size_t)& score, GetScoreOrder(blockHash)) {
+        CMasternode& mn = vMasternodes[score.second];
         if(mn.nProtocolVersion < nMinProtocol) continue;
         if(fOnlyActive) {
             if(!mn.IsEnabled()) continue;
@@ -610,17 +1033,8 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nM
         else {
             if(!mn.IsValidForPayment()) continue;
         }
-        int64_t nScore = H256(mn.CalculateScore(blockHash)).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int nRank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& scorePair, vecMasternodeScores) {
         nRank++;
-        if(scorePair.second->vin.prevout == vin.prevout) return nRank;
+        if(mn.vin.prevout == vin.prevout) return nRank;
     }
 
     return -1;
@@ -628,7 +1042,6 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int nBlockHeight, int nM
 
 std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int nBlockHeight, int nMinProtocol)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
     std::vector<std::pair<int, CMasternode> > vecMasternodeRanks;
 
     //make sure we know about this block
@@ -637,22 +1050,12 @@ std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int
 
     LOCK(cs);
 
-    // scan for winner
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
-        if(mn.nProtocolVersion < nMinProtocol || !mn.IsEnabled()) continue;
-
-        int64_t nScore = H256(mn.CalculateScore(blockHash)).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
     int nRank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& s, vecMasternodeScores) {
+    BOOST_FOREACH(const PAIRTYPE(int64_t, size_t)& score, GetScoreOrder(blockHash)) {
+        CMasternode& mn = vMasternodes[score.second];
+        if(mn.nProtocolVersion < nMinProtocol || !mn.IsEnabled()) continue;
         nRank++;
-        vecMasternodeRanks.push_back(std::make_pair(nRank, *s.second));
+        vecMasternodeRanks.push_back(std::make_pair(nRank, mn));
     }
 
     return vecMasternodeRanks;
@@ -660,8 +1063,6 @@ std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CMasternode*> > vecMasternodeScores;
-
     LOCK(cs);
 
     H256 blockHash;
@@ -670,24 +1071,14 @@ CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int nBlockHeight, in
         return NULL;
     }
 
-    // Fill scores
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-
+    int rank = 0;
+    BOOST_FOREACH(const PAIRTYPE(int64_t, size_t)& score, GetScoreOrder(blockHash)) {
+        CMasternode& mn = vMasternodes[score.second];
         if(mn.nProtocolVersion < nMinProtocol) continue;
         if(fOnlyActive && !mn.IsEnabled()) continue;
-
-        int64_t nScore = H256(mn.CalculateScore(blockHash)).GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(nScore, &mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(int64_t, CMasternode*)& s, vecMasternodeScores){
         rank++;
         if(rank == nRank) {
-            return s.second;
+            return &mn;
         }
     }
 
@@ -736,12 +1127,75 @@ std::pair<CService, std::set<H256> > CMasternodeMan::PopScheduledMnbRequestConne
 }
 
 
+void CMasternodeMan::ProcessMasternodeBroadcast(CNode* pfrom, CMasternodeBroadcast& mnb)
+{
+    int nDos = 0;
+
+    if (CheckMnbAndUpdateMasternodeList(pfrom, mnb, nDos)) {
+        // use announced Masternode as a peer
+        if(pfrom) g_connman->AddNewAddress(CAddress(mnb.addr, NODE_NETWORK), pfrom->addr, 2*60*60);
+    } else if(nDos > 0 && pfrom) {
+        Misbehaving(pfrom->GetId(), nDos);
+    }
+
+    if(fMasternodesAdded) {
+        NotifyMasternodeUpdates();
+    }
+}
+
+void CMasternodeMan::ProcessMasternodePing(CNode* pfrom, CMasternodePing& mnp)
+{
+    H256 nHash = mnp.GetHash();
+
+    // Need LOCK2 here to ensure consistent locking order because the CheckAndUpdate call below locks cs_main
+    LOCK2(cs_main, cs);
+
+    if(mapSeenMasternodePing.count(nHash)) return; //seen
+    AddSeenMasternodePing(mnp);
+
+    LogPrint("masternode", "MNPING -- Masternode ping, masternode=%s new\n", mnp.vin.prevout.ToStringShort());
+
+    // see if we have this Masternode
+    CMasternode* pmn = mnodeman.Find(mnp.vin);
+
+    // if masternode uses sentinel ping instead of watchdog
+    // we shoud update nTimeLastWatchdogVote here if sentinel
+    // ping flag is actual
+    if(pmn && mnp.fSentinelIsCurrent)
+        pmn->UpdateWatchdogVoteTime(mnp.sigTime);
+
+    // too late, new MNANNOUNCE is required
+    if(pmn && pmn->IsNewStartRequired()) return;
+
+    int nDos = 0;
+    bool fAccepted = mnp.CheckAndUpdate(pmn, false, nDos);
+    if(pmn) UpdatePaymentState(mapIndexByOutpoint[pmn->vin.prevout]);
+    if(fAccepted) return;
+
+    // the peer may have disconnected while the ping waited for verification
+    if(!pfrom) return;
+
+    if(nDos > 0) {
+        // if anything significant failed, mark that node
+        Misbehaving(pfrom->GetId(), nDos);
+    } else if(pmn != NULL) {
+        // nothing significant failed, mn is a known one too
+        return;
+    }
+
+    // something significant is broken or mn is unknown,
+    // we might have to ask for a masternode entry once
+    AskForMN(pfrom, mnp.vin);
+}
+
 void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
     if(fLiteMode) return; // disable all Ebakus specific functionality
     if(!masternodeSync.IsBlockchainSynced()) return;
 
     if (strCommand == NetMsgType::MNANNOUNCE) { //Masternode Broadcast
+        static CMetricHistogram& metric = GetMessageHandlerMetric("masternode", NetMsgType::MNANNOUNCE);
+        CMetricTimer timer(metric);
 
         CMasternodeBroadcast mnb;
         vRecv >> mnb;
@@ -750,65 +1204,29 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         LogPrint("masternode", "MNANNOUNCE -- Masternode announce, masternode=%s\n", mnb.vin.prevout.ToStringShort());
 
-        int nDos = 0;
-
-        if (CheckMnbAndUpdateMasternodeList(pfrom, mnb, nDos)) {
-            // use announced Masternode as a peer
-            g_connman->AddNewAddress(CAddress(mnb.addr, NODE_NETWORK), pfrom->addr, 2*60*60);
-        } else if(nDos > 0) {
-            Misbehaving(pfrom->GetId(), nDos);
+        // signatures are checked on the verification workers, the result is applied in arrival order
+        if(!mnsigqueue.PushBroadcast(pfrom->GetId(), mnb)) {
+            ProcessMasternodeBroadcast(pfrom, mnb);
         }
 
-        if(fMasternodesAdded) {
-            NotifyMasternodeUpdates();
-        }
     } else if (strCommand == NetMsgType::MNPING) { //Masternode Ping
+        static CMetricHistogram& metric = GetMessageHandlerMetric("masternode", NetMsgType::MNPING);
+        CMetricTimer timer(metric);
 
         CMasternodePing mnp;
         vRecv >> mnp;
 
-        H256 nHash = mnp.GetHash();
-
-        pfrom->setAskFor.erase(nHash);
+        pfrom->setAskFor.erase(mnp.GetHash());
 
         LogPrint("masternode", "MNPING -- Masternode ping, masternode=%s\n", mnp.vin.prevout.ToStringShort());
 
-        // Need LOCK2 here to ensure consistent locking order because the CheckAndUpdate call below locks cs_main
-        LOCK2(cs_main, cs);
-
-        if(mapSeenMasternodePing.count(nHash)) return; //seen
-        mapSeenMasternodePing.insert(std::make_pair(nHash, mnp));
-
-        LogPrint("masternode", "MNPING -- Masternode ping, masternode=%s new\n", mnp.vin.prevout.ToStringShort());
-
-        // see if we have this Masternode
-        CMasternode* pmn = mnodeman.Find(mnp.vin);
-
-        // if masternode uses sentinel ping instead of watchdog
-        // we shoud update nTimeLastWatchdogVote here if sentinel
-        // ping flag is actual
-        if(pmn && mnp.fSentinelIsCurrent)
-            pmn->UpdateWatchdogVoteTime(mnp.sigTime);
-
-        // too late, new MNANNOUNCE is required
-        if(pmn && pmn->IsNewStartRequired()) return;
-
-        int nDos = 0;
-        if(mnp.CheckAndUpdate(pmn, false, nDos)) return;
-
-        if(nDos > 0) {
-            // if anything significant failed, mark that node
-            Misbehaving(pfrom->GetId(), nDos);
-        } else if(pmn != NULL) {
-            // nothing significant failed, mn is a known one too
-            return;
+        if(!mnsigqueue.PushPing(pfrom->GetId(), mnp)) {
+            ProcessMasternodePing(pfrom, mnp);
         }
 
-        // something significant is broken or mn is unknown,
-        // we might have to ask for a masternode entry once
-        AskForMN(pfrom, mnp.vin);
-
     } else if (strCommand == NetMsgType::DSEG) { //Get Masternode list or specific entry
+        static CMetricHistogram& metric = GetMessageHandlerMetric("masternode", NetMsgType::DSEG);
+        CMetricTimer timer(metric);
         // Ignore such requests until we are fully synced.
         // We could start processing this after masternode list is synced
         // but this is a heavy one so it's better to finish sync first.
@@ -870,6 +1288,8 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         LogPrint("masternode", "DSEG -- No invs sent to peer %d\n", pfrom->id);
 
     } else if (strCommand == NetMsgType::MNVERIFY) { // Masternode Verify
+        static CMetricHistogram& metric = GetMessageHandlerMetric("masternode", NetMsgType::MNVERIFY);
+        CMetricTimer timer(metric);
 
         // Need LOCK2 here to ensure consistent locking order because the all functions below call GetBlockHash which locks cs_main
         LOCK2(cs_main, cs);
@@ -977,7 +1397,6 @@ void CMasternodeMan::CheckSameAddr()
     if(!masternodeSync.IsSynced() || vMasternodes.empty()) return;
 
     std::vector<CMasternode*> vBan;
-    std::vector<CMasternode*> vSortedByAddr;
 
     {
         LOCK(cs);
@@ -985,13 +1404,9 @@ void CMasternodeMan::CheckSameAddr()
         CMasternode* pprevMasternode = NULL;
         CMasternode* pverifiedMasternode = NULL;
 
-        BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-            vSortedByAddr.push_back(&mn);
-        }
-
-        sort(vSortedByAddr.begin(), vSortedByAddr.end(), CompareByAddr());
-
-        BOOST_FOREACH(CMasternode* pmn, vSortedByAddr) {
+        // the address index already keeps masternodes sharing an address next to each other
+        for(std::multimap<CService, size_t>::iterator it = mapIndexByAddr.begin(); it != mapIndexByAddr.end(); ++it) {
+            CMasternode* pmn = &vMasternodes[it->second];
             // check only (pre)enabled masternodes
             if(!pmn->IsEnabled() && !pmn->IsPreEnabled()) continue;
             // initial step
@@ -1208,6 +1623,7 @@ void CMasternodeMan::ProcessVerifyBroadcast(CNode* pnode, const CMasternodeVerif
         return;
     }
     mapSeenMasternodeVerification[mnv.GetHash()] = mnv;
+    expirySeenMasternodeVerification.Set(mnv.GetHash(), mnv.nBlockHeight + MAX_POSE_BLOCKS + 1);
 
     // we don't care about history
     if(mnv.nBlockHeight < nCachedBlockHeight - MAX_POSE_BLOCKS) {
@@ -1318,7 +1734,7 @@ std::string CMasternodeMan::ToString() const
 void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
 {
     LOCK2(cs_main, cs);
-    mapSeenMasternodePing.insert(std::make_pair(mnb.lastPing.GetHash(), mnb.lastPing));
+    AddSeenMasternodePing(mnb.lastPing);
     mapSeenMasternodeBroadcast.insert(std::make_pair(mnb.GetHash(), std::make_pair(GetTime(), mnb)));
 
     LogPrintf("CMasternodeMan::UpdateMasternodeList -- masternode=%s  addr=%s\n", mnb.vin.prevout.ToStringShort(), mnb.addr.ToString());
@@ -1330,7 +1746,10 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         }
     } else {
         CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
-        if(pmn->UpdateFromNewBroadcast(mnb)) {
+        bool fUpdated = pmn->UpdateFromNewBroadcast(mnb);
+        // pubkey and address may have changed even if the update was refused
+        UpdateIndexes(mnb.vin);
+        if(fUpdated) {
             masternodeSync.BumpAssetLastTime("CMasternodeMan::UpdateMasternodeList - seen");
             mapSeenMasternodeBroadcast.erase(mnbOld.GetHash());
         }
@@ -1434,7 +1853,7 @@ void CMasternodeMan::UpdateLastPaid(const CBlockIndex* pindex)
 {
     LOCK(cs);
 
-    if(fLiteMode || !masternodeSync.IsWinnersListSynced() || vMasternodes.empty()) return;
+    if(fLiteMode || !masternodeSync.IsWinnersListSynced() || vMasternodes.empty() || !pindex) return;
 
     static bool IsFirstRun = true;
     // Do full scan on first run or if we are not a masternode
@@ -1444,13 +1863,63 @@ void CMasternodeMan::UpdateLastPaid(const CBlockIndex* pindex)
     // LogPrint("mnpayments", "CMasternodeMan::UpdateLastPaid -- nHeight=%d, nMaxBlocksToScanBack=%d, IsFirstRun=%s\n",
     //                         nCachedBlockHeight, nMaxBlocksToScanBack, IsFirstRun ? "true" : "false");
 
-    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-        mn.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
+    if(IsFirstRun || !fMasterNode || !pindexLastPaid) {
+        for(size_t i = 0; i < vMasternodes.size(); i++) {
+            UpdateLastPaidBlock(i, pindex, nMaxBlocksToScanBack);
+        }
+    } else {
+        // Only masternodes with a vote majority in one of the blocks connected since the
+        // last run can have been paid since, new ones still need the regular scan back.
+        std::set<size_t> setToUpdate;
+        BOOST_FOREACH(const COutPoint& outpoint, setLastPaidPending) {
+            std::map<COutPoint, size_t>::iterator it = mapIndexByOutpoint.find(outpoint);
+            if(it != mapIndexByOutpoint.end()) setToUpdate.insert(it->second);
+        }
+
+        const CBlockIndex* pindexFork = pindexLastPaid;
+        if(pindexFork->nHeight > pindex->nHeight) pindexFork = pindexFork->GetAncestor(pindex->nHeight);
+        const CBlockIndex* pindexReading = pindex;
+        std::vector<CScript> vecPayees;
+        for(int i = 0; pindexReading && i < nMaxBlocksToScanBack; i++) {
+            while(pindexFork && pindexFork->nHeight > pindexReading->nHeight) pindexFork = pindexFork->pprev;
+            if(pindexReading == pindexFork) break;
+            mnpayments.GetPayeesWithVotes(pindexReading->nHeight, 2, vecPayees);
+            BOOST_FOREACH(const CScript& payee, vecPayees) {
+                std::pair<std::multimap<CScript, size_t>::const_iterator, std::multimap<CScript, size_t>::const_iterator> range = mapIndexByPayee.equal_range(payee);
+                for(std::multimap<CScript, size_t>::const_iterator it = range.first; it != range.second; ++it) {
+                    setToUpdate.insert(it->second);
+                }
+            }
+            pindexReading = pindexReading->pprev;
+        }
+
+        BOOST_FOREACH(size_t nIndex, setToUpdate) {
+            UpdateLastPaidBlock(nIndex, pindex, nMaxBlocksToScanBack);
+        }
     }
 
+    setLastPaidPending.clear();
+    pindexLastPaid = pindex;
     IsFirstRun = false;
 }
 
+void CMasternodeMan::UpdateLastPaidBlock(size_t nIndex, const CBlockIndex* pindex, int nMaxBlocksToScanBack)
+{
+    AssertLockHeld(cs);
+
+    CMasternode& mn = vMasternodes[nIndex];
+    mn.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
+    // move it to its new place in the payment queues
+    index_keys_t& keys = vIndexKeys[nIndex];
+    if(mn.GetLastPaidBlock() == keys.nLastPaidBlock) return;
+
+    setPaymentQueue.erase(std::make_pair(keys.nLastPaidBlock, mn.vin.prevout));
+    if(keys.fPaymentEligible) setPaymentEligible.erase(std::make_pair(keys.nLastPaidBlock, mn.vin.prevout));
+    keys.nLastPaidBlock = mn.GetLastPaidBlock();
+    setPaymentQueue.insert(std::make_pair(keys.nLastPaidBlock, mn.vin.prevout));
+    if(keys.fPaymentEligible) setPaymentEligible.insert(std::make_pair(keys.nLastPaidBlock, mn.vin.prevout));
+}
+
 bool CMasternodeMan::UpdateLastDsq(const CTxIn& vin)
 {
     masternode_info_t info;
@@ -1509,6 +1978,7 @@ void CMasternodeMan::CheckMasternode(const CTxIn& vin, bool fForce)
         return;
     }
     pMN->Check(fForce);
+    UpdatePaymentState(mapIndexByOutpoint[pMN->vin.prevout]);
 }
 
 void CMasternodeMan::CheckMasternode(const CPubKey& pubKeyMasternode, bool fForce)
@@ -1519,6 +1989,7 @@ void CMasternodeMan::CheckMasternode(const CPubKey& pubKeyMasternode, bool fForc
         return;
     }
     pMN->Check(fForce);
+    UpdatePaymentState(mapIndexByOutpoint[pMN->vin.prevout]);
 }
 
 int CMasternodeMan::GetMasternodeState(const CTxIn& vin)
@@ -1564,7 +2035,7 @@ void CMasternodeMan::SetMasternodeLastPing(const CTxIn& vin, const CMasternodePi
     // ping flag is actual
     if(mnp.fSentinelIsCurrent)
         pMN->UpdateWatchdogVoteTime(mnp.sigTime);
-    mapSeenMasternodePing.insert(std::make_pair(mnp.GetHash(), mnp));
+    AddSeenMasternodePing(mnp);
 
     CMasternodeBroadcast mnb(*pMN);
     H256 hash = mnb.GetHash();
@@ -1580,6 +2051,11 @@ void CMasternodeMan::UpdatedBlockTip(const CBlockIndex *pindex)
 
     CheckSameAddr();
 
+    {
+        LOCK2(cs_main, cs);
+        RefreshPaymentEligibility();
+    }
+
     if(fMasterNode) {
         // normal wallet does not need to update this every block, doing update on rpc call should be enough
         UpdateLastPaid(pindex);
@@ -5,6 +5,7 @@
 #ifndef MASTERNODEMAN_H
 #define MASTERNODEMAN_H
 
+#include "expiryindex.h"
 #include "masternode.h"
 #include "sync.h"
 
@@ -36,6 +37,10 @@ private:
     static const int MNB_RECOVERY_WAIT_SECONDS      = 60;
     static const int MNB_RECOVERY_RETRY_SECONDS     = 3 * 60 * 60;
 
+    static const int MAX_RANK_CACHE_BLOCKS          = 16;
+    // masternodes scored by one job of the score worker pool
+    static const int RANK_SCORES_PER_CHECK          = 256;
+
 
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
@@ -43,8 +48,67 @@ private:
     // Keep track of current block height
     int nCachedBlockHeight;
 
-    // map to hold all MNs
+    // slab to hold all MNs, removal moves the last entry into the freed slot
     std::vector<CMasternode> vMasternodes;
+
+    struct index_keys_t {
+        CPubKey pubKeyMasternode;
+        CScript payee;
+        CService addr;
+        int nLastPaidBlock;
+        // -1 if not (yet) known, reset when the collateral is spent or reorged out
+        int nCollateralHeight;
+        int64_t nSigTime;
+        // enabled with the payment protocol, counted in nPaymentEnabledCount
+        bool fPaymentEnabled;
+        // valid for payment with the payment protocol, in the candidate sets below
+        bool fPaymentCandidate;
+        // candidate that passed the age checks too, in setPaymentEligible
+        bool fPaymentEligible;
+    };
+    // keys every slot of vMasternodes is currently indexed under
+    std::vector<index_keys_t> vIndexKeys;
+    // lookup indexes into vMasternodes
+    std::map<COutPoint, size_t> mapIndexByOutpoint;
+    std::multimap<CPubKey, size_t> mapIndexByPubKey;
+    std::multimap<CScript, size_t> mapIndexByPayee;
+    std::multimap<CService, size_t> mapIndexByAddr;
+    // all masternodes ordered by last paid block, the order payments are scheduled in
+    std::set<std::pair<int, COutPoint> > setPaymentQueue;
+
+    // Payment eligibility. State changes update a masternode's entries as they
+    // happen. A new tip or time only changes the outcome of the two age checks,
+    // so candidates are also ordered by the values those compare and a refresh
+    // only re-evaluates the ones between the old and the new cutoffs.
+    std::set<std::pair<int, COutPoint> > setPaymentEligible; // by last paid block, like setPaymentQueue
+    std::set<std::pair<int64_t, COutPoint> > setPaymentCandidatesBySigTime;
+    std::set<std::pair<int, COutPoint> > setPaymentCandidatesByCollateral;
+    // candidates whose collateral height is still unknown, looked up on refresh
+    std::set<COutPoint> setPaymentCandidatesNoCollateral;
+    int nPaymentEnabledCount;
+    // what eligibility was last evaluated against
+    const CBlockIndex* pindexPayment;
+    int64_t nPaymentTime;
+    int nPaymentMnCount;
+    int nPaymentMinProtocol;
+    bool fPaymentSentinelRequired;
+
+    // masternodes added since UpdateLastPaid last ran, and the tip it ran for
+    std::set<COutPoint> setLastPaidPending;
+    const CBlockIndex* pindexLastPaid;
+
+    /// Confirmations of the masternode collateral in slot nIndex, requires cs_main and cs
+    int GetCollateralConfirmations(size_t nIndex);
+    /// Payment eligibility of slot nIndex against the last refresh, require cs
+    bool IsPaymentEligible(size_t nIndex);
+    void UpdatePaymentEligible(size_t nIndex);
+    /// Re-evaluate slot nIndex after its state may have changed, requires cs
+    void UpdatePaymentState(size_t nIndex);
+    void RemoveFromPayments(size_t nIndex);
+    /// Bring eligibility up to the current tip and time, requires cs_main and cs
+    void RefreshPaymentEligibility();
+    /// Move slot nIndex to its new place in the payment queues if its last paid block changed, requires cs
+    void UpdateLastPaidBlock(size_t nIndex, const CBlockIndex* pindex, int nMaxBlocksToScanBack);
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -69,12 +133,44 @@ private:
 
     int64_t nLastWatchdogVoteTime;
 
+    // (score, index into vMasternodes), best score first
+    typedef std::vector<std::pair<int64_t, size_t> > score_order_t;
+
+    struct rank_cache_entry_t {
+        int64_t nLastUsed;
+        score_order_t vecSorted;
+    };
+
+    // Masternode score order per block hash. Scores only depend on the collateral and
+    // the block hash, so Add and RemoveMasternode adjust the cached orders in place;
+    // protocol and state filters are applied when the order is read.
+    std::map<H256, rank_cache_entry_t> mapRankCache;
+    int64_t nRankCacheCounter;
+
+    /// Get (computing it once per block) the masternode order for blockHash, requires cs
+    const score_order_t& GetScoreOrder(const H256& blockHash);
+    /// Keep the cached orders in sync with vMasternodes, require cs
+    void AddToRankCache(size_t nIndex);
+    void RemoveFromRankCache(size_t nIndex, size_t nLast);
+    void InvalidateRankCache() { mapRankCache.clear(); }
+
+    /// Keep the lookup indexes in sync with slot nIndex of vMasternodes, require cs
+    void AddToIndexes(size_t nIndex, int nCollateralHeight = -1);
+    void RemoveFromIndexes(size_t nIndex);
+    void RebuildIndexes();
+    /// Remove the masternode in slot nIndex, moving the last one into its place, requires cs
+    void RemoveMasternode(size_t nIndex);
+
+    // expiry of the seen maps below, checked by CheckAndRemove
+    CExpiryIndex<H256> expirySeenMasternodePing; // by time
+    CExpiryIndex<H256> expirySeenMasternodeVerification; // by block height
+
     friend class CMasternodeSync;
 
 public:
     // Keep track of all broadcasts I've seen
     std::map<H256, std::pair<int64_t, CMasternodeBroadcast> > mapSeenMasternodeBroadcast;
-    // Keep track of all pings I've seen
+    // Keep track of all pings I've seen, add them with AddSeenMasternodePing
     std::map<H256, CMasternodePing> mapSeenMasternodePing;
     // Keep track of all verifications I've seen
     std::map<H256, CMasternodeVerification> mapSeenMasternodeVerification;
@@ -107,6 +203,9 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
+        if(ser_action.ForRead()) {
+            RebuildIndexes();
+        }
         if(ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING)) {
             Clear();
         }
@@ -117,6 +216,9 @@ public:
     /// Add an entry
     bool Add(CMasternode &mn);
 
+    /// Remember a ping in mapSeenMasternodePing until it expires
+    void AddSeenMasternodePing(const CMasternodePing& mnp);
+
     /// Ask (source) node for mnb
     void AskForMN(CNode *pnode, const CTxIn &vin);
     void AskForMnb(CNode *pnode, const H256 &hash);
@@ -152,6 +254,9 @@ public:
     bool Get(const CTxIn& vin, CMasternode& masternode);
     bool Has(const CTxIn& vin);
 
+    /// Must be called after a masternode's pubkey or address changed in place
+    void UpdateIndexes(const CTxIn& vin);
+
     masternode_info_t GetMasternodeInfo(const CTxIn& vin);
 
     masternode_info_t GetMasternodeInfo(const CPubKey& pubKeyMasternode);
@@ -174,6 +279,9 @@ public:
     std::pair<CService, std::set<H256> > PopScheduledMnbRequestConnection();
 
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+    /// Apply a received broadcast or ping, pfrom is NULL if the peer disconnected while it was queued for verification
+    void ProcessMasternodeBroadcast(CNode* pfrom, CMasternodeBroadcast& mnb);
+    void ProcessMasternodePing(CNode* pfrom, CMasternodePing& mnp);
 
     void DoFullVerificationStep();
     void CheckSameAddr();
@@ -234,4 +342,7 @@ public:
 
 };
 
+/** Worker of the pool that scores masternodes for the rank cache */
+void ThreadMasternodeScore();
+
 #endif
@@ -6,9 +6,72 @@
 #include "hash.h"
 #include "validation.h" // For strMessageMagic
 #include "messagesigner.h"
+#include "random.h"
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace {
+
+class CRecoveredKeyCacheHasher
+{
+public:
+    size_t operator()(const H256& key) const {
+        return key.GetCheapHash();
+    }
+};
+
+/**
+ * Keys recovered from compact signatures, keyed by Hash(hash || signature).
+ * Lets masternode messages be recovered in bulk on worker threads and then
+ * verified cheaply, in order, on the thread that applies them.
+ */
+class CRecoveredKeyCache
+{
+private:
+    static const size_t MAX_ENTRIES = 100000;
+
+    typedef boost::unordered_map<H256, CKeyID, CRecoveredKeyCacheHasher> map_type;
+    map_type mapKeys;
+    boost::shared_mutex cs_keycache;
+
+public:
+    static H256 ComputeEntry(const H256& hash, const std::vector<unsigned char>& vchSig)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << hash << vchSig;
+        return ss.GetHash();
+    }
+
+    bool Get(const H256& entry, CKeyID& keyIDRet)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_keycache);
+        map_type::const_iterator it = mapKeys.find(entry);
+        if(it == mapKeys.end()) return false;
+        keyIDRet = it->second;
+        return true;
+    }
+
+    void Set(const H256& entry, const CKeyID& keyID)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_keycache);
+        while(mapKeys.size() >= MAX_ENTRIES) {
+            map_type::size_type s = GetRand(mapKeys.bucket_count());
+            map_type::local_iterator it = mapKeys.begin(s);
+            if(it != mapKeys.end(s)) {
+                mapKeys.erase(it->first);
+            }
+        }
+        mapKeys.insert(std::make_pair(entry, keyID));
+    }
+};
+
+CRecoveredKeyCache recoveredKeyCache;
+
+}
+
 bool CMessageSigner::GetKeysFromSecret(const std::string strSecret, CKey& keyRet, CPubKey& pubkeyRet)
 {
     CBitcoinSecret vchSecret;
@@ -39,6 +102,15 @@ bool CMessageSigner::VerifyMessage(const CPubKey pubkey, const std::vector<unsig
     return CHashSigner::VerifyHash(ss.GetHash(), pubkey, vchSig, strErrorRet);
 }
 
+bool CMessageSigner::RecoverMessage(const std::vector<unsigned char>& vchSig, const std::string strMessage, CKeyID& keyIDRet)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << strMessageMagic;
+    ss << strMessage;
+
+    return CHashSigner::RecoverHash(ss.GetHash(), vchSig, keyIDRet);
+}
+
 bool CHashSigner::SignHash(const H256& hash, const CKey key, std::vector<unsigned char>& vchSigRet)
 {
     return key.SignCompact(hash, vchSigRet);
@@ -46,18 +118,31 @@ bool CHashSigner::SignHash(const H256& hash, const CKey key, std::vector<unsigne
 
 bool CHashSigner::VerifyHash(const H256& hash, const CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet)
 {
-    CPubKey pubkeyFromSig;
-    if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
+    CKeyID keyIDFromSig;
+    if(!RecoverHash(hash, vchSig, keyIDFromSig)) {
         strErrorRet = "Error recovering public key.";
         return false;
     }
 
-    if(pubkeyFromSig.GetID() != pubkey.GetID()) {
+    if(keyIDFromSig != pubkey.GetID()) {
         strErrorRet = strprintf("Keys don't match: pubkey=%s, pubkeyFromSig=%s, hash=%s, vchSig=%s",
-                    pubkey.GetID().ToString(), pubkeyFromSig.GetID().ToString(), hash.ToString(),
+                    pubkey.GetID().ToString(), keyIDFromSig.ToString(), hash.ToString(),
                     EncodeBase64(&vchSig[0], vchSig.size()));
         return false;
     }
 
     return true;
 }
+
+bool CHashSigner::RecoverHash(const H256& hash, const std::vector<unsigned char>& vchSig, CKeyID& keyIDRet)
+{
+    H256 entry = CRecoveredKeyCache::ComputeEntry(hash, vchSig);
+    if(recoveredKeyCache.Get(entry, keyIDRet)) return true;
+
+    CPubKey pubkeyFromSig;
+    if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) return false;
+
+    keyIDRet = pubkeyFromSig.GetID();
+    recoveredKeyCache.Set(entry, keyIDRet);
+    return true;
+}
@@ -18,6 +18,8 @@ public:
     static bool SignMessage(const std::string strMessage, std::vector<unsigned char>& vchSigRet, const CKey key);
     /// Verify the message signature, returns true if succcessful
     static bool VerifyMessage(const CPubKey pubkey, const std::vector<unsigned char>& vchSig, const std::string strMessage, std::string& strErrorRet);
+    /// Recover the key that signed the message, returns true if successful
+    static bool RecoverMessage(const std::vector<unsigned char>& vchSig, const std::string strMessage, CKeyID& keyIDRet);
 };
 
 /** Helper class for signing hashes and checking their signatures
@@ -29,6 +31,10 @@ public:
     static bool SignHash(const H256& hash, const CKey key, std::vector<unsigned char>& vchSigRet);
     /// Verify the hash signature, returns true if succcessful
     static bool VerifyHash(const H256& hash, const CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
+    /// Recover the key that signed the hash, returns true if successful.
+    /// Recovered keys are cached, so recovering ahead of time (e.g. on a worker
+    /// thread) makes a later VerifyHash of the same signature cheap.
+    static bool RecoverHash(const H256& hash, const std::vector<unsigned char>& vchSig, CKeyID& keyIDRet);
 };
 
 #endif
@@ -0,0 +1,243 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+#include "sync.h"
+#include "tinyformat.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <map>
+#include <memory>
+
+CMetricHistogram::CMetricHistogram() :
+    nCount(0),
+    nSum(0),
+    nMax(0)
+{
+    for (int i = 0; i < BUCKETS; i++)
+        vBuckets[i].store(0, std::memory_order_relaxed);
+}
+
+int CMetricHistogram::GetBucketIndex(uint64_t nValue)
+{
+    if (nValue < (uint64_t)SUB_BUCKETS)
+        return (int)nValue;
+
+    int nExponent = 63;
+    while (!(nValue >> nExponent))
+        nExponent--;
+
+    // nExponent >= SUB_BUCKET_BITS here, keep the SUB_BUCKET_BITS bits below the top one
+    int nShift = nExponent - SUB_BUCKET_BITS;
+    return (nShift + 1) * SUB_BUCKETS + (int)((nValue >> nShift) - SUB_BUCKETS);
+}
+
+uint64_t CMetricHistogram::GetBucketUpperBound(int nIndex)
+{
+    if (nIndex < SUB_BUCKETS)
+        return nIndex;
+
+    int nShift = nIndex / SUB_BUCKETS - 1;
+    uint64_t nLower = (uint64_t)(SUB_BUCKETS + nIndex % SUB_BUCKETS) << nShift;
+    return nLower + (((uint64_t)1 << nShift) - 1);
+}
+
+void CMetricHistogram::Observe(uint64_t nValue)
+{
+    vBuckets[GetBucketIndex(nValue)].fetch_add(1, std::memory_order_relaxed);
+    nCount.fetch_add(1, std::memory_order_relaxed);
+    nSum.fetch_add(nValue, std::memory_order_relaxed);
+
+    uint64_t nPrevMax = nMax.load(std::memory_order_relaxed);
+    while (nValue > nPrevMax && !nMax.compare_exchange_weak(nPrevMax, nValue, std::memory_order_relaxed)) {}
+}
+
+uint64_t CMetricHistogram::GetQuantile(double dQuantile) const
+{
+    // buckets are read one by one while writers go on, so count what we actually see
+    uint64_t vCounts[BUCKETS];
+    uint64_t nTotal = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        vCounts[i] = vBuckets[i].load(std::memory_order_relaxed);
+        nTotal += vCounts[i];
+    }
+    if (nTotal == 0)
+        return 0;
+
+    uint64_t nRank = (uint64_t)(dQuantile * nTotal + 0.5);
+    if (nRank < 1)
+        nRank = 1;
+    if (nRank > nTotal)
+        nRank = nTotal;
+
+    uint64_t nSeen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        nSeen += vCounts[i];
+        if (nSeen >= nRank)
+            return std::min(GetBucketUpperBound(i), GetMax());
+    }
+    return GetMax();
+}
+
+namespace {
+
+struct CMetricEntry
+{
+    CMetricSnapshot::Type type;
+    std::string strHelp;
+    std::unique_ptr<CMetricCounter> counter;
+    std::unique_ptr<CMetricGauge> gauge;
+    std::unique_ptr<CMetricHistogram> histogram;
+};
+
+typedef std::map<std::pair<std::string, MetricLabels>, CMetricEntry> CMetricMap;
+
+CCriticalSection cs_metrics;
+CMetricMap mapMetrics;
+
+CMetricEntry& GetMetricEntry(CMetricSnapshot::Type type, const std::string& strName, const std::string& strHelp, const MetricLabels& labels)
+{
+    AssertLockHeld(cs_metrics);
+
+    std::pair<CMetricMap::iterator, bool> ret = mapMetrics.insert(std::make_pair(std::make_pair(strName, labels), CMetricEntry()));
+    CMetricEntry& entry = ret.first->second;
+    if (ret.second) {
+        entry.type = type;
+        entry.strHelp = strHelp;
+    }
+    // one name is one kind of metric, anything else is a programming error
+    assert(entry.type == type);
+    return entry;
+}
+
+std::string EscapeLabelValue(const std::string& str)
+{
+    std::string strRet;
+    for (size_t i = 0; i < str.size(); i++) {
+        if (str[i] == '\\' || str[i] == '"')
+            strRet += '\\';
+        if (str[i] == '\n') {
+            strRet += "\\n";
+            continue;
+        }
+        strRet += str[i];
+    }
+    return strRet;
+}
+
+std::string FormatLabels(const MetricLabels& labels, const std::string& strExtra = std::string())
+{
+    if (labels.empty() && strExtra.empty())
+        return std::string();
+
+    std::string strRet = "{";
+    for (size_t i = 0; i < labels.size(); i++) {
+        if (i)
+            strRet += ",";
+        strRet += labels[i].first + "=\"" + EscapeLabelValue(labels[i].second) + "\"";
+    }
+    if (!strExtra.empty())
+        strRet += (labels.empty() ? "" : ",") + strExtra;
+    return strRet + "}";
+}
+
+std::string FormatSeconds(uint64_t nMicros)
+{
+    return strprintf("%.6f", nMicros * 0.000001);
+}
+
+}
+
+CMetricCounter& GetMetricCounter(const std::string& strName, const std::string& strHelp, const MetricLabels& labels)
+{
+    LOCK(cs_metrics);
+    CMetricEntry& entry = GetMetricEntry(CMetricSnapshot::COUNTER, strName, strHelp, labels);
+    if (!entry.counter)
+        entry.counter.reset(new CMetricCounter());
+    return *entry.counter;
+}
+
+CMetricGauge& GetMetricGauge(const std::string& strName, const std::string& strHelp, const MetricLabels& labels)
+{
+    LOCK(cs_metrics);
+    CMetricEntry& entry = GetMetricEntry(CMetricSnapshot::GAUGE, strName, strHelp, labels);
+    if (!entry.gauge)
+        entry.gauge.reset(new CMetricGauge());
+    return *entry.gauge;
+}
+
+CMetricHistogram& GetMetricHistogram(const std::string& strName, const std::string& strHelp, const MetricLabels& labels)
+{
+    LOCK(cs_metrics);
+    CMetricEntry& entry = GetMetricEntry(CMetricSnapshot::HISTOGRAM, strName, strHelp, labels);
+    if (!entry.histogram)
+        entry.histogram.reset(new CMetricHistogram());
+    return *entry.histogram;
+}
+
+std::vector<CMetricSnapshot> GetMetricsSnapshot()
+{
+    std::vector<CMetricSnapshot> vRet;
+
+    LOCK(cs_metrics);
+    vRet.reserve(mapMetrics.size());
+    for (CMetricMap::const_iterator it = mapMetrics.begin(); it != mapMetrics.end(); ++it) {
+        const CMetricEntry& entry = it->second;
+        CMetricSnapshot snapshot;
+        snapshot.type = entry.type;
+        snapshot.strName = it->first.first;
+        snapshot.strHelp = entry.strHelp;
+        snapshot.labels = it->first.second;
+        snapshot.nValue = 0;
+        snapshot.nCount = snapshot.nSum = snapshot.nMax = 0;
+        switch (entry.type) {
+        case CMetricSnapshot::COUNTER:
+            snapshot.nValue = entry.counter->Get();
+            break;
+        case CMetricSnapshot::GAUGE:
+            snapshot.nValue = entry.gauge->Get();
+            break;
+        case CMetricSnapshot::HISTOGRAM:
+            snapshot.nCount = entry.histogram->GetCount();
+            snapshot.nSum = entry.histogram->GetSum();
+            snapshot.nMax = entry.histogram->GetMax();
+            for (size_t i = 0; i < sizeof(METRIC_QUANTILES) / sizeof(METRIC_QUANTILES[0]); i++)
+                snapshot.vQuantiles.push_back(entry.histogram->GetQuantile(METRIC_QUANTILES[i]));
+            break;
+        }
+        vRet.push_back(snapshot);
+    }
+    return vRet;
+}
+
+std::string MetricsToPrometheus()
+{
+    std::vector<CMetricSnapshot> vMetrics = GetMetricsSnapshot();
+
+    std::string strRet;
+    for (size_t i = 0; i < vMetrics.size(); i++) {
+        const CMetricSnapshot& metric = vMetrics[i];
+
+        // the snapshot is sorted by name, write the header once per name
+        if (i == 0 || vMetrics[i - 1].strName != metric.strName) {
+            static const char* const TYPE_NAMES[] = {"counter", "gauge", "summary"};
+            strRet += strprintf("# HELP %s %s\n", metric.strName, metric.strHelp);
+            strRet += strprintf("# TYPE %s %s\n", metric.strName, TYPE_NAMES[metric.type]);
+        }
+
+        if (metric.type != CMetricSnapshot::HISTOGRAM) {
+            strRet += strprintf("%s%s %d\n", metric.strName, FormatLabels(metric.labels), metric.nValue);
+            continue;
+        }
+        for (size_t j = 0; j < metric.vQuantiles.size(); j++) {
+            strRet += strprintf("%s%s %s\n", metric.strName,
+                                FormatLabels(metric.labels, strprintf("quantile=\"%g\"", METRIC_QUANTILES[j])),
+                                FormatSeconds(metric.vQuantiles[j]));
+        }
+        strRet += strprintf("%s_sum%s %s\n", metric.strName, FormatLabels(metric.labels), FormatSeconds(metric.nSum));
+        strRet += strprintf("%s_count%s %d\n", metric.strName, FormatLabels(metric.labels), metric.nCount);
+    }
+    return strRet;
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "utiltime.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Label name/value pairs of one metric, e.g. {{"stage", "verify"}} */
+typedef std::vector<std::pair<std::string, std::string> > MetricLabels;
+
+/** Quantiles reported for every histogram */
+static const double METRIC_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+/** Monotonic counter, safe to bump from any thread */
+class CMetricCounter
+{
+private:
+    std::atomic<uint64_t> nValue;
+
+public:
+    CMetricCounter() : nValue(0) {}
+
+    void Inc(uint64_t n = 1) { nValue.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Get() const { return nValue.load(std::memory_order_relaxed); }
+};
+
+/** Value that can go up and down, safe to update from any thread */
+class CMetricGauge
+{
+private:
+    std::atomic<int64_t> nValue;
+
+public:
+    CMetricGauge() : nValue(0) {}
+
+    void Set(int64_t n) { nValue.store(n, std::memory_order_relaxed); }
+    void Add(int64_t n) { nValue.fetch_add(n, std::memory_order_relaxed); }
+    int64_t Get() const { return nValue.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Lock-free latency histogram in the style of HdrHistogram.
+ *
+ * Values (microseconds for timers) go to log-linear buckets: every power of
+ * two is split into SUB_BUCKETS linear buckets, so quantiles are exact below
+ * SUB_BUCKETS and within 1/SUB_BUCKETS (12.5%) of the true value above,
+ * over the whole 64 bit range, with a fixed amount of memory.
+ */
+class CMetricHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+private:
+    std::atomic<uint64_t> vBuckets[BUCKETS];
+    std::atomic<uint64_t> nCount;
+    std::atomic<uint64_t> nSum;
+    std::atomic<uint64_t> nMax;
+
+public:
+    CMetricHistogram();
+
+    /** Bucket a value goes to, and the largest value that goes to a bucket */
+    static int GetBucketIndex(uint64_t nValue);
+    static uint64_t GetBucketUpperBound(int nIndex);
+
+    void Observe(uint64_t nValue);
+    /** Record a time difference, a negative one (the clock was set back) counts as 0 */
+    void ObserveMicros(int64_t nMicros) { Observe(nMicros > 0 ? nMicros : 0); }
+
+    uint64_t GetCount() const { return nCount.load(std::memory_order_relaxed); }
+    uint64_t GetSum() const { return nSum.load(std::memory_order_relaxed); }
+    uint64_t GetMax() const { return nMax.load(std::memory_order_relaxed); }
+
+    /** Smallest bucket bound at or above the given fraction (0..1] of the values, 0 when empty */
+    uint64_t GetQuantile(double dQuantile) const;
+};
+
+/** Records the time from construction to destruction into a histogram */
+class CMetricTimer
+{
+private:
+    CMetricHistogram& histogram;
+    int64_t nTimeStart;
+
+public:
+    explicit CMetricTimer(CMetricHistogram& histogramIn) : histogram(histogramIn), nTimeStart(GetTimeMicros()) {}
+    ~CMetricTimer() { histogram.ObserveMicros(GetTimeMicros() - nTimeStart); }
+};
+
+/**
+ * Registry lookups. A metric is created on first use and lives until
+ * shutdown, so callers on hot paths look it up once and keep the reference,
+ * usually in a function local static. Histogram names end in _seconds and
+ * are fed microseconds, the exporters do the conversion.
+ */
+CMetricCounter& GetMetricCounter(const std::string& strName, const std::string& strHelp, const MetricLabels& labels = MetricLabels());
+CMetricGauge& GetMetricGauge(const std::string& strName, const std::string& strHelp, const MetricLabels& labels = MetricLabels());
+CMetricHistogram& GetMetricHistogram(const std::string& strName, const std::string& strHelp, const MetricLabels& labels = MetricLabels());
+
+/** Point in time copy of one metric, for the exporters */
+struct CMetricSnapshot
+{
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+    Type type;
+    std::string strName;
+    std::string strHelp;
+    MetricLabels labels;
+    int64_t nValue;             // counters and gauges
+    uint64_t nCount;            // histograms
+    uint64_t nSum;
+    uint64_t nMax;
+    std::vector<uint64_t> vQuantiles; // one per METRIC_QUANTILES entry
+};
+
+/** Copy of all metrics, sorted by name then labels */
+std::vector<CMetricSnapshot> GetMetricsSnapshot();
+
+/** All metrics in the Prometheus text exposition format, histograms as summaries */
+std::string MetricsToPrometheus();
+
+#endif // METRICS_H
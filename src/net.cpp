@@ -33,6 +33,12 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#include <unordered_map>
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -86,6 +92,8 @@ std::deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<H256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
+CNetBufferPool netBufferPool(DEFAULT_NET_BUFFER_POOL_BYTES, DEFAULT_NET_BUFFER_MAX_POOLED_SIZE);
+
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
@@ -421,8 +429,11 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         }
 
         GetNodeSignals().InitializeNode(pnode, *this);
-        LOCK(cs_vNodes);
-        vNodes.push_back(pnode);
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+        SocketInterestChanged(pnode);
 
         return pnode;
     } else if (!proxyConnectionFailed) {
@@ -679,7 +690,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -702,16 +713,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         nBytes -= handled;
 
         if (msg.complete()) {
-
-            //store received bytes per message command
-            //to prevent a memory DOS, only allow valid commands
-            mapMsgCmdSize::iterator i = mapRecvBytesPerMsgCmd.find(msg.hdr.pchCommand);
-            if (i == mapRecvBytesPerMsgCmd.end())
-                i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
-            assert(i != mapRecvBytesPerMsgCmd.end());
-            i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
-
-            msg.nTime = nTimeMicros;
+            MessageComplete(msg, nTimeMicros);
             complete = true;
         }
     }
@@ -719,6 +721,49 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+bool CNode::GetRecvDataWindow(char*& pch, unsigned int& nSize)
+{
+    // Only the payload of a message whose header was already parsed can be
+    // received in place, headers still go through ReceiveMsgBytes.
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data || vRecvMsg.back().complete())
+        return false;
+
+    CNetMessage& msg = vRecvMsg.back();
+    nSize = msg.ReserveData(nSize);
+    pch = &msg.vRecv[msg.nDataPos];
+    return true;
+}
+
+void CNode::ReceiveMsgData(unsigned int nBytes, bool& complete)
+{
+    complete = false;
+    int64_t nTimeMicros = GetTimeMicros();
+    nLastRecv = nTimeMicros / 1000000;
+    nRecvBytes += nBytes;
+
+    CNetMessage& msg = vRecvMsg.back();
+    msg.nDataPos += nBytes;
+    assert(msg.nDataPos <= msg.hdr.nMessageSize);
+
+    if (msg.complete()) {
+        MessageComplete(msg, nTimeMicros);
+        complete = true;
+    }
+}
+
+void CNode::MessageComplete(CNetMessage& msg, int64_t nTimeMicros)
+{
+    //store received bytes per message command
+    //to prevent a memory DOS, only allow valid commands
+    mapMsgCmdSize::iterator i = mapRecvBytesPerMsgCmd.find(msg.hdr.pchCommand);
+    if (i == mapRecvBytesPerMsgCmd.end())
+        i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
+    assert(i != mapRecvBytesPerMsgCmd.end());
+    i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+
+    msg.nTime = nTimeMicros;
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -774,10 +819,17 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    // payload goes into a recycled buffer
+    if (hdr.nMessageSize > 0) {
+        CSerializeData data;
+        netBufferPool.Get(data);
+        vRecv.swap(data);
+    }
+
     return nCopy;
 }
 
-int CNetMessage::readData(const char *pch, unsigned int nBytes)
+unsigned int CNetMessage::ReserveData(unsigned int nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
@@ -787,12 +839,89 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
         vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
     }
 
+    return nCopy;
+}
+
+int CNetMessage::readData(const char *pch, unsigned int nBytes)
+{
+    unsigned int nCopy = ReserveData(nBytes);
+
     memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+void CNetBufferPool::Get(CSerializeData& data)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (vFree.empty())
+        return;
+    nPooledBytes -= vFree.back().capacity();
+    data.swap(vFree.back());
+    vFree.pop_back();
+}
+
+void CNetBufferPool::Return(CSerializeData& data)
+{
+    size_t nCapacity = data.capacity();
+    if (nCapacity == 0)
+        return;
+    if (nCapacity > nMaxBufferBytes) {
+        // oversized, e.g. after a block; free it rather than keep its capacity
+        CSerializeData().swap(data);
+        return;
+    }
+    data.clear();
+
+    std::lock_guard<std::mutex> lock(cs);
+    if (nPooledBytes + nCapacity > nMaxPooledBytes)
+        return; // pool is full, let the caller free it
+    nPooledBytes += nCapacity;
+    vFree.emplace_back();
+    vFree.back().swap(data);
+}
+
+size_t CNetBufferPool::GetPooledBytes() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return nPooledBytes;
+}
+
+size_t CNetBufferPool::GetPooledBuffers() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    return vFree.size();
+}
+
+void CSocketInterestQueue::Push(CNode* pnode)
+{
+    if (pnode->fSocketInterestQueued.exchange(true))
+        return; // already queued
+    std::lock_guard<std::mutex> lock(cs);
+    vQueue.push_back(pnode);
+}
+
+void CSocketInterestQueue::Take(std::vector<CNode*>& vNodesOut)
+{
+    vNodesOut.clear();
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        vNodesOut.swap(vQueue);
+    }
+    // cleared before the caller looks at the peers, so a change made from
+    // now on queues them again instead of being lost
+    BOOST_FOREACH(CNode* pnode, vNodesOut)
+        pnode->fSocketInterestQueued = false;
+}
+
+void CSocketInterestQueue::Remove(CNode* pnode)
+{
+    std::lock_guard<std::mutex> lock(cs);
+    vQueue.erase(std::remove(vQueue.begin(), vQueue.end(), pnode), vQueue.end());
+    pnode->fSocketInterestQueued = false;
+}
+
 
 
 
@@ -808,7 +937,7 @@ size_t CConnman::SocketSendData(CNode *pnode)
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        CSerializeData &data = *it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -820,6 +949,7 @@ size_t CConnman::SocketSendData(CNode *pnode)
                 pnode->nSendOffset = 0;
                 pnode->nSendSize -= data.size();
                 pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                netBufferPool.Return(data);
                 it++;
             } else {
                 // could not send full message; stop sending more
@@ -1092,8 +1222,260 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
+    SocketInterestChanged(pnode);
 }
 
+bool CConnman::GetSocketInterest(CNode* pnode, bool& fSelectRecv, bool& fSelectSend)
+{
+    // Implement the following logic:
+    // * If there is data to send, select() for sending data. As this only
+    //   happens when optimistic write failed, we choose to first drain the
+    //   write buffer in this case before receiving more. This avoids
+    //   needlessly queueing received data, if the remote peer is not themselves
+    //   receiving data. This means properly utilizing TCP flow control signalling.
+    // * Otherwise, if there is space left in the receive buffer, select() for
+    //   receiving data.
+    // * Hand off all complete messages to the processor, to be handled without
+    //   blocking here.
+    // Returns false if the send queue was busy and could not be inspected.
+    fSelectSend = false;
+    fSelectRecv = false;
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (lockSend && !pnode->vSendMsg.empty()) {
+            fSelectSend = true;
+            return true;
+        }
+        fSelectRecv = !pnode->fPauseRecv;
+        return lockSend;
+    }
+}
+
+bool CConnman::GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        recv_set.insert(hListenSocket.socket);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            error_set.insert(pnode->hSocket);
+
+            bool fSelectRecv, fSelectSend;
+            GetSocketInterest(pnode, fSelectRecv, fSelectSend);
+            if (fSelectSend)
+                send_set.insert(pnode->hSocket);
+            else if (fSelectRecv)
+                recv_set.insert(pnode->hSocket);
+        }
+    }
+
+    return !recv_set.empty() || !send_set.empty() || !error_set.empty();
+}
+
+void CConnman::SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+#ifdef USE_EPOLL
+    if (epollfd != -1) {
+        SocketEventsEpoll(recv_set, send_set, error_set);
+        return;
+    }
+#endif
+#ifdef USE_POLL
+    SocketEventsPoll(recv_set, send_set, error_set);
+#else
+    SocketEventsSelect(recv_set, send_set, error_set);
+#endif
+}
+
+void CConnman::SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
+        interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        return;
+    }
+
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = SELECT_TIMEOUT_MILLISECONDS * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    BOOST_FOREACH(SOCKET hSocket, recv_select_set) {
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, send_select_set) {
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, error_select_set) {
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+
+    int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        int nErr = WSAGetLastError();
+        LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        // try receiving on every socket, the failing ones get disconnected
+        recv_set = recv_select_set;
+        interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        return;
+    }
+
+    BOOST_FOREACH(SOCKET hSocket, recv_select_set) {
+        if (FD_ISSET(hSocket, &fdsetRecv))
+            recv_set.insert(hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, send_select_set) {
+        if (FD_ISSET(hSocket, &fdsetSend))
+            send_set.insert(hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, error_select_set) {
+        if (FD_ISSET(hSocket, &fdsetError))
+            error_set.insert(hSocket);
+    }
+}
+
+#ifdef USE_POLL
+void CConnman::SocketEventsPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
+        interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        return;
+    }
+
+    std::unordered_map<SOCKET, struct pollfd> pollfds;
+    BOOST_FOREACH(SOCKET hSocket, recv_select_set) {
+        pollfds[hSocket].fd = hSocket;
+        pollfds[hSocket].events |= POLLIN;
+    }
+    BOOST_FOREACH(SOCKET hSocket, send_select_set) {
+        pollfds[hSocket].fd = hSocket;
+        pollfds[hSocket].events |= POLLOUT;
+    }
+    BOOST_FOREACH(SOCKET hSocket, error_select_set) {
+        // errors are always reported, no need to ask for them
+        pollfds[hSocket].fd = hSocket;
+    }
+
+    std::vector<struct pollfd> vpollfds;
+    vpollfds.reserve(pollfds.size());
+    for (const auto& it : pollfds) {
+        vpollfds.push_back(it.second);
+    }
+
+    if (poll(vpollfds.data(), vpollfds.size(), SELECT_TIMEOUT_MILLISECONDS) < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket poll error %s\n", NetworkErrorString(nErr));
+            // don't spin on a persistent error
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    if (interruptNet)
+        return;
+
+    for (const struct pollfd& pollfd : vpollfds) {
+        if (pollfd.revents & POLLIN)
+            recv_set.insert(pollfd.fd);
+        if (pollfd.revents & POLLOUT)
+            send_set.insert(pollfd.fd);
+        if (pollfd.revents & (POLLERR | POLLHUP))
+            error_set.insert(pollfd.fd);
+    }
+}
+#endif
+
+#ifdef USE_EPOLL
+void CConnman::SocketEventsEpoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+{
+    // Sockets stay registered with the kernel. Only peers whose interest may
+    // have changed (send queue filled or drained, receive paused or resumed)
+    // are looked at, and only an actual change costs a syscall. Closed sockets
+    // drop out of the epoll set on their own. Nodes are only deleted by this
+    // thread, so the queued pointers stay valid here.
+    std::vector<CNode*> vChanged;
+    socketInterestQueue.Take(vChanged);
+    BOOST_FOREACH(CNode* pnode, vChanged)
+    {
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+
+        bool fSelectRecv, fSelectSend;
+        if (!GetSocketInterest(pnode, fSelectRecv, fSelectSend)) {
+            // send queue busy, look at it again next round
+            socketInterestQueue.Push(pnode);
+            if (pnode->fEpollRegistered)
+                continue; // keep what is registered
+        }
+
+        uint32_t nEvents = (fSelectRecv ? EPOLLIN : 0) | (fSelectSend ? EPOLLOUT : 0);
+        if (pnode->fEpollRegistered && pnode->nEpollEvents == nEvents)
+            continue;
+
+        struct epoll_event event = {};
+        event.events = nEvents;
+        event.data.fd = pnode->hSocket;
+        if (epoll_ctl(epollfd, pnode->fEpollRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+            // a socket we cannot wait on would never be serviced again
+            LogPrintf("socket epoll_ctl error for peer=%d: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
+            pnode->fDisconnect = true;
+            continue;
+        }
+        pnode->fEpollRegistered = true;
+        pnode->nEpollEvents = nEvents;
+    }
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, SELECT_TIMEOUT_MILLISECONDS);
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            // don't spin on a persistent error
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    if (interruptNet)
+        return;
+
+    for (int i = 0; i < nEvents; i++) {
+        SOCKET hSocket = events[i].data.fd;
+        if (events[i].events & EPOLLIN)
+            recv_set.insert(hSocket);
+        if (events[i].events & EPOLLOUT)
+            send_set.insert(hSocket);
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            error_set.insert(hSocket);
+    }
+}
+#endif
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1167,87 +1549,18 @@ void CConnman::ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend) {
-                        if (!pnode->vSendMsg.empty()) {
-                            FD_SET(pnode->hSocket, &fdsetSend);
-                            continue;
-                        }
-                    }
-                }
-                {
-                    if (!pnode->fPauseRecv)
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
+        std::set<SOCKET> recv_set, send_set, error_set;
+        SocketEvents(recv_set, send_set, error_set);
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
-
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1267,17 +1580,24 @@ void CConnman::ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (recv_set.count(pnode->hSocket) > 0 || error_set.count(pnode->hSocket) > 0)
             {
                 {
                     {
                         // typical socket buffer is 8K-64K
                         char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                        // Once a header has been parsed, receive the payload straight
+                        // into the message buffer instead of copying it out of pchBuf.
+                        char* pchDest = pchBuf;
+                        unsigned int nMaxBytes = sizeof(pchBuf);
+                        bool fInPlace = pnode->GetRecvDataWindow(pchDest, nMaxBytes);
+                        int nBytes = recv(pnode->hSocket, pchDest, nMaxBytes, MSG_DONTWAIT);
                         if (nBytes > 0)
                         {
                             bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+                            if (fInPlace)
+                                pnode->ReceiveMsgData(nBytes, notify);
+                            else if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
                                 pnode->CloseSocketDisconnect();
                             RecordBytesRecv(nBytes);
                             if (notify) {
@@ -1292,7 +1612,9 @@ void CConnman::ThreadSocketHandler()
                                     LOCK(pnode->cs_vProcessMsg);
                                     pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
                                     pnode->nProcessQueueSize += nSizeAdded;
-                                    pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+                                    bool fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+                                    if (pnode->fPauseRecv.exchange(fPauseRecv) != fPauseRecv)
+                                        SocketInterestChanged(pnode);
                                 }
                                 WakeMessageHandler();
                             }
@@ -1324,7 +1646,7 @@ void CConnman::ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (send_set.count(pnode->hSocket) > 0)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend) {
@@ -1332,6 +1654,8 @@ void CConnman::ThreadSocketHandler()
                     if (nBytes) {
                         RecordBytesSent(nBytes);
                     }
+                    if (pnode->vSendMsg.empty())
+                        SocketInterestChanged(pnode); // drained, go back to receiving
                 }
             }
 
@@ -2095,6 +2419,9 @@ CConnman::CConnman()
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+#ifdef USE_EPOLL
+    epollfd = -1;
+#endif
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2158,6 +2485,22 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     fAddressesInitialized = true;
 
+#ifdef USE_EPOLL
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd == -1) {
+        LogPrintf("epoll_create1 failed: %s, falling back to poll\n", NetworkErrorString(WSAGetLastError()));
+    } else {
+        // listening sockets are always watched for incoming connections
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = hListenSocket.socket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+                LogPrintf("epoll_ctl failed for listening socket: %s\n", NetworkErrorString(WSAGetLastError()));
+        }
+    }
+#endif
+
     if (semOutbound == NULL) {
         // initialize semaphore
         semOutbound = new CSemaphore(std::min((nMaxOutbound + nMaxFeeler), nMaxConnections));
@@ -2206,7 +2549,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
 
     // Dump network addresses
-    scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL, CScheduler::PRIORITY_LOW, "net-dumpdata");
 
     return true;
 }
@@ -2294,6 +2637,12 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
     delete semOutbound;
     semOutbound = NULL;
     delete semMasternodeOutbound;
@@ -2310,6 +2659,9 @@ void CConnman::DeleteNode(CNode* pnode)
     GetNodeSignals().FinalizeNode(pnode->GetId(), fUpdateConnectionTime);
     if(fUpdateConnectionTime)
         addrman.Connected(pnode->addr);
+#ifdef USE_EPOLL
+    socketInterestQueue.Remove(pnode);
+#endif
     delete pnode;
 }
 
@@ -2623,6 +2975,15 @@ int CConnman::GetBestHeight() const
     return nBestHeight.load(std::memory_order_acquire);
 }
 
+void CConnman::SocketInterestChanged(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    // poll and select ask every peer for its interest each round anyway
+    if (epollfd != -1)
+        socketInterestQueue.Push(pnode);
+#endif
+}
+
 unsigned int CConnman::GetReceiveFloodSize() const { return nReceiveFloodSize; }
 unsigned int CConnman::GetSendBufferSize() const{ return nSendBufferMaxSize; }
 
@@ -2680,6 +3041,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nLocalServices = nLocalServicesIn;
     fPauseRecv = false;
     fPauseSend = false;
+    fEpollRegistered = false;
+    nEpollEvents = 0;
+    fSocketInterestQueued = false;
     nProcessQueueSize = 0;
 
     GetRandBytes((unsigned char*)&nLocalHostNonce, sizeof(nLocalHostNonce));
@@ -2780,7 +3144,13 @@ std::vector<unsigned char> CNode::CalculateKeyedNetGroup(CAddress& address)
 
 CDataStream CConnman::BeginMessage(CNode* pnode, int nVersion, int flags, const std::string& sCommand)
 {
-    return {SER_NETWORK, (nVersion ? nVersion : pnode->GetSendVersion()) | flags, CMessageHeader(Params().MessageStart(), sCommand.c_str(), 0) };
+    CDataStream msg(SER_NETWORK, (nVersion ? nVersion : pnode->GetSendVersion()) | flags);
+    // serialize into a recycled buffer, it is moved as a whole into vSendMsg later
+    CSerializeData data;
+    netBufferPool.Get(data);
+    msg.swap(data);
+    msg << CMessageHeader(Params().MessageStart(), sCommand.c_str(), 0);
+    return msg;
 }
 
 void CConnman::EndMessage(CDataStream& strm)
@@ -2800,7 +3170,8 @@ void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& s
     if(strm.empty())
         return;
 
-    unsigned int nSize = strm.size() - CMessageHeader::HEADER_SIZE;
+    size_t nTotalSize = strm.size();
+    unsigned int nSize = nTotalSize - CMessageHeader::HEADER_SIZE;
     LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(sCommand.c_str()), nSize, pnode->id);
 
     size_t nBytesSent = 0;
@@ -2810,18 +3181,24 @@ void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& s
             return;
         }
         bool optimisticSend(pnode->vSendMsg.empty());
-        pnode->vSendMsg.emplace_back(strm.begin(), strm.end());
+        // hand the serialized buffer over without copying it
+        pnode->vSendMsg.emplace_back();
+        strm.swap(pnode->vSendMsg.back());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[sCommand] += strm.size();
-        pnode->nSendSize += strm.size();
+        pnode->mapSendBytesPerMsgCmd[sCommand] += nTotalSize;
+        pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
 
         // If write queue empty, attempt "optimistic write"
-        if (optimisticSend == true)
+        if (optimisticSend == true) {
             nBytesSent = SocketSendData(pnode);
+            // the socket handler has to wait for the socket to become writable
+            if (!pnode->vSendMsg.empty())
+                SocketInterestChanged(pnode);
+        }
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
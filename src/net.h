@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <thread>
 #include <memory>
+#include <mutex>
 #include <condition_variable>
 
 #ifndef WIN32
@@ -81,6 +82,10 @@ static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** Default for blocks only*/
 static const bool DEFAULT_BLOCKSONLY = false;
+/** How long the socket handler waits for socket events before polling the send queues again (in milliseconds) */
+static const int SELECT_TIMEOUT_MILLISECONDS = 50;
+/** Maximum number of ready sockets fetched by a single epoll_wait() call */
+static const int MAX_EPOLL_EVENTS = 1024;
 
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
@@ -101,6 +106,26 @@ struct AddedNodeInfo
     bool fInbound;
 };
 
+/**
+ * Peers whose socket interest (send queue empty or not, receive paused or not)
+ * may have changed since the socket handler last registered it with epoll.
+ * Lets the socket handler touch only those peers instead of every connection.
+ * A peer is queued at most once at a time.
+ */
+class CSocketInterestQueue
+{
+private:
+    std::mutex cs;
+    std::vector<CNode*> vQueue;
+
+public:
+    void Push(CNode* pnode);
+    /** Move the queued peers into vNodesOut; they can be queued again afterwards */
+    void Take(std::vector<CNode*>& vNodesOut);
+    /** Forget a peer that is about to be deleted */
+    void Remove(CNode* pnode);
+};
+
 class CTransaction;
 class CNodeStats;
 class CClientUIInterface;
@@ -387,6 +412,11 @@ public:
 
 
     unsigned int GetReceiveFloodSize() const;
+
+    // Tell the socket handler that pnode's send queue or receive pause changed
+    void SocketInterestChanged(CNode* pnode);
+
+    void WakeMessageHandler();
 private:
     struct ListenSocket {
         SOCKET socket;
@@ -400,12 +430,22 @@ private:
     void ThreadOpenConnections();
     void ThreadMessageHandler();
     void AcceptConnection(const ListenSocket& hListenSocket);
+
+    // Socket readiness backends: epoll on Linux, poll elsewhere and select on Windows
+    bool GetSocketInterest(CNode* pnode, bool& fSelectRecv, bool& fSelectSend);
+    bool GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+    void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+    void SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#ifdef USE_POLL
+    void SocketEventsPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#endif
+#ifdef USE_EPOLL
+    void SocketEventsEpoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#endif
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
     void ThreadMnbRequestConnections();
 
-    void WakeMessageHandler();
-
     CNode* FindNode(const CNetAddr& ip);
     CNode* FindNode(const CSubNet& subNet);
     CNode* FindNode(const std::string& addrName);
@@ -461,6 +501,12 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+#ifdef USE_EPOLL
+    // epoll instance used by the socket handler, -1 if unavailable (poll is used then)
+    int epollfd;
+    // peers whose epoll registration needs to be looked at again
+    CSocketInterestQueue socketInterestQueue;
+#endif
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
     bool setBannedIsDirty;
@@ -616,6 +662,42 @@ public:
 
 
 
+/**
+ * Recycles message payload buffers between serialization, the socket thread
+ * and the message handler. Returned buffers are cleared but keep their
+ * capacity, so steady-state traffic neither reallocates nor wipes payload
+ * memory. Buffers that grew past nMaxBufferBytes (a block, say) or that do not
+ * fit into the pool are released as usual, so one large message does not pin
+ * its capacity for the lifetime of the process.
+ */
+class CNetBufferPool
+{
+private:
+    mutable std::mutex cs;
+    std::vector<CSerializeData> vFree;
+    size_t nPooledBytes;
+    size_t nMaxPooledBytes;
+    size_t nMaxBufferBytes;
+
+public:
+    CNetBufferPool(size_t nMaxPooledBytesIn, size_t nMaxBufferBytesIn) : nPooledBytes(0), nMaxPooledBytes(nMaxPooledBytesIn), nMaxBufferBytes(nMaxBufferBytesIn) {}
+
+    /** Replace data with an empty recycled buffer, if one is available */
+    void Get(CSerializeData& data);
+    /** Take ownership of data's storage for reuse; data is left empty */
+    void Return(CSerializeData& data);
+
+    size_t GetPooledBytes() const;
+    size_t GetPooledBuffers() const;
+};
+
+/** Upper bound on the capacity kept around by the message buffer pool */
+static const size_t DEFAULT_NET_BUFFER_POOL_BYTES = 32 * 1024 * 1024;
+/** Largest capacity a single buffer may have and still be kept by the pool */
+static const size_t DEFAULT_NET_BUFFER_MAX_POOLED_SIZE = 256 * 1024;
+
+extern CNetBufferPool netBufferPool;
+
 class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
@@ -637,6 +719,19 @@ public:
         nTime = 0;
     }
 
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    CNetMessage(const CNetMessage&) = delete;
+    CNetMessage& operator=(const CNetMessage&) = delete;
+
+    ~CNetMessage()
+    {
+        // hand the payload buffer back for reuse instead of freeing it
+        CSerializeData data;
+        vRecv.swap(data);
+        netBufferPool.Return(data);
+    }
+
     bool complete() const
     {
         if (!in_data)
@@ -652,6 +747,9 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    /** Make room for up to nBytes of payload, returns how many bytes fit at nDataPos */
+    unsigned int ReserveData(unsigned int nBytes);
 };
 
 
@@ -717,6 +815,12 @@ public:
 
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+
+    // Events this socket is currently registered for with epoll (used only by SocketHandler thread)
+    bool fEpollRegistered;
+    uint32_t nEpollEvents;
+    // Whether the node is waiting in CSocketInterestQueue
+    std::atomic_bool fSocketInterestQueued;
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -780,6 +884,8 @@ private:
     int nMyStartingHeight;
     int nSendVersion;
     std::list<CNetMessage> vRecvMsg;  // Used only by SocketHandler thread
+
+    void MessageComplete(CNetMessage& msg, int64_t nTimeMicros);
 public:
 
     NodeId GetId() const {
@@ -802,6 +908,9 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    // Zero-copy receive: recv() straight into the payload of the message being read
+    bool GetRecvDataWindow(char*& pch, unsigned int& nSize);
+    void ReceiveMsgData(unsigned int nBytes, bool& complete);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -123,6 +123,11 @@ void CTransaction::UpdateHash() const
     *const_cast<H256*>(&hash) = h;
 }
 
+H256 CTransaction::GetFullHash() const
+{
+    return SerializeHash(*this, SER_NETWORK, PROTOCOL_VERSION);
+}
+
 CTransaction::CTransaction() : nVersion(CTransaction::CURRENT_VERSION), mAmount(0), nLockTime(0) { }
 
 CTransaction::CTransaction(const CMutableTransaction &tx) :
@@ -150,6 +155,11 @@ void CTransaction::Sign(const CKey &key)
 CTransaction& CTransaction::operator=(const CTransaction &tx) {
     *const_cast<int*>(&nVersion) = tx.nVersion;
     *const_cast<unsigned int*>(&nLockTime) = tx.nLockTime;
+    *const_cast<CKeyID*>(&mReceiver) = tx.mReceiver;
+    *const_cast<CAmount*>(&mAmount) = tx.mAmount;
+    *const_cast<Bytes*>(&mData) = tx.mData;
+    *const_cast<Bytes*>(&mSignature) = tx.mSignature;
+    *const_cast<CKeyID*>(&mSender) = tx.mSender;
     *const_cast<H256*>(&hash) = tx.hash;
     return *this;
 }
@@ -281,6 +281,10 @@ public:
         return hash;
     }
 
+    // GetHash() leaves out the signature, which selects the sender. This one
+    // covers the whole transaction and is computed on every call.
+    H256 GetFullHash() const;
+
     // Return sum of txouts.
     CAmount GetValueOut() const;
     // GetValueIn() is a method on CCoinsViewCache, because
@@ -9,6 +9,7 @@
 #include "init.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
+#include "scheduler.h"
 #include "script/sign.h"
 #include "txmempool.h"
 #include "util.h"
@@ -16,6 +17,8 @@
 
 #include <memory>
 
+#include <boost/bind.hpp>
+
 CPrivateSendClient privateSendClient;
 
 void CPrivateSendClient::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
@@ -1331,32 +1334,26 @@ void CPrivateSendClient::UpdatedBlockTip(const CBlockIndex *pindex)
     CPrivateSend::CheckDSTXes(pindex->nHeight);
 }
 
+static void CheckPrivateSendClient(CConnman& connman)
+{
+    // a periodic task never runs twice at the same time, no lock needed
+    static unsigned int nTick = 0;
+    static unsigned int nDoAutoNextRun = nTick + PRIVATESEND_AUTO_TIMEOUT_MIN;
+
+    if(masternodeSync.IsBlockchainSynced() && !ShutdownRequested()) {
+        nTick++;
+        privateSendClient.CheckTimeout();
+        if(nDoAutoNextRun == nTick) {
+            privateSendClient.DoAutomaticDenominating(connman);
+            nDoAutoNextRun = nTick + PRIVATESEND_AUTO_TIMEOUT_MIN + GetRandInt(PRIVATESEND_AUTO_TIMEOUT_MAX - PRIVATESEND_AUTO_TIMEOUT_MIN);
+        }
+    }
+}
+
 //TODO: Rename/move to core
-void ThreadCheckPrivateSendClient(CConnman& connman)
+void ScheduleCheckPrivateSendClient(CScheduler& scheduler, CConnman& connman)
 {
     if(fLiteMode) return; // disable all Ebakus specific functionality
 
-    static bool fOneThread;
-    if(fOneThread) return;
-    fOneThread = true;
-
-    // Make this thread recognisable as the PrivateSend thread
-    RenameThread("ebakus-ps-client");
-
-    unsigned int nTick = 0;
-    unsigned int nDoAutoNextRun = nTick + PRIVATESEND_AUTO_TIMEOUT_MIN;
-
-    while (true)
-    {
-        MilliSleep(1000);
-
-        if(masternodeSync.IsBlockchainSynced() && !ShutdownRequested()) {
-            nTick++;
-            privateSendClient.CheckTimeout();
-            if(nDoAutoNextRun == nTick) {
-                privateSendClient.DoAutomaticDenominating(connman);
-                nDoAutoNextRun = nTick + PRIVATESEND_AUTO_TIMEOUT_MIN + GetRandInt(PRIVATESEND_AUTO_TIMEOUT_MAX - PRIVATESEND_AUTO_TIMEOUT_MIN);
-            }
-        }
-    }
+    scheduler.scheduleEvery(boost::bind(&CheckPrivateSendClient, boost::ref(connman)), 1, CScheduler::PRIORITY_NORMAL, "privatesend-client");
 }
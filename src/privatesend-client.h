@@ -141,6 +141,6 @@ public:
     void UpdatedBlockTip(const CBlockIndex *pindex);
 };
 
-void ThreadCheckPrivateSendClient(CConnman& connman);
+void ScheduleCheckPrivateSendClient(CScheduler& scheduler, CConnman& connman);
 
 #endif
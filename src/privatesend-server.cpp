@@ -9,6 +9,7 @@
 #include "init.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
+#include "scheduler.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -213,28 +214,18 @@ void CPrivateSendServer::SetState(PoolState nStateNew)
     nState = nStateNew;
 }
 
+static void CheckPrivateSendServer()
+{
+    if(masternodeSync.IsBlockchainSynced() && !ShutdownRequested()) {
+        privateSendServer.CheckTimeout();
+        privateSendServer.CheckForCompleteQueue();
+    }
+}
+
 //TODO: Rename/move to core
-void ThreadCheckPrivateSendServer()
+void ScheduleCheckPrivateSendServer(CScheduler& scheduler)
 {
     if(fLiteMode) return; // disable all Ebakus specific functionality
 
-    static bool fOneThread;
-    if(fOneThread) return;
-    fOneThread = true;
-
-    // Make this thread recognisable as the PrivateSend thread
-    RenameThread("ebakus-ps-server");
-
-    unsigned int nTick = 0;
-
-    while (true)
-    {
-        MilliSleep(1000);
-
-        if(masternodeSync.IsBlockchainSynced() && !ShutdownRequested()) {
-            nTick++;
-            privateSendServer.CheckTimeout();
-            privateSendServer.CheckForCompleteQueue();
-        }
-    }
+    scheduler.scheduleEvery(&CheckPrivateSendServer, 1, CScheduler::PRIORITY_NORMAL, "privatesend-server");
 }
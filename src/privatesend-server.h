@@ -77,6 +77,6 @@ public:
     void CheckForCompleteQueue();
 };
 
-void ThreadCheckPrivateSendServer();
+void ScheduleCheckPrivateSendServer(CScheduler& scheduler);
 
 #endif
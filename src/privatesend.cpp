@@ -12,6 +12,7 @@
 #include "masternode-sync.h"
 #include "masternodeman.h"
 #include "messagesigner.h"
+#include "scheduler.h"
 #include "script/sign.h"
 #include "txmempool.h"
 #include "util.h"
@@ -396,52 +397,65 @@ void CPrivateSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     LogPrint("privatesend", "CPrivateSendClient::SyncTransaction -- txid=%s\n", txHash.ToString());
 }
 
-//TODO: Rename/move to core
-void ThreadCheckPrivateSend()
+static bool IsReadyForMaintenance()
 {
-    if(fLiteMode) return; // disable all Ebakus specific functionality
+    return masternodeSync.IsBlockchainSynced() && !ShutdownRequested();
+}
 
-    static bool fOneThread;
-    if(fOneThread) return;
-    fOneThread = true;
+static void CheckMasternodes()
+{
+    // a periodic task never runs twice at the same time, no lock needed
+    static unsigned int nTick = 0;
 
-    // Make this thread recognisable as the PrivateSend thread
-    RenameThread("ebakus-ps");
+    // try to sync from all available nodes, one step at a time
+    masternodeSync.ProcessTick();
 
-    unsigned int nTick = 0;
+    if(!IsReadyForMaintenance()) return;
 
-    while (true)
-    {
-        MilliSleep(1000);
+    nTick++;
 
-        // try to sync from all available nodes, one step at a time
-        masternodeSync.ProcessTick();
+    // make sure to check all masternodes first
+    mnodeman.Check();
 
-        if(masternodeSync.IsBlockchainSynced() && !ShutdownRequested()) {
+    // check if we should activate or ping every few minutes,
+    // slightly postpone first run to give net thread a chance to connect to some peers
+    if(nTick % MASTERNODE_MIN_MNP_SECONDS == 15)
+        activeMasternode.ManageState();
+}
 
-            nTick++;
+static void CleanUpMasternodes()
+{
+    if(!IsReadyForMaintenance()) return;
 
-            // make sure to check all masternodes first
-            mnodeman.Check();
+    mnodeman.ProcessMasternodeConnections();
+    mnodeman.CheckAndRemove();
+    mnpayments.CheckAndRemove();
+    instantsend.CheckAndRemove();
+}
 
-            // check if we should activate or ping every few minutes,
-            // slightly postpone first run to give net thread a chance to connect to some peers
-            if(nTick % MASTERNODE_MIN_MNP_SECONDS == 15)
-                activeMasternode.ManageState();
+static void VerifyMasternodes()
+{
+    if(!IsReadyForMaintenance()) return;
 
-            if(nTick % 60 == 0) {
-                mnodeman.ProcessMasternodeConnections();
-                mnodeman.CheckAndRemove();
-                mnpayments.CheckAndRemove();
-                instantsend.CheckAndRemove();
-            }
-            if(fMasterNode && (nTick % (60 * 5) == 0)) {
-                mnodeman.DoFullVerificationStep();
-            }
+    mnodeman.DoFullVerificationStep();
+}
 
-            if(nTick % (60 * 5) == 0) {
-                governance.DoMaintenance();
-            }
-        }
-    }
+static void MaintainGovernance()
+{
+    if(!IsReadyForMaintenance()) return;
+
+    governance.DoMaintenance();
+}
+
+//TODO: Rename/move to core
+void ScheduleCheckPrivateSend(CScheduler& scheduler)
+{
+    if(fLiteMode) return; // disable all Ebakus specific functionality
+
+    // the one second tick drives the sync and pings, the slow cleanups must not hold it back
+    scheduler.scheduleEvery(&CheckMasternodes, 1, CScheduler::PRIORITY_NORMAL, "masternode-check");
+    scheduler.scheduleEvery(&CleanUpMasternodes, 60, CScheduler::PRIORITY_LOW, "masternode-cleanup");
+    if(fMasterNode)
+        scheduler.scheduleEvery(&VerifyMasternodes, 60 * 5, CScheduler::PRIORITY_LOW, "masternode-verify");
+    scheduler.scheduleEvery(&MaintainGovernance, 60 * 5, CScheduler::PRIORITY_LOW, "governance-maintenance");
 }
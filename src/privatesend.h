@@ -13,6 +13,7 @@
 #include "utiltime.h"
 
 class CPrivateSend;
+class CScheduler;
 
 // timeouts
 static const int PRIVATESEND_AUTO_TIMEOUT_MIN       = 5;
@@ -355,6 +356,7 @@ public:
     static void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
 };
 
-void ThreadCheckPrivateSend();
+/// Schedule the masternode, payments, InstantSend and governance maintenance tasks
+void ScheduleCheckPrivateSend(CScheduler& scheduler);
 
 #endif
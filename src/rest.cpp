@@ -24,6 +24,8 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const int32_t MAX_REST_BLOCKS = 1000; //blocks per /rest/blocks/ request, each one is buffered until the client reads it
+static const size_t MAX_REST_BLOCKS_BUFFERED_SIZE = 32 * 1000 * 1000; //reply size of /rest/blocks/ when it has to be sent in one piece
 
 enum RetFormat {
     RF_UNDEF,
@@ -72,6 +74,16 @@ static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message
     return false;
 }
 
+/** Stream a JSON reply, large ones never exist as a single string */
+static void RESTWriteJSON(HTTPRequest* req, const UniValue& val)
+{
+    req->WriteHeader("Content-Type", "application/json");
+    HTTPReplyWriter writer(req, HTTP_OK);
+    if (JSONWrite(writer, val))
+        writer.write("\n");
+    writer.finish();
+}
+
 static enum RetFormat ParseDataFormat(std::string& param, const std::string& strReq)
 {
     const std::string::size_type pos = strReq.rfind('.');
@@ -186,9 +198,7 @@ static bool rest_headers(HTTPRequest* req,
         BOOST_FOREACH(const CBlockIndex *pindex, headers) {
             jsonHeaders.push_back(blockheaderToJSON(pindex));
         }
-        string strJSON = jsonHeaders.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        RESTWriteJSON(req, jsonHeaders);
         return true;
     }
     default: {
@@ -248,9 +258,7 @@ static bool rest_block(HTTPRequest* req,
 
     case RF_JSON: {
         UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        RESTWriteJSON(req, objBlock);
         return true;
     }
 
@@ -284,9 +292,7 @@ static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
     case RF_JSON: {
         UniValue rpcParams(UniValue::VARR);
         UniValue chainInfoObject = getblockchaininfo(rpcParams, false);
-        string strJSON = chainInfoObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        RESTWriteJSON(req, chainInfoObject);
         return true;
     }
     default: {
@@ -309,9 +315,7 @@ static bool rest_mempool_info(HTTPRequest* req, const std::string& strURIPart)
     case RF_JSON: {
         UniValue mempoolInfoObject = mempoolInfoToJSON();
 
-        string strJSON = mempoolInfoObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        RESTWriteJSON(req, mempoolInfoObject);
         return true;
     }
     default: {
@@ -334,9 +338,7 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
     case RF_JSON: {
         UniValue mempoolObject = mempoolToJSON(true);
 
-        string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        RESTWriteJSON(req, mempoolObject);
         return true;
     }
     default: {
@@ -385,9 +387,7 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     case RF_JSON: {
         UniValue objTx(UniValue::VOBJ);
         TxToJSON(tx, hashBlock, objTx);
-        string strJSON = objTx.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        RESTWriteJSON(req, objTx);
         return true;
     }
 
@@ -582,9 +582,7 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         objGetUTXOResponse.push_back(Pair("utxos", utxos));
 
         // return json string
-        string strJSON = objGetUTXOResponse.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        RESTWriteJSON(req, objGetUTXOResponse);
         return true;
     }
     default: {
@@ -596,24 +594,109 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No block count specified. Use /rest/blocks/<height>/<count>.<ext>.");
+
+    int32_t nHeight;
+    if (!ParseInt32(path[0], &nHeight) || nHeight < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[0]);
+
+    int32_t count;
+    if (!ParseInt32(path[1], &count) || count < 1 || count > MAX_REST_BLOCKS)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[1]);
+
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    // the range is fixed under cs_main, each block is then read under the lock like in rest_block,
+    // so pruning cannot remove it in between, and sent without holding the lock
+    std::vector<const CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        if (nHeight > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, "Height out of range: " + path[0]);
+
+        for (const CBlockIndex* pindex = chainActive[nHeight]; pindex != NULL; pindex = chainActive.Next(pindex)) {
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available (pruned data)");
+            vIndex.push_back(pindex);
+            if (vIndex.size() == (unsigned long)count)
+                break;
+        }
+    }
+
+    // blocks are sent as they are stored, back to back for .bin and one per line for .hex;
+    // the range is cut at the tip, and at MAX_REST_BLOCKS_BUFFERED_SIZE when the reply
+    // cannot be sent in chunks, so clients count what they got
+    req->WriteHeader("Content-Type", rf == RF_BINARY ? "application/octet-stream" : "text/plain");
+    HTTPReplyWriter writer(req, HTTP_OK);
+    std::vector<unsigned char> vchBlock;
+    size_t nWritten = 0;
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        if (!HTTPReplyWriter::IsChunked() && nWritten >= MAX_REST_BLOCKS_BUFFERED_SIZE)
+            break;
+        const CBlockIndex* pindex = vIndex[i];
+        bool fRead;
+        {
+            LOCK(cs_main);
+            fRead = (pindex->nStatus & BLOCK_HAVE_DATA) &&
+                    ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), Params().MessageStart());
+        }
+        if (!fRead) {
+            // nothing has been written before the first block, later the status is already on its way
+            if (i == 0)
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available");
+            LogPrintf("%s: failed to read block %s, reply ends early\n", __func__, pindex->GetBlockHash().ToString());
+            break;
+        }
+        std::string strBlock;
+        if (rf == RF_BINARY)
+            strBlock.assign(vchBlock.begin(), vchBlock.end());
+        else
+            strBlock = HexStr(vchBlock.begin(), vchBlock.end()) + "\n";
+        nWritten += strBlock.size();
+        if (!writer.write(strBlock))
+            break; // the client went away
+    }
+    writer.finish();
+    return true;
+}
+
+static HTTPWorkQueueClass rest_fast(HTTPRequest* req, const std::string& strReq)
+{
+    return HTTP_QUEUE_FAST;
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
+    bool fFast; // served by the fast work queue
 } uri_prefixes[] = {
-      {"/rest/tx/", rest_tx},
-      {"/rest/block/notxdetails/", rest_block_notxdetails},
-      {"/rest/block/", rest_block_extended},
-      {"/rest/chaininfo", rest_chaininfo},
-      {"/rest/mempool/info", rest_mempool_info},
-      {"/rest/mempool/contents", rest_mempool_contents},
-      {"/rest/headers/", rest_headers},
-      {"/rest/getutxos", rest_getutxos},
+      {"/rest/tx/", rest_tx, false},
+      {"/rest/block/notxdetails/", rest_block_notxdetails, false},
+      {"/rest/block/", rest_block_extended, false},
+      {"/rest/chaininfo", rest_chaininfo, false},
+      {"/rest/mempool/info", rest_mempool_info, true},
+      {"/rest/mempool/contents", rest_mempool_contents, false},
+      {"/rest/headers/", rest_headers, false},
+      {"/rest/getutxos", rest_getutxos, false},
+      {"/rest/blocks/", rest_blocks, false},
 };
 
 bool StartREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
-        RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler);
+        RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler,
+                            uri_prefixes[i].fFast ? HTTPRequestClassifier(rest_fast) : HTTPRequestClassifier());
     return true;
 }
 
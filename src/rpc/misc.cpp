@@ -6,7 +6,9 @@
 
 #include "base58.h"
 #include "clientversion.h"
+#include "httpserver.h"
 #include "init.h"
+#include "metrics.h"
 #include "validation.h"
 #include "net.h"
 #include "netbase.h"
@@ -141,6 +143,119 @@ UniValue debug(const UniValue& params, bool fHelp)
     return "Debug mode: " + (fDebug ? strMode : "off");
 }
 
+UniValue getrpcqueueinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcqueueinfo\n"
+            "Returns the counters of the HTTP work queues serving RPC and REST calls since startup.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\" : \"fast|heavy\",   (string) the queue, cheap calls go to the fast one\n"
+            "    \"threads\" : n,             (numeric) worker threads serving the queue\n"
+            "    \"depth\" : n,               (numeric) calls waiting for a worker\n"
+            "    \"maxdepth\" : n,            (numeric) calls that can wait before new ones are rejected\n"
+            "    \"processed\" : n,           (numeric) calls run\n"
+            "    \"rejected\" : n,            (numeric) calls rejected because the queue was full\n"
+            "    \"avgwaittime\" : n,         (numeric) average time calls waited for a worker, in microseconds\n"
+            "    \"maxwaittime\" : n,         (numeric) longest time a call waited for a worker, in microseconds\n"
+            "    \"avgruntime\" : n,          (numeric) average time to run a call, in microseconds\n"
+            "    \"maxruntime\" : n           (numeric) longest time to run a call, in microseconds\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcqueueinfo", "")
+            + HelpExampleRpc("getrpcqueueinfo", "")
+        );
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const HTTPWorkQueueStats& stats, GetHTTPWorkQueueStats()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.strName));
+        obj.push_back(Pair("threads", stats.nThreads));
+        obj.push_back(Pair("depth", (uint64_t)stats.nDepth));
+        obj.push_back(Pair("maxdepth", (uint64_t)stats.nMaxDepth));
+        obj.push_back(Pair("processed", stats.nProcessed));
+        obj.push_back(Pair("rejected", stats.nRejected));
+        obj.push_back(Pair("avgwaittime", stats.nProcessed ? stats.nTotalWaitTime / (int64_t)stats.nProcessed : 0));
+        obj.push_back(Pair("maxwaittime", stats.nMaxWaitTime));
+        obj.push_back(Pair("avgruntime", stats.nProcessed ? stats.nTotalRunTime / (int64_t)stats.nProcessed : 0));
+        obj.push_back(Pair("maxruntime", stats.nMaxRunTime));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
+UniValue getmetrics(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmetrics ( \"prefix\" )\n"
+            "Returns the counters, gauges and latency histograms collected since startup.\n"
+            "\nArguments:\n"
+            "1. \"prefix\"      (string, optional) Only return metrics whose name starts with this\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\" : \"name\",          (string) the metric name\n"
+            "    \"labels\" : { ... },       (object) the label values telling apart metrics with the same name\n"
+            "    \"type\" : \"counter|gauge|histogram\", (string) the kind of metric\n"
+            "    \"value\" : n,              (numeric) counters and gauges only, the current value\n"
+            "    \"count\" : n,              (numeric) histograms only, values recorded\n"
+            "    \"sum\" : n,                (numeric) histograms only, sum of the values in microseconds\n"
+            "    \"max\" : n,                (numeric) histograms only, largest value in microseconds\n"
+            "    \"quantiles\" : {           (object) histograms only, in microseconds, within 12.5%\n"
+            "      \"0.5\" : n,\n"
+            "      ...\n"
+            "    }\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmetrics", "")
+            + HelpExampleCli("getmetrics", "\"ebakus_block_\"")
+            + HelpExampleRpc("getmetrics", "\"ebakus_block_\"")
+        );
+
+    std::string strPrefix = params.size() > 0 ? params[0].get_str() : std::string();
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const CMetricSnapshot& metric, GetMetricsSnapshot()) {
+        if (metric.strName.compare(0, strPrefix.size(), strPrefix) != 0)
+            continue;
+
+        UniValue labels(UniValue::VOBJ);
+        for (size_t i = 0; i < metric.labels.size(); i++)
+            labels.push_back(Pair(metric.labels[i].first, metric.labels[i].second));
+
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", metric.strName));
+        obj.push_back(Pair("labels", labels));
+        switch (metric.type) {
+        case CMetricSnapshot::COUNTER:
+        case CMetricSnapshot::GAUGE:
+            obj.push_back(Pair("type", metric.type == CMetricSnapshot::COUNTER ? "counter" : "gauge"));
+            obj.push_back(Pair("value", metric.nValue));
+            break;
+        case CMetricSnapshot::HISTOGRAM: {
+            UniValue quantiles(UniValue::VOBJ);
+            for (size_t i = 0; i < metric.vQuantiles.size(); i++)
+                quantiles.push_back(Pair(strprintf("%g", METRIC_QUANTILES[i]), metric.vQuantiles[i]));
+            obj.push_back(Pair("type", "histogram"));
+            obj.push_back(Pair("count", metric.nCount));
+            obj.push_back(Pair("sum", metric.nSum));
+            obj.push_back(Pair("max", metric.nMax));
+            obj.push_back(Pair("quantiles", quantiles));
+            break;
+        }
+        }
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
 UniValue mnsync(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -731,6 +846,10 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"starttxindex\" (number, optional) Skip the transactions of the start block before this position\n"
+            "  \"limit\" (number, optional) Return at most this many deltas per address, the deltas of one\n"
+            "                          transaction are never split. Ask for the next page with \"start\" set to the\n"
+            "                          height and \"starttxindex\" to the blockindex + 1 of the last delta\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -738,6 +857,7 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    \"satoshis\"  (number) The difference of satoshis\n"
             "    \"txid\"  (string) The related txid\n"
             "    \"index\"  (number) The related input or output index\n"
+            "    \"blockindex\"  (number) The position of the transaction in the block\n"
             "    \"height\"  (number) The block height\n"
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
@@ -750,9 +870,13 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
 
     UniValue startValue = find_value(params[0].get_obj(), "start");
     UniValue endValue = find_value(params[0].get_obj(), "end");
+    UniValue startTxIndexValue = find_value(params[0].get_obj(), "starttxindex");
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
 
     int start = 0;
     int end = 0;
+    int startTxIndex = 0;
+    int limit = 0;
 
     if (startValue.isNum() && endValue.isNum()) {
         start = startValue.get_int();
@@ -760,6 +884,23 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         if (end < start) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "End value is expected to be greater than start");
         }
+    } else if (startValue.isNum()) {
+        // open ended range, used when paging
+        start = startValue.get_int();
+    }
+
+    if (startTxIndexValue.isNum()) {
+        startTxIndex = startTxIndexValue.get_int();
+        if (startTxIndex < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "starttxindex is expected to be positive");
+        }
+    }
+
+    if (limitValue.isNum()) {
+        limit = limitValue.get_int();
+        if (limit <= 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "limit is expected to be positive");
+        }
     }
 
     std::vector<std::pair<H160, int> > addresses;
@@ -771,14 +912,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
     for (std::vector<std::pair<H160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
+        if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end, startTxIndex, limit)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
         }
     }
 
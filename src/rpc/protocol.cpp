@@ -54,6 +54,55 @@ string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValu
     return reply.write() + "\n";
 }
 
+static bool JSONFlush(JSONWriteSink& sink, std::string& s)
+{
+    if (s.size() < JSON_WRITE_FLUSH_SIZE)
+        return true;
+    bool fContinue = sink.write(s);
+    s.clear();
+    return fContinue;
+}
+
+/** Containers are walked here, leaves are written by UniValue itself so the escaping stays the same */
+static bool JSONWriteTo(JSONWriteSink& sink, std::string& s, const UniValue& val)
+{
+    if (!val.isArray() && !val.isObject()) {
+        s += val.write();
+        return true;
+    }
+
+    std::vector<std::string> keys;
+    if (val.isObject())
+        keys = val.getKeys();
+    s += val.isObject() ? "{" : "[";
+    for (unsigned int i = 0; i < val.size(); i++) {
+        if (i > 0)
+            s += ",";
+        if (val.isObject())
+            s += UniValue(keys[i]).write() + ":";
+        if (!JSONWriteTo(sink, s, val[i]) || !JSONFlush(sink, s))
+            return false;
+    }
+    s += val.isObject() ? "}" : "]";
+    return true;
+}
+
+bool JSONWrite(JSONWriteSink& sink, const UniValue& val)
+{
+    std::string s;
+    s.reserve(JSON_WRITE_FLUSH_SIZE * 2);
+    if (!JSONWriteTo(sink, s, val))
+        return false;
+    return s.empty() || sink.write(s);
+}
+
+bool JSONRPCWriteReply(JSONWriteSink& sink, const UniValue& result, const UniValue& id)
+{
+    return sink.write("{\"result\":") &&
+           JSONWrite(sink, result) &&
+           sink.write(",\"error\":null,\"id\":" + id.write() + "}\n");
+}
+
 UniValue JSONRPCError(int code, const string& message)
 {
     UniValue error(UniValue::VOBJ);
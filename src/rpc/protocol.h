@@ -80,6 +80,25 @@ enum RPCErrorCode
 std::string JSONRPCRequest(const std::string& strMethod, const UniValue& params, const UniValue& id);
 UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const UniValue& id);
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
+
+/** Receives the output of JSONWrite piece by piece */
+class JSONWriteSink
+{
+public:
+    virtual ~JSONWriteSink() {}
+    /** Return false to stop the serialization, e.g. when the client went away */
+    virtual bool write(const std::string& s) = 0;
+};
+
+/** Pieces handed to a JSONWriteSink are about this large */
+static const size_t JSON_WRITE_FLUSH_SIZE = 65536;
+
+/** Write the same as val.write() to sink, without building the whole string.
+ * Returns false if the sink stopped it.
+ */
+bool JSONWrite(JSONWriteSink& sink, const UniValue& val);
+/** Write the same as JSONRPCReply(result, NullUniValue, id) to sink, without copying result */
+bool JSONRPCWriteReply(JSONWriteSink& sink, const UniValue& result, const UniValue& id);
 UniValue JSONRPCError(int code, const std::string& message);
 
 /** Get name of RPC authentication cookie file */
@@ -26,6 +26,9 @@
 #include <boost/thread.hpp>
 #include <boost/algorithm/string/case_conv.hpp> // for to_upper()
 
+#include <algorithm>
+#include <atomic>
+
 using namespace RPCServer;
 using namespace std;
 
@@ -38,6 +41,9 @@ static std::vector<RPCTimerInterface*> timerInterfaces;
 /* Map of name to timer.
  * @note Can be changed to std::unique_ptr when C++11 */
 static std::map<std::string, boost::shared_ptr<RPCTimerBase> > deadlineTimers;
+/* Runs the entries of batch requests on other threads */
+static RPCBatchDispatcher batchDispatcher;
+static CCriticalSection cs_batchDispatcher;
 
 static struct CRPCSignals
 {
@@ -259,6 +265,8 @@ static const CRPCCommand vRPCCommands[] =
     /* Overall control/query calls */
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
     { "control",            "debug",                  &debug,                  true  },
+    { "control",            "getrpcqueueinfo",        &getrpcqueueinfo,        true  },
+    { "control",            "getmetrics",             &getmetrics,             true  },
     { "control",            "help",                   &help,                   true  },
     { "control",            "stop",                   &stop,                   true  },
 
@@ -528,13 +536,116 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+/** Entries of one batch request, shared with the helper threads working on it.
+ * Helpers may only get to run after the batch is done, so they never touch
+ * the request without first claiming an entry that is still open.
+ */
+struct CRPCBatch
+{
+    const UniValue& vReq;
+    const unsigned int nSize;
+    std::vector<UniValue> vResults;
+    std::atomic<unsigned int> nNextIdx;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    unsigned int nDone;
+
+    CRPCBatch(const UniValue& vReqIn) :
+        vReq(vReqIn), nSize(vReqIn.size()), vResults(vReqIn.size()), nNextIdx(0), nDone(0)
+    {
+    }
+};
+
+static void JSONRPCExecBatchEntries(boost::shared_ptr<CRPCBatch> batch)
 {
+    unsigned int nDone = 0;
+    while (true) {
+        unsigned int reqIdx = batch->nNextIdx++;
+        if (reqIdx >= batch->nSize)
+            break;
+        batch->vResults[reqIdx] = JSONRPCExecOne(batch->vReq[reqIdx]);
+        nDone++;
+    }
+
+    if (nDone > 0) {
+        boost::lock_guard<boost::mutex> lock(batch->mutex);
+        batch->nDone += nDone;
+        batch->cond.notify_all();
+    }
+}
+
+/** Read-only lookups whose results do not depend on the order they run in */
+static const char* const vParallelBatchMethods[] = {
+    "getaddressbalance",
+    "getaddressdeltas",
+    "getaddressmempool",
+    "getaddresstxids",
+    "getaddressutxos",
+    "getbestblockhash",
+    "getblock",
+    "getblockcount",
+    "getblockhash",
+    "getblockhashes",
+    "getblockheader",
+    "getblockheaders",
+    "getrawtransaction",
+    "getspentinfo",
+    "gettxout",
+};
+
+/** Entries of a batch may only run in parallel if all of them are read-only lookups */
+static bool IsParallelBatch(const UniValue& vReq)
+{
+    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++) {
+        if (!vReq[reqIdx].isObject())
+            return false;
+        const UniValue& valMethod = find_value(vReq[reqIdx], "method");
+        if (!valMethod.isStr())
+            return false;
+        const char* const* pend = vParallelBatchMethods + ARRAYLEN(vParallelBatchMethods);
+        if (std::find(vParallelBatchMethods, pend, valMethod.get_str()) == pend)
+            return false;
+    }
+    return true;
+}
+
+UniValue JSONRPCExecBatch(const UniValue& vReq)
+{
+    RPCBatchDispatcher dispatcher;
+    {
+        LOCK(cs_batchDispatcher);
+        dispatcher = batchDispatcher;
+    }
+    int nThreads = std::min((int64_t)GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), (int64_t)vReq.size());
+
+    // anything that may change state runs in the order of the request
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    if (dispatcher.empty() || nThreads <= 1 || !IsParallelBatch(vReq)) {
+        for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
+            ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+        return ret;
+    }
 
-    return ret.write() + "\n";
+    // Entries are handed out one at a time to whichever thread asks next, the
+    // calling thread works on them as well so the batch also completes when no
+    // helper could be queued or all of them are still waiting for a free worker
+    boost::shared_ptr<CRPCBatch> batch(new CRPCBatch(vReq));
+    for (int i = 1; i < nThreads; i++) {
+        if (!dispatcher(boost::bind(&JSONRPCExecBatchEntries, batch)))
+            break;
+    }
+    JSONRPCExecBatchEntries(batch);
+
+    {
+        boost::unique_lock<boost::mutex> lock(batch->mutex);
+        while (batch->nDone < batch->nSize)
+            batch->cond.wait(lock);
+    }
+
+    for (unsigned int reqIdx = 0; reqIdx < batch->nSize; reqIdx++)
+        ret.push_back(batch->vResults[reqIdx]);
+    return ret;
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
@@ -600,6 +711,12 @@ void RPCUnregisterTimerInterface(RPCTimerInterface *iface)
     timerInterfaces.erase(i);
 }
 
+void RPCSetBatchDispatcher(const RPCBatchDispatcher& dispatcher)
+{
+    LOCK(cs_batchDispatcher);
+    batchDispatcher = dispatcher;
+}
+
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds)
 {
     if (timerInterfaces.empty())
@@ -21,6 +21,9 @@
 
 class CRPCCommand;
 
+//! Maximum number of threads working on the entries of one batch request, 1 runs them in order on the calling thread
+static const int DEFAULT_RPC_BATCH_THREADS = 1;
+
 namespace RPCServer
 {
     void OnStarted(boost::function<void ()> slot);
@@ -105,6 +108,14 @@ void RPCRegisterTimerInterface(RPCTimerInterface *iface);
 /** Unregister factory function for timers */
 void RPCUnregisterTimerInterface(RPCTimerInterface *iface);
 
+/** Function running work on another thread, returns false if the work could not be queued.
+ * @note Like the timers this keeps rpcserver independent of the HTTP server, whose
+ * worker threads run the entries of batch requests in parallel.
+ */
+typedef boost::function<bool(const boost::function<void(void)>&)> RPCBatchDispatcher;
+/** Set the dispatcher for batch entries, an empty function runs all entries on the calling thread */
+void RPCSetBatchDispatcher(const RPCBatchDispatcher& dispatcher);
+
 /**
  * Run func nSeconds from now.
  * Overrides previous timer <name> (if any).
@@ -247,6 +258,8 @@ extern UniValue encryptwallet(const UniValue& params, bool fHelp);
 extern UniValue validateaddress(const UniValue& params, bool fHelp);
 extern UniValue getinfo(const UniValue& params, bool fHelp);
 extern UniValue debug(const UniValue& params, bool fHelp);
+extern UniValue getrpcqueueinfo(const UniValue& params, bool fHelp);
+extern UniValue getmetrics(const UniValue& params, bool fHelp);
 extern UniValue getwalletinfo(const UniValue& params, bool fHelp);
 extern UniValue getblockchaininfo(const UniValue& params, bool fHelp);
 extern UniValue getnetworkinfo(const UniValue& params, bool fHelp);
@@ -301,6 +314,6 @@ extern UniValue sentinelping(const UniValue& params, bool fHelp);
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+UniValue JSONRPCExecBatch(const UniValue& vReq);
 
 #endif // BITCOIN_RPCSERVER_H
@@ -4,13 +4,13 @@
 
 #include "scheduler.h"
 
-#include "reverselock.h"
+#include "metrics.h"
+#include "utiltime.h"
 
 #include <assert.h>
-#include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nLastHandle(0), nThreadsServicingQueue(0), nThreadsBusy(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -19,73 +19,113 @@ CScheduler::~CScheduler()
     assert(nThreadsServicingQueue == 0);
 }
 
-
-#if BOOST_VERSION < 105000
-static boost::system_time toPosixTime(const boost::chrono::system_clock::time_point& t)
+CScheduler::TaskQueue::iterator CScheduler::nextTask(TimePoint now)
 {
-    return boost::posix_time::from_time_t(boost::chrono::system_clock::to_time_t(t));
+    // low priority tasks must leave at least one free thread for the others,
+    // the calling thread is free itself
+    bool fLowAllowed = nThreadsServicingQueue == 1 || nThreadsServicingQueue - nThreadsBusy > 1;
+
+    TaskQueue::iterator itBest = taskQueue.end();
+    Priority priorityBest = PRIORITY_LOW;
+    for (TaskQueue::iterator it = taskQueue.begin(); it != taskQueue.end() && it->first <= now; ++it) {
+        Priority priority = mapTasks[it->second].priority;
+        if (priority == PRIORITY_LOW && !fLowAllowed)
+            continue;
+        // the queue is in time order, so among equal priorities the earliest wins
+        if (itBest == taskQueue.end() || priority < priorityBest) {
+            itBest = it;
+            priorityBest = priority;
+        }
+        if (priority == PRIORITY_HIGH)
+            break;
+    }
+    return itBest;
 }
-#endif
 
 void CScheduler::serviceQueue()
 {
-    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::unique_lock<std::mutex> lock(newTaskMutex);
     ++nThreadsServicingQueue;
 
     // newTaskMutex is locked throughout this loop EXCEPT
     // when the thread is waiting or when the user's function
     // is called.
     while (!shouldStop()) {
-        try {
-            while (!shouldStop() && taskQueue.empty()) {
-                // Wait until there is something to do.
+        TimePoint now = std::chrono::system_clock::now();
+        TaskQueue::iterator it = nextTask(now);
+        if (it == taskQueue.end()) {
+            // Wait until there is a new task or the next task in the future
+            // is due. A low priority task held back for lack of free threads
+            // is picked up by the next thread that finishes its task.
+            TaskQueue::iterator itNext = taskQueue.upper_bound(now);
+            if (itNext == taskQueue.end())
                 newTaskScheduled.wait(lock);
-            }
-
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
-// wait_until needs boost 1.50 or later; older versions have timed_wait:
-#if BOOST_VERSION < 105000
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.timed_wait(lock, toPosixTime(taskQueue.begin()->first))) {
-                // Keep waiting until timeout
-            }
-#else
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty() &&
-                   newTaskScheduled.wait_until<>(lock, taskQueue.begin()->first) != boost::cv_status::timeout) {
-                // Keep waiting until timeout
-            }
-#endif
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
-                continue;
-
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
-
-            {
-                // Unlock before calling f, so it can reschedule itself or another task
-                // without deadlocking:
-                reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
-            }
+            else
+                newTaskScheduled.wait_until(lock, itNext->first);
+            continue;
+        }
+
+        Handle handle = it->second;
+        taskQueue.erase(it);
+
+        Task& task = mapTasks[handle];
+        task.fRunning = true;
+        nThreadsBusy++;
+        Function f = task.f;
+        CMetricHistogram* pmetricRunTime = task.pmetricRunTime;
+        task.pmetricDelay->ObserveMicros(std::chrono::duration_cast<std::chrono::microseconds>(now - task.time).count());
+
+        try {
+            // Unlock before calling f, so it can reschedule itself or another task
+            // without deadlocking:
+            lock.unlock();
+            int64_t nTimeStart = GetTimeMicros();
+            f();
+            pmetricRunTime->ObserveMicros(GetTimeMicros() - nTimeStart);
+            lock.lock();
         } catch (...) {
+            lock.lock();
+            finishTask(handle);
             --nThreadsServicingQueue;
+            newTaskScheduled.notify_all();
             throw;
         }
+        finishTask(handle);
     }
     --nThreadsServicingQueue;
-    newTaskScheduled.notify_one();
+    newTaskScheduled.notify_all();
+}
+
+void CScheduler::finishTask(Handle handle)
+{
+    std::map<Handle, Task>::iterator it = mapTasks.find(handle);
+    assert(it != mapTasks.end());
+    Task& task = it->second;
+
+    task.fRunning = false;
+    nThreadsBusy--;
+
+    if (task.interval == std::chrono::system_clock::duration::zero() || task.fCancelled) {
+        mapTasks.erase(it);
+        return;
+    }
+
+    // Keep the cadence. If the task ran late or took longer than its
+    // interval, the missed runs are coalesced into a single one right away.
+    TimePoint now = std::chrono::system_clock::now();
+    task.time += task.interval;
+    if (task.time < now) {
+        int64_t nSkipped = (now - task.time) / task.interval;
+        task.time += task.interval * nSkipped;
+        task.pmetricCoalesced->Inc(nSkipped);
+    }
+    taskQueue.insert(std::make_pair(task.time, handle));
 }
 
 void CScheduler::stop(bool drain)
 {
     {
-        boost::unique_lock<boost::mutex> lock(newTaskMutex);
+        std::unique_lock<std::mutex> lock(newTaskMutex);
         if (drain)
             stopWhenEmpty = true;
         else
@@ -94,35 +134,91 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+CScheduler::Handle CScheduler::scheduleTask(CScheduler::Function f, TimePoint t, Priority priority, const std::string& strName, std::chrono::system_clock::duration interval)
 {
+    // the registry takes its own lock, look the metrics up before taking ours
+    MetricLabels labels{{"task", strName.empty() ? "other" : strName}};
+    Task task;
+    task.f = f;
+    task.time = t;
+    task.priority = priority;
+    task.strName = strName;
+    task.interval = interval;
+    task.fRunning = false;
+    task.fCancelled = false;
+    task.pmetricRunTime = &GetMetricHistogram("ebakus_scheduler_run_seconds", "Time spent running a scheduler task", labels);
+    task.pmetricDelay = &GetMetricHistogram("ebakus_scheduler_delay_seconds", "Time a scheduler task waited for a thread after it was due", labels);
+    task.pmetricCoalesced = &GetMetricCounter("ebakus_scheduler_coalesced_total", "Runs of a periodic scheduler task skipped because it was late", labels);
+
+    bool fPeriodicByName = interval != std::chrono::system_clock::duration::zero() && !strName.empty();
+
+    Handle handle;
     {
-        boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        std::unique_lock<std::mutex> lock(newTaskMutex);
+        if (fPeriodicByName) {
+            std::map<std::string, Handle>::const_iterator it = mapPeriodicTasks.find(strName);
+            if (it != mapPeriodicTasks.end())
+                return it->second;
+        }
+        handle = ++nLastHandle;
+        taskQueue.insert(std::make_pair(t, handle));
+        mapTasks.insert(std::make_pair(handle, task));
+        if (fPeriodicByName)
+            mapPeriodicTasks[strName] = handle;
     }
     newTaskScheduled.notify_one();
+    return handle;
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::Handle CScheduler::schedule(CScheduler::Function f, TimePoint t, Priority priority, const std::string& strName)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    return scheduleTask(f, t, priority, strName, std::chrono::system_clock::duration::zero());
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::Handle CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds, Priority priority, const std::string& strName)
 {
-    f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    return schedule(f, std::chrono::system_clock::now() + std::chrono::seconds(deltaSeconds), priority, strName);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::Handle CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds, Priority priority, const std::string& strName)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    assert(deltaSeconds > 0);
+    return scheduleTask(f, std::chrono::system_clock::now() + std::chrono::seconds(deltaSeconds), priority, strName, std::chrono::seconds(deltaSeconds));
+}
+
+bool CScheduler::cancel(Handle handle)
+{
+    std::unique_lock<std::mutex> lock(newTaskMutex);
+    std::map<Handle, Task>::iterator it = mapTasks.find(handle);
+    if (it == mapTasks.end())
+        return false;
+    Task& task = it->second;
+
+    if (!task.strName.empty() && mapPeriodicTasks.count(task.strName) && mapPeriodicTasks[task.strName] == handle)
+        mapPeriodicTasks.erase(task.strName);
+
+    if (task.fRunning) {
+        if (task.interval == std::chrono::system_clock::duration::zero())
+            return false;
+        // finishTask drops it after the current run
+        task.fCancelled = true;
+        return true;
+    }
+
+    std::pair<TaskQueue::iterator, TaskQueue::iterator> range = taskQueue.equal_range(task.time);
+    for (TaskQueue::iterator itQueue = range.first; itQueue != range.second; ++itQueue) {
+        if (itQueue->second == handle) {
+            taskQueue.erase(itQueue);
+            break;
+        }
+    }
+    mapTasks.erase(it);
+    return true;
 }
 
-size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
-                             boost::chrono::system_clock::time_point &last) const
+size_t CScheduler::getQueueInfo(TimePoint &first, TimePoint &last) const
 {
-    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::unique_lock<std::mutex> lock(newTaskMutex);
     size_t result = taskQueue.size();
     if (!taskQueue.empty()) {
         first = taskQueue.begin()->first;
@@ -5,15 +5,19 @@
 #ifndef BITCOIN_SCHEDULER_H
 #define BITCOIN_SCHEDULER_H
 
-//
-// NOTE:
-// boost::thread / boost::function / boost::chrono should be ported to
-// std::thread / std::function / std::chrono when we support C++11.
-//
-#include <boost/function.hpp>
-#include <boost/chrono/chrono.hpp>
-#include <boost/thread.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+class CMetricCounter;
+class CMetricHistogram;
+
+//! Threads servicing the scheduler queue
+static const int DEFAULT_SCHEDULER_THREADS = 2;
 
 //
 // Simple class for background tasks that should be run
@@ -24,13 +28,19 @@
 // CScheduler* s = new CScheduler();
 // s->scheduleFromNow(doSomething, 11); // Assuming a: void doSomething() { }
 // s->scheduleFromNow(boost::bind(Class::func, this, argument), 3);
+// CScheduler::Handle h = s->scheduleEvery(doMaintenance, 60, CScheduler::PRIORITY_LOW, "maintenance");
 // boost::thread* t = new boost::thread(boost::bind(CScheduler::serviceQueue, s));
 //
-// ... then at program shutdown, clean up the thread running serviceQueue:
-// t->interrupt();
+// ... then at program shutdown, clean up the threads running serviceQueue:
+// s->stop();
 // t->join();
 // delete t;
-// delete s; // Must be done after thread is interrupted/joined.
+// delete s; // Must be done after the threads are stopped/joined.
+//
+// Any number of threads can service the queue. Due tasks run in priority
+// order, and low priority tasks never take the last free thread, so slow
+// maintenance jobs cannot hold back time sensitive ones. Run times and
+// delays are accounted per task name in the metrics registry.
 //
 
 class CScheduler
@@ -39,25 +49,39 @@ public:
     CScheduler();
     ~CScheduler();
 
-    typedef boost::function<void(void)> Function;
+    typedef std::function<void(void)> Function;
+    typedef std::chrono::system_clock::time_point TimePoint;
+    //! Identifies a scheduled task, 0 is never a valid handle
+    typedef uint64_t Handle;
+
+    enum Priority {
+        PRIORITY_HIGH,      // time sensitive, runs first when several tasks are due
+        PRIORITY_NORMAL,
+        PRIORITY_LOW,       // slow maintenance, never runs on the last free thread
+    };
 
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    Handle schedule(Function f, TimePoint t, Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    Handle scheduleFromNow(Function f, int64_t deltaSeconds, Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
-    // Another convenience method: call f approximately
-    // every deltaSeconds forever, starting deltaSeconds from now.
-    // To be more precise: every time f is finished, it
-    // is rescheduled to run deltaSeconds later. If you
-    // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    // Another convenience method: call f every deltaSeconds
+    // forever, starting deltaSeconds from now. A periodic task
+    // never runs twice at the same time: runs missed while it
+    // was still running or waiting for a thread are coalesced
+    // into one, keeping the original cadence. Scheduling a named
+    // periodic task again returns the handle of the existing one.
+    Handle scheduleEvery(Function f, int64_t deltaSeconds, Priority priority = PRIORITY_NORMAL, const std::string& strName = "");
 
-    // To keep things as simple as possible, there is no unschedule.
+    // Remove a task from the queue. A periodic task that is
+    // running finishes its current run and is not rescheduled.
+    // Returns false if the task is unknown or a one-off task
+    // that already started.
+    bool cancel(Handle handle);
 
-    // Services the queue 'forever'. Should be run in a thread,
-    // and interrupted using boost::interrupt_thread
+    // Services the queue until stop() is called. Should be run
+    // in one or more threads.
     void serviceQueue();
 
     // Tell any threads running serviceQueue to stop as soon as they're
@@ -67,17 +91,42 @@ public:
 
     // Returns number of tasks waiting to be serviced,
     // and first and last task times
-    size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
-                        boost::chrono::system_clock::time_point &last) const;
+    size_t getQueueInfo(TimePoint &first, TimePoint &last) const;
 
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
-    boost::condition_variable newTaskScheduled;
-    mutable boost::mutex newTaskMutex;
+    struct Task
+    {
+        Function f;
+        TimePoint time;
+        Priority priority;
+        std::string strName;
+        std::chrono::system_clock::duration interval; // zero for one-off tasks
+        bool fRunning;
+        bool fCancelled;
+        CMetricHistogram* pmetricRunTime;
+        CMetricHistogram* pmetricDelay;
+        CMetricCounter* pmetricCoalesced;
+    };
+
+    typedef std::multimap<TimePoint, Handle> TaskQueue;
+
+    std::map<Handle, Task> mapTasks;
+    TaskQueue taskQueue;
+    std::map<std::string, Handle> mapPeriodicTasks;
+    std::condition_variable newTaskScheduled;
+    mutable std::mutex newTaskMutex;
+    Handle nLastHandle;
     int nThreadsServicingQueue;
+    int nThreadsBusy; // threads running a task
     bool stopRequested;
     bool stopWhenEmpty;
-    bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    bool shouldStop() const { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+
+    Handle scheduleTask(Function f, TimePoint t, Priority priority, const std::string& strName, std::chrono::system_clock::duration interval);
+    // The due task to run next, taskQueue.end() if none can run now
+    TaskQueue::iterator nextTask(TimePoint now);
+    // Bookkeeping after a run, reschedules periodic tasks
+    void finishTask(Handle handle);
 };
 
 #endif
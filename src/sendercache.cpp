@@ -0,0 +1,98 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sendercache.h"
+
+#include "hash.h"
+#include "memusage.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "random.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace {
+
+class CSenderCacheHasher
+{
+public:
+    size_t operator()(const H256& key) const {
+        return key.GetCheapHash();
+    }
+};
+
+/**
+ * Recovered sender cache. Public key recovery is the most expensive part of
+ * handling an account transaction, and the address index needs the sender
+ * both when a block is connected and when it is disconnected again.
+ */
+class CSenderCache
+{
+private:
+    //! Entries are keyed by Hash(txhash || signature), the signature is not part of the txid
+    typedef boost::unordered_map<H256, CPubKey, CSenderCacheHasher> map_type;
+    map_type mapSenders;
+    boost::shared_mutex cs_sendercache;
+
+public:
+    static H256 ComputeEntry(const CTransaction& tx)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << tx.GetHash() << tx.mSignature;
+        return ss.GetHash();
+    }
+
+    bool Get(const H256& entry, CPubKey& pubkeyRet)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sendercache);
+        map_type::const_iterator it = mapSenders.find(entry);
+        if (it == mapSenders.end())
+            return false;
+        pubkeyRet = it->second;
+        return true;
+    }
+
+    void Set(const H256& entry, const CPubKey& pubkey)
+    {
+        size_t nMaxCacheSize = GetArg("-maxsendercachesize", DEFAULT_MAX_SENDER_CACHE_SIZE) * ((size_t) 1 << 20);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_sendercache);
+        while (memusage::DynamicUsage(mapSenders) > nMaxCacheSize)
+        {
+            map_type::size_type s = GetRand(mapSenders.bucket_count());
+            map_type::local_iterator it = mapSenders.begin(s);
+            if (it != mapSenders.end(s)) {
+                mapSenders.erase(it->first);
+            }
+        }
+
+        mapSenders.insert(std::make_pair(entry, pubkey));
+    }
+};
+
+CSenderCache senderCache;
+
+}
+
+bool RecoverTransactionSender(const CTransaction& tx, CPubKey& pubkeyRet)
+{
+    H256 entry = CSenderCache::ComputeEntry(tx);
+    if (senderCache.Get(entry, pubkeyRet))
+        return true;
+
+    pubkeyRet = tx.GetSenderPubKey();
+    if (!pubkeyRet.IsValid())
+        return false;
+
+    senderCache.Set(entry, pubkeyRet);
+    return true;
+}
+
+bool GetCachedTransactionSender(const CTransaction& tx, CPubKey& pubkeyRet)
+{
+    return senderCache.Get(CSenderCache::ComputeEntry(tx), pubkeyRet);
+}
@@ -0,0 +1,25 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SENDERCACHE_H
+#define SENDERCACHE_H
+
+class CPubKey;
+class CTransaction;
+
+/** Default for -maxsendercachesize, the memory (in MiB) used for recovered senders */
+static const unsigned int DEFAULT_MAX_SENDER_CACHE_SIZE = 16;
+
+/**
+ * Recover the public key that signed tx, consulting the recovered sender
+ * cache first. Successful recoveries are cached, keyed by the transaction
+ * hash and its signature, so the address index does not pay for ECDSA
+ * recovery again when a block is disconnected or the executor runs it.
+ */
+bool RecoverTransactionSender(const CTransaction& tx, CPubKey& pubkeyRet);
+
+/** Look up the sender of tx in the cache only, without recovering it */
+bool GetCachedTransactionSender(const CTransaction& tx, CPubKey& pubkeyRet);
+
+#endif // SENDERCACHE_H
@@ -304,6 +304,16 @@ public:
         clear();
     }
 
+    /**
+     * Exchange the underlying buffer with data without copying.
+     * The read position is reset, so bytes already consumed from
+     * this stream are handed over together with the rest.
+     */
+    void swap(CSerializeData &data) {
+        vch.swap(data);
+        nReadPos = 0;
+    }
+
     /**
      * XOR the contents of this stream with a certain key.
      *
@@ -0,0 +1,126 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "txdb.h"
+#include "validation.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestingSetup)
+
+static CTransaction BuildTransaction(const CKey& keySender, const CKeyID& receiver, CAmount nAmount)
+{
+    CMutableTransaction mtx;
+    mtx.mAmount = nAmount;
+    mtx.mReceiver = receiver;
+    mtx.mData = Bytes(1, 0x01);
+    mtx.Sign(keySender);
+    return CTransaction(mtx);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_account_entries)
+{
+    CKey keySender, keyReceiver;
+    keySender.MakeNewKey(true);
+    keyReceiver.MakeNewKey(true);
+    CKeyID sender = keySender.GetPubKey().GetID();
+    CKeyID receiver = keyReceiver.GetPubKey().GetID();
+
+    CTransaction tx(BuildTransaction(keySender, receiver, 500));
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    GetAccountAddressIndex(tx, 7, 2, addressIndex);
+    BOOST_REQUIRE_EQUAL(addressIndex.size(), 2U);
+
+    BOOST_CHECK(addressIndex[0].first.hashBytes == sender);
+    BOOST_CHECK(addressIndex[0].first.spending);
+    BOOST_CHECK_EQUAL(addressIndex[0].second, -500);
+    BOOST_CHECK(addressIndex[1].first.hashBytes == receiver);
+    BOOST_CHECK(!addressIndex[1].first.spending);
+    BOOST_CHECK_EQUAL(addressIndex[1].second, 500);
+    for (size_t i = 0; i < addressIndex.size(); i++) {
+        BOOST_CHECK_EQUAL(addressIndex[i].first.type, 1U);
+        BOOST_CHECK_EQUAL(addressIndex[i].first.blockHeight, 7);
+        BOOST_CHECK_EQUAL(addressIndex[i].first.txindex, 2U);
+        BOOST_CHECK(addressIndex[i].first.txhash == tx.GetHash());
+    }
+
+    // without a signature there is no sender, the receiver is still credited
+    CMutableTransaction mtxUnsigned;
+    mtxUnsigned.mAmount = 5;
+    mtxUnsigned.mReceiver = receiver;
+    addressIndex.clear();
+    GetAccountAddressIndex(CTransaction(mtxUnsigned), 7, 3, addressIndex);
+    BOOST_REQUIRE_EQUAL(addressIndex.size(), 1U);
+    BOOST_CHECK(addressIndex[0].first.hashBytes == receiver);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_write_and_read)
+{
+    bool fAddressIndexPrev = fAddressIndex;
+    fAddressIndex = true;
+
+    CKey keySender, keyReceiver;
+    keySender.MakeNewKey(true);
+    keyReceiver.MakeNewKey(true);
+    CKeyID sender = keySender.GetPubKey().GetID();
+    CKeyID receiver = keyReceiver.GetPubKey().GetID();
+
+    // three blocks, the last one with two transactions from the sender
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    GetAccountAddressIndex(BuildTransaction(keySender, receiver, 10), 1, 0, addressIndex);
+    GetAccountAddressIndex(BuildTransaction(keySender, receiver, 20), 2, 0, addressIndex);
+    GetAccountAddressIndex(BuildTransaction(keySender, receiver, 30), 3, 0, addressIndex);
+    GetAccountAddressIndex(BuildTransaction(keySender, receiver, 40), 3, 1, addressIndex);
+    BOOST_CHECK(pblocktree->WriteAddressIndex(addressIndex));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > result;
+    BOOST_CHECK(GetAddressIndex(sender, 1, result));
+    BOOST_REQUIRE_EQUAL(result.size(), 4U);
+    CAmount nBalance = 0;
+    for (size_t i = 0; i < result.size(); i++) {
+        BOOST_CHECK(result[i].first.spending);
+        nBalance += result[i].second;
+    }
+    BOOST_CHECK_EQUAL(nBalance, -100);
+    BOOST_CHECK_EQUAL(result[3].first.blockHeight, 3);
+    BOOST_CHECK_EQUAL(result[3].first.txindex, 1U);
+
+    // a height range
+    result.clear();
+    BOOST_CHECK(GetAddressIndex(receiver, 1, result, 2, 2));
+    BOOST_REQUIRE_EQUAL(result.size(), 1U);
+    BOOST_CHECK_EQUAL(result[0].second, 20);
+
+    // pages of two, the next page starts after the last transaction returned
+    result.clear();
+    BOOST_CHECK(GetAddressIndex(receiver, 1, result, 0, 0, 0, 2));
+    BOOST_REQUIRE_EQUAL(result.size(), 2U);
+    BOOST_CHECK_EQUAL(result[1].first.blockHeight, 2);
+    result.clear();
+    BOOST_CHECK(GetAddressIndex(receiver, 1, result, 3, 0, 0, 1));
+    BOOST_REQUIRE_EQUAL(result.size(), 1U);
+    BOOST_CHECK_EQUAL(result[0].second, 30);
+    result.clear();
+    BOOST_CHECK(GetAddressIndex(receiver, 1, result, 3, 0, 1, 1));
+    BOOST_REQUIRE_EQUAL(result.size(), 1U);
+    BOOST_CHECK_EQUAL(result[0].second, 40);
+
+    // disconnecting produces the same keys and removes the entries
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndexTip(addressIndex.begin() + 4, addressIndex.end());
+    BOOST_CHECK(pblocktree->EraseAddressIndex(addressIndexTip));
+    result.clear();
+    BOOST_CHECK(GetAddressIndex(receiver, 1, result));
+    BOOST_CHECK_EQUAL(result.size(), 2U);
+    result.clear();
+    BOOST_CHECK(GetAddressIndex(sender, 1, result));
+    BOOST_CHECK_EQUAL(result.size(), 2U);
+
+    fAddressIndex = fAddressIndexPrev;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,139 @@
+// Copyright (c) 2011-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, TestingSetup)
+
+static CMutableTransaction BuildTransaction(unsigned char nSeed)
+{
+    CMutableTransaction tx;
+    tx.mAmount = 1000 + nSeed;
+    tx.mData = Bytes(1, nSeed);
+    tx.mSignature = Bytes(65, nSeed);
+    return tx;
+}
+
+static CBlock BuildBlock()
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.nBits = 0x207fffff;
+    block.nTime = 1;
+    block.vtx.push_back(CTransaction(BuildTransaction(0)));
+    block.vtx.push_back(CTransaction(BuildTransaction(1)));
+    block.vtx.push_back(CTransaction(BuildTransaction(2)));
+    return block;
+}
+
+static CBlockHeaderAndShortTxIDs RoundTrip(const CBlockHeaderAndShortTxIDs& shortIDs)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+    return shortIDs2;
+}
+
+BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlock());
+
+    CMutableTransaction tx1(block.vtx[1]);
+    pool.addUnchecked(block.vtx[1].GetHash(), entry.FromTx(tx1));
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    BOOST_CHECK_EQUAL(shortIDs.BlockTxCount(), 3U);
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(RoundTrip(shortIDs)) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0)); // prefilled
+    BOOST_CHECK(partialBlock.IsTxAvailable(1)); // from the mempool
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+
+    // exactly the one missing transaction has to be supplied
+    CBlock block2;
+    std::vector<CTransaction> vtx_missing;
+    BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_INVALID);
+    vtx_missing.push_back(block.vtx[2]);
+    vtx_missing.push_back(block.vtx[1]);
+    BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(SignatureMismatchTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlock());
+
+    // same hash as the block's transaction, but signed differently
+    CMutableTransaction txOther(block.vtx[1]);
+    txOther.mSignature = Bytes(65, 0xff);
+    BOOST_CHECK(CTransaction(txOther).GetHash() == block.vtx[1].GetHash());
+    BOOST_CHECK(CTransaction(txOther).GetFullHash() != block.vtx[1].GetFullHash());
+    pool.addUnchecked(txOther.GetHash(), entry.FromTx(txOther));
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(RoundTrip(shortIDs)) == READ_STATUS_OK);
+    BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolEntryFullHashTest)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction tx(BuildTransaction(7));
+    CTxMemPoolEntry poolEntry(entry.FromTx(tx));
+    BOOST_CHECK(poolEntry.GetFullHash() == CTransaction(tx).GetFullHash());
+    BOOST_CHECK(poolEntry.GetFullHash() != poolEntry.GetTx().GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(EmptyBlockTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block(BuildBlock());
+    block.vtx.clear();
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    BOOST_CHECK_EQUAL(shortIDs.BlockTxCount(), 0U);
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(RoundTrip(shortIDs)) == READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest)
+{
+    BlockTransactionsRequest req1;
+    req1.blockhash = GetRandHash();
+    req1.indexes.resize(4);
+    req1.indexes[0] = 0;
+    req1.indexes[1] = 1;
+    req1.indexes[2] = 3;
+    req1.indexes[3] = 4;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req1;
+
+    BlockTransactionsRequest req2;
+    stream >> req2;
+
+    BOOST_CHECK(req1.blockhash == req2.blockhash);
+    BOOST_CHECK_EQUAL(req1.indexes.size(), req2.indexes.size());
+    BOOST_CHECK_EQUAL(req1.indexes[0], req2.indexes[0]);
+    BOOST_CHECK_EQUAL(req1.indexes[1], req2.indexes[1]);
+    BOOST_CHECK_EQUAL(req1.indexes[2], req2.indexes[2]);
+    BOOST_CHECK_EQUAL(req1.indexes[3], req2.indexes[3]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,135 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "expiryindex.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(expiryindex_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(expiryindex_insert_and_expire)
+{
+    CExpiryIndex<int> index;
+    index.Set(1, 30);
+    index.Set(2, 10);
+    index.Set(3, 20);
+    index.Set(4, 10);
+    BOOST_CHECK_EQUAL(index.size(), 4);
+
+    // nothing expires before the earliest entry
+    std::vector<int> vecExpired;
+    index.PopExpired(9, vecExpired);
+    BOOST_CHECK(vecExpired.empty());
+    BOOST_CHECK_EQUAL(index.size(), 4);
+
+    // expiry is inclusive, keys come out in expiry order and in insertion order on ties
+    index.PopExpired(20, vecExpired);
+    BOOST_REQUIRE_EQUAL(vecExpired.size(), 3);
+    BOOST_CHECK_EQUAL(vecExpired[0], 2);
+    BOOST_CHECK_EQUAL(vecExpired[1], 4);
+    BOOST_CHECK_EQUAL(vecExpired[2], 3);
+    BOOST_CHECK_EQUAL(index.size(), 1);
+
+    // popped keys are gone, new ones are appended to the vector
+    index.PopExpired(20, vecExpired);
+    BOOST_CHECK_EQUAL(vecExpired.size(), 3);
+    index.PopExpired(100, vecExpired);
+    BOOST_REQUIRE_EQUAL(vecExpired.size(), 4);
+    BOOST_CHECK_EQUAL(vecExpired[3], 1);
+    BOOST_CHECK_EQUAL(index.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(expiryindex_update)
+{
+    CExpiryIndex<int> index;
+    index.Set(1, 10);
+    index.Set(2, 20);
+
+    // setting a key again replaces its expiry instead of adding a second entry
+    index.Set(1, 30);
+    BOOST_CHECK_EQUAL(index.size(), 2);
+    index.Set(2, 20);
+    BOOST_CHECK_EQUAL(index.size(), 2);
+
+    std::vector<int> vecExpired;
+    index.PopExpired(10, vecExpired);
+    BOOST_CHECK(vecExpired.empty());
+    index.PopExpired(20, vecExpired);
+    BOOST_REQUIRE_EQUAL(vecExpired.size(), 1);
+    BOOST_CHECK_EQUAL(vecExpired[0], 2);
+
+    // moving a key earlier works as well
+    index.Set(1, 5);
+    index.PopExpired(5, vecExpired);
+    BOOST_REQUIRE_EQUAL(vecExpired.size(), 2);
+    BOOST_CHECK_EQUAL(vecExpired[1], 1);
+    BOOST_CHECK_EQUAL(index.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(expiryindex_erase)
+{
+    CExpiryIndex<int> index;
+    index.Set(1, 10);
+    index.Set(2, 10);
+    index.Set(3, 20);
+
+    index.Erase(2);
+    BOOST_CHECK_EQUAL(index.size(), 2);
+    // erasing an unknown or already erased key is a no-op
+    index.Erase(2);
+    index.Erase(42);
+    BOOST_CHECK_EQUAL(index.size(), 2);
+
+    std::vector<int> vecExpired;
+    index.PopExpired(20, vecExpired);
+    BOOST_REQUIRE_EQUAL(vecExpired.size(), 2);
+    BOOST_CHECK_EQUAL(vecExpired[0], 1);
+    BOOST_CHECK_EQUAL(vecExpired[1], 3);
+
+    // an erased key can be registered again
+    index.Set(2, 30);
+    index.Clear();
+    BOOST_CHECK_EQUAL(index.size(), 0);
+    vecExpired.clear();
+    index.PopExpired(100, vecExpired);
+    BOOST_CHECK(vecExpired.empty());
+}
+
+BOOST_AUTO_TEST_CASE(expiryindex_rekey)
+{
+    // re-keying many entries keeps both sides of the index consistent
+    CExpiryIndex<int> index;
+    for (int i = 0; i < 100; i++) {
+        index.Set(i, i);
+    }
+    // reverse the order: key i now expires at 200 - i
+    for (int i = 0; i < 100; i++) {
+        index.Set(i, 200 - i);
+    }
+    BOOST_CHECK_EQUAL(index.size(), 100);
+
+    std::vector<int> vecExpired;
+    index.PopExpired(99, vecExpired);
+    BOOST_CHECK(vecExpired.empty());
+    index.PopExpired(150, vecExpired);
+    BOOST_REQUIRE_EQUAL(vecExpired.size(), 50);
+    for (size_t i = 0; i < vecExpired.size(); i++) {
+        BOOST_CHECK_EQUAL(vecExpired[i], 99 - (int)i);
+    }
+    BOOST_CHECK_EQUAL(index.size(), 50);
+
+    // the remaining keys still re-key and erase cleanly
+    index.Set(0, 151);
+    index.Erase(1);
+    vecExpired.clear();
+    index.PopExpired(151, vecExpired);
+    BOOST_REQUIRE_EQUAL(vecExpired.size(), 2);
+    BOOST_CHECK_EQUAL(vecExpired[0], 49);
+    BOOST_CHECK_EQUAL(vecExpired[1], 0);
+    BOOST_CHECK_EQUAL(index.size(), 47);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,141 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flat-database.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+/** Set of values that journals the values it gains, like CMasternodePayments does with its votes */
+class CFlatDBTestObject
+{
+public:
+    typedef int journal_entry_t;
+
+    std::set<int> setValues;
+    std::vector<int> vecJournal;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(setValues);
+    }
+
+    void Add(int nValue)
+    {
+        setValues.insert(nValue);
+        vecJournal.push_back(nValue);
+    }
+
+    void Clear() { setValues.clear(); vecJournal.clear(); }
+    void CheckAndRemove() {}
+    std::string ToString() const { return strprintf("Values: %d", (int)setValues.size()); }
+
+    size_t GetJournalEntries(std::vector<int>& vecEntriesRet)
+    {
+        vecEntriesRet.insert(vecEntriesRet.end(), vecJournal.begin(), vecJournal.end());
+        return vecJournal.size();
+    }
+    size_t GetJournalSize() { return vecJournal.size(); }
+    void DiscardJournalEntries(size_t nCount) { vecJournal.erase(vecJournal.begin(), vecJournal.begin() + std::min(nCount, vecJournal.size())); }
+    void ApplyJournalEntry(const int& nValue) { setValues.insert(nValue); }
+};
+
+BOOST_FIXTURE_TEST_SUITE(flatdb_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(flatdb_journal_replay)
+{
+    CFlatDB<CFlatDBTestObject> flatdb("flatdbtest.dat", "magicFlatDBTest");
+    boost::filesystem::path pathJournal = GetDataDir() / "flatdbtest.dat.log";
+
+    CFlatDBTestObject obj;
+    obj.Add(1);
+    obj.Add(2);
+    // no snapshot yet, the first append writes one
+    BOOST_CHECK(flatdb.Append(obj));
+    BOOST_CHECK(obj.vecJournal.empty());
+    BOOST_CHECK(!boost::filesystem::exists(pathJournal));
+
+    obj.Add(3);
+    obj.Add(4);
+    BOOST_CHECK(flatdb.Append(obj));
+    BOOST_CHECK(obj.vecJournal.empty());
+    BOOST_CHECK(boost::filesystem::exists(pathJournal));
+    uintmax_t nJournalSize = boost::filesystem::file_size(pathJournal);
+
+    // nothing new, nothing appended
+    BOOST_CHECK(flatdb.Append(obj));
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(pathJournal), nJournalSize);
+
+    CFlatDBTestObject objLoaded;
+    BOOST_CHECK(flatdb.LoadWithJournal(objLoaded));
+    BOOST_CHECK(objLoaded.setValues == obj.setValues);
+
+    // a torn record at the end is cut off and the records before it are kept
+    FILE* file = fopen(pathJournal.string().c_str(), "ab");
+    BOOST_REQUIRE(file);
+    fwrite("\x10\x01\x02", 1, 3, file);
+    fclose(file);
+
+    objLoaded.Clear();
+    BOOST_CHECK(flatdb.LoadWithJournal(objLoaded));
+    BOOST_CHECK(objLoaded.setValues == obj.setValues);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(pathJournal), nJournalSize);
+}
+
+BOOST_AUTO_TEST_CASE(flatdb_dump_clears_journal)
+{
+    CFlatDB<CFlatDBTestObject> flatdb("flatdbtest.dat", "magicFlatDBTest");
+    boost::filesystem::path pathJournal = GetDataDir() / "flatdbtest.dat.log";
+
+    CFlatDBTestObject obj;
+    obj.Add(1);
+    BOOST_CHECK(flatdb.Append(obj));
+    obj.Add(2);
+    BOOST_CHECK(flatdb.Append(obj));
+    BOOST_CHECK(boost::filesystem::exists(pathJournal));
+
+    // the snapshot includes everything pending, neither the journal nor the entries survive it
+    obj.Add(3);
+    BOOST_CHECK(flatdb.DumpWithJournal(obj));
+    BOOST_CHECK(obj.vecJournal.empty());
+    BOOST_CHECK(!boost::filesystem::exists(pathJournal));
+
+    // and the next append does not write them again
+    BOOST_CHECK(flatdb.Append(obj));
+    BOOST_CHECK(!boost::filesystem::exists(pathJournal));
+
+    CFlatDBTestObject objLoaded;
+    BOOST_CHECK(flatdb.LoadWithJournal(objLoaded));
+    BOOST_CHECK(objLoaded.setValues == obj.setValues);
+}
+
+BOOST_AUTO_TEST_CASE(flatdb_stale_journal)
+{
+    CFlatDB<CFlatDBTestObject> flatdb("flatdbtest.dat", "magicFlatDBTest");
+    boost::filesystem::path pathJournal = GetDataDir() / "flatdbtest.dat.log";
+    boost::filesystem::path pathSaved = GetDataDir() / "flatdbtest.dat.log.saved";
+
+    CFlatDBTestObject obj;
+    obj.Add(1);
+    BOOST_CHECK(flatdb.Append(obj));
+    obj.Add(2);
+    BOOST_CHECK(flatdb.Append(obj));
+    boost::filesystem::copy_file(pathJournal, pathSaved);
+
+    // a journal that extends an older snapshot is ignored and removed
+    CFlatDBTestObject objOther;
+    objOther.Add(5);
+    BOOST_CHECK(flatdb.DumpWithJournal(objOther));
+    boost::filesystem::rename(pathSaved, pathJournal);
+
+    CFlatDBTestObject objLoaded;
+    BOOST_CHECK(flatdb.LoadWithJournal(objLoaded));
+    BOOST_CHECK(objLoaded.setValues == objOther.setValues);
+    BOOST_CHECK(!boost::filesystem::exists(pathJournal));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
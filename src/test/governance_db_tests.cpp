@@ -0,0 +1,183 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "governance-db.h"
+#include "governance-object.h"
+#include "governance-votedb.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(governance_db_tests, TestingSetup)
+
+static CTxIn BuildVin(int n)
+{
+    return CTxIn(COutPoint(ArithToUint256(arith_uint256(3000 + n)), 0));
+}
+
+static CGovernanceObject BuildObject(int64_t nTime)
+{
+    return CGovernanceObject(H256(), 1, nTime, H256(), "");
+}
+
+static std::vector<CGovernanceVote> BuildVotes(const CGovernanceObject& govobj, int nBegin, int nEnd)
+{
+    std::vector<CGovernanceVote> vecVotes;
+    for(int i = nBegin; i < nEnd; i++) {
+        vecVotes.push_back(CGovernanceVote(BuildVin(i), govobj.GetHash(), VOTE_SIGNAL_FUNDING, VOTE_OUTCOME_YES));
+    }
+    return vecVotes;
+}
+
+BOOST_AUTO_TEST_CASE(governance_db_time_index)
+{
+    CGovernanceDB db(1 << 20, true, true);
+    std::vector<CGovernanceVote> vecNoVotes;
+
+    // creation times beyond 32 bits and before the epoch keep their order
+    CGovernanceObject govobjOld(BuildObject(-5));
+    CGovernanceObject govobjNow(BuildObject(1500000000));
+    CGovernanceObject govobjLate(BuildObject(int64_t(1) << 33));
+    BOOST_CHECK(db.WriteObject(govobjLate, vecNoVotes));
+    BOOST_CHECK(db.WriteObject(govobjOld, vecNoVotes));
+    BOOST_CHECK(db.WriteObject(govobjNow, vecNoVotes));
+
+    std::vector<H256> vecHashes;
+    BOOST_CHECK(db.ReadObjectsNewerThan(-10, vecHashes));
+    BOOST_REQUIRE_EQUAL(vecHashes.size(), 3U);
+    BOOST_CHECK(vecHashes[0] == govobjOld.GetHash());
+    BOOST_CHECK(vecHashes[1] == govobjNow.GetHash());
+    BOOST_CHECK(vecHashes[2] == govobjLate.GetHash());
+
+    vecHashes.clear();
+    BOOST_CHECK(db.ReadObjectsNewerThan(1500000001, vecHashes));
+    BOOST_REQUIRE_EQUAL(vecHashes.size(), 1U);
+    BOOST_CHECK(vecHashes[0] == govobjLate.GetHash());
+
+    // erasing an object takes it out of the time index
+    BOOST_CHECK(db.EraseObject(govobjNow));
+    vecHashes.clear();
+    BOOST_CHECK(db.ReadObjectsNewerThan(0, vecHashes));
+    BOOST_REQUIRE_EQUAL(vecHashes.size(), 1U);
+    BOOST_CHECK(vecHashes[0] == govobjLate.GetHash());
+
+    std::map<H256, CGovernanceObject> mapObjects;
+    BOOST_CHECK(db.LoadObjects(mapObjects));
+    BOOST_CHECK_EQUAL(mapObjects.size(), 2U);
+    BOOST_CHECK(mapObjects.count(govobjOld.GetHash()));
+    BOOST_CHECK(mapObjects.count(govobjLate.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(governance_db_votes)
+{
+    CGovernanceDB db(1 << 20, true, true);
+    CGovernanceObject govobj(BuildObject(1500000000));
+    CGovernanceObject govobjOther(BuildObject(1500000001));
+    std::vector<CGovernanceVote> vecVotes = BuildVotes(govobj, 0, 3);
+    std::vector<CGovernanceVote> vecVotesOther = BuildVotes(govobjOther, 0, 2);
+    BOOST_CHECK(db.WriteObject(govobj, vecVotes));
+    BOOST_CHECK(db.WriteObject(govobjOther, vecVotesOther));
+
+    CGovernanceVote vote;
+    H256 nParentHash;
+    BOOST_CHECK(db.ReadVote(vecVotes[1].GetHash(), vote));
+    BOOST_CHECK(vote == vecVotes[1]);
+    BOOST_CHECK(db.ReadVoteParent(vecVotesOther[0].GetHash(), nParentHash));
+    BOOST_CHECK(nParentHash == govobjOther.GetHash());
+
+    std::vector<CGovernanceVote> vecRead;
+    BOOST_CHECK(db.ReadVotes(govobj.GetHash(), vecRead));
+    BOOST_CHECK_EQUAL(vecRead.size(), 3U);
+    std::set<H256> setHashes;
+    BOOST_CHECK(db.ReadVoteHashes(govobjOther.GetHash(), setHashes));
+    BOOST_CHECK_EQUAL(setHashes.size(), 2U);
+
+    // only the votes of that masternode on that object go
+    std::vector<H256> vecErased;
+    BOOST_CHECK(db.EraseVotesFromMasternode(BuildVin(1).prevout, govobj.GetHash(), vecErased));
+    BOOST_REQUIRE_EQUAL(vecErased.size(), 1U);
+    BOOST_CHECK(vecErased[0] == vecVotes[1].GetHash());
+    BOOST_CHECK(!db.ReadVote(vecVotes[1].GetHash(), vote));
+    BOOST_CHECK(db.ReadVote(vecVotesOther[1].GetHash(), vote));
+
+    // the object goes with all of its votes
+    BOOST_CHECK(db.EraseObject(govobj));
+    BOOST_CHECK(!db.ReadVote(vecVotes[0].GetHash(), vote));
+    BOOST_CHECK(!db.ReadVoteParent(vecVotes[2].GetHash(), nParentHash));
+    vecRead.clear();
+    BOOST_CHECK(db.ReadVotes(govobj.GetHash(), vecRead));
+    BOOST_CHECK(vecRead.empty());
+    vecRead.clear();
+    BOOST_CHECK(db.ReadVotes(govobjOther.GetHash(), vecRead));
+    BOOST_CHECK_EQUAL(vecRead.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(governance_vote_file_lazy_load)
+{
+    CGovernanceDB db(1 << 20, true, true);
+    CGovernanceDB* pgovernancedbPrev = pgovernancedb;
+    pgovernancedb = &db;
+
+    CGovernanceObject govobj(BuildObject(1500000000));
+    std::vector<CGovernanceVote> vecVotes = BuildVotes(govobj, 0, 3);
+    CGovernanceObjectVoteFile& fileVotes = govobj.GetVoteFile();
+    for(size_t i = 0; i < vecVotes.size(); i++) {
+        fileVotes.AddVote(vecVotes[i]);
+    }
+
+    // the votes stay in memory until the write went through
+    std::vector<CGovernanceVote> vecMemoryVotes;
+    fileVotes.GetMemoryVotes(vecMemoryVotes);
+    BOOST_CHECK_EQUAL(vecMemoryVotes.size(), 3U);
+    BOOST_CHECK_EQUAL(fileVotes.GetMemoryVoteCount(), 3);
+    BOOST_CHECK(db.WriteObject(govobj, vecMemoryVotes));
+    fileVotes.SetMemoryVotesStored();
+    BOOST_CHECK_EQUAL(fileVotes.GetMemoryVoteCount(), 0);
+    BOOST_CHECK_EQUAL(fileVotes.GetVoteCount(), 3);
+    BOOST_CHECK(fileVotes.HasVote(vecVotes[0].GetHash()));
+
+    // a later vote is held in memory next to the stored ones
+    CGovernanceVote voteNew(BuildVin(3), govobj.GetHash(), VOTE_SIGNAL_VALID, VOTE_OUTCOME_NO);
+    fileVotes.AddVote(voteNew);
+    BOOST_CHECK_EQUAL(fileVotes.GetVoteCount(), 4);
+    BOOST_CHECK_EQUAL(fileVotes.GetVotes().size(), 4U);
+
+    // loaded from disk only the count is known, the hashes and votes are read on use
+    std::map<H256, CGovernanceObject> mapObjects;
+    BOOST_CHECK(db.LoadObjects(mapObjects));
+    BOOST_REQUIRE(mapObjects.count(govobj.GetHash()));
+    CGovernanceObjectVoteFile& fileLoaded = mapObjects[govobj.GetHash()].GetVoteFile();
+    BOOST_CHECK_EQUAL(fileLoaded.GetVoteCount(), 3);
+    BOOST_CHECK_EQUAL(fileLoaded.GetMemoryVoteCount(), 0);
+    BOOST_CHECK(fileLoaded.HasVote(vecVotes[2].GetHash()));
+    BOOST_CHECK(!fileLoaded.HasVote(voteNew.GetHash()));
+    CGovernanceVote vote;
+    BOOST_CHECK(fileLoaded.GetVote(vecVotes[1].GetHash(), vote));
+    BOOST_CHECK(vote == vecVotes[1]);
+    BOOST_CHECK_EQUAL(fileLoaded.GetVoteHashes().size(), 3U);
+    BOOST_CHECK_EQUAL(fileLoaded.GetVotes().size(), 3U);
+
+    // the next write stores the object with the memory vote counted
+    vecMemoryVotes.clear();
+    fileVotes.GetMemoryVotes(vecMemoryVotes);
+    BOOST_CHECK(db.WriteObject(govobj, vecMemoryVotes));
+    fileVotes.SetMemoryVotesStored();
+    mapObjects.clear();
+    BOOST_CHECK(db.LoadObjects(mapObjects));
+    CGovernanceObjectVoteFile& fileReloaded = mapObjects[govobj.GetHash()].GetVoteFile();
+    BOOST_CHECK_EQUAL(fileReloaded.GetVoteCount(), 4);
+    BOOST_CHECK(fileReloaded.HasVote(voteNew.GetHash()));
+
+    // removing a masternode's votes erases the stored ones too
+    fileReloaded.RemoveVotesFromMasternode(BuildVin(0));
+    BOOST_CHECK_EQUAL(fileReloaded.GetVoteCount(), 3);
+    BOOST_CHECK(!fileReloaded.HasVote(vecVotes[0].GetHash()));
+    BOOST_CHECK(!db.ReadVote(vecVotes[0].GetHash(), vote));
+
+    pgovernancedb = pgovernancedbPrev;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
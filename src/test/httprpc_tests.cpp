@@ -0,0 +1,65 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "httprpc.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(httprpc_tests, BasicTestingSetup)
+
+static bool Peek(const std::string& strBody, const std::string& strExpected)
+{
+    std::string strMethod;
+    if (!PeekJSONRPCMethod(strBody, strMethod))
+        return false;
+    BOOST_CHECK_EQUAL(strMethod, strExpected);
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(httprpc_peek_method)
+{
+    BOOST_CHECK(Peek("{\"method\":\"getinfo\"}", "getinfo"));
+    BOOST_CHECK(Peek(" \r\n\t{ \"jsonrpc\" : \"1.0\", \"id\" : 1, \"method\" : \"getblockcount\" }", "getblockcount"));
+    BOOST_CHECK(Peek("{\"method\":\"getblock\",\"params\":[", "getblock"));
+    BOOST_CHECK(Peek("{\"method\":\"\"}", ""));
+
+    // nested values and strings are skipped, only the top-level key counts
+    BOOST_CHECK(Peek("{\"params\":[{\"method\":\"stop\"},\"method\"],\"method\":\"getinfo\"}", "getinfo"));
+    BOOST_CHECK(Peek("{\"params\":{\"a\":{\"method\":[\"stop\"]}},\"method\":\"getinfo\"}", "getinfo"));
+    BOOST_CHECK(Peek("{\"id\":\"a\\\"b,\\\"method\\\":\\\"stop\",\"method\":\"getinfo\"}", "getinfo"));
+    BOOST_CHECK(Peek("{\"id\":\"\\\\\",\"method\":\"getinfo\"}", "getinfo"));
+    BOOST_CHECK(Peek("{\"id\":\"method\",\"method\":\"getinfo\"}", "getinfo"));
+}
+
+BOOST_AUTO_TEST_CASE(httprpc_peek_method_unexpected)
+{
+    std::string strMethod;
+    BOOST_CHECK(!PeekJSONRPCMethod("", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("   ", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("\"method\"", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("x{\"method\":\"getinfo\"}", strMethod));
+
+    // batches are left to the parser
+    BOOST_CHECK(!PeekJSONRPCMethod("[{\"method\":\"getinfo\"}]", strMethod));
+
+    // no top-level method
+    BOOST_CHECK(!PeekJSONRPCMethod("{}", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("{\"id\":1}", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("{\"params\":{\"method\":\"getinfo\"}}", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("{\"id\":1}{\"method\":\"getinfo\"}", strMethod));
+
+    // cut off before the method is complete
+    BOOST_CHECK(!PeekJSONRPCMethod("{\"params\":[1,2", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("{\"method\":\"getin", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("{\"method\":", strMethod));
+    BOOST_CHECK(!PeekJSONRPCMethod("{\"id\":\"abc\\", strMethod));
+
+    // escaped method names are not unescaped here
+    BOOST_CHECK(!PeekJSONRPCMethod("{\"method\":\"get\\u0069nfo\"}", strMethod));
+    BOOST_CHECK(strMethod.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
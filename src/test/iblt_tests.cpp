@@ -0,0 +1,180 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "iblt.h"
+
+#include "arith_uint256.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(iblt_tests, BasicTestingSetup)
+
+static const uint64_t TEST_SALT = 0x1234;
+
+static H256 TestHash(uint32_t n)
+{
+    return ArithToUint256(arith_uint256(n) * 2654435761U + 1);
+}
+
+BOOST_AUTO_TEST_CASE(iblt_insert_erase)
+{
+    CIblt iblt(60, TEST_SALT);
+    BOOST_CHECK(iblt.IsValid());
+    BOOST_CHECK_EQUAL(iblt.GetCellCount(), 60);
+
+    // cell counts are rounded up to a multiple of the hash functions
+    BOOST_CHECK_EQUAL(CIblt(61, TEST_SALT).GetCellCount(), 63);
+    BOOST_CHECK(!CIblt().IsValid());
+    BOOST_CHECK(!CIblt(MAX_IBLT_CELLS + 1, TEST_SALT).IsValid());
+
+    for (uint32_t i = 0; i < 10; i++) {
+        iblt.Insert(TestHash(i));
+    }
+    std::set<H256> setPositive;
+    std::set<H256> setNegative;
+    BOOST_CHECK(iblt.ListEntries(setPositive, setNegative));
+    BOOST_CHECK_EQUAL(setPositive.size(), 10);
+    BOOST_CHECK(setNegative.empty());
+    for (uint32_t i = 0; i < 10; i++) {
+        BOOST_CHECK(setPositive.count(TestHash(i)));
+    }
+
+    // erasing everything leaves an empty table
+    for (uint32_t i = 0; i < 10; i++) {
+        iblt.Erase(TestHash(i));
+    }
+    setPositive.clear();
+    BOOST_CHECK(iblt.ListEntries(setPositive, setNegative));
+    BOOST_CHECK(setPositive.empty());
+    BOOST_CHECK(setNegative.empty());
+
+    // erasing a hash that was never inserted lists it as negative
+    iblt.Erase(TestHash(42));
+    BOOST_CHECK(iblt.ListEntries(setPositive, setNegative));
+    BOOST_CHECK(setPositive.empty());
+    BOOST_CHECK_EQUAL(setNegative.size(), 1);
+    BOOST_CHECK(setNegative.count(TestHash(42)));
+}
+
+BOOST_AUTO_TEST_CASE(iblt_subtract)
+{
+    // two large sets with a small difference in both directions
+    CIblt ibltA(60, TEST_SALT);
+    CIblt ibltB(60, TEST_SALT);
+    for (uint32_t i = 0; i < 1000; i++) {
+        ibltA.Insert(TestHash(i));
+        ibltB.Insert(TestHash(i));
+    }
+    for (uint32_t i = 1000; i < 1005; i++) {
+        ibltA.Insert(TestHash(i));
+    }
+    for (uint32_t i = 2000; i < 2003; i++) {
+        ibltB.Insert(TestHash(i));
+    }
+
+    // tables of different sizes or salts cannot be subtracted
+    BOOST_CHECK(!CIblt(ibltA).Subtract(CIblt(120, TEST_SALT)));
+    BOOST_CHECK(!CIblt(ibltA).Subtract(CIblt(60, TEST_SALT + 1)));
+
+    BOOST_CHECK(ibltA.Subtract(ibltB));
+    std::set<H256> setPositive;
+    std::set<H256> setNegative;
+    BOOST_CHECK(ibltA.ListEntries(setPositive, setNegative));
+    BOOST_CHECK_EQUAL(setPositive.size(), 5);
+    BOOST_CHECK_EQUAL(setNegative.size(), 3);
+    for (uint32_t i = 1000; i < 1005; i++) {
+        BOOST_CHECK(setPositive.count(TestHash(i)));
+    }
+    for (uint32_t i = 2000; i < 2003; i++) {
+        BOOST_CHECK(setNegative.count(TestHash(i)));
+    }
+
+    // identical sets cancel out completely
+    CIblt ibltC(60, TEST_SALT);
+    CIblt ibltD(60, TEST_SALT);
+    for (uint32_t i = 0; i < 100; i++) {
+        ibltC.Insert(TestHash(i));
+        ibltD.Insert(TestHash(99 - i));
+    }
+    BOOST_CHECK(ibltC.Subtract(ibltD));
+    setPositive.clear();
+    setNegative.clear();
+    BOOST_CHECK(ibltC.ListEntries(setPositive, setNegative));
+    BOOST_CHECK(setPositive.empty());
+    BOOST_CHECK(setNegative.empty());
+}
+
+BOOST_AUTO_TEST_CASE(iblt_decode_failure)
+{
+    // a difference as large as the table cannot be decoded
+    CIblt ibltFull(60, TEST_SALT);
+    for (uint32_t i = 0; i < 60; i++) {
+        ibltFull.Insert(TestHash(i));
+    }
+    std::set<H256> setPositive;
+    std::set<H256> setNegative;
+    BOOST_CHECK(!ibltFull.ListEntries(setPositive, setNegative));
+
+    // twice the cells decode the same difference again
+    CIblt ibltBig(120, TEST_SALT);
+    for (uint32_t i = 0; i < 60; i++) {
+        ibltBig.Insert(TestHash(i));
+    }
+    setPositive.clear();
+    setNegative.clear();
+    BOOST_CHECK(ibltBig.ListEntries(setPositive, setNegative));
+    BOOST_CHECK_EQUAL(setPositive.size(), 60);
+
+    // a corrupted cell leaves the table undecodable
+    CIblt ibltCorrupt(60, TEST_SALT);
+    ibltCorrupt.Insert(TestHash(1));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << ibltCorrupt;
+    // flip a bit in the hash sum of the first cell, after the salt, cell count and cell nCount
+    ss[8 + 1 + 4] ^= 1;
+    CIblt ibltRead;
+    ss >> ibltRead;
+    setPositive.clear();
+    setNegative.clear();
+    BOOST_CHECK(!ibltRead.ListEntries(setPositive, setNegative));
+}
+
+BOOST_AUTO_TEST_CASE(iblt_set)
+{
+    CIbltSet ibltSet;
+    BOOST_CHECK(ibltSet.Get(60, TEST_SALT) == NULL);
+
+    // tables created later start from the owner's set and then follow every change
+    CIblt& table60 = ibltSet.Create(60, TEST_SALT);
+    ibltSet.Insert(TestHash(1));
+    ibltSet.Insert(TestHash(2));
+    CIblt& table120 = ibltSet.Create(120, TEST_SALT);
+    table120.Insert(TestHash(1));
+    table120.Insert(TestHash(2));
+    ibltSet.Insert(TestHash(3));
+    ibltSet.Erase(TestHash(1));
+    BOOST_CHECK(ibltSet.Get(60, TEST_SALT) == &table60);
+    BOOST_CHECK(ibltSet.Get(60, TEST_SALT + 1) == NULL);
+
+    unsigned int nCells[] = {60, 120};
+    for (unsigned int i = 0; i < 2; i++) {
+        const CIblt* pTable = ibltSet.Get(nCells[i], TEST_SALT);
+        BOOST_REQUIRE(pTable);
+        std::set<H256> setPositive;
+        std::set<H256> setNegative;
+        BOOST_CHECK(pTable->ListEntries(setPositive, setNegative));
+        BOOST_CHECK_EQUAL(setPositive.size(), 2);
+        BOOST_CHECK(setPositive.count(TestHash(2)));
+        BOOST_CHECK(setPositive.count(TestHash(3)));
+        BOOST_CHECK(setNegative.empty());
+    }
+
+    ibltSet.Clear();
+    BOOST_CHECK(ibltSet.Get(60, TEST_SALT) == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,127 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "instantx.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(instantx_tests, BasicTestingSetup)
+
+static CTxLockCandidate MakeCandidate(uint32_t nId, int nOutPoints)
+{
+    CMutableTransaction mtx;
+    mtx.nLockTime = nId;
+    CTxLockCandidate txLockCandidate((CTxLockRequest(CTransaction(mtx))));
+    for (int i = 0; i < nOutPoints; i++) {
+        txLockCandidate.AddOutPointLock(COutPoint(ArithToUint256(arith_uint256(nId * 16 + i + 1)), i));
+    }
+    return txLockCandidate;
+}
+
+static void LockCandidate(CInstantSendLockIndex& lockIndex, const CTxLockCandidate& txLockCandidate)
+{
+    lockIndex.UpdateCandidate(txLockCandidate);
+    std::map<COutPoint, COutPointLock>::const_iterator it = txLockCandidate.mapOutPointLocks.begin();
+    for (; it != txLockCandidate.mapOutPointLocks.end(); ++it) {
+        lockIndex.LockOutPoint(it->first, txLockCandidate.GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lockindex_lookup)
+{
+    CInstantSendLockIndex lockIndex;
+
+    // enough candidates and outpoints to spread over all shards
+    std::vector<CTxLockCandidate> vecCandidates;
+    for (uint32_t i = 0; i < 64; i++) {
+        vecCandidates.push_back(MakeCandidate(i, 3));
+        LockCandidate(lockIndex, vecCandidates.back());
+    }
+
+    BOOST_FOREACH(const CTxLockCandidate& txLockCandidate, vecCandidates) {
+        H256 txHash = txLockCandidate.GetHash();
+        BOOST_CHECK(lockIndex.IsLocked(txHash));
+        BOOST_CHECK_EQUAL(lockIndex.GetSignatures(txHash), 0);
+        std::map<COutPoint, COutPointLock>::const_iterator it = txLockCandidate.mapOutPointLocks.begin();
+        for (; it != txLockCandidate.mapOutPointLocks.end(); ++it) {
+            H256 hashLocked;
+            BOOST_CHECK(lockIndex.GetLockedOutPointTxHash(it->first, hashLocked));
+            BOOST_CHECK(hashLocked == txHash);
+        }
+    }
+
+    // unknown candidates and outpoints are not found
+    CTxLockCandidate txLockCandidateUnknown = MakeCandidate(1000, 1);
+    H256 hashLocked;
+    BOOST_CHECK(!lockIndex.IsLocked(txLockCandidateUnknown.GetHash()));
+    BOOST_CHECK_EQUAL(lockIndex.GetSignatures(txLockCandidateUnknown.GetHash()), -1);
+    BOOST_CHECK(!lockIndex.GetLockedOutPointTxHash(txLockCandidateUnknown.mapOutPointLocks.begin()->first, hashLocked));
+
+    // an existing lock is kept, a conflicting candidate is not locked
+    CTxLockCandidate txLockCandidateConflict = MakeCandidate(1001, 0);
+    const COutPoint& outpoint = vecCandidates[0].mapOutPointLocks.begin()->first;
+    txLockCandidateConflict.AddOutPointLock(outpoint);
+    LockCandidate(lockIndex, txLockCandidateConflict);
+    BOOST_CHECK(lockIndex.GetLockedOutPointTxHash(outpoint, hashLocked));
+    BOOST_CHECK(hashLocked == vecCandidates[0].GetHash());
+    BOOST_CHECK(!lockIndex.IsLocked(txLockCandidateConflict.GetHash()));
+    BOOST_CHECK(lockIndex.IsLocked(vecCandidates[0].GetHash()));
+
+    // a candidate without outpoints is never locked
+    CTxLockCandidate txLockCandidateEmpty = MakeCandidate(1002, 0);
+    LockCandidate(lockIndex, txLockCandidateEmpty);
+    BOOST_CHECK(!lockIndex.IsLocked(txLockCandidateEmpty.GetHash()));
+}
+
+BOOST_AUTO_TEST_CASE(lockindex_erase)
+{
+    CInstantSendLockIndex lockIndex;
+
+    std::vector<CTxLockCandidate> vecCandidates;
+    for (uint32_t i = 0; i < 64; i++) {
+        vecCandidates.push_back(MakeCandidate(i, 2));
+        LockCandidate(lockIndex, vecCandidates.back());
+    }
+
+    // unlocking one outpoint unlocks its candidate only
+    const COutPoint outpoint = vecCandidates[0].mapOutPointLocks.begin()->first;
+    H256 hashLocked;
+    lockIndex.UnlockOutPoint(outpoint);
+    BOOST_CHECK(!lockIndex.GetLockedOutPointTxHash(outpoint, hashLocked));
+    BOOST_CHECK(!lockIndex.IsLocked(vecCandidates[0].GetHash()));
+    BOOST_CHECK_EQUAL(lockIndex.GetSignatures(vecCandidates[0].GetHash()), 0);
+    BOOST_CHECK(lockIndex.GetLockedOutPointTxHash(vecCandidates[0].mapOutPointLocks.rbegin()->first, hashLocked));
+
+    // the outpoint is free for another lock now
+    lockIndex.LockOutPoint(outpoint, vecCandidates[1].GetHash());
+    BOOST_CHECK(lockIndex.GetLockedOutPointTxHash(outpoint, hashLocked));
+    BOOST_CHECK(hashLocked == vecCandidates[1].GetHash());
+    lockIndex.UnlockOutPoint(outpoint);
+
+    // removing candidates leaves the others and the outpoint locks alone
+    for (size_t i = 0; i < vecCandidates.size(); i += 2) {
+        lockIndex.RemoveCandidate(vecCandidates[i].GetHash());
+    }
+    for (size_t i = 0; i < vecCandidates.size(); i++) {
+        H256 txHash = vecCandidates[i].GetHash();
+        const COutPoint& outpointLast = vecCandidates[i].mapOutPointLocks.rbegin()->first;
+        BOOST_CHECK(lockIndex.GetLockedOutPointTxHash(outpointLast, hashLocked));
+        if (i % 2 == 0) {
+            BOOST_CHECK(!lockIndex.IsLocked(txHash));
+            BOOST_CHECK_EQUAL(lockIndex.GetSignatures(txHash), -1);
+        } else {
+            BOOST_CHECK(lockIndex.IsLocked(txHash));
+            BOOST_CHECK_EQUAL(lockIndex.GetSignatures(txHash), 0);
+        }
+    }
+
+    // removing twice is harmless
+    lockIndex.RemoveCandidate(vecCandidates[0].GetHash());
+    lockIndex.UnlockOutPoint(outpoint);
+    BOOST_CHECK_EQUAL(lockIndex.GetSignatures(vecCandidates[0].GetHash()), -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
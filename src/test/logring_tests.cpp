@@ -0,0 +1,112 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logring.h"
+#include "tinyformat.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(logring_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(logring_push_drain)
+{
+    std::atomic<uint64_t> nSequence(0);
+    CLogRing ring(4);
+    BOOST_CHECK(ring.IsEmpty());
+
+    // lines come out in the order they went in, across the end of the ring
+    std::vector<CLogLine> vLines;
+    for (int nRound = 0; nRound < 3; nRound++) {
+        for (int i = 0; i < 3; i++)
+            BOOST_CHECK(ring.Push(nSequence, strprintf("line %d\n", nRound * 3 + i)));
+        BOOST_CHECK(!ring.IsEmpty());
+        ring.Drain(vLines);
+        BOOST_CHECK(ring.IsEmpty());
+    }
+    BOOST_REQUIRE_EQUAL(vLines.size(), 9U);
+    for (size_t i = 0; i < vLines.size(); i++) {
+        BOOST_CHECK_EQUAL(vLines[i].first, i);
+        BOOST_CHECK_EQUAL(vLines[i].second, strprintf("line %d\n", i));
+    }
+
+    // a full ring refuses the line without using up a sequence number
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK(ring.Push(nSequence, "full\n"));
+    BOOST_CHECK(!ring.Push(nSequence, "lost\n"));
+    BOOST_CHECK_EQUAL(nSequence.load(), 13U);
+    vLines.clear();
+    ring.Drain(vLines);
+    BOOST_CHECK_EQUAL(vLines.size(), 4U);
+    BOOST_CHECK(ring.Push(nSequence, "room again\n"));
+}
+
+BOOST_AUTO_TEST_CASE(logring_dropped)
+{
+    CLogRing ring(1);
+    BOOST_CHECK_EQUAL(ring.TakeDropped(), 0U);
+    ring.AddDropped();
+    ring.AddDropped();
+    BOOST_CHECK_EQUAL(ring.TakeDropped(), 2U);
+    BOOST_CHECK_EQUAL(ring.TakeDropped(), 0U);
+    ring.AddDropped();
+    BOOST_CHECK_EQUAL(ring.TakeDropped(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(logring_ordered_merge)
+{
+    std::atomic<uint64_t> nSequence(0);
+    CLogRing ringA(8), ringB(8);
+    BOOST_CHECK(ringA.Push(nSequence, "0\n"));
+    BOOST_CHECK(ringB.Push(nSequence, "1\n"));
+    BOOST_CHECK(ringB.Push(nSequence, "2\n"));
+    BOOST_CHECK(ringA.Push(nSequence, "3\n"));
+
+    // the rings are merged by sequence, whatever order they are drained in
+    std::vector<CLogLine> vHeld, vLines;
+    uint64_t nNextSequence = 0;
+    ringB.Drain(vHeld);
+    ringA.Drain(vHeld);
+    TakeOrderedLogLines(vHeld, nNextSequence, vLines, false);
+    BOOST_REQUIRE_EQUAL(vLines.size(), 4U);
+    for (size_t i = 0; i < vLines.size(); i++)
+        BOOST_CHECK_EQUAL(vLines[i].second, strprintf("%d\n", i));
+    BOOST_CHECK(vHeld.empty());
+    BOOST_CHECK_EQUAL(nNextSequence, 4U);
+
+    // number 4 is taken by a thread that has not queued its line yet, the
+    // lines after it wait for it
+    std::atomic<uint64_t> nSequenceSlow(nSequence++);
+    BOOST_CHECK(ringB.Push(nSequence, "5\n"));
+    BOOST_CHECK(ringB.Push(nSequence, "6\n"));
+    ringB.Drain(vHeld);
+    vLines.clear();
+    TakeOrderedLogLines(vHeld, nNextSequence, vLines, false);
+    BOOST_CHECK(vLines.empty());
+    BOOST_CHECK_EQUAL(vHeld.size(), 2U);
+    BOOST_CHECK_EQUAL(nNextSequence, 4U);
+
+    BOOST_CHECK(ringA.Push(nSequenceSlow, "4\n"));
+    ringA.Drain(vHeld);
+    TakeOrderedLogLines(vHeld, nNextSequence, vLines, false);
+    BOOST_REQUIRE_EQUAL(vLines.size(), 3U);
+    BOOST_CHECK_EQUAL(vLines[0].second, "4\n");
+    BOOST_CHECK_EQUAL(vLines[1].second, "5\n");
+    BOOST_CHECK_EQUAL(vLines[2].second, "6\n");
+    BOOST_CHECK(vHeld.empty());
+    BOOST_CHECK_EQUAL(nNextSequence, 7U);
+
+    // the last round takes everything, gaps or not
+    nSequence++;
+    BOOST_CHECK(ringB.Push(nSequence, "8\n"));
+    ringB.Drain(vHeld);
+    vLines.clear();
+    TakeOrderedLogLines(vHeld, nNextSequence, vLines, true);
+    BOOST_REQUIRE_EQUAL(vLines.size(), 1U);
+    BOOST_CHECK_EQUAL(vLines[0].second, "8\n");
+    BOOST_CHECK_EQUAL(nNextSequence, 9U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,6 +6,7 @@
 #include "chainparams.h"
 #include "validation.h"
 #include "net.h"
+#include "streams.h"
 
 #include "test/test_ebakus.h"
 
@@ -79,4 +80,51 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_AUTO_TEST_CASE(read_raw_block_test)
+{
+    const CChainParams& chainparams = Params();
+
+    // the genesis block as the rawblock ZMQ topic sends it, against the block
+    // deserialized and serialized again as it was sent before
+    std::vector<unsigned char> vchRaw;
+    CBlock block;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindex = chainActive.Genesis();
+        BOOST_REQUIRE(pindex != NULL);
+        BOOST_CHECK(ReadRawBlockFromDisk(vchRaw, pindex->GetBlockPos(), chainparams.MessageStart()));
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+    }
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(std::vector<unsigned char>(ss.begin(), ss.end()) == vchRaw);
+
+    // a block with transactions, stored after another one in the same file
+    CBlock blockTxs(chainparams.GenesisBlock());
+    for (unsigned char i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.mAmount = 1000 + i;
+        tx.mData = Bytes(10 * i, i);
+        tx.mSignature = Bytes(65, i);
+        blockTxs.vtx.push_back(CTransaction(tx));
+    }
+    CDiskBlockPos posFirst(1000, 0);
+    BOOST_CHECK(WriteBlockToDisk(block, posFirst, chainparams.MessageStart()));
+    CDiskBlockPos pos(1000, posFirst.nPos + ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION));
+    BOOST_CHECK(WriteBlockToDisk(blockTxs, pos, chainparams.MessageStart()));
+    BOOST_CHECK(ReadRawBlockFromDisk(vchRaw, pos, chainparams.MessageStart()));
+    CDataStream ssTxs(SER_NETWORK, PROTOCOL_VERSION);
+    ssTxs << blockTxs;
+    BOOST_CHECK(std::vector<unsigned char>(ssTxs.begin(), ssTxs.end()) == vchRaw);
+
+    // a position without the index header in front of it, or the wrong network
+    CMessageHeader::MessageStartChars messageStartOther;
+    memcpy(messageStartOther, chainparams.MessageStart(), MESSAGE_START_SIZE);
+    messageStartOther[0] ^= 0xff;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchRaw, CDiskBlockPos(1000, 4), chainparams.MessageStart()));
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchRaw, pos, messageStartOther));
+    BOOST_CHECK(vchRaw.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
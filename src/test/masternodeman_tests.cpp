@@ -0,0 +1,247 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "masternode-payments.h"
+#include "masternode-sync.h"
+#include "masternodeman.h"
+#include "script/standard.h"
+#include "util.h"
+#include "validation.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodeman_tests, TestingSetup)
+
+struct CompareScoreReference
+{
+    bool operator()(const std::pair<int64_t, CMasternode>& t1,
+                    const std::pair<int64_t, CMasternode>& t2) const
+    {
+        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second.vin < t2.second.vin);
+    }
+};
+
+static CTxIn BuildVin(int n)
+{
+    return CTxIn(COutPoint(ArithToUint256(arith_uint256(1000 + n)), n % 3));
+}
+
+static void AddMasternodes(CMasternodeMan& man, int nBegin, int nEnd, std::vector<CKey>& vCollateralKeys)
+{
+    for(int i = nBegin; i < nEnd; i++) {
+        CKey collateralKey, mnKey;
+        collateralKey.MakeNewKey(true);
+        mnKey.MakeNewKey(true);
+        CMasternode mn(CService(strprintf("1.2.3.%d", i + 1), 9999), BuildVin(i),
+                       collateralKey.GetPubKey(), mnKey.GetPubKey(), PROTOCOL_VERSION - (i % 2));
+        mn.fUnitTest = true;
+        BOOST_CHECK(man.Add(mn));
+        vCollateralKeys.push_back(collateralKey);
+    }
+}
+
+// What the lookups returned before the indexes, a scan over the whole list
+static bool FindByScan(const std::vector<CMasternode>& vMasternodes, const CPubKey& pubKeyMasternode, CMasternode& mnRet)
+{
+    BOOST_FOREACH(const CMasternode& mn, vMasternodes) {
+        if(mn.pubKeyMasternode == pubKeyMasternode) { mnRet = mn; return true; }
+    }
+    return false;
+}
+
+static bool FindByScan(const std::vector<CMasternode>& vMasternodes, const CScript& payee, CMasternode& mnRet)
+{
+    BOOST_FOREACH(const CMasternode& mn, vMasternodes) {
+        if(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID()) == payee) { mnRet = mn; return true; }
+    }
+    return false;
+}
+
+// What the ranks were before the rank cache, scored and sorted on every call
+static std::vector<CMasternode> RankByScan(std::vector<CMasternode> vMasternodes, int nBlockHeight, int nMinProtocol, bool fOnlyActive)
+{
+    H256 blockHash;
+    BOOST_CHECK(GetBlockHash(blockHash, nBlockHeight));
+
+    std::vector<std::pair<int64_t, CMasternode> > vecScores;
+    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        if(mn.nProtocolVersion < nMinProtocol) continue;
+        if(fOnlyActive ? !mn.IsEnabled() : !mn.IsValidForPayment()) continue;
+        vecScores.push_back(std::make_pair(H256(mn.CalculateScore(blockHash)).GetCompact(false), mn));
+    }
+    sort(vecScores.rbegin(), vecScores.rend(), CompareScoreReference());
+
+    std::vector<CMasternode> vecRanked;
+    for(size_t i = 0; i < vecScores.size(); i++) {
+        vecRanked.push_back(vecScores[i].second);
+    }
+    return vecRanked;
+}
+
+static void CheckLookups(CMasternodeMan& man)
+{
+    std::vector<CMasternode> vMasternodes = man.GetFullMasternodeVector();
+    BOOST_CHECK_EQUAL(man.size(), (int)vMasternodes.size());
+
+    BOOST_FOREACH(const CMasternode& mn, vMasternodes) {
+        BOOST_CHECK(man.Has(mn.vin));
+        CMasternode* pmn = man.Find(mn.vin);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->vin == mn.vin);
+
+        CMasternode mnScan;
+        BOOST_REQUIRE(FindByScan(vMasternodes, mn.pubKeyMasternode, mnScan));
+        pmn = man.Find(mn.pubKeyMasternode);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->vin == mnScan.vin);
+
+        CScript payee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
+        BOOST_REQUIRE(FindByScan(vMasternodes, payee, mnScan));
+        pmn = man.Find(payee);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->vin == mnScan.vin);
+    }
+
+    CKey keyUnknown;
+    keyUnknown.MakeNewKey(true);
+    BOOST_CHECK(!man.Has(BuildVin(100000)));
+    BOOST_CHECK(man.Find(BuildVin(100000)) == NULL);
+    BOOST_CHECK(man.Find(keyUnknown.GetPubKey()) == NULL);
+    BOOST_CHECK(man.Find(GetScriptForDestination(keyUnknown.GetPubKey().GetID())) == NULL);
+}
+
+static void CheckRanks(CMasternodeMan& man, int nMinProtocol)
+{
+    std::vector<CMasternode> vMasternodes = man.GetFullMasternodeVector();
+
+    for(int f = 0; f < 2; f++) {
+        bool fOnlyActive = (f == 0);
+        std::vector<CMasternode> vecRanked = RankByScan(vMasternodes, 0, nMinProtocol, fOnlyActive);
+        for(size_t i = 0; i < vecRanked.size(); i++) {
+            BOOST_CHECK_EQUAL(man.GetMasternodeRank(vecRanked[i].vin, 0, nMinProtocol, fOnlyActive), (int)i + 1);
+            CMasternode* pmn = man.GetMasternodeByRank(i + 1, 0, nMinProtocol, fOnlyActive);
+            BOOST_REQUIRE(pmn != NULL);
+            BOOST_CHECK(pmn->vin == vecRanked[i].vin);
+        }
+        BOOST_CHECK(man.GetMasternodeByRank(vecRanked.size() + 1, 0, nMinProtocol, fOnlyActive) == NULL);
+    }
+
+    // not ranked at all when filtered out
+    BOOST_FOREACH(const CMasternode& mn, vMasternodes) {
+        CMasternode mnCopy(mn);
+        if(mnCopy.nProtocolVersion < nMinProtocol || !mnCopy.IsEnabled())
+            BOOST_CHECK_EQUAL(man.GetMasternodeRank(mn.vin, 0, nMinProtocol, true), -1);
+    }
+
+    std::vector<CMasternode> vecActive = RankByScan(vMasternodes, 0, nMinProtocol, true);
+    std::vector<std::pair<int, CMasternode> > vecRanks = man.GetMasternodeRanks(0, nMinProtocol);
+    BOOST_REQUIRE_EQUAL(vecRanks.size(), vecActive.size());
+    for(size_t i = 0; i < vecRanks.size(); i++) {
+        BOOST_CHECK_EQUAL(vecRanks[i].first, (int)i + 1);
+        BOOST_CHECK(vecRanks[i].second.vin == vecActive[i].vin);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_lookups_match_scans)
+{
+    CMasternodeMan man;
+    std::vector<CKey> vCollateralKeys;
+    AddMasternodes(man, 0, 40, vCollateralKeys);
+    CheckLookups(man);
+
+    // a second broadcast for a known collateral is not added twice
+    CMasternode mnDuplicate(*man.Find(BuildVin(3)));
+    BOOST_CHECK(!man.Add(mnDuplicate));
+    BOOST_CHECK_EQUAL(man.size(), 40);
+
+    // a new broadcast can move a masternode to another key and address
+    for(int i = 0; i < 40; i += 7) {
+        CMasternode* pmn = man.Find(BuildVin(i));
+        BOOST_REQUIRE(pmn != NULL);
+        CPubKey pubKeyOld = pmn->pubKeyMasternode;
+        CKey mnKey;
+        mnKey.MakeNewKey(true);
+        pmn->pubKeyMasternode = mnKey.GetPubKey();
+        pmn->addr = CService(strprintf("5.6.7.%d", i + 1), 9999);
+        man.UpdateIndexes(BuildVin(i));
+        BOOST_CHECK(man.Find(pubKeyOld) == NULL);
+    }
+    CheckLookups(man);
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_ranks_match_scans)
+{
+    CMasternodeMan man;
+    std::vector<CKey> vCollateralKeys;
+    AddMasternodes(man, 0, 30, vCollateralKeys);
+    CheckRanks(man, 0);
+    CheckRanks(man, PROTOCOL_VERSION);
+
+    // added after the score order for the block was cached
+    AddMasternodes(man, 30, 45, vCollateralKeys);
+    CheckRanks(man, 0);
+
+    // states only filter the cached order
+    for(int i = 0; i < 45; i += 4) {
+        man.Find(BuildVin(i))->nActiveState = CMasternode::MASTERNODE_PRE_ENABLED;
+        man.UpdateIndexes(BuildVin(i));
+    }
+    CheckRanks(man, 0);
+    CheckRanks(man, PROTOCOL_VERSION);
+
+    // removed from the middle of the list with the score order cached
+    for(int i = 1; i < 45; i += 5) {
+        man.Find(BuildVin(i))->nActiveState = CMasternode::MASTERNODE_OUTPOINT_SPENT;
+    }
+    masternodeSync.SwitchToNextAsset();
+    masternodeSync.SwitchToNextAsset();
+    BOOST_CHECK(masternodeSync.IsMasternodeListSynced());
+    man.CheckAndRemove();
+    BOOST_CHECK_EQUAL(man.size(), 36);
+    BOOST_CHECK(!man.Has(BuildVin(1)));
+    CheckLookups(man);
+    CheckRanks(man, 0);
+    CheckRanks(man, PROTOCOL_VERSION);
+    masternodeSync.Reset();
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_payment_queue_matches_scan)
+{
+    CMasternodeMan man;
+    std::vector<CKey> vCollateralKeys;
+    AddMasternodes(man, 0, 20, vCollateralKeys);
+
+    masternodeSync.SwitchToNextAsset();
+    masternodeSync.SwitchToNextAsset();
+    masternodeSync.SwitchToNextAsset();
+    BOOST_CHECK(masternodeSync.IsWinnersListSynced());
+
+    // the old filter: valid for payment and at least as many confirmations as there are masternodes
+    int nMinProtocol = mnpayments.GetMinMasternodePaymentsProto();
+    int nMnCount = man.CountEnabled(nMinProtocol);
+    int nEligible = 0;
+    std::vector<CMasternode> vMasternodes = man.GetFullMasternodeVector();
+    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        if(!mn.IsValidForPayment() || mn.nProtocolVersion < nMinProtocol) continue;
+        if(GetUTXOConfirmations(mn.vin.prevout) < nMnCount) continue;
+        nEligible++;
+    }
+
+    int nCount = -1;
+    CMasternode* pmn = man.GetNextMasternodeInQueueForPayment(1, true, nCount);
+    BOOST_CHECK_EQUAL(nCount, nEligible);
+    if(nEligible == 0) BOOST_CHECK(pmn == NULL);
+
+    nCount = -1;
+    pmn = man.GetNextMasternodeInQueueForPayment(1, false, nCount);
+    BOOST_CHECK_EQUAL(nCount, nEligible);
+    if(nEligible == 0) BOOST_CHECK(pmn == NULL);
+
+    masternodeSync.Reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,113 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include "test/test_ebakus.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(metrics_tests, BasicTestingSetup)
+
+static size_t CountOccurrences(const std::string& str, const std::string& strFind)
+{
+    size_t nCount = 0;
+    for (size_t pos = str.find(strFind); pos != std::string::npos; pos = str.find(strFind, pos + 1))
+        nCount++;
+    return nCount;
+}
+
+BOOST_AUTO_TEST_CASE(metrics_histogram_buckets)
+{
+    // exact below SUB_BUCKETS
+    for (int i = 0; i < CMetricHistogram::SUB_BUCKETS; i++) {
+        BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(i), i);
+        BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketUpperBound(i), (uint64_t)i);
+    }
+    BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(8), 8);
+    BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(15), 15);
+    BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(16), 16);
+    BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(17), 16);
+    BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(18), 17);
+    BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketUpperBound(16), 17U);
+
+    // the whole 64 bit range fits, the last bucket ends at the largest value
+    uint64_t nMaxValue = std::numeric_limits<uint64_t>::max();
+    BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(nMaxValue), CMetricHistogram::BUCKETS - 1);
+    BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketUpperBound(CMetricHistogram::BUCKETS - 1), nMaxValue);
+
+    // every bucket starts right after the previous one ends and is at most 1/SUB_BUCKETS wide
+    for (int i = 0; i < CMetricHistogram::BUCKETS; i++) {
+        uint64_t nUpper = CMetricHistogram::GetBucketUpperBound(i);
+        uint64_t nLower = i == 0 ? 0 : CMetricHistogram::GetBucketUpperBound(i - 1) + 1;
+        BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(nLower), i);
+        BOOST_CHECK_EQUAL(CMetricHistogram::GetBucketIndex(nUpper), i);
+        BOOST_CHECK(nUpper - nLower <= nLower / CMetricHistogram::SUB_BUCKETS);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(metrics_histogram_quantiles)
+{
+    CMetricHistogram histogram;
+    BOOST_CHECK_EQUAL(histogram.GetQuantile(0.5), 0U);
+
+    for (int i = 1; i <= 100; i++)
+        histogram.Observe(i);
+    BOOST_CHECK_EQUAL(histogram.GetCount(), 100U);
+    BOOST_CHECK_EQUAL(histogram.GetSum(), 5050U);
+    BOOST_CHECK_EQUAL(histogram.GetMax(), 100U);
+    BOOST_CHECK_EQUAL(histogram.GetQuantile(0.5), 51U);  // 50 is in [48, 51]
+    BOOST_CHECK_EQUAL(histogram.GetQuantile(0.9), 95U);  // 90 is in [88, 95]
+    BOOST_CHECK_EQUAL(histogram.GetQuantile(0.99), 100U); // [96, 103] capped at the max
+    BOOST_CHECK_EQUAL(histogram.GetQuantile(1), 100U);
+    BOOST_CHECK_EQUAL(histogram.GetQuantile(0), 1U);
+
+    CMetricHistogram histogramSmall;
+    histogramSmall.Observe(1);
+    histogramSmall.Observe(2);
+    histogramSmall.Observe(3);
+    BOOST_CHECK_EQUAL(histogramSmall.GetQuantile(0.5), 2U);
+
+    // a clock set back does not turn into a huge value
+    CMetricHistogram histogramTime;
+    histogramTime.ObserveMicros(-5);
+    histogramTime.ObserveMicros(7);
+    BOOST_CHECK_EQUAL(histogramTime.GetCount(), 2U);
+    BOOST_CHECK_EQUAL(histogramTime.GetSum(), 7U);
+    BOOST_CHECK_EQUAL(histogramTime.GetMax(), 7U);
+    BOOST_CHECK_EQUAL(histogramTime.GetQuantile(0.5), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_prometheus)
+{
+    CMetricCounter& counter = GetMetricCounter("test_metrics_requests_total", "Requests seen", {{"method", "get\"x"}});
+    BOOST_CHECK(&counter == &GetMetricCounter("test_metrics_requests_total", "Requests seen", {{"method", "get\"x"}}));
+    counter.Inc(3);
+    GetMetricCounter("test_metrics_requests_total", "Requests seen", {{"method", "post"}}).Inc();
+    GetMetricGauge("test_metrics_peers", "Connected peers").Set(-2);
+    CMetricHistogram& histogram = GetMetricHistogram("test_metrics_latency_seconds", "Latency", {{"stage", "verify"}});
+    histogram.Observe(1500);
+
+    std::string strOut = MetricsToPrometheus();
+    BOOST_CHECK_EQUAL(CountOccurrences(strOut, "# HELP test_metrics_requests_total Requests seen\n"), 1U);
+    BOOST_CHECK_EQUAL(CountOccurrences(strOut, "# TYPE test_metrics_requests_total counter\n"), 1U);
+    BOOST_CHECK(strOut.find("test_metrics_requests_total{method=\"get\\\"x\"} 3\n") != std::string::npos);
+    BOOST_CHECK(strOut.find("test_metrics_requests_total{method=\"post\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strOut.find("# TYPE test_metrics_peers gauge\ntest_metrics_peers -2\n") != std::string::npos);
+
+    // histograms are summaries in seconds
+    BOOST_CHECK(strOut.find(
+        "# HELP test_metrics_latency_seconds Latency\n"
+        "# TYPE test_metrics_latency_seconds summary\n"
+        "test_metrics_latency_seconds{stage=\"verify\",quantile=\"0.5\"} 0.001500\n"
+        "test_metrics_latency_seconds{stage=\"verify\",quantile=\"0.9\"} 0.001500\n"
+        "test_metrics_latency_seconds{stage=\"verify\",quantile=\"0.99\"} 0.001500\n"
+        "test_metrics_latency_seconds{stage=\"verify\",quantile=\"0.999\"} 0.001500\n"
+        "test_metrics_latency_seconds_sum{stage=\"verify\"} 0.001500\n"
+        "test_metrics_latency_seconds_count{stage=\"verify\"} 1\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
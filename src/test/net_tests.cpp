@@ -166,4 +166,93 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(netbufferpool_recycle)
+{
+    CNetBufferPool pool(1024, 256);
+
+    // a returned buffer comes back cleared with its capacity intact
+    CSerializeData data(100, 'x');
+    size_t nCapacity = data.capacity();
+    pool.Return(data);
+    BOOST_CHECK(data.empty());
+    BOOST_CHECK_EQUAL(pool.GetPooledBuffers(), 1U);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), nCapacity);
+
+    CSerializeData reused;
+    pool.Get(reused);
+    BOOST_CHECK(reused.empty());
+    BOOST_CHECK_EQUAL(reused.capacity(), nCapacity);
+    BOOST_CHECK_EQUAL(pool.GetPooledBuffers(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0U);
+
+    // an empty pool leaves the caller's buffer alone
+    CSerializeData none;
+    pool.Get(none);
+    BOOST_CHECK_EQUAL(none.capacity(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(netbufferpool_releases_large_buffers)
+{
+    CNetBufferPool pool(1024, 256);
+
+    // buffers above the per-buffer limit are freed, not pooled
+    CSerializeData big(512, 'x');
+    pool.Return(big);
+    BOOST_CHECK_EQUAL(big.capacity(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetPooledBuffers(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0U);
+
+    // the pool stops taking buffers once the total limit is reached
+    for (int i = 0; i < 8; i++) {
+        CSerializeData data;
+        data.reserve(200);
+        pool.Return(data);
+    }
+    BOOST_CHECK(pool.GetPooledBytes() <= 1024U);
+    BOOST_CHECK(pool.GetPooledBuffers() < 8U);
+}
+
+BOOST_AUTO_TEST_CASE(socket_interest_queue)
+{
+    CAddress addr = CAddress(CService("252.1.1.1", 7777), NODE_NETWORK);
+    CNode node1(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, "", false);
+    CNode node2(1, NODE_NETWORK, 0, INVALID_SOCKET, addr, "", false);
+    CSocketInterestQueue queue;
+    std::vector<CNode*> vNodes;
+
+    // nothing queued
+    queue.Take(vNodes);
+    BOOST_CHECK(vNodes.empty());
+
+    // a peer is queued once no matter how often it changes
+    queue.Push(&node1);
+    queue.Push(&node2);
+    queue.Push(&node1);
+    queue.Take(vNodes);
+    BOOST_CHECK_EQUAL(vNodes.size(), 2U);
+    BOOST_CHECK(vNodes[0] == &node1);
+    BOOST_CHECK(vNodes[1] == &node2);
+    BOOST_CHECK(!node1.fSocketInterestQueued);
+
+    // taken peers can be queued again, and taking empties the queue
+    queue.Push(&node2);
+    queue.Take(vNodes);
+    BOOST_CHECK_EQUAL(vNodes.size(), 1U);
+    BOOST_CHECK(vNodes[0] == &node2);
+    queue.Take(vNodes);
+    BOOST_CHECK(vNodes.empty());
+
+    // a removed peer is not handed out
+    queue.Push(&node1);
+    queue.Push(&node2);
+    queue.Remove(&node1);
+    queue.Take(vNodes);
+    BOOST_CHECK_EQUAL(vNodes.size(), 1U);
+    BOOST_CHECK(vNodes[0] == &node2);
+    queue.Push(&node1);
+    queue.Take(vNodes);
+    BOOST_CHECK_EQUAL(vNodes.size(), 1U);
+    BOOST_CHECK(vNodes[0] == &node1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
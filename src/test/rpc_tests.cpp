@@ -7,14 +7,18 @@
 
 #include "base58.h"
 #include "netbase.h"
+#include "validation.h"
 
 #include "test/test_ebakus.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <univalue.h>
 
+#include <atomic>
+
 using namespace std;
 
 UniValue createArgs(int nRequired, const char* address1=NULL, const char* address2=NULL)
@@ -314,4 +318,133 @@ BOOST_AUTO_TEST_CASE(rpc_sentinel_ping)
     BOOST_CHECK_THROW(CallRPC("sentinelping 2"), bad_cast);
 }
 
+class JSONStringSink : public JSONWriteSink
+{
+public:
+    string str;
+    int nWrites;
+    int nMaxWrites;
+
+    JSONStringSink(int nMaxWrites = -1) : nWrites(0), nMaxWrites(nMaxWrites) {}
+    bool write(const string& s) { str += s; ++nWrites; return nMaxWrites < 0 || nWrites < nMaxWrites; }
+};
+
+BOOST_AUTO_TEST_CASE(rpc_jsonwrite)
+{
+    UniValue arr(UniValue::VARR);
+    for (int i = 0; i < 10000; i++) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("n", i));
+        obj.push_back(Pair("str", "a\"b\n"));
+        obj.push_back(Pair("k\"ey", UniValue(UniValue::VOBJ)));
+        UniValue inner(UniValue::VARR);
+        inner.push_back(true);
+        inner.push_back(NullUniValue);
+        obj.push_back(Pair("inner", inner));
+        arr.push_back(obj);
+    }
+
+    // large values are handed over in pieces, but the output is unchanged
+    JSONStringSink sink;
+    BOOST_CHECK(JSONWrite(sink, arr));
+    BOOST_CHECK_EQUAL(sink.str, arr.write());
+    BOOST_CHECK(sink.nWrites > 1);
+
+    JSONStringSink sinkNum;
+    BOOST_CHECK(JSONWrite(sinkNum, UniValue(42)));
+    BOOST_CHECK_EQUAL(sinkNum.str, "42");
+    BOOST_CHECK_EQUAL(sinkNum.nWrites, 1);
+
+    JSONStringSink sinkReply;
+    BOOST_CHECK(JSONRPCWriteReply(sinkReply, arr, UniValue(1)));
+    BOOST_CHECK_EQUAL(sinkReply.str, JSONRPCReply(arr, NullUniValue, UniValue(1)));
+
+    // a sink that stops after the first piece gets no more
+    JSONStringSink sinkStopped(1);
+    BOOST_CHECK(!JSONWrite(sinkStopped, arr));
+    BOOST_CHECK_EQUAL(sinkStopped.nWrites, 1);
+    BOOST_CHECK(!JSONRPCWriteReply(sinkStopped, arr, UniValue(1)));
+    BOOST_CHECK_EQUAL(sinkStopped.nWrites, 2);
+}
+
+static std::atomic<int> nBatchDispatched(0);
+
+static bool DispatchBatchWork(const boost::function<void(void)>& fn)
+{
+    nBatchDispatched++;
+    boost::thread(fn).detach();
+    return true;
+}
+
+static UniValue BuildBatchEntry(const string& strMethod, const UniValue& params, int nId)
+{
+    UniValue req(UniValue::VOBJ);
+    req.push_back(Pair("method", strMethod));
+    req.push_back(Pair("params", params));
+    req.push_back(Pair("id", nId));
+    return req;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch)
+{
+    if (RPCIsInWarmup(NULL))
+        SetRPCWarmupFinished();
+    RPCSetBatchDispatcher(&DispatchBatchWork);
+    mapArgs["-rpcbatchthreads"] = "4";
+
+    UniValue params(UniValue::VARR);
+    UniValue paramsHeight(UniValue::VARR);
+    paramsHeight.push_back(0);
+    string strGenesis = chainActive.Genesis()->GetBlockHash().GetHex();
+
+    // read-only lookups are spread over the workers, the replies keep the order of the request
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 40; i++)
+        vReq.push_back(i % 2 ? BuildBatchEntry("getblockcount", params, i) : BuildBatchEntry("getblockhash", paramsHeight, i));
+    UniValue ret = JSONRPCExecBatch(vReq);
+    BOOST_CHECK(nBatchDispatched > 0);
+    BOOST_REQUIRE_EQUAL(ret.size(), 40U);
+    for (int i = 0; i < 40; i++) {
+        BOOST_CHECK_EQUAL(find_value(ret[i], "id").get_int(), i);
+        BOOST_CHECK(find_value(ret[i], "error").isNull());
+        if (i % 2)
+            BOOST_CHECK_EQUAL(find_value(ret[i], "result").get_int(), 0);
+        else
+            BOOST_CHECK_EQUAL(find_value(ret[i], "result").get_str(), strGenesis);
+    }
+
+    // anything else keeps the whole batch in order on the calling thread
+    nBatchDispatched = 0;
+    vReq.push_back(BuildBatchEntry("help", params, 40));
+    ret = JSONRPCExecBatch(vReq);
+    BOOST_CHECK_EQUAL(nBatchDispatched, 0);
+    BOOST_REQUIRE_EQUAL(ret.size(), 41U);
+    for (int i = 0; i < 41; i++)
+        BOOST_CHECK_EQUAL(find_value(ret[i], "id").get_int(), i);
+    BOOST_CHECK(find_value(ret[40], "result").isStr());
+
+    // unknown methods fail in their own slot only
+    vReq = UniValue(UniValue::VARR);
+    vReq.push_back(BuildBatchEntry("getblockcount", params, 0));
+    vReq.push_back(BuildBatchEntry("nosuchmethod", params, 1));
+    vReq.push_back(BuildBatchEntry("getblockcount", params, 2));
+    ret = JSONRPCExecBatch(vReq);
+    BOOST_CHECK_EQUAL(nBatchDispatched, 0);
+    BOOST_REQUIRE_EQUAL(ret.size(), 3U);
+    BOOST_CHECK(find_value(ret[0], "error").isNull());
+    BOOST_CHECK_EQUAL(find_value(find_value(ret[1], "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+    BOOST_CHECK(find_value(ret[2], "error").isNull());
+
+    // by default every batch runs in order
+    mapArgs.erase("-rpcbatchthreads");
+    vReq = UniValue(UniValue::VARR);
+    for (int i = 0; i < 8; i++)
+        vReq.push_back(BuildBatchEntry("getblockcount", params, i));
+    ret = JSONRPCExecBatch(vReq);
+    BOOST_CHECK_EQUAL(nBatchDispatched, 0);
+    BOOST_CHECK_EQUAL(ret.size(), 8U);
+
+    RPCSetBatchDispatcher(RPCBatchDispatcher());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,8 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "metrics.h"
 #include "random.h"
 #include "scheduler.h"
+#include "utiltime.h"
 
 #include "test/test_ebakus.h"
 
@@ -13,15 +15,18 @@
 #include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include <atomic>
+#include <vector>
+
 BOOST_AUTO_TEST_SUITE(scheduler_tests)
 
-static void microTask(CScheduler& s, boost::mutex& mutex, int& counter, int delta, boost::chrono::system_clock::time_point rescheduleTime)
+static void microTask(CScheduler& s, boost::mutex& mutex, int& counter, int delta, CScheduler::TimePoint rescheduleTime)
 {
     {
         boost::unique_lock<boost::mutex> lock(mutex);
         counter += delta;
     }
-    boost::chrono::system_clock::time_point noTime = boost::chrono::system_clock::time_point::min();
+    CScheduler::TimePoint noTime = CScheduler::TimePoint::min();
     if (rescheduleTime != noTime) {
         CScheduler::Function f = boost::bind(&microTask, boost::ref(s), boost::ref(mutex), boost::ref(counter), -delta + 1, noTime);
         s.schedule(f, rescheduleTime);
@@ -63,15 +68,15 @@ BOOST_AUTO_TEST_CASE(manythreads)
     boost::random::uniform_int_distribution<> randomMsec(-11, 1000);
     boost::random::uniform_int_distribution<> randomDelta(-1000, 1000);
 
-    boost::chrono::system_clock::time_point start = boost::chrono::system_clock::now();
-    boost::chrono::system_clock::time_point now = start;
-    boost::chrono::system_clock::time_point first, last;
+    CScheduler::TimePoint start = std::chrono::system_clock::now();
+    CScheduler::TimePoint now = start;
+    CScheduler::TimePoint first, last;
     size_t nTasks = microTasks.getQueueInfo(first, last);
     BOOST_CHECK(nTasks == 0);
 
     for (int i = 0; i < 100; i++) {
-        boost::chrono::system_clock::time_point t = now + boost::chrono::microseconds(randomMsec(rng));
-        boost::chrono::system_clock::time_point tReschedule = now + boost::chrono::microseconds(500 + randomMsec(rng));
+        CScheduler::TimePoint t = now + std::chrono::microseconds(randomMsec(rng));
+        CScheduler::TimePoint tReschedule = now + std::chrono::microseconds(500 + randomMsec(rng));
         int whichCounter = zeroToNine(rng);
         CScheduler::Function f = boost::bind(&microTask, boost::ref(microTasks),
                                              boost::ref(counterMutex[whichCounter]), boost::ref(counter[whichCounter]),
@@ -89,14 +94,14 @@ BOOST_AUTO_TEST_CASE(manythreads)
         microThreads.create_thread(boost::bind(&CScheduler::serviceQueue, &microTasks));
 
     MicroSleep(600);
-    now = boost::chrono::system_clock::now();
+    now = std::chrono::system_clock::now();
 
     // More threads and more tasks:
     for (int i = 0; i < 5; i++)
         microThreads.create_thread(boost::bind(&CScheduler::serviceQueue, &microTasks));
     for (int i = 0; i < 100; i++) {
-        boost::chrono::system_clock::time_point t = now + boost::chrono::microseconds(randomMsec(rng));
-        boost::chrono::system_clock::time_point tReschedule = now + boost::chrono::microseconds(500 + randomMsec(rng));
+        CScheduler::TimePoint t = now + std::chrono::microseconds(randomMsec(rng));
+        CScheduler::TimePoint tReschedule = now + std::chrono::microseconds(500 + randomMsec(rng));
         int whichCounter = zeroToNine(rng);
         CScheduler::Function f = boost::bind(&microTask, boost::ref(microTasks),
                                              boost::ref(counterMutex[whichCounter]), boost::ref(counter[whichCounter]),
@@ -116,4 +121,141 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void recordTask(std::vector<int>& vOrder, int n)
+{
+    vOrder.push_back(n);
+}
+
+BOOST_AUTO_TEST_CASE(priorities_and_cancel)
+{
+    CScheduler scheduler;
+    std::vector<int> vOrder;
+
+    // everything is due, a single thread runs it by priority then by time
+    CScheduler::TimePoint now = std::chrono::system_clock::now();
+    scheduler.schedule(boost::bind(&recordTask, boost::ref(vOrder), 1), now - std::chrono::seconds(3), CScheduler::PRIORITY_LOW);
+    scheduler.schedule(boost::bind(&recordTask, boost::ref(vOrder), 2), now - std::chrono::seconds(2), CScheduler::PRIORITY_NORMAL);
+    CScheduler::Handle handle = scheduler.schedule(boost::bind(&recordTask, boost::ref(vOrder), 3), now - std::chrono::seconds(2), CScheduler::PRIORITY_HIGH);
+    scheduler.schedule(boost::bind(&recordTask, boost::ref(vOrder), 4), now - std::chrono::seconds(1), CScheduler::PRIORITY_HIGH);
+    scheduler.schedule(boost::bind(&recordTask, boost::ref(vOrder), 5), now - std::chrono::seconds(3), CScheduler::PRIORITY_NORMAL);
+
+    BOOST_CHECK(scheduler.cancel(handle));
+    BOOST_CHECK(!scheduler.cancel(handle));
+
+    // named periodic tasks are only scheduled once
+    CScheduler::Handle handleEvery = scheduler.scheduleEvery(boost::bind(&recordTask, boost::ref(vOrder), 6), 60, CScheduler::PRIORITY_NORMAL, "every");
+    BOOST_CHECK_EQUAL(scheduler.scheduleEvery(boost::bind(&recordTask, boost::ref(vOrder), 7), 60, CScheduler::PRIORITY_NORMAL, "every"), handleEvery);
+    BOOST_CHECK(scheduler.cancel(handleEvery));
+
+    CScheduler::TimePoint first, last;
+    BOOST_CHECK_EQUAL(scheduler.getQueueInfo(first, last), 4U);
+
+    scheduler.stop(true);
+    boost::thread thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    thread.join();
+
+    std::vector<int> vExpected = {4, 5, 2, 1};
+    BOOST_CHECK(vOrder == vExpected);
+}
+
+static bool WaitFor(const std::atomic<bool>& fFlag)
+{
+    int64_t nStart = GetTimeMillis();
+    while (!fFlag && GetTimeMillis() - nStart < 10000)
+        MilliSleep(1);
+    return fFlag;
+}
+
+static void blockingTask(std::atomic<bool>& fStarted, std::atomic<bool>& fRelease)
+{
+    fStarted = true;
+    WaitFor(fRelease);
+}
+
+static void flagTask(std::atomic<bool>& fFlag)
+{
+    fFlag = true;
+}
+
+BOOST_AUTO_TEST_CASE(low_priority_leaves_a_free_thread)
+{
+    CScheduler scheduler;
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    // one of the two threads is busy with a normal task
+    std::atomic<bool> fStarted(false), fRelease(false), fLowRan(false), fNormalRan(false);
+    scheduler.schedule(boost::bind(&blockingTask, boost::ref(fStarted), boost::ref(fRelease)), std::chrono::system_clock::now());
+    BOOST_REQUIRE(WaitFor(fStarted));
+
+    // the other one is the last free thread, a low priority task must not take it
+    scheduler.schedule(boost::bind(&flagTask, boost::ref(fLowRan)), std::chrono::system_clock::now(), CScheduler::PRIORITY_LOW);
+    MilliSleep(100);
+    BOOST_CHECK(!fLowRan);
+    scheduler.schedule(boost::bind(&flagTask, boost::ref(fNormalRan)), std::chrono::system_clock::now());
+    BOOST_CHECK(WaitFor(fNormalRan));
+    BOOST_CHECK(!fLowRan);
+
+    // once the busy thread is done there are two free threads again
+    fRelease = true;
+    BOOST_CHECK(WaitFor(fLowRan));
+
+    scheduler.stop(true);
+    threads.join_all();
+}
+
+struct PeriodicTaskState
+{
+    std::atomic<int> nRunning;
+    std::atomic<int> nRuns;
+    std::atomic<bool> fOverlap;
+    std::atomic<bool> fSecondRun;
+    std::atomic<int64_t> nFirstEnd;
+    std::atomic<int64_t> nSecondStart;
+
+    PeriodicTaskState() : nRunning(0), nRuns(0), fOverlap(false), fSecondRun(false), nFirstEnd(0), nSecondStart(0) {}
+};
+
+static void periodicTask(PeriodicTaskState& state)
+{
+    if (++state.nRunning > 1)
+        state.fOverlap = true;
+    int nRun = ++state.nRuns;
+    if (nRun == 1) {
+        // two and a bit intervals, the second run is missed and the third is late
+        MilliSleep(2100);
+        state.nFirstEnd = GetTimeMillis();
+    } else if (nRun == 2) {
+        state.nSecondStart = GetTimeMillis();
+        state.fSecondRun = true;
+    }
+    state.nRunning--;
+}
+
+BOOST_AUTO_TEST_CASE(periodic_no_overlap_and_coalesce)
+{
+    CScheduler scheduler;
+    PeriodicTaskState state;
+    CMetricCounter& metricCoalesced = GetMetricCounter("ebakus_scheduler_coalesced_total", "", {{"task", "test_periodic"}});
+    uint64_t nCoalescedBefore = metricCoalesced.Get();
+
+    // free threads do not pick up a periodic task that is still running
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    CScheduler::Handle handle = scheduler.scheduleEvery(boost::bind(&periodicTask, boost::ref(state)), 1, CScheduler::PRIORITY_NORMAL, "test_periodic");
+
+    BOOST_REQUIRE(WaitFor(state.fSecondRun));
+    BOOST_CHECK(scheduler.cancel(handle));
+    scheduler.stop();
+    threads.join_all();
+
+    BOOST_CHECK(!state.fOverlap);
+    BOOST_CHECK_EQUAL(state.nRuns, 2);
+    // the missed run is counted and the late one runs right away
+    BOOST_CHECK_EQUAL(metricCoalesced.Get() - nCoalescedBefore, 1U);
+    BOOST_CHECK(state.nSecondStart - state.nFirstEnd < 500);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sendercache.h"
+#include "key.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "util.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sendercache_tests, BasicTestingSetup)
+
+static CMutableTransaction BuildTransaction(CAmount nAmount)
+{
+    CMutableTransaction tx;
+    tx.mAmount = nAmount;
+    tx.mData = Bytes(1, 0x01);
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(sendercache_recover)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CMutableTransaction mtx(BuildTransaction(1));
+    mtx.Sign(key);
+    CTransaction tx(mtx);
+
+    CPubKey pubkey;
+    BOOST_CHECK(!GetCachedTransactionSender(tx, pubkey));
+
+    BOOST_CHECK(RecoverTransactionSender(tx, pubkey));
+    BOOST_CHECK(pubkey == key.GetPubKey());
+
+    // the second lookup is served from the cache
+    CPubKey pubkeyCached;
+    BOOST_CHECK(GetCachedTransactionSender(tx, pubkeyCached));
+    BOOST_CHECK(pubkeyCached == key.GetPubKey());
+    BOOST_CHECK(RecoverTransactionSender(tx, pubkeyCached));
+    BOOST_CHECK(pubkeyCached == key.GetPubKey());
+}
+
+BOOST_AUTO_TEST_CASE(sendercache_keyed_by_signature)
+{
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+
+    // same hash, different signers: each must get its own entry
+    CMutableTransaction mtx1(BuildTransaction(2));
+    mtx1.Sign(key1);
+    CMutableTransaction mtx2(BuildTransaction(2));
+    mtx2.Sign(key2);
+    CTransaction tx1(mtx1), tx2(mtx2);
+    BOOST_CHECK(tx1.GetHash() == tx2.GetHash());
+
+    CPubKey pubkey;
+    BOOST_CHECK(RecoverTransactionSender(tx1, pubkey));
+    BOOST_CHECK(pubkey == key1.GetPubKey());
+    BOOST_CHECK(!GetCachedTransactionSender(tx2, pubkey));
+    BOOST_CHECK(RecoverTransactionSender(tx2, pubkey));
+    BOOST_CHECK(pubkey == key2.GetPubKey());
+}
+
+BOOST_AUTO_TEST_CASE(sendercache_invalid_signature)
+{
+    CMutableTransaction mtx(BuildTransaction(3));
+    mtx.mSignature = Bytes(65, 0x00);
+    CTransaction tx(mtx);
+
+    // failed recoveries are not cached
+    CPubKey pubkey;
+    BOOST_CHECK(!RecoverTransactionSender(tx, pubkey));
+    BOOST_CHECK(!GetCachedTransactionSender(tx, pubkey));
+}
+
+BOOST_AUTO_TEST_CASE(sendercache_disabled)
+{
+    mapArgs["-maxsendercachesize"] = "0";
+
+    CKey key;
+    key.MakeNewKey(true);
+    CMutableTransaction mtx(BuildTransaction(4));
+    mtx.Sign(key);
+    CTransaction tx(mtx);
+
+    // recovery still works, nothing is kept
+    CPubKey pubkey;
+    BOOST_CHECK(RecoverTransactionSender(tx, pubkey));
+    BOOST_CHECK(pubkey == key.GetPubKey());
+    BOOST_CHECK(!GetCachedTransactionSender(tx, pubkey));
+
+    mapArgs.erase("-maxsendercachesize");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,75 @@
+// Copyright (c) 2014-2017 The Dash Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "masternode-sigqueue.h"
+#include "utiltime.h"
+
+#include "test/test_ebakus.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigqueue_tests, TestingSetup)
+
+static CMasternodePing BuildPing(int n)
+{
+    CMasternodePing mnp;
+    mnp.vin = CTxIn(COutPoint(ArithToUint256(arith_uint256(2000 + n)), 0));
+    mnp.sigTime = n;
+    return mnp;
+}
+
+BOOST_AUTO_TEST_CASE(sigqueue_without_workers)
+{
+    // nobody would verify the message, the caller has to process it
+    CMasternodeSigQueue queue;
+    BOOST_CHECK(!queue.PushPing(1, BuildPing(0)));
+    BOOST_CHECK_EQUAL(queue.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(sigqueue_applies_in_order_on_caller)
+{
+    CMasternodeSigQueue queue;
+    boost::thread worker(boost::bind(&CMasternodeSigQueue::ThreadVerify, &queue));
+
+    // the worker registers itself once it runs
+    int64_t nStart = GetTimeMillis();
+    while(!queue.PushPing(1, BuildPing(0)) && GetTimeMillis() - nStart < 10000)
+        MilliSleep(1);
+    BOOST_REQUIRE_EQUAL(queue.size(), 1U);
+
+    BOOST_CHECK(queue.PushPing(2, BuildPing(1)));
+    BOOST_CHECK(queue.PushPing(1, BuildPing(2)));
+    BOOST_CHECK(queue.PushPing(2, BuildPing(3)));
+    BOOST_CHECK(queue.PushPing(2, BuildPing(4)));
+
+    // the worker only verifies, nothing is applied until the message handler asks
+    MilliSleep(100);
+    BOOST_CHECK_EQUAL(queue.size(), 5U);
+
+    // everything up to the last message from peer 1 is applied, in arrival order
+    queue.ProcessQueued(1);
+    BOOST_CHECK_EQUAL(queue.size(), 2U);
+    queue.ProcessQueued(1);
+    BOOST_CHECK_EQUAL(queue.size(), 2U);
+    queue.ProcessQueued(3);
+    BOOST_CHECK_EQUAL(queue.size(), 2U);
+
+    nStart = GetTimeMillis();
+    while(queue.size() > 0 && GetTimeMillis() - nStart < 10000) {
+        queue.ProcessVerified();
+        MilliSleep(1);
+    }
+    BOOST_CHECK_EQUAL(queue.size(), 0U);
+
+    worker.interrupt();
+    worker.join();
+
+    // the last worker is gone, messages go back to the caller
+    BOOST_CHECK(!queue.PushPing(1, BuildPing(5)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
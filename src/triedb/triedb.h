@@ -7,12 +7,19 @@
 
 #include "crypto/hash.h"
 #include "exceptions.h"
+#include "metrics.h"
 
 #include "nibble.h"
 #include "streams.h"
 
 extern const H256 NullTrieDBNode;
 
+/** Latency of one trie operation ("at", "insert" or "remove"), shared by all tries */
+inline CMetricHistogram& GetTrieMetric(const std::string& strOp)
+{
+    return GetMetricHistogram("ebakus_trie_seconds", "Time spent on a state trie lookup or update", MetricLabels{{"op", strOp}});
+}
+
 template <class DB>
 class CTrieDB
 {
@@ -118,6 +125,8 @@ protected:
 template <class DB>
 H256 CTrieDB<DB>::At(const Bytes& key) const
 {
+    static CMetricHistogram& metric = GetTrieMetric("at");
+    CMetricTimer timer(metric);
     return AtAux(node(mRoot), key);
 }
 
@@ -337,6 +346,8 @@ CTrieNode CTrieDB<DB>::MergeAt(CTrieNode const& orig, H256 const& origHash, CNib
 template <class DB>
 void CTrieDB<DB>::Insert(Bytes const& key, Bytes const& value)
 {
+    static CMetricHistogram& metric = GetTrieMetric("insert");
+    CMetricTimer timer(metric);
     CTrieNode rootValue = node(mRoot);
     CTrieNode b = MergeAt(rootValue, mRoot, CNibbleView(key), value);
     mRoot = RawInsertNode(b);
@@ -345,6 +356,8 @@ void CTrieDB<DB>::Insert(Bytes const& key, Bytes const& value)
 template <class DB>
 void CTrieDB<DB>::Remove(const Bytes& key)
 {
+    static CMetricHistogram& metric = GetTrieMetric("remove");
+    CMetricTimer timer(metric);
     CTrieNode n = node(mRoot);
     CTrieNode b = DeleteAt(n, CNibbleView(key));
 
@@ -237,16 +237,21 @@ bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKe
 
 bool CBlockTreeDB::ReadAddressIndex(H160 addressHash, int type,
                                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
+                                    int start, int end, unsigned int startTxIndex, size_t nLimit) {
 
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
+    if (startTxIndex > 0) {
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorTxKey(type, addressHash, start, startTxIndex)));
+    } else if (start > 0) {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
+    size_t nCount = 0;
+    CAddressIndexKey lastKey;
+
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
@@ -254,6 +259,12 @@ bool CBlockTreeDB::ReadAddressIndex(H160 addressHash, int type,
             if (end > 0 && key.second.blockHeight > end) {
                 break;
             }
+            if (nLimit > 0 && nCount >= nLimit &&
+                (key.second.blockHeight != lastKey.blockHeight || key.second.txindex != lastKey.txindex)) {
+                break;
+            }
+            ++nCount;
+            lastKey = key.second;
             CAmount nValue;
             if (pcursor->GetValue(nValue)) {
                 addressIndex.push_back(make_pair(key.second, nValue));
@@ -12,6 +12,7 @@
 
 #include "support/allocators/secure.h"
 #include "chainparamsbase.h"
+#include "logring.h"
 #include "random.h"
 #include "serialize.h"
 #include "sync.h"
@@ -39,7 +40,9 @@
 #endif // __linux__
 
 #include <algorithm>
+#include <atomic>
 #include <fcntl.h>
+#include <memory>
 #include <sys/resource.h>
 #include <sys/stat.h>
 
@@ -216,6 +219,20 @@ static int FileWriteStr(const std::string &str, FILE *fp)
     return fwrite(str.data(), 1, str.size(), fp);
 }
 
+/** Write to the open debug.log, mutexDebugLog must be held */
+static int DebugLogWriteStr(const std::string &str)
+{
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
+            setbuf(fileout, NULL); // unbuffered
+    }
+
+    return FileWriteStr(str, fileout);
+}
+
 static void DebugPrintInit()
 {
     assert(mutexDebugLog == NULL);
@@ -339,6 +356,138 @@ static std::string LogThreadNameStr(const std::string &str, bool *fStartedNewLin
     return strThreadLogged;
 }
 
+/**
+ * Asynchronous debug.log writing (-logasync).
+ *
+ * Every logging thread gets its own CLogRing, so a line is queued without a
+ * lock. The writer merges the rings by a global sequence number taken when a
+ * line is queued, and holds back the lines after a number that is still
+ * being pushed, so lines are written in the order they were queued. Each
+ * round is written with a single fwrite.
+ */
+
+//! Time the writer thread waits between rounds
+static const int LOG_ASYNC_FLUSH_INTERVAL_MS = 100;
+
+static std::atomic<bool> fLogAsync(false);
+static bool fLogAsyncBlock = false;
+static size_t nLogAsyncBufferLines = 0;
+static std::atomic<uint64_t> nLogSequence(0);
+
+static boost::thread_specific_ptr<CLogRingRef> ptrLogRing;
+static boost::mutex mutexLogRings;
+static boost::condition_variable condLogWriter;
+static std::vector<CLogRingRef> vLogRings; // guarded by mutexLogRings
+static bool fLogWriterStop = false;        // guarded by mutexLogRings
+static boost::thread threadLogWriter;
+static std::vector<CLogLine> vLogLinesHeld; // only used by the writer thread
+static uint64_t nLogNextSequence = 0;       // only used by the writer thread
+
+/** Queue a line for the writer thread, returns false if the caller has to write it itself */
+static bool LogAsyncPush(const std::string& str)
+{
+    CLogRingRef* pring = ptrLogRing.get();
+    if (pring == NULL) {
+        // the writer keeps the ring until it is drained after the thread exited
+        pring = new CLogRingRef(std::make_shared<CLogRing>(nLogAsyncBufferLines));
+        ptrLogRing.reset(pring);
+        boost::lock_guard<boost::mutex> lock(mutexLogRings);
+        vLogRings.push_back(*pring);
+    }
+
+    while (!(*pring)->Push(nLogSequence, str)) {
+        if (!fLogAsyncBlock) {
+            (*pring)->AddDropped();
+            return true;
+        }
+        condLogWriter.notify_one();
+        // logging must never throw boost::thread_interrupted into the caller
+        boost::this_thread::disable_interruption di;
+        MilliSleep(1);
+        if (!fLogAsync)
+            return false;
+    }
+    return true;
+}
+
+static void LogAsyncFlush(bool fAll)
+{
+    std::vector<CLogLine> vLines;
+    uint64_t nDropped = 0;
+    {
+        boost::lock_guard<boost::mutex> lock(mutexLogRings);
+        std::vector<CLogRingRef>::iterator it = vLogRings.begin();
+        while (it != vLogRings.end()) {
+            (*it)->Drain(vLogLinesHeld);
+            nDropped += (*it)->TakeDropped();
+            if (it->use_count() == 1 && (*it)->IsEmpty())
+                it = vLogRings.erase(it); // its thread is gone
+            else
+                ++it;
+        }
+    }
+    TakeOrderedLogLines(vLogLinesHeld, nLogNextSequence, vLines, fAll);
+    if (vLines.empty() && nDropped == 0)
+        return;
+
+    std::string strBatch;
+    for (size_t i = 0; i < vLines.size(); i++)
+        strBatch += vLines[i].second;
+    if (nDropped > 0) {
+        bool fStartedNewLine = true;
+        strBatch += LogTimestampStr(strprintf("%u log lines dropped, the log buffer was full\n", nDropped), &fStartedNewLine);
+    }
+
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    if (fileout != NULL)
+        DebugLogWriteStr(strBatch);
+}
+
+static void ThreadLogWriter()
+{
+    RenameThread("ebakus-logwriter");
+    bool fStop = false;
+    while (!fStop) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexLogRings);
+            if (!fLogWriterStop)
+                condLogWriter.timed_wait(lock, boost::posix_time::milliseconds(LOG_ASYNC_FLUSH_INTERVAL_MS));
+            fStop = fLogWriterStop;
+        }
+        LogAsyncFlush(fStop);
+    }
+}
+
+void StartAsyncLogging(size_t nBufferLines, bool fBlockWhenFull)
+{
+    // only debug.log is written asynchronously, and only once it is open
+    if (fLogAsync || fPrintToConsole || !fPrintToDebugLog || fileout == NULL)
+        return;
+
+    nLogAsyncBufferLines = 1;
+    while (nLogAsyncBufferLines < nBufferLines)
+        nLogAsyncBufferLines <<= 1;
+    fLogAsyncBlock = fBlockWhenFull;
+    fLogWriterStop = false;
+    threadLogWriter = boost::thread(&ThreadLogWriter);
+    fLogAsync = true;
+}
+
+void StopAsyncLogging()
+{
+    if (!fLogAsync)
+        return;
+
+    // new lines are written directly from now on, the last round picks up the rest
+    fLogAsync = false;
+    {
+        boost::lock_guard<boost::mutex> lock(mutexLogRings);
+        fLogWriterStop = true;
+    }
+    condLogWriter.notify_one();
+    threadLogWriter.join();
+}
+
 int LogPrintStr(const std::string &str)
 {
     int ret = 0; // Returns total number of characters written
@@ -360,6 +509,9 @@ int LogPrintStr(const std::string &str)
     }
     else if (fPrintToDebugLog)
     {
+        if (fLogAsync && LogAsyncPush(strTimestamped))
+            return strTimestamped.length();
+
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
         boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
 
@@ -371,15 +523,7 @@ int LogPrintStr(const std::string &str)
         }
         else
         {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                    setbuf(fileout, NULL); // unbuffered
-            }
-
-            ret = FileWriteStr(strTimestamped, fileout);
+            ret = DebugLogWriteStr(strTimestamped);
         }
     }
     return ret;
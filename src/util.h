@@ -51,6 +51,11 @@ static const bool DEFAULT_LOGTIMEMICROS  = false;
 static const bool DEFAULT_LOGIPS         = false;
 static const bool DEFAULT_LOGTIMESTAMPS  = true;
 static const bool DEFAULT_LOGTHREADNAMES = false;
+static const bool DEFAULT_LOGASYNC       = false;
+/** Lines each thread can have waiting for the log writer thread */
+static const unsigned int DEFAULT_LOGASYNC_BUFFER = 4096;
+/** Every logging thread allocates its whole buffer up front, keep it small */
+static const unsigned int MAX_LOGASYNC_BUFFER = 65536;
 
 /** Signals for translation. */
 class CTranslationInterface
@@ -158,6 +163,13 @@ boost::filesystem::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 #endif
 boost::filesystem::path GetTempPath();
 void OpenDebugLog();
+/** Write debug.log from a background thread instead of the logging threads.
+ * When a thread's buffer is full its lines are dropped and counted, or with
+ * fBlockWhenFull the thread waits for the writer.
+ */
+void StartAsyncLogging(size_t nBufferLines, bool fBlockWhenFull);
+/** Write out the buffered lines and go back to writing on the logging threads */
+void StopAsyncLogging();
 void ShrinkDebugFile();
 void runCommand(const std::string& strCommand);
 
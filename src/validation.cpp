@@ -16,6 +16,7 @@
 #include "consensus/validation.h"
 #include "hash.h"
 #include "init.h"
+#include "metrics.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "primitives/block.h"
@@ -23,6 +24,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "sendercache.h"
 #include "timedata.h"
 #include "tinyformat.h"
 #include "txdb.h"
@@ -163,6 +165,14 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /**
+     * Blocks accepted while they were ahead of the active tip, kept in memory so
+     * ConnectTip does not have to read them back from disk once validation
+     * reaches them. Bounded by MAX_BLOCKS_AHEAD_OF_TIP_SIZE. Protected by cs_main.
+     */
+    map<H256, pair<CBlockIndex*, std::shared_ptr<const CBlock> > > mapBlocksAheadOfTip;
+    size_t nBlocksAheadOfTipSize = 0;
 } // anon namespace
 
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
@@ -415,6 +425,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                               std::vector<H256>& vHashTxnToUncache, bool fDryRun)
 {
     AssertLockHeld(cs_main);
+    static CMetricHistogram& metricAccept = GetMetricHistogram("ebakus_mempool_accept_seconds", "Time spent checking a transaction for the mempool");
+    CMetricTimer timer(metricAccept);
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -769,6 +781,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 {
     std::vector<H256> vHashTxToUncache;
     bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, vHashTxToUncache, fDryRun);
+    if (!fDryRun) {
+        static CMetricCounter& metricAccepted = GetMetricCounter("ebakus_mempool_transactions_total", "Transactions offered to the mempool", MetricLabels{{"result", "accepted"}});
+        static CMetricCounter& metricRejected = GetMetricCounter("ebakus_mempool_transactions_total", "Transactions offered to the mempool", MetricLabels{{"result", "rejected"}});
+        static CMetricGauge& metricSize = GetMetricGauge("ebakus_mempool_size", "Transactions in the mempool");
+        (res ? metricAccepted : metricRejected).Inc();
+        metricSize.Set(pool.size());
+    }
     if (!res || fDryRun) {
         if(!res) LogPrint("mempool", "%s: %s %s\n", __func__, tx.GetHash().ToString(), state.GetRejectReason());
         BOOST_FOREACH(const H256& hashTx, vHashTxToUncache)
@@ -806,12 +825,13 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 }
 
 bool GetAddressIndex(H160 addressHash, int type,
-                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end)
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end,
+                     unsigned int startTxIndex, size_t nLimit)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end, startTxIndex, nLimit))
         return error("unable to get txids for address");
 
     return true;
@@ -955,6 +975,40 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    block.clear();
+
+    // The index header written by WriteBlockToDisk is right before the block
+    unsigned int nHeaderSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return error("%s: invalid position %s", __func__, pos.ToString());
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - nHeaderSize);
+
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+
+        if (memcmp(blockStart, messageStart, MESSAGE_START_SIZE))
+            return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+        if (nSize > MAX_BLOCK_SIZE)
+            return error("%s: block size %u too large at %s", __func__, nSize, pos.ToString());
+
+        block.resize(nSize);
+        filein.read((char*)block.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
 double ConvertBitsToDouble(unsigned int nBits)
 {
     int nShift = (nBits >> 24) & 0xff;
@@ -1324,6 +1378,21 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
+void GetAccountAddressIndex(const CTransaction& tx, int nHeight, unsigned int nTxIndex,
+                            std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex)
+{
+    const H256& txhash = tx.GetHash();
+
+    CPubKey pubkeySender;
+    if (RecoverTransactionSender(tx, pubkeySender)) {
+        addressIndex.push_back(make_pair(CAddressIndexKey(1, pubkeySender.GetID(), nHeight, nTxIndex, txhash, 0, true), -tx.mAmount));
+    }
+
+    if (!tx.mReceiver.IsNull()) {
+        addressIndex.push_back(make_pair(CAddressIndexKey(1, tx.mReceiver, nHeight, nTxIndex, txhash, 0, false), tx.mAmount));
+    }
+}
+
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
@@ -1353,7 +1422,7 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         H256 hash = tx.GetHash();
 
         if (fAddressIndex) {
-
+            GetAccountAddressIndex(tx, pindex->nHeight, i, addressIndex);
         }
 
         // Check that all outputs are available and match the outputs in the block itself
@@ -1480,6 +1549,11 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+static CMetricHistogram& GetBlockStageMetric(const std::string& strStage)
+{
+    return GetMetricHistogram("ebakus_block_connect_seconds", "Time spent connecting a block to the tip, by stage", MetricLabels{{"stage", strStage}});
+}
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
     const CChainParams& chainparams = Params();
@@ -1530,9 +1604,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     int64_t nTime1 = GetTimeMicros(); nTimeCheck += nTime1 - nTimeStart;
+    static CMetricHistogram& metricCheck = GetBlockStageMetric("sanity_checks");
+    metricCheck.ObserveMicros(nTime1 - nTimeStart);
     LogPrint("bench", "    - Sanity checks: %.2fms [%.2fs]\n", 0.001 * (nTime1 - nTimeStart), nTimeCheck * 0.000001);
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
+    static CMetricHistogram& metricForks = GetBlockStageMetric("fork_checks");
+    metricForks.ObserveMicros(nTime2 - nTime1);
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
     CBlockUndo blockundo;
@@ -1554,10 +1632,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         const CTransaction &tx = block.vtx[i];
         const H256 txhash = tx.GetHash();
 
+        if (fAddressIndex) {
+            GetAccountAddressIndex(tx, pindex->nHeight, i, addressIndex);
+        }
+
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
         pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
+    static CMetricHistogram& metricConnect = GetBlockStageMetric("connect_transactions");
+    metricConnect.ObserveMicros(nTime3 - nTime2);
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
 
     // EBAKUS : MODIFIED TO CHECK MASTERNODE PAYMENTS AND SUPERBLOCKS
@@ -1584,6 +1668,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     //if (!control.Wait())
     //    return state.DoS(100, false);
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
+    static CMetricHistogram& metricVerify = GetBlockStageMetric("verify");
+    metricVerify.ObserveMicros(nTime4 - nTime2);
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
 
     if (fJustCheck)
@@ -1634,6 +1720,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime5 = GetTimeMicros(); nTimeIndex += nTime5 - nTime4;
+    static CMetricHistogram& metricIndex = GetBlockStageMetric("index");
+    metricIndex.ObserveMicros(nTime5 - nTime4);
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime5 - nTime4), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
@@ -1642,6 +1730,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     hashPrevBestCoinBase = block.vtx[0].GetHash();
 
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
+    static CMetricHistogram& metricCallbacks = GetBlockStageMetric("callbacks");
+    metricCallbacks.ObserveMicros(nTime6 - nTime5);
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
 
     return true;
@@ -1883,6 +1973,15 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
+    std::shared_ptr<const CBlock> pblockAhead;
+    map<H256, pair<CBlockIndex*, std::shared_ptr<const CBlock> > >::iterator itAhead = mapBlocksAheadOfTip.find(pindexNew->GetBlockHash());
+    if (itAhead != mapBlocksAheadOfTip.end()) {
+        pblockAhead = itAhead->second.second;
+        nBlocksAheadOfTipSize -= ::GetSerializeSize(*pblockAhead, SER_NETWORK, PROTOCOL_VERSION);
+        mapBlocksAheadOfTip.erase(itAhead);
+        if (!pblock)
+            pblock = pblockAhead.get();
+    }
     if (!pblock) {
         if (!ReadBlockFromDisk(block, pindexNew, chainparams.GetConsensus()))
             return AbortNode(state, "Failed to read block");
@@ -1890,6 +1989,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     }
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    static CMetricHistogram& metricRead = GetBlockStageMetric("load");
+    metricRead.ObserveMicros(nTime2 - nTime1);
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
@@ -1902,15 +2003,21 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
+        static CMetricHistogram& metricConnectTotal = GetBlockStageMetric("connect_total");
+        metricConnectTotal.ObserveMicros(nTime3 - nTime2);
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
+    static CMetricHistogram& metricFlush = GetBlockStageMetric("flush");
+    metricFlush.ObserveMicros(nTime4 - nTime3);
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
+    static CMetricHistogram& metricChainState = GetBlockStageMetric("chainstate");
+    metricChainState.ObserveMicros(nTime5 - nTime4);
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
@@ -1928,6 +2035,10 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     }
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
+    static CMetricHistogram& metricPostConnect = GetBlockStageMetric("postprocess");
+    static CMetricHistogram& metricTotal = GetBlockStageMetric("total");
+    metricPostConnect.ObserveMicros(nTime6 - nTime5);
+    metricTotal.ObserveMicros(nTime6 - nTime1);
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
     return true;
@@ -2755,6 +2866,37 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 }
 
 
+/**
+ * Keep a block that was accepted ahead of the active tip in memory, so that
+ * connecting it later does not cost a disk read. Requires cs_main.
+ */
+static void KeepBlockAheadOfTip(CBlockIndex* pindex, const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (pindex->nHeight <= chainActive.Height() + 1 || mapBlocksAheadOfTip.count(pindex->GetBlockHash()))
+        return;
+
+    size_t nBlockSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (nBlocksAheadOfTipSize + nBlockSize > MAX_BLOCKS_AHEAD_OF_TIP_SIZE) {
+        // Drop what validation has passed by (stale forks), then give up if still full
+        map<H256, pair<CBlockIndex*, std::shared_ptr<const CBlock> > >::iterator it = mapBlocksAheadOfTip.begin();
+        while (it != mapBlocksAheadOfTip.end()) {
+            if (it->second.first->nHeight <= chainActive.Height()) {
+                nBlocksAheadOfTipSize -= ::GetSerializeSize(*it->second.second, SER_NETWORK, PROTOCOL_VERSION);
+                mapBlocksAheadOfTip.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        if (nBlocksAheadOfTipSize + nBlockSize > MAX_BLOCKS_AHEAD_OF_TIP_SIZE)
+            return;
+    }
+
+    std::shared_ptr<const CBlock> pblockCopy = std::make_shared<const CBlock>(block);
+    mapBlocksAheadOfTip.insert(std::make_pair(pindex->GetBlockHash(), std::make_pair(pindex, pblockCopy)));
+    nBlocksAheadOfTipSize += nBlockSize;
+}
+
 bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool *fNewBlock)
 {
     {
@@ -2762,14 +2904,17 @@ bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool
 
         // Store to disk
         CBlockIndex *pindex = NULL;
-        if (fNewBlock) *fNewBlock = false;
+        bool fNewBlockAccepted = false;
         CValidationState state;
-        bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fForceProcessing, dbp, fNewBlock);
+        bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fForceProcessing, dbp, &fNewBlockAccepted);
+        if (fNewBlock) *fNewBlock = fNewBlockAccepted;
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret) {
             GetMainSignals().BlockChecked(*pblock, state);
             return error("%s: AcceptBlock FAILED", __func__);
         }
+        if (fNewBlockAccepted && dbp == NULL)
+            KeepBlockAheadOfTip(pindex, *pblock);
     }
 
     NotifyHeaderTip();
@@ -3207,6 +3352,8 @@ void UnloadBlockIndex()
     nBlockSequenceId = 1;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    mapBlocksAheadOfTip.clear();
+    nBlocksAheadOfTipSize = 0;
     versionbitscache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
@@ -85,8 +85,18 @@ static const int MAX_SCRIPTCHECK_THREADS = 16;
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** During initial block download, the per-peer limit is scaled by the peer's measured
+ *  throughput relative to the average peer, within these bounds. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER_IBD = 4;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER_IBD = 128;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
+/** Time in microseconds after which the block holding back the download window is requested
+ *  from a faster peer instead. Kept well below BLOCK_STALLING_TIMEOUT so a slow peer is routed
+ *  around before it gets disconnected. */
+static const int64_t BLOCK_REASSIGN_TIMEOUT = 500000;
+/** Maximum serialized size of blocks kept in memory ahead of the active tip, waiting to be connected. */
+static const size_t MAX_BLOCKS_AHEAD_OF_TIP_SIZE = 64 * 1024 * 1024;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
@@ -133,6 +143,14 @@ static const bool DEFAULT_ENABLE_REPLACEMENT = false;
 /** Maximum number of headers to announce when relaying blocks with headers message.*/
 static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 
+/** Maximum depth of blocks we're willing to serve as compact blocks to peers
+ *  when requested. For older blocks, a regular BLOCK response will be sent. */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of blocks we're willing to respond to GETBLOCKTXN requests for. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Number of peers we ask to announce new blocks to us with compact blocks (BIP152 high-bandwidth mode) */
+static const unsigned int MAX_CMPCTBLOCK_HB_PEERS = 3;
+
 struct BlockHasher
 {
     size_t operator()(const H256& hash) const { return hash.GetCheapHash(); }
@@ -152,6 +170,7 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern unsigned int nBytesPerSigOp;
@@ -579,6 +598,49 @@ struct CAddressIndexIteratorHeightKey {
     }
 };
 
+struct CAddressIndexIteratorTxKey {
+    unsigned int type;
+    H160 hashBytes;
+    int blockHeight;
+    unsigned int txindex;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 29;
+    }
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s, nType, nVersion);
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s, nType, nVersion);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+    }
+
+    CAddressIndexIteratorTxKey(unsigned int addressType, H160 addressHash, int height, unsigned int blockindex) {
+        type = addressType;
+        hashBytes = addressHash;
+        blockHeight = height;
+        txindex = blockindex;
+    }
+
+    CAddressIndexIteratorTxKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        type = 0;
+        hashBytes.SetNull();
+        blockHeight = 0;
+        txindex = 0;
+    }
+};
+
 struct CDiskTxPos : public CDiskBlockPos
 {
     unsigned int nTxOffset; // after header
@@ -677,16 +739,32 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp = NULL
 
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<H256> &hashes);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
+/**
+ * Read the address index entries of an address from height start (and
+ * transaction startTxIndex in that block) up to height end. With nLimit set at
+ * most that many entries are returned, the entries of a transaction are never
+ * split so the next page starts at the following transaction.
+ */
 bool GetAddressIndex(H160 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                     int start = 0, int end = 0);
+                     int start = 0, int end = 0, unsigned int startTxIndex = 0, size_t nLimit = 0);
 bool GetAddressUnspent(H160 addressHash, int type,
                        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+/**
+ * Address index entries of an account transaction: the amount leaves the
+ * sender and reaches the receiver. Both are keyed by height and position of
+ * the transaction in the block, so connecting and disconnecting a block
+ * produce the same keys.
+ */
+void GetAccountAddressIndex(const CTransaction& tx, int nHeight, unsigned int nTxIndex,
+                            std::vector<std::pair<CAddressIndexKey, CAmount> >& addressIndex);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block as it is stored on disk, without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
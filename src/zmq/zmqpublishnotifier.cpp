@@ -57,6 +57,12 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     return 0;
 }
 
+// Releases the reference a zmq message held on its buffer, called by zmq once the message is sent
+static void zmq_free_buffer(void * /*data*/, void *hint)
+{
+    delete static_cast<CZMQBufferRef*>(hint);
+}
+
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 {
     assert(!psocket);
@@ -143,6 +149,44 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const CZMQBufferRef& data)
+{
+    assert(psocket);
+
+    if (data->empty())
+        return SendMessage(command, NULL, 0);
+
+    zmq_msg_t msg;
+    CZMQBufferRef* hint = new CZMQBufferRef(data);
+    if (zmq_msg_init_data(&msg, (void*)&(*data)[0], data->size(), zmq_free_buffer, hint) != 0)
+    {
+        zmqError("Unable to initialize ZMQ msg");
+        delete hint;
+        return false;
+    }
+
+    /* same three parts as SendMessage above, only the data part is not copied */
+    unsigned char msgseq[sizeof(uint32_t)];
+    WriteLE32(&msgseq[0], nSequence);
+    if (zmq_send(psocket, command, strlen(command), ZMQ_SNDMORE) == -1 ||
+        zmq_msg_send(&msg, psocket, ZMQ_SNDMORE) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        zmq_msg_close(&msg);
+        return false;
+    }
+    if (zmq_send(psocket, msgseq, sizeof(uint32_t), 0) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        return false;
+    }
+
+    /* increment memory only sequence number after sending */
+    nSequence++;
+
+    return true;
+}
+
 bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     uint256 hash = pindex->GetBlockHash();
@@ -177,21 +221,18 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    // the block is sent as stored, without deserializing it or copying it into the message
+    std::shared_ptr<std::vector<unsigned char> > block = std::make_shared<std::vector<unsigned char> >();
     {
         LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
+        if(!ReadRawBlockFromDisk(*block, pindex->GetBlockPos(), Params().MessageStart()))
         {
             zmqError("Can't read block from disk");
             return false;
         }
-
-        ss << block;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWBLOCK, CZMQBufferRef(block));
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
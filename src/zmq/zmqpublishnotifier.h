@@ -7,8 +7,13 @@
 
 #include "zmqabstractnotifier.h"
 
+#include <memory>
+#include <vector>
+
 class CBlockIndex;
 
+typedef std::shared_ptr<const std::vector<unsigned char> > CZMQBufferRef;
+
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
@@ -24,6 +29,9 @@ public:
     */
     bool SendMessage(const char *command, const void* data, size_t size);
 
+    /* same as above, but zmq keeps a reference to data until it is sent instead of copying it */
+    bool SendMessage(const char *command, const CZMQBufferRef& data);
+
     bool Initialize(void *pcontext);
     void Shutdown();
 };